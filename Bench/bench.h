@@ -0,0 +1,234 @@
+#pragma once
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <vector>
+#include <map>
+#include <string>
+#include <algorithm>
+#include <process.h>
+#include <windows.h>
+
+// Each benchmark is run in samples of about BENCH_SAMPLE_MS. The first
+// sample only warms caches and the lookaside lists up, the median of the
+// others is reported with their interquartile range, which is what a
+// comparison against a baseline has to beat to count as a change.
+#define BENCH_SAMPLES			15
+#define BENCH_SAMPLE_MS			40
+#define BENCH_THRESHOLD			5.0		// percent slower than the baseline that fails -c
+#define BENCH_MAX_THREADS		64
+
+typedef struct {
+	const char *name;
+	void      (*body)(LONGLONG iterations, int thread);	// runs the operation iterations times
+	int         threads;		// threads running body at once, each does its share
+	LONGLONG    bytes;			// payload bytes per operation, 0 if none
+} BENCH_CASE;
+
+typedef struct {
+	std::string name;
+	double      median;			// ns per operation
+	double      min;
+	double      spread;			// interquartile range, percent of the median
+	LONGLONG    bytes;
+} BENCH_RESULT;
+
+typedef struct {
+	void      (*body)(LONGLONG iterations, int thread);
+	LONGLONG    iterations;
+	int         thread;
+	HANDLE      start;
+} BENCH_THREAD;
+
+LONGLONG gBenchFrequency = 1;
+int gBenchSamples = BENCH_SAMPLES;
+
+// Function: benchNow
+// Description: Read the high resolution clock
+// Return: the clock in performance counter ticks
+inline LONGLONG benchNow() {
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+}
+
+// Function: initializeBench
+// Description: Read the clock frequency and quiet the machine down for the
+//              run: the process gets a high priority and the calling
+//              thread, which runs the single-threaded benchmarks, stays
+//              on one processor.
+void initializeBench() {
+	LARGE_INTEGER frequency;
+
+	QueryPerformanceFrequency(&frequency);
+	gBenchFrequency = frequency.QuadPart;
+	SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS);
+	SetThreadAffinityMask(GetCurrentThread(), 1);
+}
+
+// Function: benchThread
+// Description: Run a share of a multi-threaded benchmark once the start
+//              event is set
+unsigned __stdcall benchThread(void *param) {
+	BENCH_THREAD *share = (BENCH_THREAD *)param;
+
+	WaitForSingleObject(share->start, INFINITE);
+	share->body(share->iterations, share->thread);
+	return 0;
+}
+
+// Function: benchRun
+// Description: Time one sample of a benchmark. Threads of a multi-threaded
+//              benchmark are created before the clock starts and released
+//              together.
+// Return: elapsed performance counter ticks
+// -IN: bench: the benchmark
+//      iterations: operations in the sample, over all threads
+LONGLONG benchRun(const BENCH_CASE *bench, LONGLONG iterations) {
+	BENCH_THREAD shares[BENCH_MAX_THREADS];
+	HANDLE threads[BENCH_MAX_THREADS];
+	LONGLONG start, elapsed;
+	int i;
+
+	if (bench->threads <= 1) {
+		start = benchNow();
+		bench->body(iterations, 0);
+		return benchNow() - start;
+	}
+
+	HANDLE startEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	for (i = 0; i < bench->threads; i++) {
+		shares[i].body = bench->body;
+		shares[i].iterations = iterations / bench->threads;
+		shares[i].thread = i;
+		shares[i].start = startEvent;
+		threads[i] = (HANDLE)_beginthreadex(0, 0, benchThread, &shares[i], 0, 0);
+	}
+
+	start = benchNow();
+	SetEvent(startEvent);
+	WaitForMultipleObjects(bench->threads, threads, TRUE, INFINITE);
+	elapsed = benchNow() - start;
+
+	for (i = 0; i < bench->threads; i++)
+		CloseHandle(threads[i]);
+	CloseHandle(startEvent);
+	return elapsed;
+}
+
+// Function: benchMeasure
+// Description: Size the samples of a benchmark to BENCH_SAMPLE_MS, then
+//              take gBenchSamples of them
+// -IN: bench: the benchmark
+// -OUT: result: ns per operation
+void benchMeasure(const BENCH_CASE *bench, BENCH_RESULT *result) {
+	LONGLONG iterations = bench->threads > 1 ? bench->threads : 1, elapsed;
+	LONGLONG target = gBenchFrequency * BENCH_SAMPLE_MS / 1000;
+	std::vector<double> samples;
+
+	// Double the sample until it takes a tenth of the target, then scale
+	while ((elapsed = benchRun(bench, iterations)) < target / 10)
+		iterations *= 2;
+	if (elapsed < target)
+		iterations = (LONGLONG)((double)iterations * target / (elapsed > 0 ? elapsed : 1));
+	if (bench->threads > 1)
+		iterations -= iterations % bench->threads;
+
+	benchRun(bench, iterations);
+	for (int i = 0; i < gBenchSamples; i++) {
+		elapsed = benchRun(bench, iterations);
+		samples.push_back((double)elapsed * 1e9 / gBenchFrequency / iterations);
+	}
+
+	std::sort(samples.begin(), samples.end());
+	result->name = bench->name;
+	result->bytes = bench->bytes;
+	result->min = samples.front();
+	result->median = samples[samples.size() / 2];
+	result->spread = (samples[samples.size() * 3 / 4] - samples[samples.size() / 4]) * 100 / result->median;
+}
+
+// Function: loadBaseline
+// Description: Read results written by writeResults
+// Return: 0 if succeed, else return 1
+// -IN: fileName: the results of an earlier run
+// -OUT: baseline: median and spread of each benchmark by name
+int loadBaseline(const char *fileName, std::map<std::string, BENCH_RESULT> &baseline) {
+	BENCH_RESULT result;
+	char name[128];
+	FILE *file;
+
+	file = fopen(fileName, "r");
+	if (file == NULL) {
+		fprintf(stderr, "Cannot open baseline %s\n", fileName);
+		return 1;
+	}
+	while (fscanf(file, "%127s %lf %lf %lf", name, &result.median, &result.min, &result.spread) == 4) {
+		result.name = name;
+		baseline[result.name] = result;
+	}
+	fclose(file);
+	return 0;
+}
+
+// Function: printResult
+// Description: Print the line of a benchmark, compared to its baseline if
+//              there is one. A benchmark is slower only if its median
+//              moved by more than the threshold and by more than the
+//              spread of both runs.
+// Return: 1 if the benchmark got slower, else 0
+// -IN: result: the benchmark
+//      base: its baseline, NULL if none
+//      threshold: percent a benchmark may slow down
+int printResult(const BENCH_RESULT *result, const BENCH_RESULT *base, double threshold) {
+	double delta, noise;
+
+	printf("%-32s %12.1f %12.1f %6.1f%%", result->name.c_str(), result->median, result->min, result->spread);
+	if (result->bytes > 0)
+		printf(" %9.1f", result->bytes * 1e9 / result->median / (1 << 20));
+	else
+		printf(" %9s", "");
+
+	if (base == NULL) {
+		printf("\n");
+		return 0;
+	}
+
+	delta = (result->median - base->median) * 100 / base->median;
+	noise = result->spread > base->spread ? result->spread : base->spread;
+	printf(" %+7.1f%%", delta);
+	if (delta > threshold && delta > noise) {
+		printf("  SLOWER\n");
+		return 1;
+	}
+	if (-delta > threshold && -delta > noise)
+		printf("  faster");
+	printf("\n");
+	return 0;
+}
+
+// Function: writeResults
+// Description: Write "name median min spread" per benchmark, the format
+//              loadBaseline reads
+// Return: 0 if succeed, else return 1
+// -IN: fileName: the output file
+//      results: the benchmarks run
+int writeResults(const char *fileName, const std::vector<BENCH_RESULT> &results) {
+	FILE *file;
+
+	file = fopen(fileName, "w");
+	if (file == NULL) {
+		fprintf(stderr, "Cannot open %s\n", fileName);
+		return 1;
+	}
+	for (auto it = results.begin(); it != results.end(); it++)
+		fprintf(file, "%s %.2f %.2f %.2f\n", it->name.c_str(), it->median, it->min, it->spread);
+	if (fclose(file) != 0) {
+		fprintf(stderr, "Cannot write %s\n", fileName);
+		return 1;
+	}
+	return 0;
+}
+
+#endif
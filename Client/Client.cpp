@@ -1,28 +1,30 @@
-// TCPClient.cpp : Defines the entry point for the console application.
-//
-
-#include "stdafx.h"
-#include "ui.h"
-
-int main(int argc, char** argv)
-{
-	// Validate parameters
-	if (argc != 3) {
-		printf("Wrong arguments! Please enter in format: \"%s [ServerIpAddress] [ServerPortNumber]\"", argv[0]);
-		return 1;
-	}
-
-	// Initialize network
-	int iRetVal = initializeNetwork(argc, argv);
-	if (iRetVal == 1)
-		return 1;
-
-	// Open data file
-	if (openFile("accData"))
-		return 1;
-
-	// Start program
-	runUI();
-
-	return 0;
+// TCPClient.cpp : Defines the entry point for the console application.
+//
+
+#include "stdafx.h"
+#include "ui.h"
+
+int main(int argc, char** argv)
+{
+	// Validate parameters
+	if (argc != 3 && argc != 4) {
+		printf("Wrong arguments! Please enter in format: \"%s [ServerIpAddress] [ServerPortNumber] [TlsServerName]\"\n"
+			"TlsServerName connects over TLS to a server started with -x, checking its certificate is issued to\n"
+			"that name, or taking any certificate if it is \"%s\"", argv[0], TLS_CLIENT_ANY_NAME);
+		return 1;
+	}
+
+	// Initialize network
+	int iRetVal = initializeNetwork(argc, argv);
+	if (iRetVal == 1)
+		return 1;
+
+	// Open data file
+	if (openFile("accData"))
+		return 1;
+
+	// Start program
+	runUI();
+
+	return 0;
 }
\ No newline at end of file
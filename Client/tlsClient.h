@@ -0,0 +1,388 @@
+#pragma once
+
+#ifndef TLS_CLIENT_H_
+#define TLS_CLIENT_H_
+
+#define SECURITY_WIN32
+#include <stdio.h>
+#include <string.h>
+#include <WinSock2.h>
+#include <windows.h>
+#include <security.h>
+#include <schannel.h>
+
+#pragma comment(lib, "Secur32.lib")
+
+// Client side of the TLS transport the server offers with -x. SChannel
+// runs the handshake and the record layer on buffers of the session, so
+// the caller decides how the bytes travel: tlsClientStep and
+// tlsClientOpen only consume what was received into in, and the token and
+// the sealed records are left for the caller to send.
+#define TLS_CLIENT_RECORD_SIZE		16384			// Largest plaintext of a record
+#define TLS_CLIENT_IN_SIZE			(5 + TLS_CLIENT_RECORD_SIZE + 2048)
+#define TLS_CLIENT_SEAL_OVERHEAD	256				// Header and trailer room a sealed frame needs
+#define TLS_CLIENT_ANY_NAME			"*"				// Server name that takes any certificate
+
+// Results of tlsClientStep and tlsClientOpen
+#define TLS_CLIENT_DATA				0				// Established, or the plaintext asked for was copied
+#define TLS_CLIENT_MORE				1				// More ciphertext is needed
+#define TLS_CLIENT_TOKEN			2				// Handshake bytes are waiting in token
+#define TLS_CLIENT_CLOSED			3				// The server sent close_notify
+#define TLS_CLIENT_FAILED			4
+
+typedef struct _TLS_CLIENT {
+	CtxtHandle                context;
+	bool                      hasContext;		// The first handshake call created context
+	bool                      established;
+	SecPkgContext_StreamSizes sizes;
+	char                      in[TLS_CLIENT_IN_SIZE];	// Received, decrypted in place
+	int                       inLen;
+	int                       plainOff, plainLen;	// Plaintext of the last record not handed out yet
+	int                       cipherOff;		// Start of the ciphertext after that record
+	void                     *token;			// Handshake bytes to send, allocated by SChannel
+	int                       tokenLen;
+} TLS_CLIENT;
+
+CredHandle gTlsClientCred;
+BOOL gTlsClientEnabled = FALSE;
+char gTlsClientName[256];		// Name the server certificate must be issued to, empty to take any
+
+// Function: initializeTlsClient
+// Description: Acquire the client credentials. Only TLS 1.2 with strong
+//              ciphers is offered. SChannel checks the certificate of the
+//              server against the trusted roots and name, unless name is
+//              TLS_CLIENT_ANY_NAME, which takes any certificate, as a test
+//              server with a self-signed one needs.
+// Return: 0 if succeed, else return 1
+// -IN: name: the name the certificate of the server is issued to
+int initializeTlsClient(const char *name) {
+	SCHANNEL_CRED cred;
+	TimeStamp expiry;
+	SECURITY_STATUS status;
+	BOOL anyName = strcmp(name, TLS_CLIENT_ANY_NAME) == 0;
+
+	if (strlen(name) >= sizeof(gTlsClientName)) {
+		fprintf(stderr, "TLS server name too long\n");
+		return 1;
+	}
+
+	memset(&cred, 0, sizeof(cred));
+	cred.dwVersion = SCHANNEL_CRED_VERSION;
+	cred.grbitEnabledProtocols = SP_PROT_TLS1_2_CLIENT;
+	cred.dwFlags = SCH_CRED_NO_DEFAULT_CREDS | SCH_USE_STRONG_CRYPTO |
+		(anyName ? SCH_CRED_MANUAL_CRED_VALIDATION : SCH_CRED_AUTO_CRED_VALIDATION);
+
+	status = AcquireCredentialsHandleA(NULL, UNISP_NAME_A, SECPKG_CRED_OUTBOUND, NULL, &cred, NULL, NULL, &gTlsClientCred, &expiry);
+	if (status != SEC_E_OK) {
+		fprintf(stderr, "AcquireCredentialsHandle failed with error 0x%x\n", (unsigned int)status);
+		return 1;
+	}
+	strcpy(gTlsClientName, anyName ? "" : name);
+	gTlsClientEnabled = TRUE;
+	return 0;
+}
+
+// Function: tlsClientTokenDone
+// Description: Release the handshake bytes once they are sent
+// -IN: tls: the session
+void tlsClientTokenDone(TLS_CLIENT *tls) {
+	if (tls->token != NULL)
+		FreeContextBuffer(tls->token);
+	tls->token = NULL;
+	tls->tokenLen = 0;
+}
+
+// Function: tlsClientRelease
+// Description: Release the context and the token of a session, not the
+//              session itself
+// -IN: tls: the session
+void tlsClientRelease(TLS_CLIENT *tls) {
+	tlsClientTokenDone(tls);
+	if (tls->hasContext)
+		DeleteSecurityContext(&tls->context);
+	tls->hasContext = false;
+	tls->established = false;
+}
+
+// Function: tlsClientSpace
+// Description: Room left for ciphertext after what was received
+// Return: bytes, 0 if a record does not fit
+// -IN: tls: the session
+inline int tlsClientSpace(TLS_CLIENT *tls) {
+	return TLS_CLIENT_IN_SIZE - tls->inLen;
+}
+
+// Function: tlsClientBuffered
+// Description: Check whether a receive can be served without reading the
+//              socket: plaintext is left, or a whole record was received
+// Return: 1 if so, else 0
+// -IN: tls: the session
+int tlsClientBuffered(TLS_CLIENT *tls) {
+	unsigned char *record = (unsigned char *)tls->in + tls->cipherOff;
+	int available = tls->inLen - tls->cipherOff;
+
+	if (tls->plainLen > 0)
+		return 1;
+	if (!tls->established || available < 5)
+		return 0;
+	return available >= 5 + ((record[3] << 8) | record[4]);
+}
+
+// Function: tlsClientStep
+// Description: Run the handshake as far as the bytes received allow. The
+//              first call starts it with nothing received. Bytes past
+//              the end of the last flight of the server, which may
+//              already be records, are kept for tlsClientOpen.
+// Return: TLS_CLIENT_TOKEN if bytes must be sent, TLS_CLIENT_MORE if
+//         more must be received, TLS_CLIENT_DATA once established with
+//         nothing to send, TLS_CLIENT_FAILED if the handshake failed
+// -IN: tls: the session, zeroed before the first call
+int tlsClientStep(TLS_CLIENT *tls) {
+	SecBuffer inBuffers[2], outBuffer;
+	SecBufferDesc inDesc, outDesc;
+	SECURITY_STATUS status;
+	ULONG attributes;
+	TimeStamp expiry;
+	bool first;
+
+	while (TRUE) {
+		first = !tls->hasContext;
+		inBuffers[0].BufferType = SECBUFFER_TOKEN;
+		inBuffers[0].pvBuffer = tls->in;
+		inBuffers[0].cbBuffer = tls->inLen;
+		inBuffers[1].BufferType = SECBUFFER_EMPTY;
+		inBuffers[1].pvBuffer = NULL;
+		inBuffers[1].cbBuffer = 0;
+		inDesc.ulVersion = SECBUFFER_VERSION;
+		inDesc.cBuffers = 2;
+		inDesc.pBuffers = inBuffers;
+		outBuffer.BufferType = SECBUFFER_TOKEN;
+		outBuffer.pvBuffer = NULL;
+		outBuffer.cbBuffer = 0;
+		outDesc.ulVersion = SECBUFFER_VERSION;
+		outDesc.cBuffers = 1;
+		outDesc.pBuffers = &outBuffer;
+
+		status = InitializeSecurityContextA(&gTlsClientCred, first ? NULL : &tls->context,
+			gTlsClientName[0] != 0 ? gTlsClientName : NULL,
+			ISC_REQ_SEQUENCE_DETECT | ISC_REQ_REPLAY_DETECT | ISC_REQ_CONFIDENTIALITY |
+			ISC_REQ_EXTENDED_ERROR | ISC_REQ_ALLOCATE_MEMORY | ISC_REQ_STREAM |
+			(gTlsClientName[0] != 0 ? 0 : ISC_REQ_MANUAL_CRED_VALIDATION),
+			0, 0, first ? NULL : &inDesc, 0, first ? &tls->context : NULL, &outDesc, &attributes, &expiry);
+
+		if (status == SEC_E_INCOMPLETE_MESSAGE) {
+			if (outBuffer.pvBuffer != NULL)
+				FreeContextBuffer(outBuffer.pvBuffer);
+			return tlsClientSpace(tls) > 0 ? TLS_CLIENT_MORE : TLS_CLIENT_FAILED;
+		}
+		if (status != SEC_E_OK && status != SEC_I_CONTINUE_NEEDED) {
+			if (outBuffer.pvBuffer != NULL)
+				FreeContextBuffer(outBuffer.pvBuffer);
+			fprintf(stderr, "InitializeSecurityContext failed with error 0x%x\n", (unsigned int)status);
+			return TLS_CLIENT_FAILED;
+		}
+		tls->hasContext = true;
+
+		// Keep what SChannel did not consume
+		if (!first) {
+			if (inBuffers[1].BufferType == SECBUFFER_EXTRA && inBuffers[1].cbBuffer > 0) {
+				memmove(tls->in, tls->in + tls->inLen - inBuffers[1].cbBuffer, inBuffers[1].cbBuffer);
+				tls->inLen = inBuffers[1].cbBuffer;
+			}
+			else
+				tls->inLen = 0;
+		}
+
+		if (outBuffer.pvBuffer != NULL && outBuffer.cbBuffer > 0) {
+			tls->token = outBuffer.pvBuffer;
+			tls->tokenLen = outBuffer.cbBuffer;
+		}
+		else if (outBuffer.pvBuffer != NULL)
+			FreeContextBuffer(outBuffer.pvBuffer);
+
+		if (status == SEC_E_OK) {
+			status = QueryContextAttributesA(&tls->context, SECPKG_ATTR_STREAM_SIZES, &tls->sizes);
+			if (status != SEC_E_OK || tls->sizes.cbHeader + tls->sizes.cbTrailer > TLS_CLIENT_SEAL_OVERHEAD) {
+				tlsClientTokenDone(tls);
+				return TLS_CLIENT_FAILED;
+			}
+			tls->established = true;
+		}
+
+		if (tls->token != NULL)
+			return TLS_CLIENT_TOKEN;
+		if (tls->established)
+			return TLS_CLIENT_DATA;
+		if (tls->inLen == 0)
+			return TLS_CLIENT_MORE;
+	}
+}
+
+// Function: tlsClientOpen
+// Description: Hand out plaintext from the ciphertext received. The
+//              caller adds what it received to inLen before the call.
+// Return: TLS_CLIENT_DATA if need bytes were copied, TLS_CLIENT_MORE if
+//         more ciphertext is needed, TLS_CLIENT_CLOSED or
+//         TLS_CLIENT_FAILED if the session is over
+// -IN: tls: the session, established
+//      need: bytes wanted
+// -OUT: out: the plaintext
+//       copied: bytes copied to out
+int tlsClientOpen(TLS_CLIENT *tls, char *out, int need, int *copied) {
+	SecBuffer buffers[4];
+	SecBufferDesc desc;
+	SECURITY_STATUS status;
+	int chunk, i;
+
+	*copied = 0;
+	while (*copied < need) {
+		if (tls->plainLen > 0) {
+			chunk = need - *copied < tls->plainLen ? need - *copied : tls->plainLen;
+			memcpy(out + *copied, tls->in + tls->plainOff, chunk);
+			tls->plainOff += chunk;
+			tls->plainLen -= chunk;
+			*copied += chunk;
+			if (tls->plainLen == 0 && tls->cipherOff > 0) {
+				// The record is used up, the next one moves to the front
+				memmove(tls->in, tls->in + tls->cipherOff, tls->inLen - tls->cipherOff);
+				tls->inLen -= tls->cipherOff;
+				tls->cipherOff = 0;
+			}
+			continue;
+		}
+		if (tls->inLen == 0)
+			break;
+
+		buffers[0].BufferType = SECBUFFER_DATA;
+		buffers[0].pvBuffer = tls->in;
+		buffers[0].cbBuffer = tls->inLen;
+		for (i = 1; i < 4; i++) {
+			buffers[i].BufferType = SECBUFFER_EMPTY;
+			buffers[i].pvBuffer = NULL;
+			buffers[i].cbBuffer = 0;
+		}
+		desc.ulVersion = SECBUFFER_VERSION;
+		desc.cBuffers = 4;
+		desc.pBuffers = buffers;
+
+		status = DecryptMessage(&tls->context, &desc, 0, NULL);
+		if (status == SEC_E_INCOMPLETE_MESSAGE) {
+			if (tlsClientSpace(tls) == 0)
+				return TLS_CLIENT_FAILED;
+			break;
+		}
+		if (status == SEC_I_CONTEXT_EXPIRED)
+			return TLS_CLIENT_CLOSED;
+		if (status != SEC_E_OK) {
+			// The server does not renegotiate, anything else is an error
+			fprintf(stderr, "DecryptMessage failed with error 0x%x\n", (unsigned int)status);
+			return TLS_CLIENT_FAILED;
+		}
+
+		tls->cipherOff = tls->inLen;
+		for (i = 1; i < 4; i++) {
+			if (buffers[i].BufferType == SECBUFFER_DATA) {
+				tls->plainOff = (int)((char *)buffers[i].pvBuffer - tls->in);
+				tls->plainLen = buffers[i].cbBuffer;
+			}
+			else if (buffers[i].BufferType == SECBUFFER_EXTRA)
+				tls->cipherOff = tls->inLen - buffers[i].cbBuffer;
+		}
+		if (tls->plainLen == 0) {
+			memmove(tls->in, tls->in + tls->cipherOff, tls->inLen - tls->cipherOff);
+			tls->inLen -= tls->cipherOff;
+			tls->cipherOff = 0;
+		}
+	}
+	return *copied == need ? TLS_CLIENT_DATA : TLS_CLIENT_MORE;
+}
+
+// Function: tlsClientSeal
+// Description: Seal plaintext into one record
+// Return: bytes of the record, -1 if it could not be sealed
+// -IN: tls: the session, established
+//      data: the plaintext
+//      len: its length, at most a record
+//      wireSize: room at wire
+// -OUT: wire: the record
+int tlsClientSeal(TLS_CLIENT *tls, const char *data, int len, char *wire, int wireSize) {
+	SecBuffer buffers[4];
+	SecBufferDesc desc;
+	SECURITY_STATUS status;
+	SecPkgContext_StreamSizes *sizes = &tls->sizes;
+
+	if (!tls->established || len > (int)sizes->cbMaximumMessage ||
+		(int)(sizes->cbHeader + sizes->cbTrailer) + len > wireSize)
+		return -1;
+
+	memcpy(wire + sizes->cbHeader, data, len);
+	buffers[0].BufferType = SECBUFFER_STREAM_HEADER;
+	buffers[0].pvBuffer = wire;
+	buffers[0].cbBuffer = sizes->cbHeader;
+	buffers[1].BufferType = SECBUFFER_DATA;
+	buffers[1].pvBuffer = wire + sizes->cbHeader;
+	buffers[1].cbBuffer = len;
+	buffers[2].BufferType = SECBUFFER_STREAM_TRAILER;
+	buffers[2].pvBuffer = wire + sizes->cbHeader + len;
+	buffers[2].cbBuffer = sizes->cbTrailer;
+	buffers[3].BufferType = SECBUFFER_EMPTY;
+	buffers[3].pvBuffer = NULL;
+	buffers[3].cbBuffer = 0;
+	desc.ulVersion = SECBUFFER_VERSION;
+	desc.cBuffers = 4;
+	desc.pBuffers = buffers;
+
+	status = EncryptMessage(&tls->context, 0, &desc, 0);
+	if (status != SEC_E_OK) {
+		fprintf(stderr, "EncryptMessage failed with error 0x%x\n", (unsigned int)status);
+		return -1;
+	}
+	return (int)(buffers[0].cbBuffer + buffers[1].cbBuffer + buffers[2].cbBuffer);
+}
+
+// Function: tlsClientSendAll
+// Description: Send bytes on a blocking socket until all are gone
+// Return: 0 if succeed, else return 1
+// -IN: s: the socket
+//      data, len: the bytes
+int tlsClientSendAll(SOCKET s, const char *data, int len) {
+	int sent;
+
+	while (len > 0) {
+		if ((sent = send(s, data, len, 0)) <= 0)
+			return 1;
+		data += sent;
+		len -= sent;
+	}
+	return 0;
+}
+
+// Function: tlsClientHandshake
+// Description: Run the whole handshake on a connected blocking socket
+// Return: 0 if succeed, else return 1
+// -IN: tls: the session, zeroed
+//      s: the socket
+int tlsClientHandshake(TLS_CLIENT *tls, SOCKET s) {
+	int state, received;
+
+	while ((state = tlsClientStep(tls)) != TLS_CLIENT_DATA) {
+		if (state == TLS_CLIENT_FAILED)
+			return 1;
+		if (state == TLS_CLIENT_TOKEN) {
+			state = tlsClientSendAll(s, (char *)tls->token, tls->tokenLen);
+			tlsClientTokenDone(tls);
+			if (state)
+				return 1;
+			if (tls->established)
+				return 0;
+			if (tls->inLen > 0)
+				continue;
+		}
+		if ((received = recv(s, tls->in + tls->inLen, tlsClientSpace(tls), 0)) <= 0)
+			return 1;
+		tls->inLen += received;
+	}
+	return 0;
+}
+
+#endif
@@ -0,0 +1,298 @@
+// LoadGen.cpp : Headless load generator. Runs many virtual users against
+// the server with a configurable mix of operations and reports throughput
+// and latency percentiles of each operation.
+//
+
+#include "stdafx.h"
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+#include "defs.h"
+#include "workload.h"
+#include "loadStats.h"
+#include "vuser.h"
+
+#pragma comment(lib, "Ws2_32.lib")
+#pragma warning(disable : 4996)
+
+#define DEFAULT_DURATION		60		// seconds measured
+#define DEFAULT_WARMUP			5		// seconds run before measuring
+#define DEFAULT_RAMP			5		// seconds over which the users start
+#define DRAIN_TIMEOUT			10		// seconds given to running operations at the end
+#define DEFAULT_SIZES			"4k:60,64k-1m:30,4m:10"
+
+char *gServerHost = NULL,
+*gServerPort = "5500",
+*gAccountsFile = NULL,
+*gMixSpec = NULL,
+*gSizeSpec = DEFAULT_SIZES,
+*gJsonFile = NULL,
+*gTlsName = NULL;
+
+int gUsersWanted = 0,
+gDuration = DEFAULT_DURATION,
+gWarmup = DEFAULT_WARMUP,
+gRamp = DEFAULT_RAMP,
+gThreads = 0;
+
+int usage(char *progname);
+void ValidateArgs(int argc, char **argv);
+std::string describeRun();
+
+int _tmain(int argc, char* argv[])
+{
+	WSADATA     wsd;
+	SYSTEM_INFO sysinfo;
+	LONGLONG    done, errors, lastDone = 0;
+	int         elapsed = 0;
+	double      seconds;
+
+	if (argc < 2)
+	{
+		usage(argv[0]);
+		exit(1);
+	}
+
+	// Validate the command line
+	ValidateArgs(argc, argv);
+	if (setMix(gMixSpec) || setSizes(gSizeSpec))
+		return 1;
+	if (gAccountsFile != NULL && loadAccounts(gAccountsFile))
+		return 1;
+
+	// Users without an account can only open connections
+	if (gAccounts.empty() && gMixWeights[LG_OP_CONNECT] != gMixTotal)
+	{
+		fprintf(stderr, "An accounts file (-u) is needed for any operation but connect\n");
+		return 1;
+	}
+	if (gUsersWanted == 0)
+		gUsersWanted = (int)gAccounts.size();
+	if (gUsersWanted <= 0 || (!gAccounts.empty() && gUsersWanted > (int)gAccounts.size()))
+	{
+		fprintf(stderr, "Need one account per virtual user, %d accounts for %d users\n", (int)gAccounts.size(), gUsersWanted);
+		return 1;
+	}
+	if (gMixWeights[LG_OP_JOIN] > 0 && gJoinGroup == NULL)
+	{
+		fprintf(stderr, "The join operation needs a group (-j)\n");
+		return 1;
+	}
+
+	if (gThreads == 0)
+	{
+		GetSystemInfo(&sysinfo);
+		gThreads = (int)sysinfo.dwNumberOfProcessors;
+	}
+	if (gThreads > MAX_WORKER_THREADS)
+		gThreads = MAX_WORKER_THREADS;
+
+	// Load Winsock
+	if (WSAStartup(MAKEWORD(2, 2), &wsd) != 0)
+	{
+		fprintf(stderr, "unable to load Winsock!\n");
+		return -1;
+	}
+
+	if (initializePayload())
+		return 1;
+	if (gTlsName != NULL && initializeTlsClient(gTlsName))
+		return 1;
+	if (initializeUsers(gServerHost, gServerPort, gUsersWanted, gThreads))
+		return 1;
+
+	printf("%d users on %d threads against %s:%s%s, %ds ramp-up, %ds warm-up, %ds measured\n",
+		gUsersWanted, gThreads, gServerHost, gServerPort, gTlsName != NULL ? " over TLS" : "", gRamp, gWarmup, gDuration);
+	initializeStats(gRamp + gWarmup, gDuration);
+	startUsers(gRamp);
+
+	// Print progress once a second until the measured window closes
+	while (statsNow() < gMeasureEnd)
+	{
+		Sleep(1000);
+		elapsed++;
+
+		statsProgress(&done, &errors);
+		printf("%4ds %s  %lld ops/s  %lld errors  %ld users\n", elapsed,
+			statsNow() < gMeasureStart ? "warm-up " : "measured", done - lastDone, errors, gActiveUsers);
+		lastDone = done;
+	}
+
+	// Let the running operations end, users stop at their next operation
+	InterlockedExchange(&gStopping, 1);
+	for (int i = 0; i < DRAIN_TIMEOUT * 10 && gActiveUsers > 0; i++)
+		Sleep(100);
+	if (gActiveUsers > 0)
+		printf("%ld users still busy after %ds, not waiting for them\n", gActiveUsers, DRAIN_TIMEOUT);
+
+	seconds = gDuration;
+	printReport(seconds);
+	if (gJsonFile != NULL && writeJsonReport(gJsonFile, describeRun(), seconds))
+		return 1;
+
+	WSACleanup();
+	return 0;
+}
+
+// Function: usage
+// Description: Prints usage information and exits.
+int usage(char *progname)
+{
+	fprintf(stderr, "Usage: %s -s server [-e port] [-u accounts] [options]\n", progname);
+	fprintf(stderr, "  -s  addr    Server address\n"
+		"  -e  port    Server port [default = %s]\n"
+		"  -u  file    Accounts, one \"username password group\" per line\n"
+		"  -n  count   Virtual users, one account each [default = one per account]\n"
+		"  -d  secs    Measured duration [default = %d]\n"
+		"  -w  secs    Warm-up before measuring [default = %d]\n"
+		"  -r  secs    Ramp-up over which the users start [default = %d]\n"
+		"  -x  mix     Operation mix, \"op:weight,...\" of login, reauth, list, groups,\n"
+		"              join, upload, download, range, delete and connect\n"
+		"  -z  sizes   Upload sizes, \"size[-max]:weight,...\" with k, m or g suffixes\n"
+		"              [default = %s]\n"
+		"  -k  ms      Mean think time between operations of a user [default = 0]\n"
+		"  -j  group   Group joined and left again by the join operation\n"
+		"  -f  name    Download this file instead of the user's own uploads\n"
+		"  -v          Verify the digest of downloaded files\n"
+		"  -t  count   Worker threads [default = number of processors]\n"
+		"  -o  file    Write the results as JSON\n"
+		"  -l  name    Connect over TLS, to a server started with -x, checking its\n"
+		"              certificate is issued to name, or taking any if name is \"%s\"\n",
+		gServerPort,
+		gDuration,
+		gWarmup,
+		gRamp,
+		gSizeSpec,
+		TLS_CLIENT_ANY_NAME
+	);
+	fprintf(stderr, "Default mix:");
+	for (int op = 0; op < LG_OP_COUNT; op++)
+		if (gOpInfo[op].defaultWeight > 0)
+			fprintf(stderr, " %s:%d", gOpInfo[op].name, gOpInfo[op].defaultWeight);
+	fprintf(stderr, "\n");
+	exit(1);
+	return 0;
+}
+
+// Function: ValidateArgs
+// Description: Parses the command line arguments and sets up some global variables.
+void ValidateArgs(int argc, char **argv)
+{
+	int     i;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (((argv[i][0] != '/') && (argv[i][0] != '-')) || (strlen(argv[i]) < 2))
+			usage(argv[0]);
+
+		// Every option but -v takes a value
+		if (tolower(argv[i][1]) != 'v' && i + 1 >= argc)
+			usage(argv[0]);
+
+		switch (tolower(argv[i][1]))
+		{
+		case 'd':               // measured duration
+			gDuration = atoi(argv[++i]);
+			break;
+
+		case 'e':               // server port
+			gServerPort = argv[++i];
+			break;
+
+		case 'f':               // fixed file to download
+			gDownloadFile = argv[++i];
+			break;
+
+		case 'j':               // group to join and leave
+			gJoinGroup = argv[++i];
+			break;
+
+		case 'k':               // think time
+			gThinkTime = atoi(argv[++i]);
+			break;
+
+		case 'l':               // TLS server name
+			gTlsName = argv[++i];
+			break;
+
+		case 'n':               // virtual users
+			gUsersWanted = atoi(argv[++i]);
+			break;
+
+		case 'o':               // JSON results
+			gJsonFile = argv[++i];
+			break;
+
+		case 'r':               // ramp-up
+			gRamp = atoi(argv[++i]);
+			break;
+
+		case 's':               // server address
+			gServerHost = argv[++i];
+			break;
+
+		case 't':               // worker threads
+			gThreads = atoi(argv[++i]);
+			break;
+
+		case 'u':               // accounts file
+			gAccountsFile = argv[++i];
+			break;
+
+		case 'v':               // verify downloads
+			gVerify = TRUE;
+			break;
+
+		case 'w':               // warm-up
+			gWarmup = atoi(argv[++i]);
+			break;
+
+		case 'x':               // operation mix
+			gMixSpec = argv[++i];
+			break;
+
+		case 'z':               // upload sizes
+			gSizeSpec = argv[++i];
+			break;
+
+		default:
+			usage(argv[0]);
+			break;
+		}
+	}
+
+	if (gServerHost == NULL || gDuration <= 0 || gWarmup < 0 || gRamp < 0 || gThinkTime < 0 || gThreads < 0)
+		usage(argv[0]);
+}
+
+// Function: describeRun
+// Description: Build the JSON members describing the settings of the run
+// Return: the members, without braces
+std::string describeRun()
+{
+	std::string out;
+	char line[512];
+	int op, first = 1;
+
+	snprintf(line, sizeof(line),
+		"\"server\": \"%s:%s\",\n  \"users\": %d,\n  \"threads\": %d,\n  \"warmup\": %d,\n  \"ramp\": %d,\n"
+		"  \"think_ms\": %d,\n  \"sizes\": \"%s\",\n  \"verify\": %s,\n  \"tls\": %s,\n  \"mix\": {",
+		gServerHost, gServerPort, gUsersWanted, gThreads, gWarmup, gRamp,
+		gThinkTime, gSizeSpec, gVerify ? "true" : "false", gTlsName != NULL ? "true" : "false");
+	out = line;
+
+	for (op = 0; op < LG_OP_COUNT; op++)
+	{
+		if (gMixWeights[op] == 0)
+			continue;
+		snprintf(line, sizeof(line), "%s \"%s\": %d", first ? "" : ",", gOpInfo[op].name, gMixWeights[op]);
+		out += line;
+		first = 0;
+	}
+	out += " }";
+	return out;
+}
@@ -0,0 +1,255 @@
+#pragma once
+
+#ifndef _LOAD_STATS_H
+#define _LOAD_STATS_H
+
+#include <string>
+#include <intrin.h>
+#include <windows.h>
+#include "workload.h"
+
+// Latencies use the bucket layout of the server metrics: each power of two
+// of microseconds is split in HIST_SUB_COUNT buckets, so a reported
+// percentile is within 1/HIST_SUB_COUNT of the exact value.
+#define HIST_SUB_BITS			3
+#define HIST_SUB_COUNT			(1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS			32
+#define HIST_BUCKETS			((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+#define MAX_WORKER_THREADS		64
+
+typedef struct {
+	LONGLONG count;
+	LONGLONG errors;
+	LONGLONG busy;		// refused by an overloaded server, not counted in errors
+	LONGLONG bytes;
+	LONGLONG sum;
+	LONGLONG maxUs;
+	LONGLONG counts[HIST_BUCKETS];
+} OP_STATS;
+
+// Each worker thread records into its own block, the report adds them up.
+// finished and failed count every operation, also outside the window, for
+// the progress line.
+typedef struct __declspec(align(64)) {
+	OP_STATS ops[LG_OP_COUNT];
+	LONGLONG finished;
+	LONGLONG failed;
+} THREAD_STATS;
+
+THREAD_STATS gThreadStats[MAX_WORKER_THREADS];
+__declspec(thread) int tlsStatsIndex = 0;
+
+LONGLONG gTicksPerUs = 1;
+LONGLONG gMeasureStart = 0, gMeasureEnd = 0;	// window of the recorded operations
+
+// Function: statsNow
+// Description: Read the high resolution clock
+// Return: the clock in performance counter ticks
+inline LONGLONG statsNow() {
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+}
+
+// Function: histBucket
+// Description: Get the bucket of a value
+// Return: index of the bucket
+// -IN: us: the value in microseconds
+inline int histBucket(ULONGLONG us) {
+	unsigned long msb;
+	int shift;
+
+	if (us < HIST_SUB_COUNT)
+		return (int)us;
+	if (us >= ((ULONGLONG)1 << HIST_MAX_BITS))
+		return HIST_BUCKETS - 1;
+
+	_BitScanReverse64(&msb, us);
+	shift = (int)msb - HIST_SUB_BITS;
+	return (shift + 1) * HIST_SUB_COUNT + (int)((us >> shift) & (HIST_SUB_COUNT - 1));
+}
+
+// Function: histUpperBound
+// Description: Get the smallest value above a bucket
+// Return: the bound in microseconds
+// -IN: bucket: index of the bucket
+ULONGLONG histUpperBound(int bucket) {
+	int shift;
+
+	if (bucket < HIST_SUB_COUNT)
+		return bucket + 1;
+	shift = bucket / HIST_SUB_COUNT - 1;
+	return ((ULONGLONG)(HIST_SUB_COUNT + bucket % HIST_SUB_COUNT) + 1) << shift;
+}
+
+// Function: initializeStats
+// Description: Read the clock frequency and set the measured window
+// -IN: warmupSecs: seconds from now before recording starts
+//      durationSecs: seconds recorded
+void initializeStats(int warmupSecs, int durationSecs) {
+	LARGE_INTEGER frequency;
+
+	QueryPerformanceFrequency(&frequency);
+	gTicksPerUs = frequency.QuadPart / 1000000;
+	if (gTicksPerUs == 0)
+		gTicksPerUs = 1;
+
+	gMeasureStart = statsNow() + (LONGLONG)warmupSecs * frequency.QuadPart;
+	gMeasureEnd = gMeasureStart + (LONGLONG)durationSecs * frequency.QuadPart;
+}
+
+// Function: statsRecord
+// Description: Record a finished operation of the calling worker thread.
+//              Operations that started before the window opened or ended
+//              after it closed are not counted.
+// -IN: op: the operation
+//      start: when the operation started, from statsNow
+//      bytes: payload bytes moved by the operation
+//      failed: TRUE if the operation failed
+//      busy: TRUE if it failed because the server was overloaded
+void statsRecord(int op, LONGLONG start, LONGLONG bytes, BOOL failed, BOOL busy) {
+	OP_STATS *stats = &gThreadStats[tlsStatsIndex].ops[op];
+	LONGLONG now = statsNow(), us;
+
+	gThreadStats[tlsStatsIndex].finished++;
+	if (failed)
+		gThreadStats[tlsStatsIndex].failed++;
+	if (start < gMeasureStart || now > gMeasureEnd)
+		return;
+
+	if (busy) {
+		stats->busy++;
+		return;
+	}
+	if (failed) {
+		stats->errors++;
+		return;
+	}
+
+	us = (now - start) / gTicksPerUs;
+	stats->count++;
+	stats->bytes += bytes;
+	stats->sum += us;
+	if (us > stats->maxUs)
+		stats->maxUs = us;
+	stats->counts[histBucket((ULONGLONG)us)]++;
+}
+
+// Function: statsSum
+// Description: Add up the statistics of an operation over all threads.
+//              Reads while the workers run may be a few updates behind.
+// -IN: op: the operation
+// -OUT: total: the sum
+void statsSum(int op, OP_STATS *total) {
+	memset(total, 0, sizeof(OP_STATS));
+	for (int t = 0; t < MAX_WORKER_THREADS; t++) {
+		OP_STATS *stats = &gThreadStats[t].ops[op];
+		total->count += stats->count;
+		total->errors += stats->errors;
+		total->busy += stats->busy;
+		total->bytes += stats->bytes;
+		total->sum += stats->sum;
+		if (stats->maxUs > total->maxUs)
+			total->maxUs = stats->maxUs;
+		for (int bucket = 0; bucket < HIST_BUCKETS; bucket++)
+			total->counts[bucket] += stats->counts[bucket];
+	}
+}
+
+// Function: statsProgress
+// Description: Count the operations finished so far, in or out of the window
+// -OUT: finished: operations finished
+//       failed: operations that failed
+void statsProgress(LONGLONG *finished, LONGLONG *failed) {
+	*finished = *failed = 0;
+	for (int t = 0; t < MAX_WORKER_THREADS; t++) {
+		*finished += gThreadStats[t].finished;
+		*failed += gThreadStats[t].failed;
+	}
+}
+
+// Function: statsPercentile
+// Description: Get a percentile of the recorded latencies
+// Return: upper bound of the bucket holding the percentile, in microseconds
+// -IN: stats: the statistics of an operation
+//      quantile: the percentile, between 0 and 1
+ULONGLONG statsPercentile(OP_STATS *stats, double quantile) {
+	LONGLONG rank = (LONGLONG)(quantile * stats->count + 0.5), seen = 0;
+
+	if (stats->count == 0)
+		return 0;
+	if (rank < 1)
+		rank = 1;
+	for (int bucket = 0; bucket < HIST_BUCKETS; bucket++) {
+		seen += stats->counts[bucket];
+		if (seen >= rank)
+			return histUpperBound(bucket);
+	}
+	return histUpperBound(HIST_BUCKETS - 1);
+}
+
+// Function: printReport
+// Description: Print throughput and latency of each operation
+// -IN: seconds: length of the measured window
+void printReport(double seconds) {
+	OP_STATS stats;
+
+	printf("\n%-9s %10s %8s %8s %10s %10s %10s %10s %10s %10s\n",
+		"op", "count", "errors", "busy", "ops/s", "MB/s", "mean ms", "p50 ms", "p99 ms", "p999 ms");
+	for (int op = 0; op < LG_OP_COUNT; op++) {
+		statsSum(op, &stats);
+		if (stats.count == 0 && stats.errors == 0 && stats.busy == 0)
+			continue;
+		printf("%-9s %10lld %8lld %8lld %10.1f %10.2f %10.3f %10.3f %10.3f %10.3f\n",
+			gOpInfo[op].name, stats.count, stats.errors, stats.busy,
+			stats.count / seconds,
+			stats.bytes / seconds / (1 << 20),
+			stats.count ? (double)stats.sum / stats.count / 1000 : 0.0,
+			statsPercentile(&stats, 0.5) / 1000.0,
+			statsPercentile(&stats, 0.99) / 1000.0,
+			statsPercentile(&stats, 0.999) / 1000.0);
+	}
+}
+
+// Function: writeJsonReport
+// Description: Write the run settings and the results of each operation
+//              as JSON, so that runs can be compared by a script
+// Return: 0 if succeed, else return 1
+// -IN: fileName: the output file
+//      settings: JSON members describing the run, without braces
+//      seconds: length of the measured window
+int writeJsonReport(const char *fileName, const std::string &settings, double seconds) {
+	OP_STATS stats;
+	FILE *file;
+	int first = 1;
+
+	file = fopen(fileName, "w");
+	if (file == NULL) {
+		fprintf(stderr, "Cannot open %s\n", fileName);
+		return 1;
+	}
+
+	fprintf(file, "{\n  %s,\n  \"seconds\": %.3f,\n  \"operations\": {", settings.c_str(), seconds);
+	for (int op = 0; op < LG_OP_COUNT; op++) {
+		statsSum(op, &stats);
+		if (stats.count == 0 && stats.errors == 0 && stats.busy == 0)
+			continue;
+		fprintf(file, "%s\n    \"%s\": { \"count\": %lld, \"errors\": %lld, \"busy\": %lld, \"ops_per_sec\": %.3f, "
+			"\"bytes\": %lld, \"mean_us\": %.1f, \"p50_us\": %llu, \"p99_us\": %llu, \"p999_us\": %llu, \"max_us\": %lld }",
+			first ? "" : ",", gOpInfo[op].name, stats.count, stats.errors, stats.busy, stats.count / seconds,
+			stats.bytes, stats.count ? (double)stats.sum / stats.count : 0.0,
+			statsPercentile(&stats, 0.5), statsPercentile(&stats, 0.99), statsPercentile(&stats, 0.999),
+			stats.maxUs);
+		first = 0;
+	}
+	fprintf(file, "\n  }\n}\n");
+
+	if (fclose(file) != 0) {
+		fprintf(stderr, "Cannot write %s\n", fileName);
+		return 1;
+	}
+	return 0;
+}
+
+#endif
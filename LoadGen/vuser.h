@@ -0,0 +1,1121 @@
+#pragma once
+
+#ifndef _VUSER_H
+#define _VUSER_H
+
+#include <map>
+#include <math.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <mswsock.h>
+#include <process.h>
+#include "defs.h"
+#include "md5.h"
+#include "workload.h"
+#include "loadStats.h"
+#include "tlsClient.h"
+
+#define VU_FILE_SLOTS		16		// uploads remembered per user for downloads and deletes
+#define VU_NAME_SIZE		64
+#define VU_ERROR_BACKOFF	1000	// milliseconds before a user whose session broke reconnects
+#define VU_RANGE_SPEC		"0:3000,-2500:0"	// ranges of the range operation, one across a frame boundary
+
+// What the I/O posted on a connection is doing
+#define VU_IO_CONNECT		0		// connecting and sending the first message
+#define VU_IO_SEND			1
+#define VU_IO_RECV			2
+#define VU_IO_CLOSE			3		// waiting for the server to close after a shutdown
+#define VU_IO_TLS_SEND		4		// sending handshake bytes
+#define VU_IO_TLS_RECV		5		// receiving handshake bytes
+
+// Completion keys
+#define VU_KEY_IO			0
+#define VU_KEY_RUN			1		// start the next operation of a user
+#define VU_KEY_TLS			2		// a receive served from plaintext already decrypted
+
+// Result of one step of an operation
+#define VU_PENDING			0		// I/O posted, the next step runs on its completion
+#define VU_DONE				1
+#define VU_FAILED			2		// the server refused, the connection is still in step
+#define VU_BROKEN			3		// I/O failed or the reply made no sense, drop the connection
+#define VU_BUSY				4		// the server is overloaded and closes the connection, retry after vu->retryMs
+
+// TLS state of a connection. A frame is sealed into wire before it is
+// sent, and received ciphertext is decrypted into the frame.
+typedef struct _VU_TLS {
+	TLS_CLIENT session;
+	char wire[sizeof(MESSAGE) + TLS_CLIENT_SEAL_OVERHEAD];
+	DWORD wireLen;
+} VU_TLS;
+
+typedef struct _VU_CONN {
+	WSAOVERLAPPED overlapped;
+	struct _VUSER *vu;
+	SOCKET s;
+	int operation;
+	BOOL expectReply;	// receive a reply once the message is sent
+	DWORD done;			// bytes of the message sent or received so far, of the record or token over TLS
+	VU_TLS *tls;		// NULL over plaintext
+	MESSAGE mess;
+} VU_CONN;
+
+// A virtual user. It runs one operation at a time, so at most one I/O is
+// outstanding for it and its state is only touched by the thread that
+// dequeued that completion.
+typedef struct _VUSER {
+	WSAOVERLAPPED runOverlapped;
+	int id;
+	ACCOUNT_ENTRY *account;		// NULL if the user only opens connections
+	VU_CONN session;			// logged in connection for the request/response operations
+	VU_CONN transfer;			// connection of the current upload, download or connect
+	char cookie[COOKIE_LEN];
+	BOOL loggedIn;
+	unsigned int seed;
+
+	int op;
+	int step;
+	LONGLONG started;
+	LONGLONG bytes;
+	int entriesLeft;			// list entries still to fetch
+	DWORD retryMs;				// wait asked for by the last OPS_ERR_BUSY
+
+	char fileName[VU_NAME_SIZE];
+	char digest[DIGEST_SIZE];
+	LONGLONG fileSize;
+	LONGLONG fileOffset;
+	MD5 md5;
+
+	char files[VU_FILE_SLOTS][VU_NAME_SIZE];	// ring of uploaded files, oldest first
+	int fileFirst;
+	int fileCount;
+	int fileSeq;
+} VUSER;
+
+HANDLE gCompletionPort;
+LPFN_CONNECTEX gConnectEx = NULL;
+SOCKADDR_STORAGE gServerAddr;
+int gServerAddrLen = 0;
+
+VUSER *gUsers = NULL;
+int gUserCount = 0;
+volatile LONG gStopping = 0, gActiveUsers = 0;
+int gThinkTime = 0;				// mean milliseconds between operations
+char *gJoinGroup = NULL;		// group joined and left by "join"
+char *gDownloadFile = NULL;		// file downloaded instead of the user's own uploads
+BOOL gVerify = FALSE;			// check the digest of downloads
+unsigned int gRunTag;			// keeps upload names of different runs apart
+
+// Users waiting for their think time, by due tick
+std::multimap<ULONGLONG, VUSER*> gWaitList;
+CRITICAL_SECTION gWaitCritSec;
+HANDLE gWaitEvent;
+
+void vuStep(VUSER *vu, MESSAGE *reply);
+
+// Function: vuSchedule
+// Description: Run the next operation of a user after a delay
+// -IN: vu: the user
+//      delayMs: the delay in milliseconds
+void vuSchedule(VUSER *vu, DWORD delayMs) {
+	if (delayMs == 0) {
+		PostQueuedCompletionStatus(gCompletionPort, 0, VU_KEY_RUN, &vu->runOverlapped);
+		return;
+	}
+
+	EnterCriticalSection(&gWaitCritSec);
+	gWaitList.insert(std::make_pair(GetTickCount64() + delayMs, vu));
+	LeaveCriticalSection(&gWaitCritSec);
+	SetEvent(gWaitEvent);
+}
+
+// Function: schedulerThread
+// Description: Hand users whose delay is over to the worker threads
+unsigned __stdcall schedulerThread(void *param) {
+	DWORD wait;
+	ULONGLONG now;
+
+	while (TRUE) {
+		wait = INFINITE;
+		EnterCriticalSection(&gWaitCritSec);
+		now = GetTickCount64();
+		while (!gWaitList.empty() && gWaitList.begin()->first <= now) {
+			PostQueuedCompletionStatus(gCompletionPort, 0, VU_KEY_RUN, &gWaitList.begin()->second->runOverlapped);
+			gWaitList.erase(gWaitList.begin());
+		}
+		if (!gWaitList.empty())
+			wait = (DWORD)(gWaitList.begin()->first - now);
+		LeaveCriticalSection(&gWaitCritSec);
+
+		WaitForSingleObject(gWaitEvent, wait);
+	}
+	return 0;
+}
+
+// Function: thinkTime
+// Description: Draw the pause before the next operation, exponentially
+//              distributed around gThinkTime
+// Return: the pause in milliseconds
+// -IN/OUT: vu: the user
+DWORD thinkTime(VUSER *vu) {
+	double uniform;
+
+	if (gThinkTime == 0)
+		return 0;
+	uniform = ((nextRandom(&vu->seed) >> 8) + 1) / (double)(1 << 24);
+	return (DWORD)(-log(uniform) * gThinkTime);
+}
+
+// Function: vuPostTls
+// Description: Post the send or receive of the rest of a record or
+//              handshake token. A frame is sealed when its send starts,
+//              and a receive whose frame was already decrypted completes
+//              on the port without reading the socket.
+// Return: 0 if succeed, else return 1
+// -IN/OUT: conn: the connection, over TLS
+int vuPostTls(VU_CONN *conn) {
+	TLS_CLIENT *session = &conn->tls->session;
+	WSABUF wbuf;
+	DWORD bytes, flags = 0;
+	int rc, len;
+
+	memset(&conn->overlapped, 0, sizeof(WSAOVERLAPPED));
+	switch (conn->operation) {
+	case VU_IO_SEND:
+		if (conn->done == 0) {
+			len = tlsClientSeal(session, (char *)&conn->mess, sizeof(MESSAGE), conn->tls->wire, sizeof(conn->tls->wire));
+			if (len < 0)
+				return 1;
+			conn->tls->wireLen = len;
+		}
+		wbuf.buf = conn->tls->wire + conn->done;
+		wbuf.len = conn->tls->wireLen - conn->done;
+		break;
+
+	case VU_IO_TLS_SEND:
+		wbuf.buf = (char *)session->token + conn->done;
+		wbuf.len = session->tokenLen - conn->done;
+		break;
+
+	case VU_IO_RECV:
+		if (tlsClientBuffered(session))
+			return PostQueuedCompletionStatus(gCompletionPort, 0, VU_KEY_TLS, &conn->overlapped) ? 0 : 1;
+		// fall through
+	default:
+		// What arrives while waiting for the close is dropped
+		if (conn->operation == VU_IO_CLOSE)
+			session->inLen = session->cipherOff = session->plainLen = 0;
+		wbuf.buf = session->in + session->inLen;
+		wbuf.len = tlsClientSpace(session);
+		if (wbuf.len == 0)
+			return 1;
+		break;
+	}
+
+	if (conn->operation == VU_IO_SEND || conn->operation == VU_IO_TLS_SEND)
+		rc = WSASend(conn->s, &wbuf, 1, &bytes, 0, &conn->overlapped, NULL);
+	else
+		rc = WSARecv(conn->s, &wbuf, 1, &bytes, &flags, &conn->overlapped, NULL);
+
+	if (rc == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING)
+		return 1;
+	return 0;
+}
+
+// Function: vuPost
+// Description: Post the send or receive of the rest of the message
+// Return: 0 if succeed, else return 1
+// -IN/OUT: conn: the connection
+int vuPost(VU_CONN *conn) {
+	WSABUF wbuf;
+	DWORD bytes, flags = 0;
+	int rc;
+
+	if (conn->tls != NULL)
+		return vuPostTls(conn);
+
+	wbuf.buf = (char *)&conn->mess + conn->done;
+	wbuf.len = sizeof(MESSAGE) - conn->done;
+	memset(&conn->overlapped, 0, sizeof(WSAOVERLAPPED));
+
+	if (conn->operation == VU_IO_SEND)
+		rc = WSASend(conn->s, &wbuf, 1, &bytes, 0, &conn->overlapped, NULL);
+	else
+		rc = WSARecv(conn->s, &wbuf, 1, &bytes, &flags, &conn->overlapped, NULL);
+
+	if (rc == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING)
+		return 1;
+	return 0;
+}
+
+// Function: vuSend
+// Description: Send a message, and receive the reply if there is one
+// Return: 0 if succeed, else return 1
+// -IN/OUT: conn: the connection
+// -IN: opcode, length, offset: header of the message
+//      payload: the payload, NULL for none
+//      expectReply: TRUE to receive a reply after the send
+int vuSend(VU_CONN *conn, int opcode, unsigned int length, long offset, const char *payload, BOOL expectReply) {
+	conn->mess.opcode = opcode;
+	conn->mess.length = length;
+	conn->mess.offset = offset;
+	conn->mess.burst = 0;
+	if (payload != NULL)
+		memcpy(conn->mess.payload, payload, length);
+	if (length < BUFF_SIZE)
+		conn->mess.payload[length] = 0;
+
+	conn->operation = VU_IO_SEND;
+	conn->expectReply = expectReply;
+	conn->done = 0;
+	return vuPost(conn);
+}
+
+// Function: vuRecv
+// Description: Receive the next message
+// Return: 0 if succeed, else return 1
+// -IN/OUT: conn: the connection
+int vuRecv(VU_CONN *conn) {
+	conn->operation = VU_IO_RECV;
+	conn->done = 0;
+	return vuPost(conn);
+}
+
+// Function: vuClose
+// Description: Close a connection that has no I/O outstanding
+// -IN/OUT: conn: the connection
+void vuClose(VU_CONN *conn) {
+	if (conn->s != INVALID_SOCKET) {
+		closesocket(conn->s);
+		conn->s = INVALID_SOCKET;
+	}
+	if (conn->tls != NULL) {
+		tlsClientRelease(&conn->tls->session);
+		HeapFree(GetProcessHeap(), 0, conn->tls);
+		conn->tls = NULL;
+	}
+}
+
+// Function: vuConnect
+// Description: Open a connection and send its first message with the
+//              connect, or after the handshake over TLS. The message must
+//              already be in conn->mess.
+// Return: 0 if succeed, else return 1
+// -IN/OUT: conn: the connection
+int vuConnect(VU_CONN *conn) {
+	SOCKADDR_STORAGE local;
+	DWORD bytes;
+	BOOL noDelay = TRUE;
+
+	conn->s = WSASocket(gServerAddr.ss_family, SOCK_STREAM, IPPROTO_TCP, NULL, 0, WSA_FLAG_OVERLAPPED);
+	if (conn->s == INVALID_SOCKET)
+		return 1;
+
+	// ConnectEx needs a bound socket
+	memset(&local, 0, sizeof(local));
+	local.ss_family = gServerAddr.ss_family;
+	if (bind(conn->s, (SOCKADDR *)&local, gServerAddrLen) == SOCKET_ERROR)
+		goto fail;
+
+	// Requests are single messages, do not hold their tail back
+	setsockopt(conn->s, IPPROTO_TCP, TCP_NODELAY, (char *)&noDelay, sizeof(noDelay));
+
+	if (CreateIoCompletionPort((HANDLE)conn->s, gCompletionPort, VU_KEY_IO, 0) == NULL)
+		goto fail;
+
+	if (gTlsClientEnabled) {
+		conn->tls = (VU_TLS *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(VU_TLS));
+		if (conn->tls == NULL)
+			goto fail;
+	}
+
+	conn->operation = VU_IO_CONNECT;
+	conn->expectReply = TRUE;
+	conn->done = 0;
+	memset(&conn->overlapped, 0, sizeof(WSAOVERLAPPED));
+	if (!gConnectEx(conn->s, (SOCKADDR *)&gServerAddr, gServerAddrLen, conn->tls != NULL ? NULL : &conn->mess,
+		conn->tls != NULL ? 0 : sizeof(MESSAGE), &bytes, &conn->overlapped) && WSAGetLastError() != ERROR_IO_PENDING)
+		goto fail;
+	return 0;
+
+fail:
+	vuClose(conn);
+	return 1;
+}
+
+// Function: vuRemember
+// Description: Add an uploaded file to the ring of the user, forgetting the
+//              oldest one if the ring is full
+// -IN/OUT: vu: the user
+void vuRemember(VUSER *vu) {
+	if (vu->fileCount == VU_FILE_SLOTS) {
+		vu->fileFirst = (vu->fileFirst + 1) % VU_FILE_SLOTS;
+		vu->fileCount--;
+	}
+	strcpy_s(vu->files[(vu->fileFirst + vu->fileCount) % VU_FILE_SLOTS], VU_NAME_SIZE, vu->fileName);
+	vu->fileCount++;
+}
+
+// Function: vuBusy
+// Description: Keep the wait a server that refused an operation asked for
+// Return: VU_BUSY
+// -IN/OUT: vu: the user
+// -IN: reply: the OPS_ERR_BUSY reply
+int vuBusy(VUSER *vu, MESSAGE *reply) {
+	vu->retryMs = reply->offset > 0 ? (DWORD)reply->offset : VU_ERROR_BACKOFF;
+	return VU_BUSY;
+}
+
+// Function: stepSession
+// Description: Log in, get a cookie and use the group of the account.
+//              A new session starts at step 0 with the connect, "login"
+//              logs out first at step 10 and reuses the connection.
+// Return: VU_PENDING, VU_DONE, VU_BROKEN or VU_BUSY
+// -IN/OUT: vu: the user
+// -IN: reply: the reply to the last request
+int stepSession(VUSER *vu, MESSAGE *reply) {
+	VU_CONN *conn = &vu->session;
+	char credentials[CRE_MAXLEN * 2 + 2];
+	int length;
+
+	length = snprintf(credentials, sizeof(credentials), "%s %s", vu->account->username, vu->account->password);
+
+	switch (vu->step) {
+	case 0:
+		vuClose(conn);
+		vu->loggedIn = FALSE;
+		conn->mess.opcode = OPA_LOGIN;
+		conn->mess.length = length;
+		conn->mess.offset = 0;
+		conn->mess.burst = 0;
+		memcpy(conn->mess.payload, credentials, length + 1);
+		vu->step = 1;
+		return vuConnect(conn) ? VU_BROKEN : VU_PENDING;
+
+	case 10:
+		vu->step = 11;
+		return vuSend(conn, OPA_LOGOUT, 0, 0, NULL, TRUE) ? VU_BROKEN : VU_PENDING;
+
+	case 11:
+		if (reply->opcode != OPS_OK)
+			return VU_BROKEN;
+		vu->loggedIn = FALSE;
+		vu->step = 1;
+		return vuSend(conn, OPA_LOGIN, length, 0, credentials, TRUE) ? VU_BROKEN : VU_PENDING;
+
+	case 1:
+		if (reply->opcode == OPS_ERR_BUSY)
+			return vuBusy(vu, reply);
+		if (reply->opcode != OPS_OK)
+			return VU_BROKEN;
+		vu->step = 2;
+		return vuSend(conn, OPA_REQ_COOKIES, 0, 0, NULL, TRUE) ? VU_BROKEN : VU_PENDING;
+
+	case 2:
+		if (reply->opcode != OPS_OK)
+			return VU_BROKEN;
+		reply->payload[COOKIE_LEN - 1] = 0;
+		strcpy_s(vu->cookie, COOKIE_LEN, reply->payload);
+		vu->step = 3;
+		return vuSend(conn, OPG_GROUP_USE, (unsigned int)strlen(vu->account->group), 0, vu->account->group, TRUE) ? VU_BROKEN : VU_PENDING;
+
+	case 3:
+		if (reply->opcode != OPS_OK)
+			return VU_BROKEN;
+		vu->loggedIn = TRUE;
+		return VU_DONE;
+	}
+	return VU_BROKEN;
+}
+
+// Function: stepReauth
+// Description: Close the session, wait for the server to let go of it
+//              and reconnect with the cookie
+// Return: VU_PENDING, VU_DONE or VU_BROKEN
+// -IN/OUT: vu: the user
+// -IN: reply: the reply to the last request
+int stepReauth(VUSER *vu, MESSAGE *reply) {
+	VU_CONN *conn = &vu->session;
+
+	switch (vu->step) {
+	case 0:
+		// The server forgets the session before it closes the socket, so
+		// once the close is seen the cookie can be used again
+		vu->step = 1;
+		shutdown(conn->s, SD_SEND);
+		conn->operation = VU_IO_CLOSE;
+		conn->done = 0;
+		return vuPost(conn) ? VU_BROKEN : VU_PENDING;
+
+	case 1:
+		vu->loggedIn = FALSE;
+		conn->mess.opcode = OPA_REAUTH;
+		conn->mess.length = COOKIE_LEN;
+		conn->mess.offset = 0;
+		conn->mess.burst = 0;
+		memcpy(conn->mess.payload, vu->cookie, COOKIE_LEN);
+		vu->step = 2;
+		return vuConnect(conn) ? VU_BROKEN : VU_PENDING;
+
+	case 2:
+		if (reply->opcode != OPS_OK)
+			return VU_BROKEN;
+		vu->loggedIn = TRUE;
+		return VU_DONE;
+	}
+	return VU_BROKEN;
+}
+
+// Function: stepListing
+// Description: Send OPB_LIST or OPG_GROUP_LIST and fetch every entry with
+//              OPS_CONTINUE, as the console client does
+// Return: VU_PENDING, VU_DONE, VU_FAILED or VU_BROKEN
+// -IN/OUT: vu: the user
+// -IN: reply: the reply to the last request
+int stepListing(VUSER *vu, MESSAGE *reply) {
+	VU_CONN *conn = &vu->session;
+
+	switch (vu->step) {
+	case 0:
+		vu->step = 1;
+		return vuSend(conn, vu->op == LG_OP_LIST ? OPB_LIST : OPG_GROUP_LIST, 0, 0, NULL, TRUE) ? VU_BROKEN : VU_PENDING;
+
+	case 1:
+		// A file listing sends the directory count next, a group listing
+		// goes straight to the names
+		if (reply->opcode == OPB_FILE_COUNT) {
+			vu->entriesLeft = atoi(reply->payload);
+			vu->step = 2;
+			return vuSend(conn, OPS_CONTINUE, 0, 0, NULL, TRUE) ? VU_BROKEN : VU_PENDING;
+		}
+		if (reply->opcode != OPG_GROUP_COUNT)
+			return VU_FAILED;
+		vu->entriesLeft = atoi(reply->payload);
+		break;
+
+	case 2:
+		if (reply->opcode != OPB_DIR_COUNT)
+			return VU_BROKEN;
+		vu->entriesLeft += atoi(reply->payload);
+		break;
+
+	case 3:
+		if (reply->opcode != OPB_FILE_NAME && reply->opcode != OPB_DIR_NAME && reply->opcode != OPG_GROUP_NAME)
+			return VU_BROKEN;
+		vu->entriesLeft--;
+		break;
+
+	default:
+		return VU_BROKEN;
+	}
+
+	if (vu->entriesLeft <= 0)
+		return VU_DONE;
+	vu->step = 3;
+	return vuSend(conn, OPS_CONTINUE, 0, 0, NULL, TRUE) ? VU_BROKEN : VU_PENDING;
+}
+
+// Function: stepSimple
+// Description: Send one request on the session and check its reply is
+//              OPS_OK. Used by join, leave and delete.
+// Return: VU_PENDING, VU_DONE, VU_FAILED or VU_BROKEN
+// -IN/OUT: vu: the user
+// -IN: reply: the reply to the last request
+int stepSimple(VUSER *vu, MESSAGE *reply) {
+	VU_CONN *conn = &vu->session;
+	const char *name;
+	int opcode;
+
+	if (vu->step == 0) {
+		switch (vu->op) {
+		case LG_OP_JOIN:
+			opcode = OPG_GROUP_JOIN;
+			name = gJoinGroup;
+			break;
+		case LG_OP_LEAVE:
+			opcode = OPG_GROUP_LEAVE;
+			name = gJoinGroup;
+			break;
+		default:
+			opcode = OPB_FILE_DEL;
+			name = vu->files[vu->fileFirst];
+			break;
+		}
+		vu->step = 1;
+		return vuSend(conn, opcode, (unsigned int)strlen(name), 0, name, TRUE) ? VU_BROKEN : VU_PENDING;
+	}
+
+	if (reply->opcode != OPS_OK)
+		return VU_FAILED;
+	if (vu->op == LG_OP_DELETE) {
+		vu->fileFirst = (vu->fileFirst + 1) % VU_FILE_SLOTS;
+		vu->fileCount--;
+	}
+	return VU_DONE;
+}
+
+// Function: stepUpload
+// Description: Upload a file of a size drawn from the distribution on a
+//              new connection: name, digest, data messages, empty message
+// Return: VU_PENDING, VU_DONE, VU_FAILED, VU_BROKEN or VU_BUSY
+// -IN/OUT: vu: the user
+// -IN: reply: the reply to the last request, NULL after a send
+int stepUpload(VUSER *vu, MESSAGE *reply) {
+	VU_CONN *conn = &vu->transfer;
+	unsigned int length;
+
+	switch (vu->step) {
+	case 0:
+		snprintf(vu->fileName, VU_NAME_SIZE, "lg%08x_%d_%d.dat", gRunTag, vu->id, vu->fileSeq++);
+		vu->fileSize = pickSize(&vu->seed);
+		vu->fileOffset = 0;
+		payloadDigest(vu->fileSize, vu->digest);
+
+		conn->mess.opcode = OPT_FILE_UP;
+		conn->mess.length = snprintf(conn->mess.payload, BUFF_SIZE, "%s %s", vu->cookie, vu->fileName);
+		conn->mess.offset = 0;
+		conn->mess.burst = 0;
+		vu->step = 1;
+		return vuConnect(conn) ? VU_BROKEN : VU_PENDING;
+
+	case 1:
+		if (reply->opcode == OPS_ERR_BUSY)
+			return vuBusy(vu, reply);
+		if (reply->opcode != OPS_OK)
+			return VU_FAILED;
+		vu->step = 2;
+		return vuSend(conn, OPT_FILE_DIGEST, DIGEST_SIZE - 1, 0, vu->digest, FALSE) ? VU_BROKEN : VU_PENDING;
+
+	case 2:
+		// The server does not answer data messages, send the next one as
+		// soon as the last is out
+		if (vu->fileOffset < vu->fileSize) {
+			length = (unsigned int)(vu->fileSize - vu->fileOffset > BUFF_SIZE ? BUFF_SIZE : vu->fileSize - vu->fileOffset);
+			if (vuSend(conn, OPT_FILE_DATA, length, (long)vu->fileOffset, payloadAt(vu->fileOffset), FALSE))
+				return VU_BROKEN;
+			vu->fileOffset += length;
+			vu->bytes += length;
+			return VU_PENDING;
+		}
+		vu->step = 3;
+		return vuSend(conn, OPT_FILE_DATA, 0, 0, NULL, TRUE) ? VU_BROKEN : VU_PENDING;
+
+	case 3:
+		if (reply->opcode != OPS_SUCCESS)
+			return VU_FAILED;
+		vuRemember(vu);
+		return VU_DONE;
+	}
+	return VU_BROKEN;
+}
+
+// Function: stepDownload
+// Description: Download a file on a new connection, checking its digest
+//              if verification is on
+// Return: VU_PENDING, VU_DONE, VU_FAILED, VU_BROKEN or VU_BUSY
+// -IN/OUT: vu: the user
+// -IN: reply: the reply to the last request
+int stepDownload(VUSER *vu, MESSAGE *reply) {
+	VU_CONN *conn = &vu->transfer;
+
+	switch (vu->step) {
+	case 0:
+		if (gDownloadFile != NULL)
+			strcpy_s(vu->fileName, VU_NAME_SIZE, gDownloadFile);
+		else
+			strcpy_s(vu->fileName, VU_NAME_SIZE, vu->files[(vu->fileFirst + nextRandom(&vu->seed) % vu->fileCount) % VU_FILE_SLOTS]);
+
+		conn->mess.opcode = OPT_FILE_DOWN;
+		conn->mess.length = snprintf(conn->mess.payload, BUFF_SIZE, "%s %s", vu->cookie, vu->fileName);
+		conn->mess.offset = 0;
+		conn->mess.burst = 0;
+		vu->step = 1;
+		return vuConnect(conn) ? VU_BROKEN : VU_PENDING;
+
+	case 1:
+		if (reply->opcode == OPS_ERR_BUSY)
+			return vuBusy(vu, reply);
+		if (reply->opcode != OPT_FILE_DIGEST)
+			return VU_FAILED;
+		reply->payload[DIGEST_SIZE - 1] = 0;
+		strcpy_s(vu->digest, DIGEST_SIZE, reply->payload);
+		vu->md5.Init();
+		vu->step = 2;
+		return vuSend(conn, OPS_OK, 0, 0, NULL, TRUE) ? VU_BROKEN : VU_PENDING;
+
+	case 2:
+		if (reply->opcode != OPT_FILE_DATA || reply->length > BUFF_SIZE)
+			return VU_BROKEN;
+		if (reply->length > 0) {
+			if (gVerify)
+				vu->md5.Update((unsigned char *)reply->payload, reply->length);
+			vu->bytes += reply->length;
+			return vuRecv(conn) ? VU_BROKEN : VU_PENDING;
+		}
+		if (gVerify) {
+			vu->md5.Final();
+			if (strcmp(vu->md5.digestChars, vu->digest) != 0)
+				return VU_FAILED;
+		}
+		return VU_DONE;
+	}
+	return VU_BROKEN;
+}
+
+// Function: stepRange
+// Description: Download two ranges of a file on a new connection, checking
+//              the digest the server sends after each range if
+//              verification is on
+// Return: VU_PENDING, VU_DONE, VU_FAILED, VU_BROKEN or VU_BUSY
+// -IN/OUT: vu: the user
+// -IN: reply: the reply to the last request
+int stepRange(VUSER *vu, MESSAGE *reply) {
+	VU_CONN *conn = &vu->transfer;
+
+	switch (vu->step) {
+	case 0:
+		if (gDownloadFile != NULL)
+			strcpy_s(vu->fileName, VU_NAME_SIZE, gDownloadFile);
+		else
+			strcpy_s(vu->fileName, VU_NAME_SIZE, vu->files[(vu->fileFirst + nextRandom(&vu->seed) % vu->fileCount) % VU_FILE_SLOTS]);
+
+		// The ranges follow the file name after its terminating zero
+		conn->mess.opcode = OPT_FILE_RANGE;
+		conn->mess.length = snprintf(conn->mess.payload, BUFF_SIZE, "%s %s", vu->cookie, vu->fileName) + 1;
+		conn->mess.length += snprintf(conn->mess.payload + conn->mess.length, BUFF_SIZE - conn->mess.length, "%s", VU_RANGE_SPEC);
+		conn->mess.offset = 0;
+		conn->mess.burst = 0;
+		vu->step = 1;
+		return vuConnect(conn) ? VU_BROKEN : VU_PENDING;
+
+	case 1:
+		if (reply->opcode == OPS_ERR_BUSY)
+			return vuBusy(vu, reply);
+		if (reply->opcode != OPT_RANGE_HEADER)
+			return VU_FAILED;
+		vu->entriesLeft = reply->burst;
+		vu->md5.Init();
+		vu->step = 2;
+		return vuSend(conn, OPS_OK, 0, 0, NULL, TRUE) ? VU_BROKEN : VU_PENDING;
+
+	case 2:
+		if (reply->opcode == OPT_RANGE_DIGEST) {
+			if (gVerify) {
+				vu->md5.Final();
+				reply->payload[DIGEST_SIZE - 1] = 0;
+				if (strcmp(vu->md5.digestChars, reply->payload) != 0)
+					return VU_FAILED;
+				vu->md5.Init();
+			}
+			vu->entriesLeft--;
+			return vuRecv(conn) ? VU_BROKEN : VU_PENDING;
+		}
+		if (reply->opcode != OPT_FILE_DATA || reply->length > BUFF_SIZE)
+			return VU_BROKEN;
+		if (reply->length > 0) {
+			if (gVerify)
+				vu->md5.Update((unsigned char *)reply->payload, reply->length);
+			vu->bytes += reply->length;
+			return vuRecv(conn) ? VU_BROKEN : VU_PENDING;
+		}
+		// Every range has to be closed by its digest
+		return vu->entriesLeft == 0 ? VU_DONE : VU_FAILED;
+	}
+	return VU_BROKEN;
+}
+
+// Function: stepConnect
+// Description: Open a connection and wait for the answer to its first
+//              message, a reauth with an unknown cookie. Measures the
+//              accept path of the server.
+// Return: VU_PENDING or VU_DONE
+// -IN/OUT: vu: the user
+// -IN: reply: the reply to the first message
+int stepConnect(VUSER *vu, MESSAGE *reply) {
+	VU_CONN *conn = &vu->transfer;
+
+	if (vu->step == 0) {
+		conn->mess.opcode = OPA_REAUTH;
+		conn->mess.length = COOKIE_LEN;
+		conn->mess.offset = 0;
+		conn->mess.burst = 0;
+		memset(conn->mess.payload, 0, COOKIE_LEN);
+		vu->step = 1;
+		return vuConnect(conn) ? VU_BROKEN : VU_PENDING;
+	}
+	return VU_DONE;
+}
+
+// Function: vuStartOp
+// Description: Start an operation. Downloads and deletes of a user that
+//              has no uploaded file yet become uploads.
+// -IN/OUT: vu: the user
+// -IN: op: the operation
+void vuStartOp(VUSER *vu, int op) {
+	if (((op == LG_OP_DOWNLOAD || op == LG_OP_RANGE) && gDownloadFile == NULL && vu->fileCount == 0) ||
+		(op == LG_OP_DELETE && vu->fileCount == 0))
+		op = LG_OP_UPLOAD;
+
+	vu->op = op;
+	vu->step = op == LG_OP_LOGIN ? 10 : 0;
+	vu->started = statsNow();
+	vu->bytes = 0;
+	vuStep(vu, NULL);
+}
+
+// Function: vuRun
+// Description: Start the next operation of a user, logging in first if
+//              the user has no session
+// -IN/OUT: vu: the user
+void vuRun(VUSER *vu) {
+	if (gStopping) {
+		InterlockedDecrement(&gActiveUsers);
+		return;
+	}
+
+	if (vu->account != NULL && !vu->loggedIn)
+		vuStartOp(vu, LG_OP_SESSION);
+	else
+		vuStartOp(vu, pickOperation(&vu->seed));
+}
+
+// Function: vuFinish
+// Description: Record an operation that ended and schedule the next one.
+//              A broken session is dropped and logged in again after a
+//              pause.
+// -IN/OUT: vu: the user
+// -IN: result: VU_DONE, VU_FAILED, VU_BROKEN or VU_BUSY
+void vuFinish(VUSER *vu, int result) {
+	BOOL onSession = vu->op != LG_OP_UPLOAD && vu->op != LG_OP_DOWNLOAD && vu->op != LG_OP_RANGE && vu->op != LG_OP_CONNECT;
+
+	vuClose(&vu->transfer);
+	if ((result == VU_BROKEN || result == VU_BUSY) && onSession) {
+		vuClose(&vu->session);
+		vu->loggedIn = FALSE;
+	}
+
+	statsRecord(vu->op, vu->started, vu->bytes, result != VU_DONE, result == VU_BUSY);
+
+	// Leave the shared group again, also when it was joined already
+	if (vu->op == LG_OP_JOIN && result != VU_BROKEN) {
+		vuStartOp(vu, LG_OP_LEAVE);
+		return;
+	}
+
+	if (gStopping) {
+		InterlockedDecrement(&gActiveUsers);
+		return;
+	}
+	// A refused user comes back when the server asked it to
+	if (result == VU_BUSY)
+		vuSchedule(vu, vu->retryMs);
+	else
+		vuSchedule(vu, result == VU_BROKEN && onSession ? VU_ERROR_BACKOFF : thinkTime(vu));
+}
+
+// Function: vuStep
+// Description: Advance the current operation of a user
+// -IN/OUT: vu: the user
+// -IN: reply: the message received, NULL if the last I/O was a send
+void vuStep(VUSER *vu, MESSAGE *reply) {
+	int result;
+
+	switch (vu->op) {
+	case LG_OP_SESSION:
+	case LG_OP_LOGIN:
+		result = stepSession(vu, reply);
+		break;
+	case LG_OP_REAUTH:
+		result = stepReauth(vu, reply);
+		break;
+	case LG_OP_LIST:
+	case LG_OP_GROUPS:
+		result = stepListing(vu, reply);
+		break;
+	case LG_OP_UPLOAD:
+		result = stepUpload(vu, reply);
+		break;
+	case LG_OP_DOWNLOAD:
+		result = stepDownload(vu, reply);
+		break;
+	case LG_OP_RANGE:
+		result = stepRange(vu, reply);
+		break;
+	case LG_OP_CONNECT:
+		result = stepConnect(vu, reply);
+		break;
+	default:
+		result = stepSimple(vu, reply);
+		break;
+	}
+
+	if (result != VU_PENDING)
+		vuFinish(vu, result);
+}
+
+// Function: vuHandshake
+// Description: Run the handshake of a connection as far as the bytes
+//              received allow, and send the first message once it is done
+// -IN/OUT: conn: the connection, over TLS
+void vuHandshake(VU_CONN *conn) {
+	TLS_CLIENT *session = &conn->tls->session;
+
+	switch (tlsClientStep(session)) {
+	case TLS_CLIENT_TOKEN:
+		conn->operation = VU_IO_TLS_SEND;
+		break;
+	case TLS_CLIENT_MORE:
+		conn->operation = VU_IO_TLS_RECV;
+		break;
+	case TLS_CLIENT_DATA:
+		conn->operation = VU_IO_SEND;
+		break;
+	default:
+		vuFinish(conn->vu, VU_BROKEN);
+		return;
+	}
+	conn->done = 0;
+	if (vuPost(conn))
+		vuFinish(conn->vu, VU_BROKEN);
+}
+
+// Function: vuTlsDone
+// Description: Handle a completed I/O of a connection over TLS. Sends
+//              are whole records or tokens, received ciphertext is
+//              decrypted into the message until it is whole.
+// -IN/OUT: conn: the connection
+// -IN: bytes: bytes transferred, 0 for a receive served from what was
+//             already received
+void vuTlsDone(VU_CONN *conn, DWORD bytes) {
+	TLS_CLIENT *session = &conn->tls->session;
+	VUSER *vu = conn->vu;
+	int copied, state;
+
+	switch (conn->operation) {
+	case VU_IO_TLS_SEND:
+		conn->done += bytes;
+		if (conn->done < (DWORD)session->tokenLen)
+			break;
+		tlsClientTokenDone(session);
+		if (session->established) {
+			conn->operation = VU_IO_SEND;
+			conn->done = 0;
+			break;
+		}
+		if (session->inLen > 0) {
+			vuHandshake(conn);
+			return;
+		}
+		conn->operation = VU_IO_TLS_RECV;
+		break;
+
+	case VU_IO_TLS_RECV:
+		session->inLen += bytes;
+		vuHandshake(conn);
+		return;
+
+	case VU_IO_SEND:
+		conn->done += bytes;
+		if (conn->done < conn->tls->wireLen)
+			break;
+		if (conn->expectReply) {
+			if (vuRecv(conn))
+				vuFinish(vu, VU_BROKEN);
+			return;
+		}
+		vuStep(vu, NULL);
+		return;
+
+	default:
+		session->inLen += bytes;
+		state = tlsClientOpen(session, (char *)&conn->mess + conn->done, sizeof(MESSAGE) - conn->done, &copied);
+		conn->done += copied;
+		if (state == TLS_CLIENT_DATA) {
+			vuStep(vu, &conn->mess);
+			return;
+		}
+		if (state != TLS_CLIENT_MORE) {
+			vuFinish(vu, VU_BROKEN);
+			return;
+		}
+		break;
+	}
+
+	if (vuPost(conn))
+		vuFinish(vu, VU_BROKEN);
+}
+
+// Function: vuIoDone
+// Description: Handle a completed I/O of a user. Messages are always
+//              whole, partial sends and receives are posted again.
+// -IN/OUT: conn: the connection
+// -IN: bytes: bytes transferred
+//      error: 0 or the error of the I/O
+void vuIoDone(VU_CONN *conn, DWORD bytes, DWORD error) {
+	VUSER *vu = conn->vu;
+
+	if (conn->operation == VU_IO_CLOSE) {
+		// Anything but the close is ignored
+		if (error == 0 && bytes > 0) {
+			conn->done = 0;
+			if (vuPost(conn))
+				vuFinish(vu, VU_BROKEN);
+			return;
+		}
+		vuClose(conn);
+		vuStep(vu, NULL);
+		return;
+	}
+
+	// A connect over TLS sends nothing with it
+	if (error != 0 || (bytes == 0 && !(conn->operation == VU_IO_CONNECT && conn->tls != NULL))) {
+		vuFinish(vu, VU_BROKEN);
+		return;
+	}
+
+	if (conn->operation == VU_IO_CONNECT) {
+		setsockopt(conn->s, SOL_SOCKET, SO_UPDATE_CONNECT_CONTEXT, NULL, 0);
+		conn->operation = VU_IO_SEND;
+		if (conn->tls != NULL) {
+			vuHandshake(conn);
+			return;
+		}
+	}
+	if (conn->tls != NULL) {
+		vuTlsDone(conn, bytes);
+		return;
+	}
+
+	conn->done += bytes;
+	if (conn->done < sizeof(MESSAGE)) {
+		if (vuPost(conn))
+			vuFinish(vu, VU_BROKEN);
+		return;
+	}
+
+	if (conn->operation == VU_IO_SEND && conn->expectReply) {
+		if (vuRecv(conn))
+			vuFinish(vu, VU_BROKEN);
+		return;
+	}
+	vuStep(vu, conn->operation == VU_IO_RECV ? &conn->mess : NULL);
+}
+
+// Function: vuWorkerThread
+// Description: Run users on completions of the port
+// -IN: param: index of the statistics block of the thread
+unsigned __stdcall vuWorkerThread(void *param) {
+	OVERLAPPED *overlapped;
+	ULONG_PTR key;
+	DWORD bytes;
+	BOOL ok;
+
+	tlsStatsIndex = (int)(INT_PTR)param;
+	while (TRUE) {
+		ok = GetQueuedCompletionStatus(gCompletionPort, &bytes, &key, &overlapped, INFINITE);
+		if (overlapped == NULL) {
+			fprintf(stderr, "GetQueuedCompletionStatus failed: %d\n", GetLastError());
+			break;
+		}
+
+		if (key == VU_KEY_RUN)
+			vuRun(CONTAINING_RECORD(overlapped, VUSER, runOverlapped));
+		else if (key == VU_KEY_TLS)
+			vuTlsDone(CONTAINING_RECORD(overlapped, VU_CONN, overlapped), 0);
+		else
+			vuIoDone(CONTAINING_RECORD(overlapped, VU_CONN, overlapped), bytes, ok ? 0 : GetLastError());
+	}
+	return 0;
+}
+
+// Function: initializeUsers
+// Description: Resolve the server, load ConnectEx and create the users
+//              and the threads that run them
+// Return: 0 if succeed, else return 1
+// -IN: host, port: the server
+//      count: number of users
+//      threads: number of worker threads
+int initializeUsers(const char *host, const char *port, int count, int threads) {
+	struct addrinfo hints, *res = NULL;
+	GUID guidConnectEx = WSAID_CONNECTEX;
+	SOCKET s;
+	DWORD bytes;
+	int i;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	if (getaddrinfo(host, port, &hints, &res) != 0 || res == NULL) {
+		fprintf(stderr, "Cannot resolve %s:%s\n", host, port);
+		return 1;
+	}
+	memcpy(&gServerAddr, res->ai_addr, res->ai_addrlen);
+	gServerAddrLen = (int)res->ai_addrlen;
+	freeaddrinfo(res);
+
+	s = WSASocket(gServerAddr.ss_family, SOCK_STREAM, IPPROTO_TCP, NULL, 0, WSA_FLAG_OVERLAPPED);
+	if (s == INVALID_SOCKET) {
+		fprintf(stderr, "WSASocket failed: %d\n", WSAGetLastError());
+		return 1;
+	}
+	if (WSAIoctl(s, SIO_GET_EXTENSION_FUNCTION_POINTER, &guidConnectEx, sizeof(guidConnectEx),
+		&gConnectEx, sizeof(gConnectEx), &bytes, NULL, NULL) == SOCKET_ERROR) {
+		fprintf(stderr, "WSAIoctl: SIO_GET_EXTENSION_FUNCTION_POINTER failed: %d\n", WSAGetLastError());
+		closesocket(s);
+		return 1;
+	}
+	closesocket(s);
+
+	gCompletionPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, (ULONG_PTR)NULL, 0);
+	if (gCompletionPort == NULL) {
+		fprintf(stderr, "CreateIoCompletionPort failed: %d\n", GetLastError());
+		return 1;
+	}
+
+	InitializeCriticalSection(&gWaitCritSec);
+	gWaitEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (gWaitEvent == NULL) {
+		fprintf(stderr, "CreateEvent failed: %d\n", GetLastError());
+		return 1;
+	}
+
+	gRunTag = (unsigned int)GetTickCount() ^ GetCurrentProcessId();
+	gUsers = new VUSER[count];
+	gUserCount = count;
+	for (i = 0; i < count; i++) {
+		VUSER *vu = &gUsers[i];
+		memset(&vu->runOverlapped, 0, sizeof(vu->runOverlapped));
+		vu->id = i;
+		vu->account = gAccounts.empty() ? NULL : &gAccounts[i];
+		vu->session.vu = vu->transfer.vu = vu;
+		vu->session.s = vu->transfer.s = INVALID_SOCKET;
+		vu->session.tls = vu->transfer.tls = NULL;
+		vu->cookie[0] = 0;
+		vu->loggedIn = FALSE;
+		vu->seed = (gRunTag + i * 2654435761u) | 1;
+		vu->fileFirst = vu->fileCount = vu->fileSeq = 0;
+	}
+
+	for (i = 0; i < threads; i++) {
+		if (_beginthreadex(0, 0, vuWorkerThread, (void *)(INT_PTR)i, 0, 0) == 0) {
+			fprintf(stderr, "Create worker thread failed with error %d\n", GetLastError());
+			return 1;
+		}
+	}
+	if (_beginthreadex(0, 0, schedulerThread, NULL, 0, 0) == 0) {
+		fprintf(stderr, "Create scheduler thread failed with error %d\n", GetLastError());
+		return 1;
+	}
+	return 0;
+}
+
+// Function: startUsers
+// Description: Start the users spread evenly over the ramp-up
+// -IN: rampSecs: seconds over which the users start
+void startUsers(int rampSecs) {
+	gActiveUsers = gUserCount;
+	for (int i = 0; i < gUserCount; i++)
+		vuSchedule(&gUsers[i], (DWORD)((LONGLONG)rampSecs * 1000 * i / gUserCount));
+}
+
+#endif
@@ -0,0 +1,346 @@
+#pragma once
+
+#ifndef _WORKLOAD_H
+#define _WORKLOAD_H
+
+#include <vector>
+#include <map>
+#include <string>
+#include <windows.h>
+#include "defs.h"
+#include "md5.h"
+
+// Operations a virtual user performs. Each one has its own latency
+// histogram; "session" and "leave" are not picked from the mix, they run
+// when a user connects and after each "join".
+enum {
+	LG_OP_SESSION,		// connect, log in, get a cookie and use the group
+	LG_OP_LOGIN,		// log out and in again on the same connection
+	LG_OP_REAUTH,		// reconnect with the cookie
+	LG_OP_LIST,			// OPB_LIST and all its entries
+	LG_OP_GROUPS,		// OPG_GROUP_LIST and all its entries
+	LG_OP_JOIN,			// join the shared group
+	LG_OP_LEAVE,		// leave the shared group
+	LG_OP_UPLOAD,		// upload a file on a new connection
+	LG_OP_DOWNLOAD,		// download a file on a new connection
+	LG_OP_RANGE,		// download the head and the tail of a file with OPT_FILE_RANGE
+	LG_OP_DELETE,		// delete the oldest uploaded file
+	LG_OP_CONNECT,		// connect and wait for the first reply only
+	LG_OP_COUNT
+};
+
+const struct {
+	const char *name;
+	int         mixable;
+	int         defaultWeight;
+} gOpInfo[LG_OP_COUNT] = {
+	{ "session", 0, 0 },
+	{ "login", 1, 2 },
+	{ "reauth", 1, 2 },
+	{ "list", 1, 40 },
+	{ "groups", 1, 10 },
+	{ "join", 1, 0 },
+	{ "leave", 0, 0 },
+	{ "upload", 1, 20 },
+	{ "download", 1, 26 },
+	{ "range", 1, 0 },
+	{ "delete", 1, 0 },
+	{ "connect", 1, 0 },
+};
+
+// Upload sizes drawn from a range are rounded to whole messages so that
+// the number of distinct sizes, and of digests to compute, stays small
+#define SIZE_ROUNDING			BUFF_SIZE
+#define PAYLOAD_POOL_SIZE		(1 << 20)	// random bytes repeated to fill uploads
+
+typedef struct {
+	char username[CRE_MAXLEN];
+	char password[CRE_MAXLEN];
+	char group[GROUPNAME_SIZE];
+} ACCOUNT_ENTRY;
+
+typedef struct {
+	LONGLONG minSize;
+	LONGLONG maxSize;
+	int      weight;
+} SIZE_CLASS;
+
+std::vector<ACCOUNT_ENTRY> gAccounts;
+std::vector<SIZE_CLASS> gSizeClasses;
+int gMixWeights[LG_OP_COUNT];
+int gMixTotal = 0, gSizeTotal = 0;
+
+char *gPayloadPool = NULL;
+std::map<LONGLONG, std::string> gDigestCache;
+SRWLOCK gDigestLock = SRWLOCK_INIT;
+
+// Function: nextRandom
+// Description: Step a xorshift generator, one per virtual user
+// Return: the next value
+// -IN/OUT: state: the generator state, never 0
+inline unsigned int nextRandom(unsigned int *state) {
+	unsigned int x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+// Function: parseSize
+// Description: Parse a byte count with an optional k, m or g suffix
+// Return: pointer past the parsed text, NULL if there is no number
+// -IN: text: the text
+// -OUT: size: the byte count
+const char* parseSize(const char *text, LONGLONG *size) {
+	char *end;
+
+	*size = _strtoi64(text, &end, 10);
+	if (end == text || *size < 0)
+		return NULL;
+
+	switch (tolower(*end)) {
+	case 'k':
+		*size <<= 10;
+		end++;
+		break;
+	case 'm':
+		*size <<= 20;
+		end++;
+		break;
+	case 'g':
+		*size <<= 30;
+		end++;
+		break;
+	}
+	return end;
+}
+
+// Function: setMix
+// Description: Set the operation mix from "op:weight,op:weight,...".
+//              Operations not listed get weight 0. NULL restores the
+//              default mix.
+// Return: 0 if succeed, else return 1
+// -IN: spec: the mix
+int setMix(const char *spec) {
+	char name[32];
+	int op, weight, length;
+
+	gMixTotal = 0;
+	for (op = 0; op < LG_OP_COUNT; op++) {
+		gMixWeights[op] = spec == NULL ? gOpInfo[op].defaultWeight : 0;
+		gMixTotal += gMixWeights[op];
+	}
+
+	while (spec != NULL && *spec != 0) {
+		if (sscanf(spec, "%31[^:,]:%d%n", name, &weight, &length) != 2 || weight < 0) {
+			fprintf(stderr, "Bad operation mix at \"%s\"\n", spec);
+			return 1;
+		}
+
+		for (op = 0; op < LG_OP_COUNT; op++)
+			if (gOpInfo[op].mixable && strcmp(gOpInfo[op].name, name) == 0)
+				break;
+		if (op == LG_OP_COUNT) {
+			fprintf(stderr, "Unknown operation %s\n", name);
+			return 1;
+		}
+
+		gMixTotal += weight - gMixWeights[op];
+		gMixWeights[op] = weight;
+		spec += length;
+		if (*spec == ',')
+			spec++;
+	}
+
+	if (gMixTotal == 0) {
+		fprintf(stderr, "The operation mix is empty\n");
+		return 1;
+	}
+	return 0;
+}
+
+// Function: setSizes
+// Description: Set the upload sizes from "size[-max]:weight,...", sizes
+//              take a k, m or g suffix
+// Return: 0 if succeed, else return 1
+// -IN: spec: the distribution
+int setSizes(const char *spec) {
+	SIZE_CLASS sizeClass;
+	const char *next;
+
+	gSizeClasses.clear();
+	gSizeTotal = 0;
+	while (*spec != 0) {
+		next = parseSize(spec, &sizeClass.minSize);
+		if (next == NULL)
+			goto bad;
+		sizeClass.maxSize = sizeClass.minSize;
+		if (*next == '-') {
+			next = parseSize(next + 1, &sizeClass.maxSize);
+			if (next == NULL || sizeClass.maxSize < sizeClass.minSize)
+				goto bad;
+		}
+
+		sizeClass.weight = 1;
+		if (*next == ':') {
+			sizeClass.weight = (int)strtol(next + 1, (char **)&next, 10);
+			if (sizeClass.weight < 0)
+				goto bad;
+		}
+		if (*next == ',')
+			next++;
+		else if (*next != 0)
+			goto bad;
+
+		gSizeClasses.push_back(sizeClass);
+		gSizeTotal += sizeClass.weight;
+		spec = next;
+	}
+
+	if (gSizeTotal == 0) {
+		fprintf(stderr, "The size distribution is empty\n");
+		return 1;
+	}
+	return 0;
+
+bad:
+	fprintf(stderr, "Bad size distribution at \"%s\"\n", spec);
+	return 1;
+}
+
+// Function: loadAccounts
+// Description: Read the accounts of the virtual users, one
+//              "username password group" per line. Blank lines and lines
+//              starting with # are skipped.
+// Return: 0 if succeed, else return 1
+// -IN: fileName: the accounts file
+int loadAccounts(const char *fileName) {
+	ACCOUNT_ENTRY entry;
+	char line[CRE_MAXLEN * 2 + GROUPNAME_SIZE + 4];
+	FILE *file;
+
+	file = fopen(fileName, "r");
+	if (file == NULL) {
+		fprintf(stderr, "Cannot open accounts file %s\n", fileName);
+		return 1;
+	}
+
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+			continue;
+		if (sscanf(line, "%255s %255s %499s", entry.username, entry.password, entry.group) != 3) {
+			fprintf(stderr, "Bad account line: %s", line);
+			fclose(file);
+			return 1;
+		}
+		gAccounts.push_back(entry);
+	}
+	fclose(file);
+
+	if (gAccounts.empty()) {
+		fprintf(stderr, "No account in %s\n", fileName);
+		return 1;
+	}
+	return 0;
+}
+
+// Function: pickOperation
+// Description: Draw the next operation from the mix
+// Return: the operation
+// -IN/OUT: seed: generator of the virtual user
+int pickOperation(unsigned int *seed) {
+	int draw = (int)(nextRandom(seed) % (unsigned int)gMixTotal), op;
+
+	for (op = 0; op < LG_OP_COUNT - 1; op++) {
+		if (draw < gMixWeights[op])
+			break;
+		draw -= gMixWeights[op];
+	}
+	return op;
+}
+
+// Function: pickSize
+// Description: Draw an upload size from the distribution
+// Return: the size in bytes
+// -IN/OUT: seed: generator of the virtual user
+LONGLONG pickSize(unsigned int *seed) {
+	int draw = (int)(nextRandom(seed) % (unsigned int)gSizeTotal);
+	unsigned int i;
+	LONGLONG span, size;
+
+	for (i = 0; i < gSizeClasses.size() - 1; i++) {
+		if (draw < gSizeClasses[i].weight)
+			break;
+		draw -= gSizeClasses[i].weight;
+	}
+
+	span = gSizeClasses[i].maxSize - gSizeClasses[i].minSize;
+	if (span == 0)
+		return gSizeClasses[i].minSize;
+
+	size = gSizeClasses[i].minSize + (LONGLONG)(((ULONGLONG)nextRandom(seed) << 32 | nextRandom(seed)) % (ULONGLONG)(span + 1));
+	size -= size % SIZE_ROUNDING;
+	return size < gSizeClasses[i].minSize ? gSizeClasses[i].minSize : size;
+}
+
+// Function: initializePayload
+// Description: Fill the pool uploads are cut from. The pool is random and
+//              much larger than a storage block, so compressed groups see
+//              data that does not shrink.
+// Return: 0 if succeed, else return 1
+int initializePayload() {
+	unsigned int seed = GetTickCount() | 1;
+
+	gPayloadPool = (char *)malloc(PAYLOAD_POOL_SIZE);
+	if (gPayloadPool == NULL) {
+		fprintf(stderr, "Memory error!\n");
+		return 1;
+	}
+	for (int i = 0; i < PAYLOAD_POOL_SIZE; i += sizeof(unsigned int))
+		*(unsigned int *)(gPayloadPool + i) = nextRandom(&seed);
+	return 0;
+}
+
+// Function: payloadAt
+// Description: Get the upload content at an offset. Offsets are multiples
+//              of BUFF_SIZE, so a message never wraps around the pool.
+// Return: pointer into the pool
+// -IN: offset: offset in the file
+inline char* payloadAt(LONGLONG offset) {
+	return gPayloadPool + (offset % PAYLOAD_POOL_SIZE);
+}
+
+// Function: payloadDigest
+// Description: Get the digest of an upload of a given size, computed once
+//              per size
+// -IN: size: the size of the upload
+// -OUT: digest: the digest, DIGEST_SIZE chars
+void payloadDigest(LONGLONG size, char *digest) {
+	MD5 md5;
+	LONGLONG offset;
+	unsigned int length;
+
+	AcquireSRWLockShared(&gDigestLock);
+	auto it = gDigestCache.find(size);
+	if (it != gDigestCache.end()) {
+		strcpy_s(digest, DIGEST_SIZE, it->second.c_str());
+		ReleaseSRWLockShared(&gDigestLock);
+		return;
+	}
+	ReleaseSRWLockShared(&gDigestLock);
+
+	md5.Init();
+	for (offset = 0; offset < size; offset += length) {
+		length = (unsigned int)(size - offset < PAYLOAD_POOL_SIZE ? size - offset : PAYLOAD_POOL_SIZE);
+		md5.Update((unsigned char *)payloadAt(offset), length);
+	}
+	md5.Final();
+	strcpy_s(digest, DIGEST_SIZE, md5.digestChars);
+
+	AcquireSRWLockExclusive(&gDigestLock);
+	gDigestCache[size] = digest;
+	ReleaseSRWLockExclusive(&gDigestLock);
+}
+
+#endif
@@ -1,1817 +1,2525 @@
-#include "stdafx.h"
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#define _WINSOCK_DEPRECATED_NO_WARNINGS 
-#define _CRT_SECURE_NO_WARNINGS
-
-#include <mswsock.h>
-#include <windows.h>
-#include <stdio.h>
-#include <stdlib.h> 
-#include <process.h>
-
-#include "dataStructures.h"
-#include "processor.h"
-#include "resolve.h"
-#include "md5.h"
-
-#pragma comment(lib, "Ws2_32.lib")
-#pragma warning(disable : 4996)
-
-#define DEFAULT_BUFFER_SIZE         4096           // default buffer size
-#define DEFAULT_OVERLAPPED_COUNT    5      // Number of overlapped recv per socket
-#define MAX_OVERLAPPED_ACCEPTS      500
-#define MAX_OVERLAPPED_SENDS        200
-#define MAX_OVERLAPPED_RECVS        200
-#define MAX_OVERLAPPED_READS        200
-#define MAX_OVERLAPPED_WRITES       200
-#define MAX_COMPLETION_THREAD_COUNT 32		// Maximum number of completion threads allowed
-#define BURST_ACCEPT_COUNT          100
-#define BUFF_SIZE                   2048
-#define DIGEST_SIZE		            33
-
-int gAddressFamily = AF_UNSPEC,         // default to unspecified
-gSocketType = SOCK_STREAM,       // default to TCP socket type
-gProtocol = IPPROTO_TCP,       // default to TCP protocol
-gBufferSize = DEFAULT_BUFFER_SIZE,
-gInitialAccepts = DEFAULT_OVERLAPPED_COUNT,
-gMaxAccepts = MAX_OVERLAPPED_ACCEPTS,
-gMaxReceives = MAX_OVERLAPPED_RECVS,
-gMaxSends = MAX_OVERLAPPED_SENDS,
-gMaxDownloads = MAX_OVERLAPPED_READS,
-gMaxUploads = MAX_OVERLAPPED_WRITES;
-
-char *gBindAddr = NULL,         // local interface to bind to
-*gBindPort = "5500";       // local port to bind to
-
-						   // Statistics counters
-volatile LONG gBytesRead = 0, gBytesSent = 0, gStartTime = 0, gBytesReadLast = 0, gBytesSentLast = 0,
-gStartTimeLast = 0, gConnections = 0, gConnectionsLast = 0, gOutstandingSends = 0, gOutstandingDownloads = 0, gOutstandingUploads = 0;
-
-// Serialize access to the free lists below
-CRITICAL_SECTION gBufferListCs, gSocketListCs, gPendingCritSec, gReadingCritSec, gWritingCritSec;
-
-// Lookaside lists for free buffers and socket objects
-BUFFER_OBJ *gFreeBufferList = NULL;
-SOCKET_OBJ *gFreeSocketList = NULL;
-BUFFER_OBJ *gPendingSendList = NULL, *gPendingSendListEnd = NULL;
-BUFFER_OBJ *gPendingReadList = NULL, *gPendingReadListEnd = NULL;
-BUFFER_OBJ *gPendingWriteList = NULL, *gPendingWriteListEnd = NULL;
-
-int isFileExists(const char *path);
-int  PostSend(SOCKET_OBJ *sock, BUFFER_OBJ *sendobj);
-int  PostRecv(SOCKET_OBJ *sock, BUFFER_OBJ *recvobj);
-void FreeBufferObj(BUFFER_OBJ *obj);
-int usage(char *progname);
-void dbgprint(char *format, ...);
-void EnqueuePendingOperation(BUFFER_OBJ **head, BUFFER_OBJ **end, BUFFER_OBJ *obj, int op);
-BUFFER_OBJ *DequeuePendingOperation(BUFFER_OBJ **head, BUFFER_OBJ **end, int op);
-void ProcessPendingOperations();
-void EnqueueDownloadingOperation(BUFFER_OBJ **head, BUFFER_OBJ **end, BUFFER_OBJ *obj);
-BUFFER_OBJ *DequeueDownloadingOperation(BUFFER_OBJ **head, BUFFER_OBJ **end);
-void ProcessDownloadingOperations();
-void EnqueueUploadingOperation(BUFFER_OBJ **head, BUFFER_OBJ **end, BUFFER_OBJ *obj);
-BUFFER_OBJ *DequeueUploadingOperation(BUFFER_OBJ **head, BUFFER_OBJ **end);
-void ProcessUploadingOperations();
-void InsertPendingAccept(LISTEN_OBJ *listenobj, BUFFER_OBJ *obj);
-void RemovePendingAccept(LISTEN_OBJ *listenobj, BUFFER_OBJ *obj);
-BUFFER_OBJ *GetBufferObj(int buflen);
-SOCKET_OBJ *GetSocketObj(SOCKET s, int af);
-void FreeSocketObj(SOCKET_OBJ *obj);
-void ValidateArgs(int argc, char **argv);
-void PrintStatistics();
-int PostAccept(LISTEN_OBJ *listen, BUFFER_OBJ *acceptobj);
-void HandleIo(ULONG_PTR key, BUFFER_OBJ *buf, HANDLE CompPort, DWORD BytesTransfered, DWORD error);
-DWORD WINAPI CompletionThread(LPVOID lpParam);
-unsigned __stdcall workerReadThread(void *param);
-unsigned __stdcall workerWriteThread(void *param);
-
-int _tmain(int argc, char* argv[])
-{
-	WSADATA          wsd;
-	SYSTEM_INFO      sysinfo;
-	LISTEN_OBJ      *ListenSockets = NULL, *listenobj = NULL;
-	SOCKET_OBJ      *sockobj = NULL;
-	BUFFER_OBJ      *acceptobj = NULL;
-	GUID             guidAcceptEx = WSAID_ACCEPTEX, guidGetAcceptExSockaddrs = WSAID_GETACCEPTEXSOCKADDRS;
-	DWORD            bytes;
-	HANDLE           CompletionPort, WaitEvents[MAX_COMPLETION_THREAD_COUNT], hrc;
-	int              endpointcount = 0, waitcount = 0, interval, rc, i;
-	struct addrinfo *res = NULL, *ptr = NULL;
-
-	if (argc < 2)
-	{
-		usage(argv[0]);
-		exit(1);
-	}
-
-	// Validate the command line
-	ValidateArgs(argc, argv);
-	// Load Winsock
-	if (WSAStartup(MAKEWORD(2, 2), &wsd) != 0)
-	{
-		fprintf(stderr, "unable to load Winsock!\n");
-		return -1;
-	}
-
-	if (initializeData()) return 1;
-
-	InitializeCriticalSection(&gSocketListCs);
-	InitializeCriticalSection(&gBufferListCs);
-	InitializeCriticalSection(&gPendingCritSec);
-	InitializeCriticalSection(&gReadingCritSec);
-	InitializeCriticalSection(&gWritingCritSec);
-
-	// Create the completion port used by this server
-	CompletionPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, (ULONG_PTR)NULL, 0);
-	if (CompletionPort == NULL)
-	{
-		fprintf(stderr, "CreateIoCompletionPort failed: %d\n", GetLastError());
-		return -1;
-	}
-
-	// Find out how many processors are on this system
-	GetSystemInfo(&sysinfo);
-	if (sysinfo.dwNumberOfProcessors > MAX_COMPLETION_THREAD_COUNT)
-	{
-		sysinfo.dwNumberOfProcessors = MAX_COMPLETION_THREAD_COUNT;
-	}
-
-	// Round the buffer size to the next increment of the page size
-	if ((gBufferSize % sysinfo.dwPageSize) != 0)
-	{
-		gBufferSize = ((gBufferSize / sysinfo.dwPageSize) + 1) * sysinfo.dwPageSize;
-	}
-
-	printf("Buffer size = %lu (page size = %lu)\n", gBufferSize, sysinfo.dwPageSize);
-
-	// Create the worker threads to service the completion notifications
-	for (waitcount = 0; waitcount < (int)sysinfo.dwNumberOfProcessors; waitcount++)
-	{
-		WaitEvents[waitcount] = CreateThread(NULL, 0, CompletionThread, (LPVOID)CompletionPort, 0, NULL);
-		if (WaitEvents[waitcount] == NULL)
-		{
-			fprintf(stderr, "CreatThread failed: %d\n", GetLastError());
-			return -1;
-		}
-	}
-
-	printf("Local address: %s; Port: %s; Family: %d\n", gBindAddr, gBindPort, gAddressFamily);
-
-	if (_beginthreadex(0, 0, workerReadThread, NULL, 0, 0) == 0) {
-		printf("Create business thread failed with error %d\n", GetLastError());
-		return 1;
-	}
-	else
-		printf("Read file thread created.\n");
-	if (_beginthreadex(0, 0, workerWriteThread, NULL, 0, 0) == 0) {
-		printf("Create business thread failed with error %d\n", GetLastError());
-		return 1;
-	}
-	else
-		printf("Read file thread created.\n");
-
-	// Obtain the "wildcard" addresses for all the available address families
-	res = ResolveAddress(gBindAddr, gBindPort, gAddressFamily, gSocketType, gProtocol);
-	if (res == NULL)
-	{
-		fprintf(stderr, "ResolveAddress failed to return any addresses!\n");
-		return -1;
-	}
-
-	// For each local address returned, create a listening/receiving socket
-	ptr = res;
-	while (ptr)
-	{
-		printf("Listening address: ");
-		PrintAddress(ptr->ai_addr, ptr->ai_addrlen);
-		printf("\n");
-		listenobj = (LISTEN_OBJ *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(LISTEN_OBJ));
-		if (listenobj == NULL)
-		{
-			fprintf(stderr, "Out of memory!\n");
-			return -1;
-		}
-
-		listenobj->LoWaterMark = gInitialAccepts;
-		InitializeCriticalSection(&listenobj->ListenCritSec);
-
-		// Save off the address family of this socket
-		listenobj->AddressFamily = ptr->ai_family;
-
-		// create the socket
-		listenobj->s = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
-		if (listenobj->s == INVALID_SOCKET)
-		{
-			fprintf(stderr, "socket failed: %d\n", WSAGetLastError());
-			return -1;
-		}
-
-		// Create an event to register for FD_ACCEPT events on
-		listenobj->AcceptEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
-		if (listenobj->AcceptEvent == NULL)
-		{
-			fprintf(stderr, "CreateEvent failed: %d\n", GetLastError());
-			return -1;
-		}
-
-		listenobj->RepostAccept = CreateEvent(NULL, TRUE, FALSE, NULL);
-		if (listenobj->RepostAccept == NULL)
-		{
-			fprintf(stderr, "CreateSemaphore failed: %d\n", GetLastError());
-			return -1;
-		}
-
-		// Add the event to the list of waiting events
-		WaitEvents[waitcount++] = listenobj->AcceptEvent;
-		WaitEvents[waitcount++] = listenobj->RepostAccept;
-
-		// Associate the socket and its SOCKET_OBJ to the completion port
-		hrc = CreateIoCompletionPort((HANDLE)listenobj->s, CompletionPort, (ULONG_PTR)listenobj, 0);
-		if (hrc == NULL)
-		{
-			fprintf(stderr, "CreateIoCompletionPort failed: %d\n", GetLastError());
-			return -1;
-		}
-
-		// bind the socket to a local address and port
-		rc = bind(listenobj->s, ptr->ai_addr, ptr->ai_addrlen);
-		if (rc == SOCKET_ERROR)
-		{
-			fprintf(stderr, "bind failed: %d\n", WSAGetLastError());
-			return -1;
-		}
-
-		// Need to load the Winsock extension functions from each provider
-		//    -- e.g. AF_INET and AF_INET6.
-		rc = WSAIoctl(
-			listenobj->s,
-			SIO_GET_EXTENSION_FUNCTION_POINTER,
-			&guidAcceptEx,
-			sizeof(guidAcceptEx),
-			&listenobj->lpfnAcceptEx,
-			sizeof(listenobj->lpfnAcceptEx),
-			&bytes,
-			NULL,
-			NULL
-		);
-		if (rc == SOCKET_ERROR)
-		{
-			fprintf(stderr, "WSAIoctl: SIO_GET_EXTENSION_FUNCTION_POINTER failed: %d\n", WSAGetLastError());
-			return -1;
-		}
-
-		// Load the Winsock extensions from each provider
-		rc = WSAIoctl(
-			listenobj->s,
-			SIO_GET_EXTENSION_FUNCTION_POINTER,
-			&guidGetAcceptExSockaddrs,
-			sizeof(guidGetAcceptExSockaddrs),
-			&listenobj->lpfnGetAcceptExSockaddrs,
-			sizeof(listenobj->lpfnGetAcceptExSockaddrs),
-			&bytes,
-			NULL,
-			NULL
-		);
-
-		if (rc == SOCKET_ERROR)
-		{
-			fprintf(stderr, "WSAIoctl: SIO_GET_EXTENSION_FUNCTION_POINTER failed: %d\n", WSAGetLastError());
-			return -1;
-		}
-
-		// Put the socket into listening mode
-		rc = listen(listenobj->s, 200);
-		if (rc == SOCKET_ERROR)
-		{
-			fprintf(stderr, "listen failed: %d\n", WSAGetLastError());
-			return -1;
-		}
-
-		// Register for FD_ACCEPT notification on listening socket
-		rc = WSAEventSelect(listenobj->s, listenobj->AcceptEvent, FD_ACCEPT);
-		if (rc == SOCKET_ERROR)
-		{
-			fprintf(stderr, "WSAEventSelect failed: %d\n", WSAGetLastError());
-			return -1;
-		}
-
-		// Initiate the initial accepts for each listen socket
-		for (i = 0; i < gInitialAccepts; i++)
-		{
-			acceptobj = GetBufferObj(gBufferSize);
-			if (acceptobj == NULL)
-			{
-				fprintf(stderr, "Out of memory!\n");
-				return -1;
-			}
-
-			acceptobj->PostAccept = listenobj->AcceptEvent;
-			InsertPendingAccept(listenobj, acceptobj);
-			PostAccept(listenobj, acceptobj);
-		}
-
-		// Maintain a list of the listening socket structures
-		if (ListenSockets == NULL)
-		{
-			ListenSockets = listenobj;
-		}
-		else
-		{
-			listenobj->next = ListenSockets;
-			ListenSockets = listenobj;
-		}
-
-		endpointcount++;
-		ptr = ptr->ai_next;
-	}
-
-	// free the addrinfo structure for the 'bind' address
-	freeaddrinfo(res);
-	gStartTime = gStartTimeLast = GetTickCount();
-	interval = 0;
-	while (1)
-	{
-		rc = WSAWaitForMultipleEvents(waitcount, WaitEvents, FALSE, 5000, FALSE);
-		if (rc == WAIT_FAILED)
-		{
-			fprintf(stderr, "WSAWaitForMultipleEvents failed: %d\n", WSAGetLastError());
-			break;
-		}
-		else if (rc == WAIT_TIMEOUT)
-		{
-			interval++;
-			PrintStatistics();
-			if (interval == 36)
-			{
-				int optval, optlen;
-
-				// For TCP, cycle through all the outstanding AcceptEx operations
-				//   to see if any of the client sockets have been connected but
-				//   haven't received any data. If so, close them as they could be
-				//   a denial of service attack.
-				listenobj = ListenSockets;
-				while (listenobj)
-				{
-					EnterCriticalSection(&listenobj->ListenCritSec);
-					acceptobj = listenobj->PendingAccepts;
-
-					while (acceptobj)
-					{
-						optlen = sizeof(optval);
-						rc = getsockopt(acceptobj->sclient, SOL_SOCKET, SO_CONNECT_TIME, (char *)&optval, &optlen);
-						if (rc == SOCKET_ERROR)
-						{
-							fprintf(stderr, "getsockopt: SO_CONNECT_TIME failed: %d\n", WSAGetLastError());
-						}
-						else
-						{
-							// If the socket has been connected for more than 5 minutes,
-							//    close it. If closed, the AcceptEx call will fail in the completion thread.
-							if ((optval != 0xFFFFFFFF) && (optval > 300))
-							{
-								printf("closing stale handle\n");
-								closesocket(acceptobj->sclient);
-								acceptobj->sclient = INVALID_SOCKET;
-							}
-						}
-						acceptobj = acceptobj->next;
-					}
-					LeaveCriticalSection(&listenobj->ListenCritSec);
-					listenobj = listenobj->next;
-				}
-				interval = 0;
-			}
-		}
-		else
-		{
-			int index;
-			index = rc - WAIT_OBJECT_0;
-			for (; index < waitcount; index++)
-			{
-				rc = WaitForSingleObject(WaitEvents[index], 0);
-				if (rc == WAIT_FAILED || rc == WAIT_TIMEOUT)
-				{
-					continue;
-				}
-				if (index < (int)sysinfo.dwNumberOfProcessors)
-				{
-					// One of the completion threads exited
-					//   This is bad so just bail - a real server would want
-					//   to gracefully exit but this is just a sample ...
-					ExitProcess(-1);
-				}
-				else
-				{
-					// An FD_ACCEPT event occurred
-					listenobj = ListenSockets;
-					while (listenobj)
-					{
-						if ((listenobj->AcceptEvent == WaitEvents[index]) ||
-							(listenobj->RepostAccept == WaitEvents[index]))
-							break;
-						listenobj = listenobj->next;
-					}
-
-					if (listenobj)
-					{
-						WSANETWORKEVENTS ne;
-						int              limit = 0;
-						if (listenobj->AcceptEvent == WaitEvents[index])
-						{
-							// EnumNetworkEvents to see if FD_ACCEPT was set
-							rc = WSAEnumNetworkEvents(listenobj->s, listenobj->AcceptEvent, &ne);
-							if (rc == SOCKET_ERROR)
-							{
-								fprintf(stderr, "WSAEnumNetworkEvents failed: %d\n", WSAGetLastError());
-							}
-							if ((ne.lNetworkEvents & FD_ACCEPT) == FD_ACCEPT)
-							{
-								// We got an FD_ACCEPT so post multiple accepts to cover the burst
-								limit = BURST_ACCEPT_COUNT;
-							}
-						}
-						else if (listenobj->RepostAccept == WaitEvents[index])
-						{
-							// Semaphore is signaled
-							limit = InterlockedExchange(&listenobj->RepostCount, 0);
-							ResetEvent(listenobj->RepostAccept);
-						}
-						i = 0;
-						while ((i++ < limit) && (listenobj->PendingAcceptCount < gMaxAccepts))
-						{
-							acceptobj = GetBufferObj(gBufferSize);
-							if (acceptobj)
-							{
-								acceptobj->PostAccept = listenobj->AcceptEvent;
-								InsertPendingAccept(listenobj, acceptobj);
-								PostAccept(listenobj, acceptobj);
-							}
-						}
-					}
-				}
-			}
-		}
-	}
-
-	WSACleanup();
-	return 0;
-}
-
-// Function: usage
-// Description: Prints usage information and exits the process.
-int usage(char *progname)
-{
-	fprintf(stderr, "Usage: %s [-a 4|6] [-e port] [-l local-addr] [-p udp|tcp]\n", progname);
-	fprintf(stderr, "  -a  4|6     Address family, 4 = IPv4, 6 = IPv6 [default = IPv4]\n"
-		"else will listen to both IPv4 and IPv6\n"
-		"  -b  size    Buffer size for send/recv [default = %d]\n"
-		"  -e  port    Port number [default = %s]\n"
-		"  -l  addr    Local address to bind to [default INADDR_ANY for IPv4 or INADDR6_ANY for IPv6]\n"
-		"  -oa count   Maximum overlapped accepts to allow\n"
-		"  -os count   Maximum overlapped sends to allow\n"
-		"  -or count   Maximum overlapped receives to allow\n"
-		"  -o  count   Initial number of overlapped accepts to post\n",
-		gBufferSize,
-		gBindPort
-	);
-	return 0;
-}
-
-// Function: dbgprint
-// Description: Prints a message if compiled with the DEBUG flag.
-void dbgprint(char *format, ...)
-{
-#ifdef DEBUG
-	va_list vl;
-	char    dbgbuf[2048];
-	va_start(vl, format);
-	wvsprintf(dbgbuf, format, vl);
-	va_end(vl);
-	printf(dbgbuf);
-	OutputDebugString(dbgbuf);
-#endif
-}
-
-int isFileExists(const char *path)
-{
-	// Try to open file
-	FILE *fptr = fopen(path, "r");
-
-	// If file does not exists 
-	if (fptr == NULL)
-		return 0;
-
-	// File exists hence close file and return true.
-	fclose(fptr);
-
-	return 1;
-}
-
-// Function: EnqueuePendingOperation
-// Description: Enqueues a buffer object into a list (at the end).
-void EnqueuePendingOperation(BUFFER_OBJ **head, BUFFER_OBJ **end, BUFFER_OBJ *obj, int op)
-{
-	EnterCriticalSection(&gPendingCritSec);
-	if (op == OP_READ);
-	else if (op == OP_WRITE)
-		InterlockedIncrement(&obj->sock->PendingSend);
-	obj->next = NULL;
-	if (*end)
-	{
-		(*end)->next = obj;
-		(*end) = obj;
-	}
-	else
-	{
-		(*head) = (*end) = obj;
-	}
-	LeaveCriticalSection(&gPendingCritSec);
-
-	return;
-}
-
-// Function: EnqueueDownloadingOperation
-// Description: Enqueues a buffer object into a list (at the end).
-// IN -BUFFER_OBJ **head: pointer to the address of head of Downloading buffer queue.
-//    -BUFFER_OBJ **end: pointer to the address of end of Downloading buffer queue.
-//    -BUFFER_OBJ *obj: pointer to buffer object to Downloading buffer queue.
-void EnqueueDownloadingOperation(BUFFER_OBJ **head, BUFFER_OBJ **end, BUFFER_OBJ *obj)
-{
-
-	EnterCriticalSection(&gReadingCritSec);
-
-	obj->next = NULL;
-	if (*end)
-	{
-		(*end)->next = obj;
-		(*end) = obj;
-	}
-	else
-	{
-		(*head) = (*end) = obj;
-	}
-
-	LeaveCriticalSection(&gReadingCritSec);
-
-	return;
-}
-
-// Function: EnqueueUploadingOperation
-// Description: Enqueues a buffer object into a list (at the end).
-// IN -BUFFER_OBJ **head: pointer to the address of head of Uploading buffer queue.
-//    -BUFFER_OBJ **end: pointer to the address of end of Uploading buffer queue.
-//    -BUFFER_OBJ *obj: pointer to buffer object to Uploading buffer queue 
-void EnqueueUploadingOperation(BUFFER_OBJ **head, BUFFER_OBJ **end, BUFFER_OBJ *obj)
-{
-
-	EnterCriticalSection(&gWritingCritSec);
-
-	obj->next = NULL;
-	if (*end)
-	{
-		(*end)->next = obj;
-		(*end) = obj;
-	}
-	else
-	{
-		(*head) = (*end) = obj;
-	}
-
-	LeaveCriticalSection(&gWritingCritSec);
-
-	return;
-}
-
-// Function: DequeuePendingOperation
-// Description: Dequeues the first entry in the list.
-BUFFER_OBJ *DequeuePendingOperation(BUFFER_OBJ **head, BUFFER_OBJ **end, int op)
-{
-	BUFFER_OBJ *obj = NULL;
-	EnterCriticalSection(&gPendingCritSec);
-
-	if (*head)
-	{
-		obj = *head;
-		(*head) = obj->next;
-
-		// If next is NULL, no more objects are in the queue
-		if (obj->next == NULL)
-		{
-			(*end) = NULL;
-		}
-		if (op == OP_READ)
-			;
-		else if (op == OP_WRITE)
-			InterlockedDecrement(&obj->sock->PendingSend);
-	}
-	LeaveCriticalSection(&gPendingCritSec);
-	return obj;
-}
-
-// Function: DequeueDownloadingOperation
-// Description: Dequeues the first entry in the list.
-// IN:  -BUFFER_OBJ **head:pointer to the address of head of Downloading buffer queue.
-//      -BUFFER_OBJ **end :pointer to the address of end of Downloading buffer queue.
-// OUT: -BUFFER_OBJ *     : poninter to the buffer object
-BUFFER_OBJ *DequeueDownloadingOperation(BUFFER_OBJ **head, BUFFER_OBJ **end)
-{
-	BUFFER_OBJ *obj = NULL;
-	EnterCriticalSection(&gReadingCritSec);
-
-	if (*head)
-	{
-		obj = *head;
-		(*head) = obj->next;
-
-		// If next is NULL, no more objects are in the queue
-		if (obj->next == NULL)
-		{
-			(*end) = NULL;
-		}
-	}
-	LeaveCriticalSection(&gReadingCritSec);
-	return obj;
-}
-
-// Function: DequeueUploadingOperation
-// Description: Dequeues the first entry in the list.
-// IN: -BUFFER_OBJ **head:pointer to address of the head of Uploading buffer queue.
-//    -BUFFER_OBJ **end :pointer toaddress of  the end of Uploading buffer queue.
-// OUT: -BUFFER_OBJ *     : poninter to the buffer object
-BUFFER_OBJ *DequeueUploadingOperation(BUFFER_OBJ **head, BUFFER_OBJ **end)
-{
-	BUFFER_OBJ *obj = NULL;
-	EnterCriticalSection(&gWritingCritSec);
-
-	if (*head)
-	{
-		obj = *head;
-		(*head) = obj->next;
-
-		// If next is NULL, no more objects are in the queue
-		if (obj->next == NULL)
-		{
-			(*end) = NULL;
-		}
-	}
-	LeaveCriticalSection(&gWritingCritSec);
-	return obj;
-}
-
-// Function: ProcessPendingOperations
-// Description:
-//    This function goes through the list of pending send operations and posts them
-//    as long as the maximum number of outstanding sends is not exceeded.
-
-void ProcessPendingOperations()
-{
-	BUFFER_OBJ *sendobj = NULL;
-	while (gOutstandingSends < gMaxSends)
-	{
-		sendobj = DequeuePendingOperation(&gPendingSendList, &gPendingSendListEnd, OP_WRITE);
-		if (sendobj)
-		{
-			if (PostSend(sendobj->sock, sendobj) == SOCKET_ERROR)
-			{
-				// Cleanup
-				printf("ProcessPendingOperations: PostSend failed!\n");
-				FreeBufferObj(sendobj);
-				break;
-			}
-		}
-		else
-		{
-			break;
-		}
-	}
-	return;
-}
-
-// Function: ProcessDownloadingOperations
-// Description:
-//    This function goes through the list of pending Downloading operations 
-//    and process them end then postRecv or enqueuePendingOperations if needed
-//    as long as the maximum number of outstanding downloads is not exceeded.
-void ProcessDownloadingOperations()
-{
-	BUFFER_OBJ *readobj = NULL;
-	MESSAGE sendMessage;
-	BUFFER_OBJ *sendobj = NULL;
-	BUFFER_OBJ *recvobj = NULL;
-	while (gOutstandingDownloads < gMaxDownloads)
-	{
-		readobj = DequeueDownloadingOperation(&gPendingReadList, &gPendingReadListEnd);
-		if (readobj)
-		{
-			MESSAGE rcvMess;
-			rcvMess = readobj->sock->mess;
-			if (rcvMess.opcode == OPT_FILE_DOWN)
-			{
-				printf("%s\n", rcvMess.payload);
-				Account* account = NULL;
-				char cookie[COOKIE_LEN];
-				rcvMess.payload[COOKIE_LEN - 1] = 0;
-				strcpy_s(cookie, COOKIE_LEN, rcvMess.payload);
-
-				// Find account with cookie
-				for (auto it = accountList.begin(); it != accountList.end(); it++) {
-					if (strcmp(it->cookie, cookie) == 0) {
-						account = (Account*)&(*it);
-						break;
-					}
-				}
-
-				if (account == NULL) {
-					sendMessage.opcode = OPS_ERR_NOTFOUND;
-					sendMessage.length = 0;
-				}
-				else
-				{
-					if (strlen(account->workingDir) > 0) {
-						snprintf(readobj->sock->fileTransfer.fileName, FILENAME_SIZE, "%s/%s/%s/%s",
-							STORAGE_LOCATION, account->workingGroup->pathName, account->workingDir, rcvMess.payload + COOKIE_LEN);
-					}
-					else {
-						snprintf(readobj->sock->fileTransfer.fileName, FILENAME_SIZE, "%s/%s/%s",
-							STORAGE_LOCATION, account->workingGroup->pathName, rcvMess.payload + COOKIE_LEN);
-					}
-
-					fprintf(stderr, "%s\n", readobj->sock->fileTransfer.fileName);
-					if (isFileExists(readobj->sock->fileTransfer.fileName)) {
-						FILE *file;
-						//Open file
-						file = fopen(readobj->sock->fileTransfer.fileName, "rb");
-						if (!file)
-						{
-							fprintf(stderr, "Unable to open file %s", readobj->sock->fileTransfer.fileName);
-							return;
-						}
-						//Get file length
-						fseek(file, 0, SEEK_END);
-						readobj->sock->fileTransfer.fileLen = ftell(file);
-						fseek(file, 0, SEEK_SET);
-						readobj->sock->fileTransfer.nLeft = readobj->sock->fileTransfer.fileLen;
-						readobj->sock->fileTransfer.idx = 0;
-						readobj->sock->fileTransfer.fileBuffer = (char*)malloc(readobj->sock->fileTransfer.fileLen + 1);
-						if (!readobj->sock->fileTransfer.fileBuffer)
-						{
-							fprintf(stderr, "Memory error!");
-							fclose(file);
-							return;
-						}
-						fread(readobj->sock->fileTransfer.fileBuffer, readobj->sock->fileTransfer.fileLen, 1, file);
-						fclose(file);//***************************
-						MD5 md5;
-						sendMessage.opcode = OPT_FILE_DIGEST;
-						strcpy_s(sendMessage.payload, md5.digestFile(readobj->sock->fileTransfer.fileName));
-						sendMessage.length = strlen(md5.digestFile(readobj->sock->fileTransfer.fileName));
-					}
-					else
-					{
-						sendMessage.opcode = OPS_ERR_NOTFOUND;
-						strcpy_s(sendMessage.payload, readobj->sock->fileTransfer.fileName);
-						sendMessage.length = strlen(readobj->sock->fileTransfer.fileName);
-					}
-				}
-				memcpy(readobj->buf, &sendMessage, sizeof(MESSAGE));
-				sendobj = readobj;
-				sendobj->buflen = sizeof(MESSAGE);
-				sendobj->sock = readobj->sock;
-				EnqueuePendingOperation(&gPendingSendList, &gPendingSendListEnd, sendobj, OP_WRITE);
-
-			}
-			else if (rcvMess.opcode == OPT_FILE_DATA || rcvMess.opcode == OPS_OK)
-			{
-
-
-				sendMessage.opcode = OPT_FILE_DATA;
-				if (readobj->sock->fileTransfer.nLeft > BUFF_SIZE)
-				{
-					for (int i = 0; i < BUFF_SIZE; i++) {
-						sendMessage.payload[i] = readobj->sock->fileTransfer.fileBuffer[readobj->sock->fileTransfer.idx + i];
-					}
-					sendMessage.length = BUFF_SIZE;
-				}
-				else
-				{
-					for (int i = 0; i < readobj->sock->fileTransfer.nLeft; i++) {
-						sendMessage.payload[i] = readobj->sock->fileTransfer.fileBuffer[readobj->sock->fileTransfer.idx + i];
-					}
-					sendMessage.length = readobj->sock->fileTransfer.nLeft;
-				}
-				sendMessage.offset = readobj->sock->fileTransfer.idx;
-
-				readobj->sock->fileTransfer.nLeft -= sendMessage.length;
-				readobj->sock->fileTransfer.idx += sendMessage.length;
-
-				memcpy(readobj->buf, &sendMessage, sizeof(MESSAGE));
-
-
-				sendobj = readobj;
-				sendobj->buflen = sizeof(MESSAGE);
-				sendobj->sock = readobj->sock;
-				//PostSend(sockobj, sendobj);
-				EnqueuePendingOperation(&gPendingSendList, &gPendingSendListEnd, sendobj, OP_WRITE);
-			}
-			else if (rcvMess.opcode == OPT_FILE_DIGEST)
-			{
-				recvobj = readobj;
-				recvobj->sock = readobj->sock;
-				PostRecv(readobj->sock, recvobj);
-			}
-			ProcessPendingOperations();
-			InterlockedIncrement(&gOutstandingDownloads);
-
-		}
-		else
-		{
-			break;
-		}
-	}
-	return;
-}
-
-// Function: ProcessUploadingOperations
-// Description:
-//    This function goes through the list of pending Uploading operations 
-//    and process them end then postRecv or enqueuePendingOperations if needed
-//    as long as the maximum number of outstanding uploads is not exceeded.
-void ProcessUploadingOperations() {
-	BUFFER_OBJ *writeobj = NULL;
-	BUFFER_OBJ *rcvobj = NULL;
-	BUFFER_OBJ *sendobj = NULL;
-	MESSAGE sendMessage;
-	while (gOutstandingUploads < gMaxUploads)
-	{
-		writeobj = DequeueUploadingOperation(&gPendingWriteList, &gPendingWriteListEnd);
-		if (writeobj)
-		{
-
-			fprintf(stderr, "%s", writeobj->sock->fileTransfer.fileName);
-			MESSAGE rcvMess;
-			rcvMess = writeobj->sock->mess;
-			if (rcvMess.opcode == OPT_FILE_UP)
-			{
-				Account* account = NULL;
-				char cookie[COOKIE_LEN];
-				rcvMess.payload[COOKIE_LEN - 1] = 0;
-				strcpy_s(cookie, COOKIE_LEN, rcvMess.payload);
-
-				// Find account with cookie
-				for (auto it = accountList.begin(); it != accountList.end(); it++) {
-					if (strcmp(it->cookie, cookie) == 0) {
-						account = (Account*)&(*it);
-						break;
-					}
-				}
-
-				if (account == NULL) {
-					sendMessage.opcode = OPS_ERR_NOTFOUND;
-					sendMessage.length = 0;
-				}
-				else
-				{
-					if (strlen(account->workingDir) > 0) {
-					snprintf(writeobj->sock->fileTransfer.fileName, FILENAME_SIZE, "%s/%s/%s/%s",
-						STORAGE_LOCATION, account->workingGroup->pathName, account->workingDir, rcvMess.payload + COOKIE_LEN);
-					}
-					else {
-						snprintf(writeobj->sock->fileTransfer.fileName, FILENAME_SIZE, "%s/%s/%s",
-							STORAGE_LOCATION, account->workingGroup->pathName, rcvMess.payload + COOKIE_LEN);
-					}
-
-					// strcat_s(writeobj->sock->fileTransfer.fileName, rcvMess.payload);
-					fprintf(stderr, "%s\n", writeobj->sock->fileTransfer.fileName);
-
-					if (!isFileExists(writeobj->sock->fileTransfer.fileName))
-					{
-						writeobj->sock->fileTransfer.file = fopen(writeobj->sock->fileTransfer.fileName, "wb");
-						if (!writeobj->sock->fileTransfer.file)
-						{
-							fprintf(stderr, "Unable to open file ");
-							return;
-						}
-						sendMessage.opcode = OPS_OK;
-						strcpy_s(sendMessage.payload, writeobj->sock->fileTransfer.fileName);
-						sendMessage.length = strlen(writeobj->sock->fileTransfer.fileName);
-					}
-					else
-					{
-						sendMessage.opcode = OPS_ERR_ALREADYEXISTS;
-						strcpy_s(sendMessage.payload, writeobj->sock->fileTransfer.fileName);
-						sendMessage.length = strlen(writeobj->sock->fileTransfer.fileName);
-					}
-
-				}
-				memcpy(writeobj->buf, &sendMessage, sizeof(MESSAGE));
-				sendobj = writeobj;
-				sendobj->buflen = sizeof(MESSAGE);
-				sendobj->sock = writeobj->sock;
-				EnqueuePendingOperation(&gPendingSendList, &gPendingSendListEnd, sendobj, OP_WRITE);
-				
-			}
-			else if (rcvMess.opcode == OPS_OK)
-			{
-				rcvobj = writeobj;
-				rcvobj->sock = writeobj->sock;
-				PostRecv(writeobj->sock, rcvobj);
-			}
-			else if (rcvMess.opcode == OPT_FILE_DATA)
-			{
-				if (rcvMess.length == 0)
-				{
-					fclose(writeobj->sock->fileTransfer.file);
-					MD5 md5;
-					if (strcmp(md5.digestFile(writeobj->sock->fileTransfer.fileName), writeobj->sock->fileTransfer.digest) == 0)
-					{
-						fprintf(stderr, "\n%s", writeobj->sock->fileTransfer.digest);
-
-
-						sendMessage.opcode = OPS_SUCCESS;
-						strcpy_s(sendMessage.payload, writeobj->sock->fileTransfer.fileName);
-						sendMessage.length = strlen(writeobj->sock->fileTransfer.fileName);
-
-
-						memcpy(writeobj->buf, &sendMessage, sizeof(MESSAGE));
-						sendobj = writeobj;
-						sendobj->buflen = sizeof(MESSAGE);
-						sendobj->sock = writeobj->sock;
-						EnqueuePendingOperation(&gPendingSendList, &gPendingSendListEnd, sendobj, OP_WRITE);
-					}
-					else
-					{
-						fprintf(stderr, "corrupted\n");
-						fprintf(stderr, "\n%s", writeobj->sock->fileTransfer.digest);
-						if (remove(writeobj->sock->fileTransfer.fileName) != 0)
-						{
-							fprintf(stderr, "Error deleting file");
-							return;
-						}
-						else
-							puts("File successfully deleted");
-
-						MESSAGE sendMessage;
-
-						sendMessage.opcode = OPS_ERR_FILE_CORRUPTED;
-						strcpy_s(sendMessage.payload, writeobj->sock->fileTransfer.fileName);
-						sendMessage.length = strlen(writeobj->sock->fileTransfer.fileName);
-
-
-						memcpy(writeobj->buf, &sendMessage, sizeof(MESSAGE));
-						sendobj = writeobj;
-						sendobj->buflen = sizeof(MESSAGE);
-						sendobj->sock = writeobj->sock;
-						EnqueuePendingOperation(&gPendingSendList, &gPendingSendListEnd, sendobj, OP_WRITE);
-					}
-				}
-				else
-				{
-					fprintf(stderr, "writting at:%d\n", rcvMess.offset);
-					fseek(writeobj->sock->fileTransfer.file, rcvMess.offset, SEEK_SET);
-					fwrite(rcvMess.payload, 1, rcvMess.length, writeobj->sock->fileTransfer.file);
-					rcvobj = writeobj;
-					rcvobj->sock = writeobj->sock;
-					PostRecv(writeobj->sock, rcvobj);
-				}
-			}
-			else if (rcvMess.opcode = OPT_FILE_DIGEST)
-			{
-
-				strcpy_s(writeobj->sock->fileTransfer.digest, rcvMess.payload);
-				fprintf(stderr, "\n%s\n", writeobj->sock->fileTransfer.digest);
-				rcvobj = writeobj;
-				rcvobj->sock = writeobj->sock;
-				PostRecv(writeobj->sock, rcvobj);
-
-			}
-			ProcessPendingOperations();
-			//ProcessPendingOperations();
-			InterlockedIncrement(&gOutstandingUploads);
-
-		}
-		else
-		{
-			break;
-		}
-	}
-	return;
-}
-
-// Function: InsertPendingAccept
-// Description: Inserts a pending accept operation into the listening object.
-void InsertPendingAccept(LISTEN_OBJ *listenobj, BUFFER_OBJ *obj)
-{
-
-	obj->next = NULL;
-	EnterCriticalSection(&listenobj->ListenCritSec);
-	if (listenobj->PendingAccepts == NULL)
-	{
-		listenobj->PendingAccepts = obj;
-	}
-	else
-	{
-		// Insert at head - order doesn't really matter
-		obj->next = listenobj->PendingAccepts;
-		listenobj->PendingAccepts = obj;
-	}
-	LeaveCriticalSection(&listenobj->ListenCritSec);
-}
-
-// Function: RemovePendingAccept
-// Description:
-//    Removes the indicated accept buffer object from the list of pending
-//    accepts in the listening object.
-
-void RemovePendingAccept(LISTEN_OBJ *listenobj, BUFFER_OBJ *obj)
-{
-	BUFFER_OBJ *ptr = NULL, *prev = NULL;
-	EnterCriticalSection(&listenobj->ListenCritSec);
-	// Search list until we find the object
-	ptr = listenobj->PendingAccepts;
-	while ((ptr) && (ptr != obj))
-	{
-		prev = ptr;
-		ptr = ptr->next;
-	}
-	if (prev)
-	{
-		// Object is somewhere after the first entry
-		prev->next = obj->next;
-	}
-	else
-	{
-		// Object is the first entry
-		listenobj->PendingAccepts = obj->next;
-	}
-	LeaveCriticalSection(&listenobj->ListenCritSec);
-}
-
-// Function: GetBufferObj
-// Description:
-//    Allocate a BUFFER_OBJ. A look aside list is maintained to increase performance
-//    as these objects are allocated frequently.
-
-BUFFER_OBJ *GetBufferObj(int buflen)
-{
-	BUFFER_OBJ *newobj = NULL;
-	EnterCriticalSection(&gBufferListCs);
-	if (gFreeBufferList == NULL)
-	{
-		// Allocate the object
-		newobj = (BUFFER_OBJ *)HeapAlloc(
-			GetProcessHeap(),
-			HEAP_ZERO_MEMORY,
-			sizeof(BUFFER_OBJ) + (sizeof(BYTE) * buflen)
-		);
-		if (newobj == NULL)
-		{
-			fprintf(stderr, "GetBufferObj: HeapAlloc failed: %d\n", GetLastError());
-		}
-	}
-	else
-	{
-		newobj = gFreeBufferList;
-		gFreeBufferList = newobj->next;
-		newobj->next = NULL;
-	}
-	LeaveCriticalSection(&gBufferListCs);
-
-	if (newobj)
-	{
-		newobj->buf = (char *)(((char *)newobj) + sizeof(BUFFER_OBJ));
-		newobj->buflen = buflen;
-		newobj->addrlen = sizeof(newobj->addr);
-	}
-
-	return newobj;
-}
-
-// Function: FreeBufferObj
-// Description: Free the buffer object. This adds the object to the free look aside list.
-
-void FreeBufferObj(BUFFER_OBJ *obj)
-{
-	EnterCriticalSection(&gBufferListCs);
-	memset(obj, 0, sizeof(BUFFER_OBJ) + gBufferSize);
-	obj->next = gFreeBufferList;
-	gFreeBufferList = obj;
-	LeaveCriticalSection(&gBufferListCs);
-}
-
-// Function: GetSocketObj
-// Description:
-//    Allocate a socket object and initialize its members. A socket object is
-//    allocated for each socket created (either by socket or accept).
-//    Socket objects are returned from a look aside list if available. Otherwise, a new object is allocated.
-
-SOCKET_OBJ *GetSocketObj(SOCKET s, int af)
-{
-	SOCKET_OBJ  *sockobj = NULL;
-	EnterCriticalSection(&gSocketListCs);
-	if (gFreeSocketList == NULL)
-	{
-		sockobj = (SOCKET_OBJ *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(SOCKET_OBJ));
-		if (sockobj == NULL)
-		{
-			fprintf(stderr, "GetSocketObj: HeapAlloc failed: %d\n", GetLastError());
-		}
-		else
-		{
-			InitializeCriticalSection(&sockobj->SockCritSec);
-		}
-	}
-	else
-	{
-		sockobj = gFreeSocketList;
-		gFreeSocketList = sockobj->next;
-		sockobj->next = NULL;
-	}
-	LeaveCriticalSection(&gSocketListCs);
-
-	// Initialize the members
-	if (sockobj)
-	{
-		sockobj->s = s;
-		sockobj->af = af;
-	}
-	return sockobj;
-}
-
-// Function: FreeSocketObj
-// Description: Frees a socket object. The object is added to the lookaside list.
-
-void FreeSocketObj(SOCKET_OBJ *obj)
-{
-	CRITICAL_SECTION cstmp;
-	BUFFER_OBJ      *ptr = NULL;
-
-	// Close the socket if it hasn't already been closed
-	if (obj->s != INVALID_SOCKET)
-	{
-		printf("FreeSocketObj: closing socket\n");
-		closesocket(obj->s);
-		obj->s = INVALID_SOCKET;
-	}
-
-	EnterCriticalSection(&gSocketListCs);
-	cstmp = obj->SockCritSec;
-	memset(obj, 0, sizeof(SOCKET_OBJ));
-	obj->SockCritSec = cstmp;
-	obj->next = gFreeSocketList;
-	gFreeSocketList = obj;
-	LeaveCriticalSection(&gSocketListCs);
-}
-
-// Function: ValidateArgs
-// Description: Parses the command line arguments and sets up some global variables.
-void ValidateArgs(int argc, char **argv)
-{
-	int     i;
-
-	for (i = 1; i < argc; i++)
-	{
-		if (((argv[i][0] != '/') && (argv[i][0] != '-')) || (strlen(argv[i]) < 2))
-			usage(argv[0]);
-		else
-		{
-			switch (tolower(argv[i][1]))
-			{
-			case 'a':               // address family - IPv4 or IPv6
-				if (i + 1 >= argc)
-					usage(argv[0]);
-				if (argv[i + 1][0] == '4')
-					gAddressFamily = AF_INET;
-				else if (argv[i + 1][0] == '6')
-					gAddressFamily = AF_INET6;
-				else
-					usage(argv[0]);
-				i++;
-				break;
-
-			case 'b':               // buffer size for send/recv
-				if (i + 1 >= argc)
-					usage(argv[0]);
-				gBufferSize = atol(argv[++i]);
-				break;
-
-			case 'e':               // endpoint - port number
-				if (i + 1 >= argc)
-					usage(argv[0]);
-				gBindPort = argv[++i];
-				break;
-
-			case 'l':               // local address for binding
-				if (i + 1 >= argc)
-					usage(argv[0]);
-				gBindAddr = argv[++i];
-				break;
-
-			case 'o':               // overlapped count
-				if (i + 1 >= argc)
-					usage(argv[0]);
-				if (strlen(argv[i]) == 2)       // Overlapped accept initial count
-				{
-					gInitialAccepts = atol(argv[++i]);
-				}
-				else if (strlen(argv[i]) == 3)
-				{
-					if (tolower(argv[i][2]) == 'a')
-						gMaxAccepts = atol(argv[++i]);
-					else if (tolower(argv[i][2]) == 's')
-						gMaxSends = atol(argv[++i]);
-					else if (tolower(argv[i][2]) == 'r')
-						gMaxReceives = atol(argv[++i]);
-					else
-						usage(argv[0]);
-				}
-				else
-				{
-					usage(argv[0]);
-				}
-				break;
-
-			default:
-				usage(argv[0]);
-				break;
-			}
-		}
-	}
-}
-
-// Function: PrintStatistics
-// Description: Print the send/recv statistics for the server
-void PrintStatistics()
-{
-	ULONG       bps, tick, elapsed, cps;
-	tick = GetTickCount();
-	elapsed = (tick - gStartTime) / 1000;
-
-	if (elapsed == 0)
-		return;
-
-	printf("\n");
-
-	// Calculate average bytes per second
-	bps = gBytesSent / elapsed;
-	printf("Average BPS sent: %lu [%lu]\n", bps, gBytesSent);
-	bps = gBytesRead / elapsed;
-	printf("Average BPS read: %lu [%lu]\n", bps, gBytesRead);
-	elapsed = (tick - gStartTimeLast) / 1000;
-
-	if (elapsed == 0)
-		return;
-
-	// Calculate bytes per second over the last X seconds
-	bps = gBytesSentLast / elapsed;
-	printf("Current BPS sent: %lu\n", bps);
-	bps = gBytesReadLast / elapsed;
-	printf("Current BPS read: %lu\n", bps);
-	cps = gConnectionsLast / elapsed;
-	printf("Current conns/sec: %lu\n", cps);
-	printf("Total connections: %lu\n", gConnections);
-	InterlockedExchange(&gBytesSentLast, 0);
-	InterlockedExchange(&gBytesReadLast, 0);
-	InterlockedExchange(&gConnectionsLast, 0);
-	gStartTimeLast = tick;
-}
-
-// Function: PostRecv
-// Description: Post an overlapped receive operation on the socket.
-int PostRecv(SOCKET_OBJ *sock, BUFFER_OBJ *recvobj)
-{
-	WSABUF  wbuf;
-	DWORD   bytes, flags;
-	int     rc;
-
-	recvobj->operation = OP_READ;
-	wbuf.buf = recvobj->buf;
-	wbuf.len = sizeof(MESSAGE);
-	flags = 0;
-	EnterCriticalSection(&sock->SockCritSec);
-	rc = WSARecv(sock->s, &wbuf, 1, &bytes, &flags, &recvobj->ol, NULL);
-
-	if (rc == SOCKET_ERROR)
-	{
-		rc = NO_ERROR;
-		if (WSAGetLastError() != WSA_IO_PENDING)
-		{
-			dbgprint("PostRecv: WSARecv* failed: %d\n", WSAGetLastError());
-			rc = SOCKET_ERROR;
-		}
-	}
-	if (rc == NO_ERROR)
-	{
-		// Increment outstanding overlapped operations
-		InterlockedIncrement(&sock->OutstandingRecv);
-	}
-	LeaveCriticalSection(&sock->SockCritSec);
-	return rc;
-}
-
-// Function: PostSend
-// Description: Post an overlapped send operation on the socket.
-
-int PostSend(SOCKET_OBJ *sock, BUFFER_OBJ *sendobj)
-{
-	WSABUF  wbuf;
-	DWORD   bytes;
-	int     rc, err;
-
-	sendobj->operation = OP_WRITE;
-	wbuf.buf = sendobj->buf;
-	wbuf.len = sizeof(MESSAGE);
-	EnterCriticalSection(&sock->SockCritSec);
-	rc = WSASend(sock->s, &wbuf, 1, &bytes, 0, &sendobj->ol, NULL);
-
-	if (rc == SOCKET_ERROR)
-	{
-		rc = NO_ERROR;
-		if ((err = WSAGetLastError()) != WSA_IO_PENDING)
-		{
-			if (err == WSAENOBUFS)
-				DebugBreak();
-			dbgprint("PostSend: WSASend* failed: %d [internal = %d]\n", WSAGetLastError(), sendobj->ol.Internal);
-			rc = SOCKET_ERROR;
-		}
-	}
-	if (rc == NO_ERROR)
-	{
-		// Increment the outstanding operation count
-		InterlockedIncrement(&sock->OutstandingSend);
-		InterlockedIncrement(&gOutstandingSends);
-	}
-	LeaveCriticalSection(&sock->SockCritSec);
-	return rc;
-}
-
-// Function: PostAccept
-// Description: Post an overlapped accept on a listening socket.
-int PostAccept(LISTEN_OBJ *listen, BUFFER_OBJ *acceptobj)
-{
-	DWORD   bytes;
-	int     rc;
-
-	acceptobj->operation = OP_ACCEPT;
-
-	// Create the client socket for an incoming connection
-	acceptobj->sclient = socket(listen->AddressFamily, SOCK_STREAM, IPPROTO_TCP);
-	if (acceptobj->sclient == INVALID_SOCKET)
-	{
-		fprintf(stderr, "PostAccept: socket failed: %d\n", WSAGetLastError());
-		return -1;
-	}
-
-	rc = listen->lpfnAcceptEx(
-		listen->s,
-		acceptobj->sclient,
-		acceptobj->buf,
-		acceptobj->buflen - ((sizeof(SOCKADDR_STORAGE) + 16) * 2),
-		sizeof(SOCKADDR_STORAGE) + 16,
-		sizeof(SOCKADDR_STORAGE) + 16,
-		&bytes,
-		&acceptobj->ol
-	);
-	if (rc == FALSE)
-	{
-		if (WSAGetLastError() != WSA_IO_PENDING)
-		{
-			printf("PostAccept: AcceptEx failed: %d\n", WSAGetLastError());
-			return SOCKET_ERROR;
-		}
-	}
-
-	// Increment the outstanding overlapped count for this socket
-	InterlockedIncrement(&listen->PendingAcceptCount);
-	return NO_ERROR;
-}
-
-// Function: HandleIo
-// Description:
-//    This function handles the IO on a socket. In the event of a receive, the
-//    completed receive is posted again. For completed accepts, another AcceptEx
-//    is posted. For completed sends, the buffer is freed.
-void HandleIo(ULONG_PTR key, BUFFER_OBJ *buf, HANDLE CompPort, DWORD BytesTransfered, DWORD error)
-{
-	LISTEN_OBJ *listenobj = NULL;
-	SOCKET_OBJ *sockobj = NULL,
-		*clientobj = NULL;                     // New client object for accepted connections
-	BUFFER_OBJ *recvobj = NULL,       // Used to post new receives on accepted connections
-		*sendobj = NULL;
-	BUFFER_OBJ *readobj = NULL,
-		*writeobj = NULL;
-	BOOL        bCleanupSocket;
-
-	if (error != 0)
-	{
-		dbgprint("OP = %d; Error = %d\n", buf->operation, error);
-	}
-	bCleanupSocket = FALSE;
-
-	if (error != NO_ERROR)
-	{
-		// An error occurred on a TCP socket, free the associated per I/O buffer
-		// and see if there are any more outstanding operations. If so we must
-		// wait until they are complete as well.
-		if (buf->operation != OP_ACCEPT)
-		{
-			sockobj = (SOCKET_OBJ *)key;
-			if (buf->operation == OP_READ)
-			{
-				if ((InterlockedDecrement(&sockobj->OutstandingRecv) == 0) && (sockobj->OutstandingSend == 0))
-				{
-					dbgprint("Freeing socket obj in GetOverlappedResult\n");
-					FreeSocketObj(sockobj);
-				}
-			}
-			else if (buf->operation == OP_WRITE)
-			{
-				if ((InterlockedDecrement(&sockobj->OutstandingSend) == 0) && (sockobj->OutstandingRecv == 0))
-				{
-					dbgprint("Freeing socket obj in GetOverlappedResult\n");
-					FreeSocketObj(sockobj);
-				}
-			}
-
-		}
-		else
-		{
-			listenobj = (LISTEN_OBJ *)key;
-			printf("Accept failed\n");
-			closesocket(buf->sclient);
-			buf->sclient = INVALID_SOCKET;
-		}
-		FreeBufferObj(buf);
-		return;
-	}
-
-	if (buf->operation == OP_ACCEPT)
-	{
-		HANDLE            hrc;
-		SOCKADDR_STORAGE *LocalSockaddr = NULL, *RemoteSockaddr = NULL;
-		int               LocalSockaddrLen, RemoteSockaddrLen;
-		listenobj = (LISTEN_OBJ *)key;
-
-		// Update counters
-		InterlockedIncrement(&gConnections);
-		InterlockedIncrement(&gConnectionsLast);
-		InterlockedDecrement(&listenobj->PendingAcceptCount);
-		InterlockedExchangeAdd(&gBytesRead, BytesTransfered);
-		InterlockedExchangeAdd(&gBytesReadLast, BytesTransfered);
-
-		// Print the client's addresses
-		listenobj->lpfnGetAcceptExSockaddrs(
-			buf->buf,
-			buf->buflen - ((sizeof(SOCKADDR_STORAGE) + 16) * 2),
-			sizeof(SOCKADDR_STORAGE) + 16,
-			sizeof(SOCKADDR_STORAGE) + 16,
-			(SOCKADDR **)&LocalSockaddr,
-			&LocalSockaddrLen,
-			(SOCKADDR **)&RemoteSockaddr,
-			&RemoteSockaddrLen
-		);
-
-		RemovePendingAccept(listenobj, buf);
-		// Get a new SOCKET_OBJ for the client connection
-		clientobj = GetSocketObj(buf->sclient, listenobj->AddressFamily);
-		if (clientobj)
-		{
-			// Associate the new connection to our completion port
-			hrc = CreateIoCompletionPort((HANDLE)clientobj->s, CompPort, (ULONG_PTR)clientobj, 0);
-			if (hrc == NULL)
-			{
-				fprintf(stderr, "CompletionThread: CreateIoCompletionPort failed: %d\n", GetLastError());
-				return;
-			}
-			MESSAGE *rcvMess;
-			//MESSAGE sendMessage;
-			rcvMess = (MESSAGE *)buf->buf;
-			fprintf(stderr, "begin\n");
-
-			if (rcvMess->opcode == OPT_FILE_DOWN)
-			{
-
-				InterlockedDecrement(&gOutstandingDownloads);
-				readobj = buf;
-				//writeobj->buf = (char *)rcvMess;
-				readobj->sock = clientobj;
-				readobj->sock->mess = *rcvMess;
-				EnqueueDownloadingOperation(&gPendingReadList, &gPendingReadListEnd, readobj);
-
-			}
-			else if (rcvMess->opcode == OPT_FILE_UP)
-			{
-				InterlockedDecrement(&gOutstandingUploads);
-				recvobj = buf;
-				recvobj->sock = clientobj;
-				recvobj->sock->mess = *rcvMess;
-				EnqueueUploadingOperation(&gPendingWriteList, &gPendingWriteListEnd, recvobj);
-
-			}
-			else if (rcvMess->opcode == OPA_LOGIN || rcvMess->opcode == OPA_REAUTH) {
-				recvobj = buf;
-				recvobj->sock = clientobj;
-				recvobj->sock->mess = *rcvMess;
-
-
-
-				if (parseAndProcess(recvobj)) {
-					memcpy(buf->buf, &recvobj->sock->mess, sizeof(MESSAGE));
-					sendobj = buf;
-					sendobj->sock = clientobj;
-					
-					EnqueuePendingOperation(&gPendingSendList, &gPendingSendListEnd, sendobj, OP_WRITE);
-					ProcessPendingOperations();
-				}
-			}
-
-		}
-		else
-		{
-			// Can't allocate a socket structure so close the connection
-			closesocket(buf->sclient);
-			buf->sclient = INVALID_SOCKET;
-			FreeBufferObj(buf);
-		}
-
-		if (error != NO_ERROR)
-		{
-			// Check for socket closure
-			EnterCriticalSection(&clientobj->SockCritSec);
-			if ((clientobj->OutstandingSend == 0) && (clientobj->OutstandingRecv == 0))
-			{
-				closesocket(clientobj->s);
-				clientobj->s = INVALID_SOCKET;
-				FreeSocketObj(clientobj);
-			}
-			else
-			{
-				clientobj->bClosing = TRUE;
-			}
-			LeaveCriticalSection(&clientobj->SockCritSec);
-			error = NO_ERROR;
-		}
-		InterlockedIncrement(&listenobj->RepostCount);
-		SetEvent(listenobj->RepostAccept);
-	}
-
-	else if (buf->operation == OP_READ)
-	{
-		sockobj = (SOCKET_OBJ *)key;
-		InterlockedDecrement(&sockobj->OutstandingRecv);
-
-		// Receive completed successfully
-		if (BytesTransfered > 0)
-		{
-			InterlockedExchangeAdd(&gBytesRead, BytesTransfered);
-			InterlockedExchangeAdd(&gBytesReadLast, BytesTransfered);
-			if (BytesTransfered == sizeof(MESSAGE))
-			{
-				MESSAGE *rcvMess;
-				rcvMess = (MESSAGE *)buf->buf;
-				if (rcvMess->opcode == OPS_OK)
-				{
-					InterlockedDecrement(&gOutstandingDownloads);
-
-					readobj = buf;
-					readobj->buflen = sizeof(MESSAGE);
-					readobj->sock = sockobj;
-					readobj->sock->mess = *rcvMess;
-					EnqueueDownloadingOperation(&gPendingReadList, &gPendingReadListEnd, readobj);
-				}
-				else if (rcvMess->opcode == OPT_FILE_DATA)
-				{
-					if (rcvMess->length == 0)
-					{
-						InterlockedDecrement(&gOutstandingUploads);
-						recvobj = buf;
-						recvobj->sock = sockobj;
-						recvobj->sock->mess = *rcvMess;
-						EnqueueUploadingOperation(&gPendingWriteList, &gPendingWriteListEnd, recvobj);
-
-					}
-					else
-					{
-						InterlockedDecrement(&gOutstandingUploads);
-						writeobj = buf;
-						writeobj->sock = sockobj;
-						writeobj->sock->mess = *rcvMess;
-						EnqueueUploadingOperation(&gPendingWriteList, &gPendingWriteListEnd, writeobj);
-					}
-				}
-				else if (rcvMess->opcode == OPT_FILE_DIGEST)
-				{
-					InterlockedDecrement(&gOutstandingUploads);
-					recvobj = buf;
-					recvobj->sock = sockobj;
-					recvobj->sock->mess = *rcvMess;
-					EnqueueUploadingOperation(&gPendingWriteList, &gPendingWriteListEnd, recvobj);
-				}
-				else {
-					recvobj = buf;
-					recvobj->sock = sockobj;
-					recvobj->sock->mess = *rcvMess;
-
-					if (parseAndProcess(recvobj)) {
-						memcpy(buf->buf, &recvobj->sock->mess, sizeof(MESSAGE));
-						sendobj = buf;
-						sendobj->sock = sockobj;
-
-						MESSAGE m = (MESSAGE) sendobj->sock->mess;
-						
-						EnqueuePendingOperation(&gPendingSendList, &gPendingSendListEnd, sendobj, OP_WRITE);
-						printf("\nSending code %d to client %d", m.opcode, sockobj->s);
-						ProcessPendingOperations();
-					}
-
-				}
-
-			}
-		}
-		else
-		{
-			dbgprint("Got 0 byte receive\n");
-			// Graceful close - the receive returned 0 bytes read
-			sockobj->bClosing = TRUE;
-			// Free the receive buffer
-			FreeBufferObj(buf);
-
-			// If this was the last outstanding operation on socket, clean it up
-			EnterCriticalSection(&sockobj->SockCritSec);
-
-			if ((sockobj->OutstandingSend == 0) && (sockobj->OutstandingRecv == 0))
-			{
-				bCleanupSocket = TRUE;
-			}
-			LeaveCriticalSection(&sockobj->SockCritSec);
-		}
-	}
-	else if (buf->operation == OP_WRITE)
-	{
-		sockobj = (SOCKET_OBJ *)key;
-		InterlockedDecrement(&sockobj->OutstandingSend);
-		InterlockedDecrement(&gOutstandingSends);
-		// Update the counters
-		InterlockedExchangeAdd(&gBytesSent, BytesTransfered);
-		InterlockedExchangeAdd(&gBytesSentLast, BytesTransfered);
-		buf->buflen = gBufferSize;
-		if (sockobj->bClosing == FALSE)
-		{
-			MESSAGE *queueMessage;
-			queueMessage = (MESSAGE *)buf->buf;
-			if (queueMessage->opcode == OPT_FILE_DATA)
-			{
-				MESSAGE sendMessage;
-				if (sockobj->fileTransfer.nLeft > 0)
-				{
-					InterlockedDecrement(&gOutstandingDownloads);
-					readobj = buf;
-					readobj->buflen = sizeof(MESSAGE);
-					readobj->sock = sockobj;
-					readobj->sock->mess = *queueMessage;
-					EnqueueDownloadingOperation(&gPendingReadList, &gPendingReadListEnd, readobj);
-				}
-				else if (sockobj->fileTransfer.nLeft == 0)
-				{
-					fprintf(stderr, "ending");
-					sendMessage.opcode = OPT_FILE_DATA;
-					sendMessage.payload[0] = 0;
-					sendMessage.length = 0;
-					sockobj->bClosing = TRUE;
-					memcpy(buf->buf, &sendMessage, sizeof(MESSAGE));
-					buf->buflen = sizeof(MESSAGE);
-					sendobj = buf;
-					sendobj->buflen = sizeof(MESSAGE);
-					sendobj->sock = sockobj;
-
-					EnqueuePendingOperation(&gPendingSendList, &gPendingSendListEnd, sendobj, OP_WRITE);
-					ProcessPendingOperations();
-				}
-
-			}
-			else if (queueMessage->opcode == OPT_FILE_DIGEST)
-			{
-				InterlockedDecrement(&gOutstandingDownloads);
-				recvobj = buf;
-				recvobj->sock = sockobj;
-				recvobj->sock->mess = *queueMessage;
-				EnqueueDownloadingOperation(&gPendingReadList, &gPendingReadListEnd, recvobj);
-			}
-			else if (queueMessage->opcode == OPS_OK)
-			{
-				InterlockedDecrement(&gOutstandingUploads);
-				recvobj = buf;
-				recvobj->sock = sockobj;
-				recvobj->sock->mess = *queueMessage;
-				EnqueueUploadingOperation(&gPendingWriteList, &gPendingWriteListEnd, recvobj);
-			}
-			else {
-				buf->sock = sockobj;
-				PostRecv(sockobj, buf);
-			}
-		}
-	}
-
-	//ProcessPendingOperations();
-	if (sockobj)
-	{
-		if (error != NO_ERROR)
-		{
-			printf("err = %d\n", error);
-			sockobj->bClosing = TRUE;
-		}
-
-		// Check to see if socket is closing
-		if ((sockobj->OutstandingSend == 0) && (sockobj->OutstandingRecv == 0) && (sockobj->bClosing))
-		{
-			bCleanupSocket = TRUE;
-		}
-
-		if (bCleanupSocket)
-		{
-			disconnect(sockobj->s);
-			closesocket(sockobj->s);
-			sockobj->s = INVALID_SOCKET;
-			FreeSocketObj(sockobj);
-		}
-	}
-
-	return;
-}
-
-// Function: CompletionThread
-// Description:
-//    This is the completion thread which services our completion port. One of
-//    these threads is created per processor on the system. The thread sits in
-//    an infinite loop calling GetQueuedCompletionStatus and handling socket IO that completed.
-
-DWORD WINAPI CompletionThread(LPVOID lpParam)
-{
-	ULONG_PTR    Key;
-	SOCKET       s;
-	BUFFER_OBJ  *bufobj = NULL;                   // Per I/O object for completed I/O
-	OVERLAPPED  *lpOverlapped = NULL;     // Pointer to overlapped structure for completed I/O
-	HANDLE       CompletionPort;                    // Completion port handle
-	DWORD        BytesTransfered,                   // Number of bytes transferred
-		Flags;                                     // Flags for completed I/O
-	int          rc, error;
-
-	CompletionPort = (HANDLE)lpParam;
-	while (1)
-	{
-		error = NO_ERROR;
-		rc = GetQueuedCompletionStatus(CompletionPort, &BytesTransfered, (PULONG_PTR)&Key, &lpOverlapped, INFINITE);
-		bufobj = CONTAINING_RECORD(lpOverlapped, BUFFER_OBJ, ol);
-		if (rc == FALSE)
-		{
-			// If the call fails, call WSAGetOverlappedResult to translate the
-			//    error code into a Winsock error code.
-			if (bufobj->operation == OP_ACCEPT)
-			{
-				s = ((LISTEN_OBJ *)Key)->s;
-			}
-			else
-			{
-				s = ((SOCKET_OBJ *)Key)->s;
-			}
-			dbgprint("CompletionThread: GetQueuedCompletionStatus failed: %d [0x%x]\n", GetLastError(), lpOverlapped->Internal);
-			rc = WSAGetOverlappedResult(s, &bufobj->ol, &BytesTransfered, FALSE, &Flags);
-			if (rc == FALSE)
-			{
-				error = WSAGetLastError();
-			}
-		}
-		// Handle the IO operation
-		HandleIo(Key, bufobj, CompletionPort, BytesTransfered, error);
-	}
-
-	ExitThread(0);
-	return 0;
-}
-
-// Function: workerReadThread
-// Description:
-//    This is the  thread which services our Download file protocol . One of
-//    these threads is created  on the system. The thread sits in
-//    an infinite loop calling ProcessDownloadingOperations to process file operation needed .
-unsigned __stdcall workerReadThread(void *param)
-{
-	while (TRUE)
-	{
-		ProcessDownloadingOperations();
-	}
-}
-
-// Function: workerWriteThread
-// Description:
-//    This is the  thread which services our Upload file protocol . One of
-//    these threads is created  on the system. The thread sits in
-//    an infinite loop calling ProcessUploadingOperations to process file operation needed .
-unsigned __stdcall workerWriteThread(void *param)
-{
-	while (TRUE)
-	{
-		ProcessUploadingOperations();
-	}
-}
-
+#include "stdafx.h"
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#define _WINSOCK_DEPRECATED_NO_WARNINGS 
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <mswsock.h>
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h> 
+#include <limits.h>
+#include <process.h>
+
+#include "dataStructures.h"
+#include "processor.h"
+#include "metrics.h"
+#include "resolve.h"
+#include "md5.h"
+#include "blockStore.h"
+#include "sendScheduler.h"
+#include "qos.h"
+#include "admission.h"
+#include "tls.h"
+#include "handoff.h"
+
+#pragma comment(lib, "Ws2_32.lib")
+#pragma warning(disable : 4996)
+
+#define DEFAULT_BUFFER_SIZE         4096           // default buffer size
+#define DEFAULT_OVERLAPPED_COUNT    5      // Number of overlapped recv per socket
+#define MAX_OVERLAPPED_ACCEPTS      500
+#define MAX_OVERLAPPED_SENDS        200
+#define MAX_OVERLAPPED_RECVS        200
+#define MAX_OVERLAPPED_READS        200
+#define MAX_OVERLAPPED_WRITES       200
+#define MAX_COMPLETION_THREAD_COUNT 32		// Maximum number of completion threads allowed
+#define BURST_ACCEPT_COUNT          100
+#define BUFF_SIZE                   2048
+#define DIGEST_SIZE		            33
+#define DEFAULT_IDLE_TIMEOUT        900    // Seconds a connection may stay without traffic
+#define ACCEPT_TIMEOUT              30     // Seconds a new connection has to send its first message
+#define ACCEPT_CHECK_INTERVAL       10     // Seconds between checks of a pending accept
+#define FRAME_TIMEOUT               30     // Seconds a started message has to arrive in full
+
+int gAddressFamily = AF_UNSPEC,         // default to unspecified
+gSocketType = SOCK_STREAM,       // default to TCP socket type
+gProtocol = IPPROTO_TCP,       // default to TCP protocol
+gBufferSize = DEFAULT_BUFFER_SIZE,
+gInitialAccepts = DEFAULT_OVERLAPPED_COUNT,
+gMaxAccepts = MAX_OVERLAPPED_ACCEPTS,
+gMaxReceives = MAX_OVERLAPPED_RECVS,
+gMaxSends = MAX_OVERLAPPED_SENDS,       // ceilings of the adaptive limits
+gMaxDownloads = MAX_OVERLAPPED_READS,
+gMaxUploads = MAX_OVERLAPPED_WRITES,
+gMemoryBudgetMb = DEFAULT_MEMORY_BUDGET_MB,
+gIdleTimeout = DEFAULT_IDLE_TIMEOUT;
+
+char *gBindAddr = NULL,         // local interface to bind to
+*gBindPort = "5500",       // local port to bind to
+*gMetricsPort = NULL,      // loopback port serving metrics, NULL if disabled
+*gTlsSubject = NULL;       // subject of the TLS certificate, NULL to serve plaintext
+
+HANDLE gCompletionPort;         // Completion port of the connections
+
+// Serialize access to the free lists below
+CRITICAL_SECTION gBufferListCs, gSocketListCs, gReadingCritSec, gWritingCritSec;
+
+// Lookaside lists for free buffers and socket objects
+BUFFER_OBJ *gFreeBufferList = NULL;
+SOCKET_OBJ *gFreeSocketList = NULL;
+BUFFER_OBJ *gPendingReadList = NULL, *gPendingReadListEnd = NULL;
+BUFFER_OBJ *gPendingWriteList = NULL, *gPendingWriteListEnd = NULL;
+
+int isFileExists(const char *path);
+int  PostSend(SOCKET_OBJ *sock, BUFFER_OBJ *sendobj);
+int  PostRecv(SOCKET_OBJ *sock, BUFFER_OBJ *recvobj);
+void FreeBufferObj(BUFFER_OBJ *obj);
+int usage(char *progname);
+void dbgprint(char *format, ...);
+void ProcessPendingOperations();
+void EnqueueDownloadingOperation(BUFFER_OBJ **head, BUFFER_OBJ **end, BUFFER_OBJ *obj);
+BUFFER_OBJ *DequeueDownloadingOperation(BUFFER_OBJ **head, BUFFER_OBJ **end);
+void ProcessDownloadingOperations();
+void EnqueueUploadingOperation(BUFFER_OBJ **head, BUFFER_OBJ **end, BUFFER_OBJ *obj);
+BUFFER_OBJ *DequeueUploadingOperation(BUFFER_OBJ **head, BUFFER_OBJ **end);
+void ProcessUploadingOperations();
+void InsertPendingAccept(LISTEN_OBJ *listenobj, BUFFER_OBJ *obj);
+void RemovePendingAccept(LISTEN_OBJ *listenobj, BUFFER_OBJ *obj);
+BUFFER_OBJ *GetBufferObj(int buflen);
+SOCKET_OBJ *GetSocketObj(SOCKET s, int af);
+void FreeSocketObj(SOCKET_OBJ *obj);
+void holdTransferAccount(SOCKET_OBJ *sock, Account *account);
+void ValidateArgs(int argc, char **argv);
+int PostAccept(LISTEN_OBJ *listen, BUFFER_OBJ *acceptobj);
+int PostNewAccept(LISTEN_OBJ *listenobj);
+void AcceptTimeout(TIMER *timer);
+void IdleTimeout(TIMER *timer);
+void ResumeDownload(TIMER *timer);
+void ResumeUpload(TIMER *timer);
+void SendBusy(SOCKET_OBJ *sock, BUFFER_OBJ *buf, DWORD retryMs);
+void DispatchFirstMessage(SOCKET_OBJ *sock, BUFFER_OBJ *buf);
+int SendTlsToken(SOCKET_OBJ *sock, BUFFER_OBJ *buf);
+int ReceiveTls(SOCKET_OBJ *sock, BUFFER_OBJ *buf, DWORD bytes);
+void HandleIo(ULONG_PTR key, BUFFER_OBJ *buf, HANDLE CompPort, DWORD BytesTransfered, DWORD error);
+DWORD WINAPI CompletionThread(LPVOID lpParam);
+unsigned __stdcall workerReadThread(void *param);
+unsigned __stdcall workerWriteThread(void *param);
+
+// The benchmark suite compiles this file in with SERVER_NO_MAIN and
+// drives the functions below without a listening socket.
+#ifndef SERVER_NO_MAIN
+int _tmain(int argc, char* argv[])
+{
+	WSADATA          wsd;
+	SYSTEM_INFO      sysinfo;
+	LISTEN_OBJ      *ListenSockets = NULL, *listenobj = NULL;
+	SOCKET_OBJ      *sockobj = NULL;
+	BUFFER_OBJ      *acceptobj = NULL;
+	GUID             guidAcceptEx = WSAID_ACCEPTEX, guidGetAcceptExSockaddrs = WSAID_GETACCEPTEXSOCKADDRS;
+	DWORD            bytes;
+	HANDLE           CompletionPort, WaitEvents[MAX_COMPLETION_THREAD_COUNT], hrc;
+	int              endpointcount = 0, waitcount = 0, rc, i;
+	struct addrinfo *res = NULL, *ptr = NULL;
+	HANDOFF_REPLY    handoff;
+	SOCKADDR_STORAGE inherited;
+	int              inheritedlen;
+
+	if (argc < 2)
+	{
+		usage(argv[0]);
+		exit(1);
+	}
+
+	// Validate the command line
+	ValidateArgs(argc, argv);
+	if (startLog()) return 1;
+	// Load Winsock
+	if (WSAStartup(MAKEWORD(2, 2), &wsd) != 0)
+	{
+		fprintf(stderr, "unable to load Winsock!\n");
+		return -1;
+	}
+
+	initializeMetrics();
+	if (initializeData())
+	{
+		logFlush();
+		return 1;
+	}
+	if (gMetricsPort != NULL && startMetricsServer(gMetricsPort))
+		return 1;
+
+	InitializeCriticalSection(&gSocketListCs);
+	InitializeCriticalSection(&gBufferListCs);
+	initializeSendScheduler();
+	initializeQos();
+	initializeAdmission(&gSendLimit, "send", ADMISSION_SEND_FLOOR, gMaxSends, ADMISSION_SEND_TARGET_MS);
+	initializeAdmission(&gDownloadLimit, "download", ADMISSION_TRANSFER_FLOOR, gMaxDownloads, ADMISSION_QUEUE_TARGET_MS);
+	initializeAdmission(&gUploadLimit, "upload", ADMISSION_TRANSFER_FLOOR, gMaxUploads, ADMISSION_QUEUE_TARGET_MS);
+	gMemoryBudget = (LONGLONG)gMemoryBudgetMb << 20;
+	if (gTlsSubject != NULL && initializeTls(gTlsSubject))
+		return 1;
+	InitializeCriticalSection(&gReadingCritSec);
+	InitializeCriticalSection(&gWritingCritSec);
+
+	// Create the completion port used by this server
+	CompletionPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, (ULONG_PTR)NULL, 0);
+	if (CompletionPort == NULL)
+	{
+		fprintf(stderr, "CreateIoCompletionPort failed: %d\n", GetLastError());
+		return -1;
+	}
+	gCompletionPort = CompletionPort;
+
+	// Find out how many processors are on this system
+	GetSystemInfo(&sysinfo);
+	if (sysinfo.dwNumberOfProcessors > MAX_COMPLETION_THREAD_COUNT)
+	{
+		sysinfo.dwNumberOfProcessors = MAX_COMPLETION_THREAD_COUNT;
+	}
+
+	// A TLS buffer also holds the sealed copy of its frame
+	if (gTlsEnabled && gBufferSize < TLS_MIN_BUFFER_SIZE)
+	{
+		gBufferSize = TLS_MIN_BUFFER_SIZE;
+	}
+
+	// Round the buffer size to the next increment of the page size
+	if ((gBufferSize % sysinfo.dwPageSize) != 0)
+	{
+		gBufferSize = ((gBufferSize / sysinfo.dwPageSize) + 1) * sysinfo.dwPageSize;
+	}
+
+	printf("Buffer size = %lu (page size = %lu)\n", gBufferSize, sysinfo.dwPageSize);
+
+	// Create the worker threads to service the completion notifications
+	for (waitcount = 0; waitcount < (int)sysinfo.dwNumberOfProcessors; waitcount++)
+	{
+		WaitEvents[waitcount] = CreateThread(NULL, 0, CompletionThread, (LPVOID)CompletionPort, 0, NULL);
+		if (WaitEvents[waitcount] == NULL)
+		{
+			fprintf(stderr, "CreatThread failed: %d\n", GetLastError());
+			return -1;
+		}
+	}
+
+	printf("Local address: %s; Port: %s; Family: %d\n", gBindAddr, gBindPort, gAddressFamily);
+
+	if (_beginthreadex(0, 0, workerReadThread, NULL, 0, 0) == 0) {
+		printf("Create business thread failed with error %d\n", GetLastError());
+		return 1;
+	}
+	else
+		printf("Read file thread created.\n");
+	if (_beginthreadex(0, 0, workerWriteThread, NULL, 0, 0) == 0) {
+		printf("Create business thread failed with error %d\n", GetLastError());
+		return 1;
+	}
+	else
+		printf("Read file thread created.\n");
+
+	if (gTakeOver)
+	{
+		// Take the listening sockets of the server running on the port
+		if (handoffReceive(gBindPort, &handoff))
+		{
+			logFlush();
+			return -1;
+		}
+	}
+	else
+	{
+		// Obtain the "wildcard" addresses for all the available address families
+		res = ResolveAddress(gBindAddr, gBindPort, gAddressFamily, gSocketType, gProtocol);
+		if (res == NULL)
+		{
+			fprintf(stderr, "ResolveAddress failed to return any addresses!\n");
+			return -1;
+		}
+	}
+
+	// For each local address returned, create a listening/receiving socket,
+	//    or set up each socket taken over
+	ptr = res;
+	while (gTakeOver ? endpointcount < handoff.count : ptr != NULL)
+	{
+		listenobj = (LISTEN_OBJ *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(LISTEN_OBJ));
+		if (listenobj == NULL)
+		{
+			fprintf(stderr, "Out of memory!\n");
+			return -1;
+		}
+
+		listenobj->LoWaterMark = gInitialAccepts;
+		for (i = 0; i < ACCEPT_SHARD_COUNT; i++)
+			InitializeCriticalSection(&listenobj->PendingAccepts[i].cs);
+
+		if (gTakeOver)
+		{
+			// The socket is already bound and listening
+			listenobj->AddressFamily = handoff.sockets[endpointcount].family;
+			listenobj->s = WSASocketW(FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO,
+				&handoff.sockets[endpointcount].info, 0, WSA_FLAG_OVERLAPPED);
+			if (listenobj->s == INVALID_SOCKET)
+			{
+				fprintf(stderr, "WSASocket failed: %d\n", WSAGetLastError());
+				return -1;
+			}
+			inheritedlen = sizeof(inherited);
+			getsockname(listenobj->s, (SOCKADDR *)&inherited, &inheritedlen);
+			printf("Listening address taken over: ");
+			PrintAddress((SOCKADDR *)&inherited, inheritedlen);
+			printf("\n");
+		}
+		else
+		{
+			printf("Listening address: ");
+			PrintAddress(ptr->ai_addr, ptr->ai_addrlen);
+			printf("\n");
+
+			// Save off the address family of this socket
+			listenobj->AddressFamily = ptr->ai_family;
+
+			// create the socket
+			listenobj->s = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
+			if (listenobj->s == INVALID_SOCKET)
+			{
+				fprintf(stderr, "socket failed: %d\n", WSAGetLastError());
+				return -1;
+			}
+		}
+
+		// Create an event to register for FD_ACCEPT events on
+		listenobj->AcceptEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (listenobj->AcceptEvent == NULL)
+		{
+			fprintf(stderr, "CreateEvent failed: %d\n", GetLastError());
+			return -1;
+		}
+
+		// Add the event to the list of waiting events. Completed accepts are
+		//    replaced by the completion threads themselves, this event only
+		//    fires when connections arrive faster than that.
+		WaitEvents[waitcount++] = listenobj->AcceptEvent;
+
+		// Associate the socket and its SOCKET_OBJ to the completion port
+		hrc = CreateIoCompletionPort((HANDLE)listenobj->s, CompletionPort, (ULONG_PTR)listenobj, 0);
+		if (hrc == NULL)
+		{
+			fprintf(stderr, "CreateIoCompletionPort failed: %d\n", GetLastError());
+			return -1;
+		}
+
+		// bind the socket to a local address and port
+		if (!gTakeOver)
+		{
+			rc = bind(listenobj->s, ptr->ai_addr, ptr->ai_addrlen);
+			if (rc == SOCKET_ERROR)
+			{
+				fprintf(stderr, "bind failed: %d\n", WSAGetLastError());
+				return -1;
+			}
+		}
+
+		// Need to load the Winsock extension functions from each provider
+		//    -- e.g. AF_INET and AF_INET6.
+		rc = WSAIoctl(
+			listenobj->s,
+			SIO_GET_EXTENSION_FUNCTION_POINTER,
+			&guidAcceptEx,
+			sizeof(guidAcceptEx),
+			&listenobj->lpfnAcceptEx,
+			sizeof(listenobj->lpfnAcceptEx),
+			&bytes,
+			NULL,
+			NULL
+		);
+		if (rc == SOCKET_ERROR)
+		{
+			fprintf(stderr, "WSAIoctl: SIO_GET_EXTENSION_FUNCTION_POINTER failed: %d\n", WSAGetLastError());
+			return -1;
+		}
+
+		// Load the Winsock extensions from each provider
+		rc = WSAIoctl(
+			listenobj->s,
+			SIO_GET_EXTENSION_FUNCTION_POINTER,
+			&guidGetAcceptExSockaddrs,
+			sizeof(guidGetAcceptExSockaddrs),
+			&listenobj->lpfnGetAcceptExSockaddrs,
+			sizeof(listenobj->lpfnGetAcceptExSockaddrs),
+			&bytes,
+			NULL,
+			NULL
+		);
+
+		if (rc == SOCKET_ERROR)
+		{
+			fprintf(stderr, "WSAIoctl: SIO_GET_EXTENSION_FUNCTION_POINTER failed: %d\n", WSAGetLastError());
+			return -1;
+		}
+
+		// Put the socket into listening mode
+		if (!gTakeOver)
+		{
+			rc = listen(listenobj->s, SOMAXCONN);
+			if (rc == SOCKET_ERROR)
+			{
+				fprintf(stderr, "listen failed: %d\n", WSAGetLastError());
+				return -1;
+			}
+		}
+
+		// Register for FD_ACCEPT notification on listening socket. On a
+		//    socket taken over this replaces the registration of the old
+		//    server, which stops accepting once told to drain.
+		rc = WSAEventSelect(listenobj->s, listenobj->AcceptEvent, FD_ACCEPT);
+		if (rc == SOCKET_ERROR)
+		{
+			fprintf(stderr, "WSAEventSelect failed: %d\n", WSAGetLastError());
+			return -1;
+		}
+
+		// Initiate the initial accepts for each listen socket
+		for (i = 0; i < gInitialAccepts; i++)
+		{
+			if (PostNewAccept(listenobj) != NO_ERROR)
+			{
+				fprintf(stderr, "Unable to post the initial accepts!\n");
+				return -1;
+			}
+		}
+
+		// Maintain a list of the listening socket structures
+		if (ListenSockets == NULL)
+		{
+			ListenSockets = listenobj;
+		}
+		else
+		{
+			listenobj->next = ListenSockets;
+			ListenSockets = listenobj;
+		}
+
+		endpointcount++;
+		if (ptr != NULL)
+			ptr = ptr->ai_next;
+	}
+
+	// free the addrinfo structure for the 'bind' address
+	if (res != NULL)
+		freeaddrinfo(res);
+
+	// Let the old server drain, then answer the next restart
+	if ((gTakeOver && handoffAccepting()) || startHandoff(gBindPort, ListenSockets))
+	{
+		logFlush();
+		return -1;
+	}
+	while (1)
+	{
+		rc = WSAWaitForMultipleEvents(waitcount, WaitEvents, FALSE, WSA_INFINITE, FALSE);
+		if (rc == WAIT_FAILED)
+		{
+			fprintf(stderr, "WSAWaitForMultipleEvents failed: %d\n", WSAGetLastError());
+			break;
+		}
+		else
+		{
+			int index;
+			index = rc - WAIT_OBJECT_0;
+			for (; index < waitcount; index++)
+			{
+				rc = WaitForSingleObject(WaitEvents[index], 0);
+				if (rc == WAIT_FAILED || rc == WAIT_TIMEOUT)
+				{
+					continue;
+				}
+				if (index < (int)sysinfo.dwNumberOfProcessors)
+				{
+					// One of the completion threads exited
+					//   This is bad so just bail - a real server would want
+					//   to gracefully exit but this is just a sample ...
+					ExitProcess(-1);
+				}
+				else
+				{
+					// An FD_ACCEPT event occurred
+					listenobj = ListenSockets;
+					while (listenobj)
+					{
+						if (listenobj->AcceptEvent == WaitEvents[index])
+							break;
+						listenobj = listenobj->next;
+					}
+
+					if (listenobj)
+					{
+						WSANETWORKEVENTS ne;
+						int              limit = 0;
+
+						// EnumNetworkEvents to see if FD_ACCEPT was set
+						rc = WSAEnumNetworkEvents(listenobj->s, listenobj->AcceptEvent, &ne);
+						if (rc == SOCKET_ERROR)
+						{
+							fprintf(stderr, "WSAEnumNetworkEvents failed: %d\n", WSAGetLastError());
+						}
+						if ((ne.lNetworkEvents & FD_ACCEPT) == FD_ACCEPT && !gDraining)
+						{
+							// We got an FD_ACCEPT so post multiple accepts to cover the burst
+							limit = BURST_ACCEPT_COUNT;
+						}
+						i = 0;
+						while ((i++ < limit) && (listenobj->PendingAcceptCount < gMaxAccepts))
+						{
+							if (PostNewAccept(listenobj) != NO_ERROR)
+								break;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	WSACleanup();
+	return 0;
+}
+#endif
+
+// Function: usage
+// Description: Prints usage information and exits the process.
+int usage(char *progname)
+{
+	fprintf(stderr, "Usage: %s [-a 4|6] [-e port] [-l local-addr] [-p udp|tcp]\n", progname);
+	fprintf(stderr, "  -a  4|6     Address family, 4 = IPv4, 6 = IPv6 [default = IPv4]\n"
+		"else will listen to both IPv4 and IPv6\n"
+		"  -b  size    Buffer size for send/recv [default = %d]\n"
+		"  -c  mb      Memory budget of buffers and sockets, new work is refused near it [default = %d]\n"
+		"  -d  file    Decode a binary log file and exit\n"
+		"  -e  port    Port number [default = %s]\n"
+		"  -f  file    Binary log file [default = %s]\n"
+		"  -g  secs    Once handed off, serve the transfers left for up to this long [default = %d]\n"
+		"  -i  secs    Close connections idle for this long [default = %d]\n"
+		"  -l  addr    Local address to bind to [default INADDR_ANY for IPv4 or INADDR6_ANY for IPv6]\n"
+		"  -m  port    Serve Prometheus metrics on 127.0.0.1:port [default = disabled]\n"
+		"  -oa count   Maximum overlapped accepts to allow\n"
+		"  -os count   Maximum overlapped sends to allow, the limit adapts below it\n"
+		"  -od count   Maximum downloads to run at once, the limit adapts below it\n"
+		"  -ou count   Maximum uploads to run at once, the limit adapts below it\n"
+		"  -or count   Maximum overlapped receives to allow\n"
+		"  -o  count   Initial number of overlapped accepts to post\n"
+		"  -r          Take the listening sockets over from the server running on the port,\n"
+		"              which drains and exits. Give it its own -f and -m.\n"
+		"  -t          Record trace spans of each request in the log\n"
+		"  -u  count   Accounts kept in memory, idle ones beyond it are dropped [default = %d]\n"
+		"  -w  count   Threads verifying login passwords [default = %d]\n"
+		"  -x  subject Serve TLS with the certificate of this subject in the MY store [default = plaintext]\n",
+		gBufferSize,
+		gMemoryBudgetMb,
+		gBindPort,
+		gLogFileName,
+		gDrainTimeout,
+		gIdleTimeout,
+		gAccountCacheSize,
+		gAuthWorkerCount
+	);
+	return 0;
+}
+
+// Function: dbgprint
+// Description: Prints a message if compiled with the DEBUG flag.
+void dbgprint(char *format, ...)
+{
+#ifdef DEBUG
+	va_list vl;
+	char    dbgbuf[2048];
+	va_start(vl, format);
+	wvsprintf(dbgbuf, format, vl);
+	va_end(vl);
+	printf(dbgbuf);
+	OutputDebugString(dbgbuf);
+#endif
+}
+
+int isFileExists(const char *path)
+{
+	DIR_ENTRY entry;
+
+	// Look the file up in the directory index
+	return dirIndexStat(path, &entry) == 1 && !entry.isDir;
+}
+
+// Function: EnqueueDownloadingOperation
+// Description: Enqueues a buffer object into a list (at the end).
+// IN -BUFFER_OBJ **head: pointer to the address of head of Downloading buffer queue.
+//    -BUFFER_OBJ **end: pointer to the address of end of Downloading buffer queue.
+//    -BUFFER_OBJ *obj: pointer to buffer object to Downloading buffer queue.
+void EnqueueDownloadingOperation(BUFFER_OBJ **head, BUFFER_OBJ **end, BUFFER_OBJ *obj)
+{
+
+	obj->queued = metricNow();
+	EnterCriticalSection(&gReadingCritSec);
+
+	obj->next = NULL;
+	if (*end)
+	{
+		(*end)->next = obj;
+		(*end) = obj;
+	}
+	else
+	{
+		(*head) = (*end) = obj;
+	}
+
+	LeaveCriticalSection(&gReadingCritSec);
+
+	return;
+}
+
+// Function: EnqueueUploadingOperation
+// Description: Enqueues a buffer object into a list (at the end).
+// IN -BUFFER_OBJ **head: pointer to the address of head of Uploading buffer queue.
+//    -BUFFER_OBJ **end: pointer to the address of end of Uploading buffer queue.
+//    -BUFFER_OBJ *obj: pointer to buffer object to Uploading buffer queue 
+void EnqueueUploadingOperation(BUFFER_OBJ **head, BUFFER_OBJ **end, BUFFER_OBJ *obj)
+{
+
+	obj->queued = metricNow();
+	EnterCriticalSection(&gWritingCritSec);
+
+	obj->next = NULL;
+	if (*end)
+	{
+		(*end)->next = obj;
+		(*end) = obj;
+	}
+	else
+	{
+		(*head) = (*end) = obj;
+	}
+
+	LeaveCriticalSection(&gWritingCritSec);
+
+	return;
+}
+
+// Function: DequeueDownloadingOperation
+// Description: Dequeues the first entry in the list.
+// IN:  -BUFFER_OBJ **head:pointer to the address of head of Downloading buffer queue.
+//      -BUFFER_OBJ **end :pointer to the address of end of Downloading buffer queue.
+// OUT: -BUFFER_OBJ *     : poninter to the buffer object
+BUFFER_OBJ *DequeueDownloadingOperation(BUFFER_OBJ **head, BUFFER_OBJ **end)
+{
+	BUFFER_OBJ *obj = NULL;
+	EnterCriticalSection(&gReadingCritSec);
+
+	if (*head)
+	{
+		obj = *head;
+		(*head) = obj->next;
+
+		// If next is NULL, no more objects are in the queue
+		if (obj->next == NULL)
+		{
+			(*end) = NULL;
+		}
+	}
+	LeaveCriticalSection(&gReadingCritSec);
+	return obj;
+}
+
+// Function: DequeueUploadingOperation
+// Description: Dequeues the first entry in the list.
+// IN: -BUFFER_OBJ **head:pointer to address of the head of Uploading buffer queue.
+//    -BUFFER_OBJ **end :pointer toaddress of  the end of Uploading buffer queue.
+// OUT: -BUFFER_OBJ *     : poninter to the buffer object
+BUFFER_OBJ *DequeueUploadingOperation(BUFFER_OBJ **head, BUFFER_OBJ **end)
+{
+	BUFFER_OBJ *obj = NULL;
+	EnterCriticalSection(&gWritingCritSec);
+
+	if (*head)
+	{
+		obj = *head;
+		(*head) = obj->next;
+
+		// If next is NULL, no more objects are in the queue
+		if (obj->next == NULL)
+		{
+			(*end) = NULL;
+		}
+	}
+	LeaveCriticalSection(&gWritingCritSec);
+	return obj;
+}
+
+// Function: ProcessPendingOperations
+// Description:
+//    This function takes the pending sends from the send scheduler and posts them
+//    as long as a slot of the send limit is free.
+
+void ProcessPendingOperations()
+{
+	BUFFER_OBJ *sendobj = NULL;
+	while (admissionAcquire(&gSendLimit))
+	{
+		sendobj = dequeueSend();
+		if (sendobj)
+		{
+			if (PostSend(sendobj->sock, sendobj) == SOCKET_ERROR)
+			{
+				// Cleanup
+				LOG_WARN("ProcessPendingOperations: PostSend failed!\n");
+				admissionRelease(&gSendLimit);
+				FreeBufferObj(sendobj);
+				break;
+			}
+		}
+		else
+		{
+			admissionRelease(&gSendLimit);
+			break;
+		}
+	}
+	return;
+}
+
+// Function: ParseRanges
+// Description:
+//    Read the ranges of an OPT_FILE_RANGE request, "offset:length" pairs
+//    separated by commas. A length of 0 reads to the end of the file and a
+//    negative offset counts back from it, so "-100:0" is the last 100
+//    bytes. Each range must start inside the file and is clamped to it.
+// Return: 0 if succeed, else return 1
+// -IN: spec: the ranges
+//      fileLen: length of the file
+// -OUT: transfer: ranges and rangeCount set
+int ParseRanges(const char *spec, long long fileLen, LPFILE_TRANSFER_PROPERTY transfer)
+{
+	const char *p = spec;
+	char *end;
+	long long offset, length;
+
+	transfer->rangeCount = 0;
+	while (*p != 0)
+	{
+		if (transfer->rangeCount == TRANSFER_MAX_RANGES)
+			return 1;
+		offset = _strtoi64(p, &end, 10);
+		if (end == p || *end != ':')
+			return 1;
+		p = end + 1;
+		length = _strtoi64(p, &end, 10);
+		if (end == p || length < 0 || (*end != ',' && *end != 0))
+			return 1;
+		p = (*end == ',') ? end + 1 : end;
+
+		if (offset < 0)
+			offset = (offset < -fileLen) ? 0 : fileLen + offset;
+		if (offset >= fileLen)
+			return 1;
+		if (length == 0 || length > fileLen - offset)
+			length = fileLen - offset;
+		transfer->ranges[transfer->rangeCount].offset = offset;
+		transfer->ranges[transfer->rangeCount].length = length;
+		transfer->rangeCount++;
+	}
+	return transfer->rangeCount == 0;
+}
+
+// Function: ProcessDownloadingOperations
+// Description:
+//    This function goes through the list of pending Downloading operations 
+//    and process them end then postRecv or enqueuePendingOperations if needed.
+//    The time each block waited on the list drives the download limit.
+void ProcessDownloadingOperations()
+{
+	BUFFER_OBJ *readobj = NULL;
+	MESSAGE sendMessage;
+	BUFFER_OBJ *sendobj = NULL;
+	BUFFER_OBJ *recvobj = NULL;
+	char filePath[MAX_PATH];
+	while (TRUE)
+	{
+		readobj = DequeueDownloadingOperation(&gPendingReadList, &gPendingReadListEnd);
+		if (readobj)
+		{
+			admissionObserve(&gDownloadLimit, readobj->queued);
+			if (readobj->started != 0)
+				TRACE_SPAN(readobj->traceId, readobj->requestOp, "queue", readobj->started);
+			MESSAGE rcvMess;
+			rcvMess = readobj->sock->mess;
+			if (rcvMess.opcode == OPT_FILE_DOWN || rcvMess.opcode == OPT_FILE_RANGE)
+			{
+				Account* account = NULL;
+				char cookie[COOKIE_LEN];
+				bool ranged = rcvMess.opcode == OPT_FILE_RANGE;
+				const char *spec = "";
+				size_t specAt;
+				rcvMess.payload[COOKIE_LEN - 1] = 0;
+				rcvMess.payload[sizeof(rcvMess.payload) - 1] = 0;
+				strcpy_s(cookie, COOKIE_LEN, rcvMess.payload);
+
+				// A ranged request has its ranges after the file name
+				specAt = COOKIE_LEN + strlen(rcvMess.payload + COOKIE_LEN) + 1;
+				if (ranged && specAt < rcvMess.length && specAt < sizeof(rcvMess.payload))
+					spec = rcvMess.payload + specAt;
+
+				// Find account with cookie
+				account = findSession(cookie);
+
+				if (account == NULL) {
+					sendMessage.opcode = OPS_ERR_NOTFOUND;
+					sendMessage.length = 0;
+				}
+				else if (account->workingGroup == NULL) {
+					// Sessions restored at startup have no group open yet
+					sendMessage.opcode = OPS_ERR_FORBIDDEN;
+					sendMessage.length = 0;
+					accountRelease(account);
+				}
+				else
+				{
+					attachSendFlow(readobj->sock, account);
+					holdTransferAccount(readobj->sock, account);
+					readobj->sock->fileTransfer.group = groupLatest(account->workingGroup);
+					accountPath(account, rcvMess.payload + COOKIE_LEN, filePath, MAX_PATH);
+					snprintf(readobj->sock->fileTransfer.fileName, FILENAME_SIZE, "%s/%s/%s",
+						STORAGE_LOCATION, readobj->sock->fileTransfer.group->pathName, filePath);
+
+					LOG_DEBUG("Download of %s\n", readobj->sock->fileTransfer.fileName);
+					if (isFileExists(readobj->sock->fileTransfer.fileName)) {
+						LPFILE_TRANSFER_PROPERTY transfer = &readobj->sock->fileTransfer;
+
+						// Open file, block-compressed files only load their index here
+						if (openStoredFile(&transfer->stored, transfer->fileName, transfer->group->compressed, !ranged))
+						{
+							LOG_ERROR("Unable to open file %s\n", transfer->fileName);
+							readobj->sock->bClosing = TRUE;
+							sendMessage.opcode = OPS_ERR_SERVERFAIL;
+							sendMessage.length = 0;
+						}
+						else if (transfer->stored.rawLen > LONG_MAX)
+						{
+							// Frames carry their offset in a long
+							LOG_WARN("Cannot serve %s, it is over 2GB\n", transfer->fileName);
+							closeStoredFile(&transfer->stored);
+							sendMessage.opcode = OPS_ERR_TOOLARGE;
+							sendMessage.length = 0;
+						}
+						else
+						{
+							transfer->fileLen = transfer->stored.rawLen;
+							transfer->nLeft = transfer->fileLen;
+							transfer->idx = 0;
+							transfer->rangeCount = 0;
+							transfer->rangeIdx = 0;
+
+							if (!ranged)
+							{
+								// Clients that can decode blocks get the stored blocks as-is
+								transfer->passThrough = transfer->stored.isBlockFile && rcvMess.burst == TRANSFER_ACCEPT_BLOCKS;
+
+								sendMessage.opcode = OPT_FILE_DIGEST;
+								strcpy_s(sendMessage.payload, transfer->stored.digest);
+								sendMessage.length = strlen(transfer->stored.digest);
+							}
+							else if (ParseRanges(spec, transfer->fileLen, transfer))
+							{
+								closeStoredFile(&transfer->stored);
+								transfer->rangeCount = 0;
+								sendMessage.opcode = OPS_ERR_BADREQUEST;
+								sendMessage.length = 0;
+							}
+							else
+							{
+								// Only the blocks under the ranges are read, and each
+								//    range is followed by the digest of its bytes
+								transfer->passThrough = false;
+								transfer->idx = transfer->ranges[0].offset;
+								transfer->nLeft = transfer->ranges[0].length;
+								transfer->rangeDigest.Init();
+
+								// Answer with the file length and the ranges as clamped
+								sendMessage.opcode = OPT_RANGE_HEADER;
+								sendMessage.offset = (long)transfer->fileLen;
+								sendMessage.burst = transfer->rangeCount;
+								sendMessage.length = 0;
+								for (int i = 0; i < transfer->rangeCount; i++)
+									sendMessage.length += snprintf(sendMessage.payload + sendMessage.length,
+										sizeof(sendMessage.payload) - sendMessage.length, "%s%lld:%lld", i > 0 ? "," : "",
+										transfer->ranges[i].offset, transfer->ranges[i].length);
+							}
+						}
+					}
+					else
+					{
+						sendMessage.opcode = OPS_ERR_NOTFOUND;
+						strcpy_s(sendMessage.payload, readobj->sock->fileTransfer.fileName);
+						sendMessage.length = strlen(readobj->sock->fileTransfer.fileName);
+					}
+				}
+				memcpy(readobj->buf, &sendMessage, sizeof(MESSAGE));
+				sendobj = readobj;
+				sendobj->buflen = sizeof(MESSAGE);
+				sendobj->sock = readobj->sock;
+				enqueueSend(sendobj);
+
+			}
+			else if ((rcvMess.opcode == OPT_FILE_DATA || rcvMess.opcode == OPT_RANGE_DIGEST || rcvMess.opcode == OPS_OK)
+				&& readobj->sock->fileTransfer.rangeCount > 0 && readobj->sock->fileTransfer.nLeft == 0)
+			{
+				// The range is sent, close it with its digest and move to the next
+				LPFILE_TRANSFER_PROPERTY transfer = &readobj->sock->fileTransfer;
+
+				transfer->rangeDigest.Final();
+				sendMessage.opcode = OPT_RANGE_DIGEST;
+				sendMessage.offset = (long)transfer->ranges[transfer->rangeIdx].offset;
+				sendMessage.burst = transfer->rangeIdx;
+				strcpy_s(sendMessage.payload, transfer->rangeDigest.digestChars);
+				sendMessage.length = DIGEST_SIZE - 1;
+
+				if (++transfer->rangeIdx < transfer->rangeCount)
+				{
+					transfer->idx = transfer->ranges[transfer->rangeIdx].offset;
+					transfer->nLeft = transfer->ranges[transfer->rangeIdx].length;
+					transfer->rangeDigest.Init();
+				}
+
+				memcpy(readobj->buf, &sendMessage, sizeof(MESSAGE));
+				sendobj = readobj;
+				sendobj->buflen = sizeof(MESSAGE);
+				sendobj->sock = readobj->sock;
+				enqueueSend(sendobj);
+			}
+			else if (rcvMess.opcode == OPT_FILE_DATA || rcvMess.opcode == OPT_RANGE_DIGEST || rcvMess.opcode == OPS_OK)
+			{
+
+
+				LPFILE_TRANSFER_PROPERTY transfer = &readobj->sock->fileTransfer;
+				LONGLONG diskStart;
+				int rawLen;
+
+				// Hold the block back while the account or group is over its limit
+				if (transfer->passThrough)
+					rawLen = storedBlockRawLen(&transfer->stored, (int)(transfer->idx / STORE_BLOCK_SIZE));
+				else
+					rawLen = (transfer->nLeft > BUFF_SIZE) ? BUFF_SIZE : (int)transfer->nLeft;
+				if (qosAdmit(readobj, rawLen, ResumeDownload))
+					continue;
+
+				sendMessage.opcode = OPT_FILE_DATA;
+				sendMessage.burst = 0;
+				if (transfer->passThrough)
+				{
+					// Forward the stored block without decoding it
+					bool isCompressed;
+					int blockIdx = (int)(transfer->idx / STORE_BLOCK_SIZE);
+					rawLen = storedBlockRawLen(&transfer->stored, blockIdx);
+					diskStart = metricNow();
+					sendMessage.length = readStoredBlock(&transfer->stored, blockIdx, sendMessage.payload, &isCompressed);
+					metricObserve(&gMetricDiskRead, diskStart);
+					TRACE_SPAN(readobj->traceId, readobj->requestOp, "disk", diskStart);
+					if (isCompressed)
+					{
+						sendMessage.opcode = OPT_FILE_BLOCK;
+						sendMessage.burst = rawLen;
+					}
+				}
+				else
+				{
+					rawLen = (transfer->nLeft > BUFF_SIZE) ? BUFF_SIZE : (int)transfer->nLeft;
+					diskStart = metricNow();
+					sendMessage.length = readStoredRange(&transfer->stored, transfer->idx, sendMessage.payload, rawLen);
+					metricObserve(&gMetricDiskRead, diskStart);
+					TRACE_SPAN(readobj->traceId, readobj->requestOp, "disk", diskStart);
+				}
+
+				if ((int)sendMessage.length < 0)
+				{
+					LOG_ERROR("Unable to read %s at %lld\n", transfer->fileName, transfer->idx);
+					closeStoredFile(&transfer->stored);
+					sendMessage.opcode = OPS_ERR_SERVERFAIL;
+					sendMessage.length = 0;
+					rawLen = (int)transfer->nLeft;
+				}
+				else if (transfer->rangeCount > 0)
+				{
+					transfer->rangeDigest.Update((unsigned char *)sendMessage.payload, sendMessage.length);
+				}
+				sendMessage.offset = (long)transfer->idx;
+
+				transfer->nLeft -= rawLen;
+				transfer->idx += rawLen;
+
+				memcpy(readobj->buf, &sendMessage, sizeof(MESSAGE));
+
+
+				sendobj = readobj;
+				sendobj->buflen = sizeof(MESSAGE);
+				sendobj->sock = readobj->sock;
+				//PostSend(sockobj, sendobj);
+				enqueueSend(sendobj);
+			}
+			else if (rcvMess.opcode == OPT_FILE_DIGEST || rcvMess.opcode == OPT_RANGE_HEADER)
+			{
+				recvobj = readobj;
+				recvobj->sock = readobj->sock;
+				PostRecv(readobj->sock, recvobj);
+			}
+			ProcessPendingOperations();
+
+		}
+		else
+		{
+			break;
+		}
+	}
+	return;
+}
+
+// Function: ProcessUploadingOperations
+// Description:
+//    This function goes through the list of pending Uploading operations 
+//    and process them end then postRecv or enqueuePendingOperations if needed.
+//    The time each block waited on the list drives the upload limit.
+void ProcessUploadingOperations() {
+	BUFFER_OBJ *writeobj = NULL;
+	BUFFER_OBJ *rcvobj = NULL;
+	BUFFER_OBJ *sendobj = NULL;
+	MESSAGE sendMessage;
+	char filePath[MAX_PATH];
+	while (TRUE)
+	{
+		writeobj = DequeueUploadingOperation(&gPendingWriteList, &gPendingWriteListEnd);
+		if (writeobj)
+		{
+			admissionObserve(&gUploadLimit, writeobj->queued);
+			if (writeobj->started != 0)
+				TRACE_SPAN(writeobj->traceId, writeobj->requestOp, "queue", writeobj->started);
+
+			MESSAGE rcvMess;
+			rcvMess = writeobj->sock->mess;
+			if (rcvMess.opcode == OPT_FILE_UP)
+			{
+				Account* account = NULL;
+				char cookie[COOKIE_LEN];
+				rcvMess.payload[COOKIE_LEN - 1] = 0;
+				strcpy_s(cookie, COOKIE_LEN, rcvMess.payload);
+
+				// Find account with cookie
+				account = findSession(cookie);
+
+				if (account == NULL) {
+					sendMessage.opcode = OPS_ERR_NOTFOUND;
+					sendMessage.length = 0;
+				}
+				else if (account->workingGroup == NULL) {
+					// Nowhere to upload to until a group is opened
+					sendMessage.opcode = OPS_ERR_FORBIDDEN;
+					sendMessage.length = 0;
+					accountRelease(account);
+				}
+				else
+				{
+					writeobj->sock->fileTransfer.group = groupLatest(account->workingGroup);
+					accountPath(account, rcvMess.payload + COOKIE_LEN, filePath, MAX_PATH);
+					snprintf(writeobj->sock->fileTransfer.fileName, FILENAME_SIZE, "%s/%s/%s",
+						STORAGE_LOCATION, writeobj->sock->fileTransfer.group->pathName, filePath);
+
+					// strcat_s(writeobj->sock->fileTransfer.fileName, rcvMess.payload);
+					LOG_DEBUG("Upload of %s\n", writeobj->sock->fileTransfer.fileName);
+					holdTransferAccount(writeobj->sock, account);
+
+					if (!isFileExists(writeobj->sock->fileTransfer.fileName))
+					{
+						writeobj->sock->fileTransfer.file = fopen(writeobj->sock->fileTransfer.fileName, "wb");
+						if (!writeobj->sock->fileTransfer.file)
+						{
+							LOG_ERROR("Unable to open file %s\n", writeobj->sock->fileTransfer.fileName);
+							writeobj->sock->bClosing = TRUE;
+							sendMessage.opcode = OPS_ERR_SERVERFAIL;
+							sendMessage.length = 0;
+						}
+						else
+						{
+							dirIndexRefresh(writeobj->sock->fileTransfer.fileName);
+							sendMessage.opcode = OPS_OK;
+							strcpy_s(sendMessage.payload, writeobj->sock->fileTransfer.fileName);
+							sendMessage.length = strlen(writeobj->sock->fileTransfer.fileName);
+						}
+					}
+					else
+					{
+						sendMessage.opcode = OPS_ERR_ALREADYEXISTS;
+						strcpy_s(sendMessage.payload, writeobj->sock->fileTransfer.fileName);
+						sendMessage.length = strlen(writeobj->sock->fileTransfer.fileName);
+					}
+
+				}
+				memcpy(writeobj->buf, &sendMessage, sizeof(MESSAGE));
+				sendobj = writeobj;
+				sendobj->buflen = sizeof(MESSAGE);
+				sendobj->sock = writeobj->sock;
+				enqueueSend(sendobj);
+				
+			}
+			else if (rcvMess.opcode == OPS_OK)
+			{
+				rcvobj = writeobj;
+				rcvobj->sock = writeobj->sock;
+				PostRecv(writeobj->sock, rcvobj);
+			}
+			else if (rcvMess.opcode == OPT_FILE_DATA)
+			{
+				if (rcvMess.length == 0)
+				{
+					fclose(writeobj->sock->fileTransfer.file);
+					MD5 md5;
+					if (strcmp(md5.digestFile(writeobj->sock->fileTransfer.fileName), writeobj->sock->fileTransfer.digest) == 0)
+					{
+						LOG_DEBUG("Upload verified, digest %s\n", writeobj->sock->fileTransfer.digest);
+
+						// Convert to the block format if the group stores compressed files
+						if (writeobj->sock->fileTransfer.group != NULL && groupLatest(writeobj->sock->fileTransfer.group)->compressed)
+						{
+							if (compressStoredFile(writeobj->sock->fileTransfer.fileName, writeobj->sock->fileTransfer.digest))
+								LOG_WARN("Unable to compress %s, keeping it raw\n", writeobj->sock->fileTransfer.fileName);
+						}
+						dirIndexRefresh(writeobj->sock->fileTransfer.fileName);
+
+						sendMessage.opcode = OPS_SUCCESS;
+						strcpy_s(sendMessage.payload, writeobj->sock->fileTransfer.fileName);
+						sendMessage.length = strlen(writeobj->sock->fileTransfer.fileName);
+
+
+						memcpy(writeobj->buf, &sendMessage, sizeof(MESSAGE));
+						sendobj = writeobj;
+						sendobj->buflen = sizeof(MESSAGE);
+						sendobj->sock = writeobj->sock;
+						enqueueSend(sendobj);
+					}
+					else
+					{
+						LOG_WARN("Upload of %s corrupted\n", writeobj->sock->fileTransfer.fileName);
+						if (remove(writeobj->sock->fileTransfer.fileName) != 0)
+						{
+							LOG_ERROR("Error deleting file %s\n", writeobj->sock->fileTransfer.fileName);
+							writeobj->sock->bClosing = TRUE;
+							sendMessage.opcode = OPS_ERR_SERVERFAIL;
+							sendMessage.length = 0;
+							memcpy(writeobj->buf, &sendMessage, sizeof(MESSAGE));
+							sendobj = writeobj;
+							sendobj->buflen = sizeof(MESSAGE);
+							sendobj->sock = writeobj->sock;
+							enqueueSend(sendobj);
+							continue;
+						}
+						else
+							LOG_DEBUG("File successfully deleted\n");
+						dirIndexRefresh(writeobj->sock->fileTransfer.fileName);
+
+						MESSAGE sendMessage;
+
+						sendMessage.opcode = OPS_ERR_FILE_CORRUPTED;
+						strcpy_s(sendMessage.payload, writeobj->sock->fileTransfer.fileName);
+						sendMessage.length = strlen(writeobj->sock->fileTransfer.fileName);
+
+
+						memcpy(writeobj->buf, &sendMessage, sizeof(MESSAGE));
+						sendobj = writeobj;
+						sendobj->buflen = sizeof(MESSAGE);
+						sendobj->sock = writeobj->sock;
+						enqueueSend(sendobj);
+					}
+				}
+				else
+				{
+					// Hold the block back while the account or group is over its limit
+					if (qosAdmit(writeobj, rcvMess.length, ResumeUpload))
+						continue;
+
+					LOG_DEBUG("Writing at %ld\n", rcvMess.offset);
+					LONGLONG diskStart = metricNow();
+					fseek(writeobj->sock->fileTransfer.file, rcvMess.offset, SEEK_SET);
+					fwrite(rcvMess.payload, 1, rcvMess.length, writeobj->sock->fileTransfer.file);
+					metricObserve(&gMetricDiskWrite, diskStart);
+					TRACE_SPAN(writeobj->traceId, writeobj->requestOp, "disk", diskStart);
+					rcvobj = writeobj;
+					rcvobj->sock = writeobj->sock;
+					PostRecv(writeobj->sock, rcvobj);
+				}
+			}
+			else if (rcvMess.opcode = OPT_FILE_DIGEST)
+			{
+
+				strcpy_s(writeobj->sock->fileTransfer.digest, rcvMess.payload);
+				LOG_DEBUG("Upload digest %s\n", writeobj->sock->fileTransfer.digest);
+				rcvobj = writeobj;
+				rcvobj->sock = writeobj->sock;
+				PostRecv(writeobj->sock, rcvobj);
+
+			}
+			ProcessPendingOperations();
+			//ProcessPendingOperations();
+
+		}
+		else
+		{
+			break;
+		}
+	}
+	return;
+}
+
+// Function: InsertPendingAccept
+// Description: Inserts a pending accept operation into the listening object.
+//    Buffers are dealt round robin over the accept shards.
+void InsertPendingAccept(LISTEN_OBJ *listenobj, BUFFER_OBJ *obj)
+{
+	ACCEPT_SHARD *shard;
+
+	obj->acceptShard = (int)((unsigned long)InterlockedIncrement(&listenobj->NextShard) % ACCEPT_SHARD_COUNT);
+	shard = &listenobj->PendingAccepts[obj->acceptShard];
+
+	EnterCriticalSection(&shard->cs);
+	// Insert at head - order doesn't really matter
+	obj->prev = NULL;
+	obj->next = shard->head;
+	if (shard->head)
+		shard->head->prev = obj;
+	shard->head = obj;
+	LeaveCriticalSection(&shard->cs);
+}
+
+// Function: RemovePendingAccept
+// Description:
+//    Removes the indicated accept buffer object from the list of pending
+//    accepts in the listening object.
+
+void RemovePendingAccept(LISTEN_OBJ *listenobj, BUFFER_OBJ *obj)
+{
+	ACCEPT_SHARD *shard = &listenobj->PendingAccepts[obj->acceptShard];
+
+	EnterCriticalSection(&shard->cs);
+	if (obj->prev)
+		obj->prev->next = obj->next;
+	else
+		shard->head = obj->next;
+	if (obj->next)
+		obj->next->prev = obj->prev;
+	obj->prev = obj->next = NULL;
+	LeaveCriticalSection(&shard->cs);
+}
+
+// Function: GetBufferObj
+// Description:
+//    Allocate a BUFFER_OBJ. A look aside list is maintained to increase performance
+//    as these objects are allocated frequently.
+
+BUFFER_OBJ *GetBufferObj(int buflen)
+{
+	BUFFER_OBJ *newobj = NULL;
+	EnterCriticalSection(&gBufferListCs);
+	if (gFreeBufferList == NULL)
+	{
+		// Allocate the object
+		newobj = (BUFFER_OBJ *)HeapAlloc(
+			GetProcessHeap(),
+			HEAP_ZERO_MEMORY,
+			sizeof(BUFFER_OBJ) + (sizeof(BYTE) * buflen)
+		);
+		if (newobj == NULL)
+		{
+			LOG_ERROR("GetBufferObj: HeapAlloc failed: %d\n", GetLastError());
+		}
+	}
+	else
+	{
+		newobj = gFreeBufferList;
+		gFreeBufferList = newobj->next;
+		newobj->next = NULL;
+	}
+	LeaveCriticalSection(&gBufferListCs);
+
+	if (newobj)
+	{
+		admissionMemoryAdd(sizeof(BUFFER_OBJ) + gBufferSize);
+		newobj->buf = (char *)(((char *)newobj) + sizeof(BUFFER_OBJ));
+		newobj->buflen = buflen;
+		newobj->addrlen = sizeof(newobj->addr);
+	}
+
+	return newobj;
+}
+
+// Function: FreeBufferObj
+// Description: Free the buffer object. This adds the object to the free look aside list.
+
+void FreeBufferObj(BUFFER_OBJ *obj)
+{
+	admissionMemoryAdd(-(LONGLONG)(sizeof(BUFFER_OBJ) + gBufferSize));
+	EnterCriticalSection(&gBufferListCs);
+	memset(obj, 0, sizeof(BUFFER_OBJ) + gBufferSize);
+	obj->next = gFreeBufferList;
+	gFreeBufferList = obj;
+	LeaveCriticalSection(&gBufferListCs);
+}
+
+// Function: GetSocketObj
+// Description:
+//    Allocate a socket object and initialize its members. A socket object is
+//    allocated for each socket created (either by socket or accept).
+//    Socket objects are returned from a look aside list if available. Otherwise, a new object is allocated.
+
+SOCKET_OBJ *GetSocketObj(SOCKET s, int af)
+{
+	SOCKET_OBJ  *sockobj = NULL;
+	EnterCriticalSection(&gSocketListCs);
+	if (gFreeSocketList == NULL)
+	{
+		sockobj = (SOCKET_OBJ *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(SOCKET_OBJ));
+		if (sockobj == NULL)
+		{
+			LOG_ERROR("GetSocketObj: HeapAlloc failed: %d\n", GetLastError());
+		}
+		else
+		{
+			InitializeCriticalSection(&sockobj->SockCritSec);
+		}
+	}
+	else
+	{
+		sockobj = gFreeSocketList;
+		gFreeSocketList = sockobj->next;
+		sockobj->next = NULL;
+	}
+	LeaveCriticalSection(&gSocketListCs);
+
+	// Initialize the members
+	if (sockobj)
+	{
+		admissionMemoryAdd(sizeof(SOCKET_OBJ));
+		sockobj->s = s;
+		sockobj->af = af;
+	}
+	return sockobj;
+}
+
+// Function: holdTransferAccount
+// Description: Set the account a transfer runs for. The connection keeps
+//    the pin of the account until another transfer or until it is freed,
+//    since the session may end while the transfer is running.
+// -IN: sock: the connection
+//      account: the account, pinned by the caller, NULL to drop it
+void holdTransferAccount(SOCKET_OBJ *sock, Account *account)
+{
+	if (sock->fileTransfer.account != NULL)
+		accountRelease(sock->fileTransfer.account);
+	sock->fileTransfer.account = account;
+}
+
+// Function: FreeSocketObj
+// Description: Frees a socket object. The object is added to the lookaside list.
+
+void FreeSocketObj(SOCKET_OBJ *obj)
+{
+	CRITICAL_SECTION cstmp;
+	BUFFER_OBJ      *ptr = NULL, *next;
+
+	// Make sure the idle timer cannot fire on the recycled object
+	timerCancel(&obj->IdleTimer);
+	metricAdd(&gMetricConnectionsClosed, 1);
+
+	// Sends the scheduler had not posted yet go with the connection
+	for (ptr = dropSends(obj); ptr != NULL; ptr = next)
+	{
+		next = ptr->next;
+		FreeBufferObj(ptr);
+	}
+
+	// Close the socket if it hasn't already been closed
+	if (obj->s != INVALID_SOCKET)
+	{
+		LOG_DEBUG("FreeSocketObj: closing socket %d\n", obj->s);
+		disconnect(obj->s);
+		closesocket(obj->s);
+		obj->s = INVALID_SOCKET;
+	}
+
+	// Release any file left open by an interrupted download
+	closeStoredFile(&obj->fileTransfer.stored);
+	holdTransferAccount(obj, NULL);
+
+	// Give back the slot of the transfer, if it was admitted
+	if (obj->Admission != NULL)
+		admissionRelease(obj->Admission);
+	if (obj->Tls != NULL)
+		tlsFree(obj->Tls);
+	admissionMemoryAdd(-(LONGLONG)sizeof(SOCKET_OBJ));
+
+	EnterCriticalSection(&gSocketListCs);
+	cstmp = obj->SockCritSec;
+	memset(obj, 0, sizeof(SOCKET_OBJ));
+	obj->SockCritSec = cstmp;
+	obj->next = gFreeSocketList;
+	gFreeSocketList = obj;
+	LeaveCriticalSection(&gSocketListCs);
+}
+
+// Function: ValidateArgs
+// Description: Parses the command line arguments and sets up some global variables.
+void ValidateArgs(int argc, char **argv)
+{
+	int     i;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (((argv[i][0] != '/') && (argv[i][0] != '-')) || (strlen(argv[i]) < 2))
+			usage(argv[0]);
+		else
+		{
+			switch (tolower(argv[i][1]))
+			{
+			case 'a':               // address family - IPv4 or IPv6
+				if (i + 1 >= argc)
+					usage(argv[0]);
+				if (argv[i + 1][0] == '4')
+					gAddressFamily = AF_INET;
+				else if (argv[i + 1][0] == '6')
+					gAddressFamily = AF_INET6;
+				else
+					usage(argv[0]);
+				i++;
+				break;
+
+			case 'b':               // buffer size for send/recv
+				if (i + 1 >= argc)
+					usage(argv[0]);
+				gBufferSize = atol(argv[++i]);
+				break;
+
+			case 'c':               // memory budget in MB
+				if (i + 1 >= argc)
+					usage(argv[0]);
+				gMemoryBudgetMb = atol(argv[++i]);
+				if (gMemoryBudgetMb <= 0)
+					usage(argv[0]);
+				break;
+
+			case 'd':               // decode a log file
+				if (i + 1 >= argc)
+					usage(argv[0]);
+				exit(logDecodeFile(argv[++i]));
+				break;
+
+			case 'e':               // endpoint - port number
+				if (i + 1 >= argc)
+					usage(argv[0]);
+				gBindPort = argv[++i];
+				break;
+
+			case 'f':               // binary log file
+				if (i + 1 >= argc)
+					usage(argv[0]);
+				gLogFileName = argv[++i];
+				break;
+
+			case 'g':               // drain deadline in seconds
+				if (i + 1 >= argc)
+					usage(argv[0]);
+				gDrainTimeout = atol(argv[++i]);
+				if (gDrainTimeout < 0)
+					usage(argv[0]);
+				break;
+
+			case 'i':               // idle timeout in seconds
+				if (i + 1 >= argc)
+					usage(argv[0]);
+				gIdleTimeout = atol(argv[++i]);
+				break;
+
+			case 'l':               // local address for binding
+				if (i + 1 >= argc)
+					usage(argv[0]);
+				gBindAddr = argv[++i];
+				break;
+
+			case 'm':               // metrics admin port
+				if (i + 1 >= argc)
+					usage(argv[0]);
+				gMetricsPort = argv[++i];
+				break;
+
+			case 'o':               // overlapped count
+				if (i + 1 >= argc)
+					usage(argv[0]);
+				if (strlen(argv[i]) == 2)       // Overlapped accept initial count
+				{
+					gInitialAccepts = atol(argv[++i]);
+				}
+				else if (strlen(argv[i]) == 3)
+				{
+					if (tolower(argv[i][2]) == 'a')
+						gMaxAccepts = atol(argv[++i]);
+					else if (tolower(argv[i][2]) == 's')
+						gMaxSends = atol(argv[++i]);
+					else if (tolower(argv[i][2]) == 'r')
+						gMaxReceives = atol(argv[++i]);
+					else if (tolower(argv[i][2]) == 'd')
+						gMaxDownloads = atol(argv[++i]);
+					else if (tolower(argv[i][2]) == 'u')
+						gMaxUploads = atol(argv[++i]);
+					else
+						usage(argv[0]);
+				}
+				else
+				{
+					usage(argv[0]);
+				}
+				break;
+
+			case 'r':               // take over from the running server
+				gTakeOver = 1;
+				break;
+
+			case 't':               // trace spans
+				gTraceEnabled = 1;
+				break;
+
+			case 'u':               // account cache size
+				if (i + 1 >= argc)
+					usage(argv[0]);
+				gAccountCacheSize = atol(argv[++i]);
+				if (gAccountCacheSize < ACCOUNT_CACHE_MIN)
+					usage(argv[0]);
+				break;
+
+			case 'w':               // auth pool threads
+				if (i + 1 >= argc)
+					usage(argv[0]);
+				gAuthWorkerCount = atol(argv[++i]);
+				if (gAuthWorkerCount <= 0 || gAuthWorkerCount > AUTH_WORKERS_MAX)
+					usage(argv[0]);
+				break;
+
+			case 'x':               // TLS certificate subject
+				if (i + 1 >= argc)
+					usage(argv[0]);
+				gTlsSubject = argv[++i];
+				break;
+
+			default:
+				usage(argv[0]);
+				break;
+			}
+		}
+	}
+}
+
+// Function: RecordRequestDone
+// Description:
+//    Record the latency of the request a buffer carried, if any. Called when
+//    the buffer is posted again, which is when the server is done with the
+//    request: its response is sent or the next message is awaited.
+void RecordRequestDone(BUFFER_OBJ *buf)
+{
+	if (buf->started != 0)
+	{
+		metricObserveRequest(buf->requestOp, buf->started);
+		buf->started = 0;
+	}
+}
+
+// Function: CollectServerGauges
+// Description: Append the queue depths and admission limits to
+//    a metrics scrape. The queues are walked under their locks, so nothing
+//    is counted on the I/O path.
+void CollectServerGauges(std::string &out)
+{
+	BUFFER_OBJ *obj;
+	int         depth, bulk, shares;
+
+	appendHelp(out, "clouddrive_queue_depth", "gauge", "Buffers waiting in the pending operation queues.");
+	sendBacklog(&depth, &bulk, &shares);
+	appendMetric(out, "clouddrive_queue_depth", "queue=\"send_control\"", depth);
+	appendMetric(out, "clouddrive_queue_depth", "queue=\"send_bulk\"", bulk);
+
+	EnterCriticalSection(&gReadingCritSec);
+	for (depth = 0, obj = gPendingReadList; obj != NULL; obj = obj->next)
+		depth++;
+	LeaveCriticalSection(&gReadingCritSec);
+	appendMetric(out, "clouddrive_queue_depth", "queue=\"download\"", depth);
+
+	EnterCriticalSection(&gWritingCritSec);
+	for (depth = 0, obj = gPendingWriteList; obj != NULL; obj = obj->next)
+		depth++;
+	LeaveCriticalSection(&gWritingCritSec);
+	appendMetric(out, "clouddrive_queue_depth", "queue=\"upload\"", depth);
+
+	appendHelp(out, "clouddrive_send_shares", "gauge", "Accounts with download frames waiting for the send scheduler.");
+	appendMetric(out, "clouddrive_send_shares", NULL, shares);
+
+	EnterCriticalSection(&gAccountCritSec);
+	collectQosMetrics(out, gAccountById, groupCatalogEnter()->groups);
+	groupCatalogLeave();
+	LeaveCriticalSection(&gAccountCritSec);
+	collectAccountMetrics(out);
+	collectCatalogMetrics(out);
+	collectChangeFeedMetrics(out);
+	collectLoginGuardMetrics(out);
+	collectAdmissionMetrics(out);
+	collectHandoffMetrics(out);
+	collectAuthMetrics(out);
+	collectCopyMetrics(out);
+	if (gTlsEnabled)
+		collectTlsMetrics(out);
+}
+
+// Function: PostRecv
+// Description: Post an overlapped receive operation on the socket.
+//    A TLS connection receives into its session. If records already
+//    received can serve the receive, its completion is posted instead.
+int PostRecv(SOCKET_OBJ *sock, BUFFER_OBJ *recvobj)
+{
+	WSABUF  wbuf;
+	DWORD   bytes, flags;
+	int     rc;
+
+	RecordRequestDone(recvobj);
+	recvobj->operation = OP_READ;
+	wbuf.buf = recvobj->buf + recvobj->received;
+	wbuf.len = sizeof(MESSAGE) - recvobj->received;
+	if (sock->Tls != NULL)
+	{
+		if (tlsBuffered(sock->Tls))
+		{
+			recvobj->tlsReplay = TRUE;
+			InterlockedIncrement(&sock->OutstandingRecv);
+			if (PostQueuedCompletionStatus(gCompletionPort, 0, (ULONG_PTR)sock, &recvobj->ol) == FALSE)
+			{
+				dbgprint("PostRecv: PostQueuedCompletionStatus failed: %d\n", GetLastError());
+				InterlockedDecrement(&sock->OutstandingRecv);
+				return SOCKET_ERROR;
+			}
+			return NO_ERROR;
+		}
+		wbuf.buf = sock->Tls->in + sock->Tls->inLen;
+		wbuf.len = tlsRecvSpace(sock->Tls);
+	}
+	flags = 0;
+	EnterCriticalSection(&sock->SockCritSec);
+	rc = WSARecv(sock->s, &wbuf, 1, &bytes, &flags, &recvobj->ol, NULL);
+
+	if (rc == SOCKET_ERROR)
+	{
+		rc = NO_ERROR;
+		if (WSAGetLastError() != WSA_IO_PENDING)
+		{
+			dbgprint("PostRecv: WSARecv* failed: %d\n", WSAGetLastError());
+			rc = SOCKET_ERROR;
+		}
+	}
+	if (rc == NO_ERROR)
+	{
+		// Increment outstanding overlapped operations
+		InterlockedIncrement(&sock->OutstandingRecv);
+	}
+	LeaveCriticalSection(&sock->SockCritSec);
+	return rc;
+}
+
+// Function: PostSend
+// Description: Post an overlapped send operation on the socket.
+//    On a TLS connection the frame is sealed after itself in the buffer,
+//    unless the buffer carries handshake bytes there already.
+
+int PostSend(SOCKET_OBJ *sock, BUFFER_OBJ *sendobj)
+{
+	WSABUF  wbuf;
+	DWORD   bytes;
+	int     rc, err, sealed;
+
+	RecordRequestDone(sendobj);
+	sendobj->sendPosted = metricNow();
+	sendobj->operation = OP_WRITE;
+	wbuf.buf = sendobj->buf;
+	wbuf.len = sizeof(MESSAGE);
+	EnterCriticalSection(&sock->SockCritSec);
+	if (sock->Tls != NULL)
+	{
+		wbuf.buf = sendobj->buf + sizeof(MESSAGE);
+		wbuf.len = sendobj->wireLen;
+		if (sendobj->wireLen == 0)
+		{
+			sealed = tlsSeal(sock->Tls, sendobj->buf, sizeof(MESSAGE), wbuf.buf, gBufferSize - sizeof(MESSAGE));
+			if (sealed < 0)
+			{
+				LeaveCriticalSection(&sock->SockCritSec);
+				LOG_WARN("PostSend: unable to seal opcode %d\n", ((MESSAGE *)sendobj->buf)->opcode);
+				return SOCKET_ERROR;
+			}
+			wbuf.len = sealed;
+		}
+	}
+	rc = WSASend(sock->s, &wbuf, 1, &bytes, 0, &sendobj->ol, NULL);
+
+	if (rc == SOCKET_ERROR)
+	{
+		rc = NO_ERROR;
+		if ((err = WSAGetLastError()) != WSA_IO_PENDING)
+		{
+			if (err == WSAENOBUFS)
+				DebugBreak();
+			dbgprint("PostSend: WSASend* failed: %d [internal = %d]\n", WSAGetLastError(), sendobj->ol.Internal);
+			rc = SOCKET_ERROR;
+		}
+	}
+	if (rc == NO_ERROR)
+	{
+		// Increment the outstanding operation count
+		InterlockedIncrement(&sock->OutstandingSend);
+	}
+	LeaveCriticalSection(&sock->SockCritSec);
+	return rc;
+}
+
+// Function: CompleteDeferredResponse
+// Description: Send the response of a request that parseAndProcess did not
+//    answer right away. The buffer still belongs to the request and its
+//    socket has no receive posted, so it is sent like an immediate response.
+void CompleteDeferredResponse(BUFFER_OBJ *bufferObj)
+{
+	memcpy(bufferObj->buf, &bufferObj->sock->mess, sizeof(MESSAGE));
+	enqueueSend(bufferObj);
+	ProcessPendingOperations();
+}
+
+// Function: PostAccept
+// Description: Post an overlapped accept on a listening socket.
+int PostAccept(LISTEN_OBJ *listen, BUFFER_OBJ *acceptobj)
+{
+	DWORD   bytes;
+	int     rc;
+
+	acceptobj->operation = OP_ACCEPT;
+
+	// Create the client socket for an incoming connection
+	acceptobj->sclient = socket(listen->AddressFamily, SOCK_STREAM, IPPROTO_TCP);
+	if (acceptobj->sclient == INVALID_SOCKET)
+	{
+		LOG_ERROR("PostAccept: socket failed: %d\n", WSAGetLastError());
+		return -1;
+	}
+
+	rc = listen->lpfnAcceptEx(
+		listen->s,
+		acceptobj->sclient,
+		acceptobj->buf,
+		acceptobj->buflen - ((sizeof(SOCKADDR_STORAGE) + 16) * 2),
+		sizeof(SOCKADDR_STORAGE) + 16,
+		sizeof(SOCKADDR_STORAGE) + 16,
+		&bytes,
+		&acceptobj->ol
+	);
+	if (rc == FALSE)
+	{
+		if (WSAGetLastError() != WSA_IO_PENDING)
+		{
+			LOG_ERROR("PostAccept: AcceptEx failed: %d\n", WSAGetLastError());
+			return SOCKET_ERROR;
+		}
+	}
+
+	// Increment the outstanding overlapped count for this socket
+	InterlockedIncrement(&listen->PendingAcceptCount);
+	return NO_ERROR;
+}
+
+// Function: PostNewAccept
+// Description: Get a buffer, track it as a pending accept and post an
+//    AcceptEx with it. Everything is undone if the accept cannot be posted.
+int PostNewAccept(LISTEN_OBJ *listenobj)
+{
+	BUFFER_OBJ *acceptobj;
+
+	acceptobj = GetBufferObj(gBufferSize);
+	if (acceptobj == NULL)
+	{
+		LOG_ERROR("Out of memory!\n");
+		return SOCKET_ERROR;
+	}
+
+	acceptobj->PostAccept = listenobj->AcceptEvent;
+	InsertPendingAccept(listenobj, acceptobj);
+	if (PostAccept(listenobj, acceptobj) != NO_ERROR)
+	{
+		RemovePendingAccept(listenobj, acceptobj);
+		if (acceptobj->sclient != INVALID_SOCKET)
+		{
+			closesocket(acceptobj->sclient);
+			acceptobj->sclient = INVALID_SOCKET;
+		}
+		FreeBufferObj(acceptobj);
+		return SOCKET_ERROR;
+	}
+
+	// The accept does not complete until the client sends something, watch
+	//    for connections that never do
+	timerArm(&acceptobj->timer, ACCEPT_CHECK_INTERVAL * 1000, AcceptTimeout, acceptobj);
+	return NO_ERROR;
+}
+
+// Function: AcceptTimeout
+// Description:
+//    Timer callback of a pending accept. If the client socket has been
+//    connected for longer than ACCEPT_TIMEOUT without sending its first
+//    message it is closed, which fails the AcceptEx in the completion
+//    thread. Otherwise the check is armed again.
+void AcceptTimeout(TIMER *timer)
+{
+	BUFFER_OBJ *acceptobj = (BUFFER_OBJ *)timer->context;
+	int         optval, optlen, rc;
+
+	optlen = sizeof(optval);
+	rc = getsockopt(acceptobj->sclient, SOL_SOCKET, SO_CONNECT_TIME, (char *)&optval, &optlen);
+	if (rc == SOCKET_ERROR)
+	{
+		LOG_WARN("getsockopt: SO_CONNECT_TIME failed: %d\n", WSAGetLastError());
+	}
+	else if ((optval != 0xFFFFFFFF) && (optval >= ACCEPT_TIMEOUT))
+	{
+		LOG_INFO("Closing stale accept\n");
+		closesocket(acceptobj->sclient);
+		acceptobj->sclient = INVALID_SOCKET;
+		return;
+	}
+	timerArm(timer, ACCEPT_CHECK_INTERVAL * 1000, AcceptTimeout, acceptobj);
+}
+
+// Function: IdleTimeout
+// Description:
+//    Timer callback of a connection. Completions only record the time of the
+//    last activity, the callback compares it with the idle timeout and arms
+//    itself again for the time left. A message that started arriving must be
+//    complete within FRAME_TIMEOUT however slowly its bytes trickle in.
+//    Expired connections have their outstanding I/O cancelled, so they are
+//    cleaned up by the completion threads like any failed connection.
+void IdleTimeout(TIMER *timer)
+{
+	SOCKET_OBJ *sockobj = (SOCKET_OBJ *)timer->context;
+	ULONGLONG   now = GetTickCount64(), deadline, frameDeadline;
+
+	deadline = sockobj->LastActivity + (ULONGLONG)gIdleTimeout * 1000;
+	if (sockobj->FrameStart != 0)
+	{
+		frameDeadline = sockobj->FrameStart + FRAME_TIMEOUT * 1000;
+		if (frameDeadline < deadline)
+			deadline = frameDeadline;
+	}
+
+	if (now < deadline)
+	{
+		timerArm(timer, (DWORD)(deadline - now), IdleTimeout, sockobj);
+		return;
+	}
+
+	LOG_INFO("Closing idle connection %d\n", sockobj->s);
+	sockobj->bClosing = TRUE;
+	CancelIoEx((HANDLE)sockobj->s, NULL);
+}
+
+// Function: ResumeDownload
+// Description: Put a download block held back by a transfer limit back on
+//    the download list.
+void ResumeDownload(TIMER *timer)
+{
+	EnqueueDownloadingOperation(&gPendingReadList, &gPendingReadListEnd, (BUFFER_OBJ *)timer->context);
+}
+
+// Function: ResumeUpload
+// Description: Put an upload block held back by a transfer limit back on
+//    the upload list.
+void ResumeUpload(TIMER *timer)
+{
+	EnqueueUploadingOperation(&gPendingWriteList, &gPendingWriteListEnd, (BUFFER_OBJ *)timer->context);
+}
+
+// Function: SendBusy
+// Description: Answer the first message of a new connection with
+//    OPS_ERR_BUSY and the time to retry after, then close the connection
+//    once the answer is sent.
+void SendBusy(SOCKET_OBJ *sock, BUFFER_OBJ *buf, DWORD retryMs)
+{
+	MESSAGE *busy = (MESSAGE *)buf->buf;
+
+	LOG_DEBUG("Refusing opcode %d, retry in %d ms\n", busy->opcode, (int)retryMs);
+	busy->opcode = OPS_ERR_BUSY;
+	busy->length = 0;
+	busy->offset = (long)retryMs;
+	busy->burst = 0;
+	busy->payload[0] = 0;
+	buf->sock = sock;
+	sock->bClosing = TRUE;
+	enqueueSend(buf);
+	ProcessPendingOperations();
+}
+
+// Function: DispatchFirstMessage
+// Description: Serve the first message of a connection, which is in buf:
+//    a download or upload is admitted and queued for its worker, a login
+//    is processed right away.
+void DispatchFirstMessage(SOCKET_OBJ *sock, BUFFER_OBJ *buf)
+{
+	MESSAGE    *rcvMess = (MESSAGE *)buf->buf;
+	LONGLONG    stageStart;
+	LONG        traceId;
+	int         traceOp, respond;
+	DWORD       retryMs;
+
+	if (rcvMess->opcode == OPT_FILE_DOWN || rcvMess->opcode == OPT_FILE_RANGE)
+	{
+		// New transfers are turned away while the server is overloaded
+		if ((retryMs = admissionAdmit(&gDownloadLimit)) != 0)
+		{
+			SendBusy(sock, buf, retryMs);
+		}
+		else
+		{
+			sock->Admission = &gDownloadLimit;
+			buf->sock = sock;
+			sock->mess = *rcvMess;
+			EnqueueDownloadingOperation(&gPendingReadList, &gPendingReadListEnd, buf);
+		}
+	}
+	else if (rcvMess->opcode == OPT_FILE_UP)
+	{
+		if ((retryMs = admissionAdmit(&gUploadLimit)) != 0)
+		{
+			SendBusy(sock, buf, retryMs);
+		}
+		else
+		{
+			sock->Admission = &gUploadLimit;
+			buf->sock = sock;
+			sock->mess = *rcvMess;
+			EnqueueUploadingOperation(&gPendingWriteList, &gPendingWriteListEnd, buf);
+		}
+	}
+	else if ((rcvMess->opcode == OPA_LOGIN || rcvMess->opcode == OPA_REAUTH) &&
+		(retryMs = admissionAdmitControl()) != 0)
+	{
+		// Logins are only refused once the memory budget is used up
+		SendBusy(sock, buf, retryMs);
+	}
+	else if (rcvMess->opcode == OPA_LOGIN || rcvMess->opcode == OPA_REAUTH) {
+		buf->sock = sock;
+		sock->mess = *rcvMess;
+
+		traceId = buf->traceId;
+		traceOp = buf->requestOp;
+		stageStart = metricNow();
+		respond = parseAndProcess(buf);
+		TRACE_SPAN(traceId, traceOp, "parse", stageStart);
+		if (respond) {
+			memcpy(buf->buf, &sock->mess, sizeof(MESSAGE));
+			enqueueSend(buf);
+			ProcessPendingOperations();
+		}
+	}
+}
+
+// Function: SendTlsToken
+// Description: Queue the handshake bytes of a TLS connection for sending,
+//    in pieces that fit after the message of a buffer. The last piece goes
+//    in buf, which receives the answer once it is sent.
+// Return: 0 if succeed, else return 1 and nothing is queued
+int SendTlsToken(SOCKET_OBJ *sock, BUFFER_OBJ *buf)
+{
+	TLS_SESSION *tls = sock->Tls;
+	BUFFER_OBJ  *pieces = NULL, *last = NULL, *obj, *next;
+	int          room = gBufferSize - sizeof(MESSAGE), offset, len;
+
+	for (offset = 0; offset < tls->tokenLen; offset += len)
+	{
+		len = tls->tokenLen - offset < room ? tls->tokenLen - offset : room;
+		obj = offset + len == tls->tokenLen ? buf : GetBufferObj(gBufferSize);
+		if (obj == NULL)
+		{
+			for (obj = pieces; obj != NULL; obj = next)
+			{
+				next = obj->next;
+				FreeBufferObj(obj);
+			}
+			tlsTokenDone(tls);
+			return 1;
+		}
+		((MESSAGE *)obj->buf)->opcode = OPT_TLS_HANDSHAKE;
+		((MESSAGE *)obj->buf)->burst = obj == buf;
+		memcpy(obj->buf + sizeof(MESSAGE), (char *)tls->token + offset, len);
+		obj->wireLen = len;
+		obj->sock = sock;
+		obj->next = NULL;
+		if (last != NULL)
+			last->next = obj;
+		else
+			pieces = obj;
+		last = obj;
+	}
+	tlsTokenDone(tls);
+
+	for (obj = pieces; obj != NULL; obj = next)
+	{
+		next = obj->next;
+		enqueueSend(obj);
+	}
+	ProcessPendingOperations();
+	return 0;
+}
+
+// Function: ReceiveTls
+// Description: Take the ciphertext a receive added to the session of a
+//    TLS connection and copy the plaintext it holds after the part of the
+//    message in buf. If there is none yet, the handshake bytes to answer
+//    are sent or another receive is posted.
+// Return: bytes of plaintext copied, 0 if the connection is to be
+//    closed, -1 if the receive was taken care of
+int ReceiveTls(SOCKET_OBJ *sock, BUFFER_OBJ *buf, DWORD bytes)
+{
+	int state, copied;
+
+	buf->tlsReplay = FALSE;
+	sock->Tls->inLen += bytes;
+
+	// SChannel does not allow a context to be used by two threads at once
+	EnterCriticalSection(&sock->SockCritSec);
+	state = tlsReceive(sock->Tls, buf->buf + buf->received, sizeof(MESSAGE) - buf->received, &copied);
+	LeaveCriticalSection(&sock->SockCritSec);
+	if (copied > 0)
+		return copied;
+
+	switch (state)
+	{
+	case TLS_DATA:
+	case TLS_MORE:
+		if (PostRecv(sock, buf) != NO_ERROR)
+			return 0;
+		return -1;
+	case TLS_TOKEN:
+		if (SendTlsToken(sock, buf))
+			return 0;
+		return -1;
+	case TLS_FAILED:
+		LOG_WARN("TLS failed on connection %d\n", sock->s);
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+// Function: HandleIo
+// Description:
+//    This function handles the IO on a socket. In the event of a receive, the
+//    completed receive is posted again. For completed accepts, another AcceptEx
+//    is posted. For completed sends, the buffer is freed.
+void HandleIo(ULONG_PTR key, BUFFER_OBJ *buf, HANDLE CompPort, DWORD BytesTransfered, DWORD error)
+{
+	LISTEN_OBJ *listenobj = NULL;
+	SOCKET_OBJ *sockobj = NULL,
+		*clientobj = NULL;                     // New client object for accepted connections
+	BUFFER_OBJ *recvobj = NULL,       // Used to post new receives on accepted connections
+		*sendobj = NULL;
+	BUFFER_OBJ *readobj = NULL,
+		*writeobj = NULL;
+	BOOL        bCleanupSocket, bSendDone = FALSE;
+	LONGLONG    stageStart = metricNow();
+	LONG        traceId;
+	int         traceOp, respond, received;
+
+	if (buf->operation == OP_ACCEPT)
+	{
+		// Stop the stale accept check. If it closed the client socket just
+		//    as the accept completed, treat the accept as failed.
+		timerCancel(&buf->timer);
+		if (buf->sclient == INVALID_SOCKET && error == NO_ERROR)
+			error = WSAECONNABORTED;
+	}
+	else
+	{
+		((SOCKET_OBJ *)key)->LastActivity = GetTickCount64();
+	}
+
+	if (error != 0)
+	{
+		dbgprint("OP = %d; Error = %d\n", buf->operation, error);
+	}
+	bCleanupSocket = FALSE;
+
+	if (error != NO_ERROR)
+	{
+		// An error occurred on a TCP socket, free the associated per I/O buffer
+		// and see if there are any more outstanding operations. If so we must
+		// wait until they are complete as well.
+		if (buf->operation != OP_ACCEPT)
+		{
+			sockobj = (SOCKET_OBJ *)key;
+			if (buf->operation == OP_READ)
+			{
+				if ((InterlockedDecrement(&sockobj->OutstandingRecv) == 0) && (sockobj->OutstandingSend == 0))
+				{
+					dbgprint("Freeing socket obj in GetOverlappedResult\n");
+					FreeSocketObj(sockobj);
+				}
+			}
+			else if (buf->operation == OP_WRITE)
+			{
+				admissionRelease(&gSendLimit);
+				if ((InterlockedDecrement(&sockobj->OutstandingSend) == 0) && (sockobj->OutstandingRecv == 0))
+				{
+					dbgprint("Freeing socket obj in GetOverlappedResult\n");
+					FreeSocketObj(sockobj);
+				}
+			}
+
+		}
+		else
+		{
+			listenobj = (LISTEN_OBJ *)key;
+			LOG_WARN("Accept failed: %d\n", error);
+			InterlockedDecrement(&listenobj->PendingAcceptCount);
+			RemovePendingAccept(listenobj, buf);
+			if (buf->sclient != INVALID_SOCKET)
+				closesocket(buf->sclient);
+			buf->sclient = INVALID_SOCKET;
+			FreeBufferObj(buf);
+
+			// Keep the number of outstanding accepts up, unless the socket
+			//    was handed to a new server
+			if (!gDraining)
+				PostNewAccept(listenobj);
+			return;
+		}
+		FreeBufferObj(buf);
+		return;
+	}
+
+	if (buf->operation == OP_ACCEPT)
+	{
+		HANDLE            hrc;
+		SOCKADDR_STORAGE *LocalSockaddr = NULL, *RemoteSockaddr = NULL;
+		int               LocalSockaddrLen, RemoteSockaddrLen;
+		ULONGLONG         source;
+		listenobj = (LISTEN_OBJ *)key;
+
+		// Update counters
+		metricAdd(&gMetricConnectionsAccepted, 1);
+		InterlockedDecrement(&listenobj->PendingAcceptCount);
+		metricAdd(&gMetricBytesReceived, BytesTransfered);
+
+		// Print the client's addresses
+		listenobj->lpfnGetAcceptExSockaddrs(
+			buf->buf,
+			buf->buflen - ((sizeof(SOCKADDR_STORAGE) + 16) * 2),
+			sizeof(SOCKADDR_STORAGE) + 16,
+			sizeof(SOCKADDR_STORAGE) + 16,
+			(SOCKADDR **)&LocalSockaddr,
+			&LocalSockaddrLen,
+			(SOCKADDR **)&RemoteSockaddr,
+			&RemoteSockaddrLen
+		);
+
+		RemovePendingAccept(listenobj, buf);
+		// Sources refused by the login guard are closed before anything
+		//    is set up for them, else get a new SOCKET_OBJ for the client
+		source = loginSourceKey((SOCKADDR *)RemoteSockaddr);
+		if (loginGuardAccept(source))
+			clientobj = NULL;
+		else
+			clientobj = GetSocketObj(buf->sclient, listenobj->AddressFamily);
+		if (clientobj)
+		{
+			clientobj->Source = source;
+			// Associate the new connection to our completion port
+			hrc = CreateIoCompletionPort((HANDLE)clientobj->s, CompPort, (ULONG_PTR)clientobj, 0);
+			if (hrc == NULL)
+			{
+				LOG_ERROR("CompletionThread: CreateIoCompletionPort failed: %d\n", GetLastError());
+				return;
+			}
+			clientobj->LastActivity = GetTickCount64();
+			timerArm(&clientobj->IdleTimer, gIdleTimeout * 1000, IdleTimeout, clientobj);
+			if (gTlsEnabled)
+			{
+				// The data of the accept is the ClientHello. The first message
+				//    comes after the handshake, which must be done within
+				//    FRAME_TIMEOUT like a message.
+				clientobj->Tls = tlsCreate();
+				if (clientobj->Tls == NULL || (int)BytesTransfered > tlsRecvSpace(clientobj->Tls))
+				{
+					LOG_WARN("Unable to start TLS on connection %d\n", clientobj->s);
+					FreeBufferObj(buf);
+					FreeSocketObj(clientobj);
+				}
+				else
+				{
+					clientobj->AwaitFirst = TRUE;
+					clientobj->FrameStart = GetTickCount64();
+					timerArm(&clientobj->IdleTimer, FRAME_TIMEOUT * 1000, IdleTimeout, clientobj);
+					memcpy(clientobj->Tls->in, buf->buf, BytesTransfered);
+					buf->sock = clientobj;
+					if (ReceiveTls(clientobj, buf, BytesTransfered) == 0)
+					{
+						FreeBufferObj(buf);
+						FreeSocketObj(clientobj);
+					}
+				}
+			}
+			else
+			{
+				MESSAGE *rcvMess;
+				rcvMess = (MESSAGE *)buf->buf;
+				buf->started = metricNow();
+				buf->requestOp = rcvMess->opcode;
+				buf->traceId = traceStart();
+				TRACE_SPAN(buf->traceId, buf->requestOp, "accept", stageStart);
+				LOG_DEBUG("Accepted connection, first opcode %d\n", rcvMess->opcode);
+				DispatchFirstMessage(clientobj, buf);
+			}
+		}
+		else
+		{
+			// Refused or can't allocate a socket structure so close the connection
+			closesocket(buf->sclient);
+			buf->sclient = INVALID_SOCKET;
+			FreeBufferObj(buf);
+		}
+
+		if (error != NO_ERROR)
+		{
+			// Check for socket closure
+			EnterCriticalSection(&clientobj->SockCritSec);
+			if ((clientobj->OutstandingSend == 0) && (clientobj->OutstandingRecv == 0))
+			{
+				closesocket(clientobj->s);
+				clientobj->s = INVALID_SOCKET;
+				FreeSocketObj(clientobj);
+			}
+			else
+			{
+				clientobj->bClosing = TRUE;
+			}
+			LeaveCriticalSection(&clientobj->SockCritSec);
+			error = NO_ERROR;
+		}
+		// Replace the completed accept from this thread rather than waking
+		//    the main thread, so accept capacity grows with completion threads
+		if (listenobj->PendingAcceptCount < gMaxAccepts && !gDraining)
+			PostNewAccept(listenobj);
+	}
+
+	else if (buf->operation == OP_READ)
+	{
+		sockobj = (SOCKET_OBJ *)key;
+		InterlockedDecrement(&sockobj->OutstandingRecv);
+
+		// Receive completed successfully. On a TLS connection it is the
+		//    plaintext that counts.
+		metricAdd(&gMetricBytesReceived, BytesTransfered);
+		received = (int)BytesTransfered;
+		if (sockobj->Tls != NULL && (BytesTransfered > 0 || buf->tlsReplay))
+			received = ReceiveTls(sockobj, buf, BytesTransfered);
+		if (received > 0)
+		{
+			buf->received += received;
+			if (buf->received < sizeof(MESSAGE))
+			{
+				// Only part of the message arrived, keep receiving the rest.
+				//    The whole message must arrive within FRAME_TIMEOUT.
+				if (sockobj->FrameStart == 0)
+				{
+					sockobj->FrameStart = GetTickCount64();
+					timerArm(&sockobj->IdleTimer, FRAME_TIMEOUT * 1000, IdleTimeout, sockobj);
+				}
+				if (PostRecv(sockobj, buf) != NO_ERROR)
+				{
+					sockobj->bClosing = TRUE;
+					FreeBufferObj(buf);
+				}
+			}
+			else
+			{
+				MESSAGE *rcvMess;
+				buf->received = 0;
+				sockobj->FrameStart = 0;
+				rcvMess = (MESSAGE *)buf->buf;
+				buf->started = metricNow();
+				buf->requestOp = rcvMess->opcode;
+				buf->traceId = traceStart();
+				if (sockobj->AwaitFirst)
+				{
+					// The first message of a TLS connection
+					sockobj->AwaitFirst = FALSE;
+					DispatchFirstMessage(sockobj, buf);
+				}
+				else if (rcvMess->opcode == OPS_OK)
+				{
+					readobj = buf;
+					readobj->buflen = sizeof(MESSAGE);
+					readobj->sock = sockobj;
+					readobj->sock->mess = *rcvMess;
+					EnqueueDownloadingOperation(&gPendingReadList, &gPendingReadListEnd, readobj);
+				}
+				else if (rcvMess->opcode == OPT_FILE_DATA)
+				{
+					if (rcvMess->length == 0)
+					{
+						recvobj = buf;
+						recvobj->sock = sockobj;
+						recvobj->sock->mess = *rcvMess;
+						EnqueueUploadingOperation(&gPendingWriteList, &gPendingWriteListEnd, recvobj);
+
+					}
+					else
+					{
+						writeobj = buf;
+						writeobj->sock = sockobj;
+						writeobj->sock->mess = *rcvMess;
+						EnqueueUploadingOperation(&gPendingWriteList, &gPendingWriteListEnd, writeobj);
+					}
+				}
+				else if (rcvMess->opcode == OPT_FILE_DIGEST)
+				{
+					recvobj = buf;
+					recvobj->sock = sockobj;
+					recvobj->sock->mess = *rcvMess;
+					EnqueueUploadingOperation(&gPendingWriteList, &gPendingWriteListEnd, recvobj);
+				}
+				else {
+					recvobj = buf;
+					recvobj->sock = sockobj;
+					recvobj->sock->mess = *rcvMess;
+
+					traceId = buf->traceId;
+					traceOp = buf->requestOp;
+					stageStart = metricNow();
+					respond = parseAndProcess(recvobj);
+					TRACE_SPAN(traceId, traceOp, "parse", stageStart);
+					if (respond) {
+						memcpy(buf->buf, &recvobj->sock->mess, sizeof(MESSAGE));
+						sendobj = buf;
+						sendobj->sock = sockobj;
+
+						MESSAGE m = (MESSAGE) sendobj->sock->mess;
+						
+						enqueueSend(sendobj);
+						LOG_DEBUG("Sending code %d to client %d\n", m.opcode, sockobj->s);
+						ProcessPendingOperations();
+					}
+
+				}
+
+			}
+		}
+		else if (received == 0)
+		{
+			dbgprint("Got 0 byte receive\n");
+			// Graceful close - the receive returned 0 bytes read
+			sockobj->bClosing = TRUE;
+			// Free the receive buffer
+			FreeBufferObj(buf);
+
+			// If this was the last outstanding operation on socket, clean it up
+			EnterCriticalSection(&sockobj->SockCritSec);
+
+			if ((sockobj->OutstandingSend == 0) && (sockobj->OutstandingRecv == 0))
+			{
+				bCleanupSocket = TRUE;
+			}
+			LeaveCriticalSection(&sockobj->SockCritSec);
+		}
+	}
+	else if (buf->operation == OP_WRITE)
+	{
+		sockobj = (SOCKET_OBJ *)key;
+		bSendDone = TRUE;
+		InterlockedDecrement(&sockobj->OutstandingSend);
+		admissionRelease(&gSendLimit);
+		admissionObserve(&gSendLimit, buf->sendPosted);
+		// Update the counters
+		metricAdd(&gMetricBytesSent, BytesTransfered);
+		TRACE_SPAN(buf->traceId, buf->requestOp, "send", buf->sendPosted);
+		buf->buflen = gBufferSize;
+		if (sockobj->bClosing == FALSE)
+		{
+			MESSAGE *queueMessage;
+			queueMessage = (MESSAGE *)buf->buf;
+			if (queueMessage->opcode == OPT_FILE_DATA || queueMessage->opcode == OPT_FILE_BLOCK
+				|| queueMessage->opcode == OPT_RANGE_DIGEST)
+			{
+				MESSAGE sendMessage;
+				// A ranged download goes on until the digest of its last range is sent
+				if (sockobj->fileTransfer.nLeft > 0 || sockobj->fileTransfer.rangeIdx < sockobj->fileTransfer.rangeCount)
+				{
+					readobj = buf;
+					readobj->buflen = sizeof(MESSAGE);
+					readobj->sock = sockobj;
+					readobj->sock->mess = *queueMessage;
+					EnqueueDownloadingOperation(&gPendingReadList, &gPendingReadListEnd, readobj);
+				}
+				else if (sockobj->fileTransfer.nLeft == 0)
+				{
+					LOG_DEBUG("Download of %s finished\n", sockobj->fileTransfer.fileName);
+					closeStoredFile(&sockobj->fileTransfer.stored);
+					sendMessage.opcode = OPT_FILE_DATA;
+					sendMessage.payload[0] = 0;
+					sendMessage.length = 0;
+					sockobj->bClosing = TRUE;
+					memcpy(buf->buf, &sendMessage, sizeof(MESSAGE));
+					buf->buflen = sizeof(MESSAGE);
+					sendobj = buf;
+					sendobj->buflen = sizeof(MESSAGE);
+					sendobj->sock = sockobj;
+
+					enqueueSend(sendobj);
+					ProcessPendingOperations();
+				}
+
+			}
+			else if (queueMessage->opcode == OPT_FILE_DIGEST || queueMessage->opcode == OPT_RANGE_HEADER)
+			{
+				recvobj = buf;
+				recvobj->sock = sockobj;
+				recvobj->sock->mess = *queueMessage;
+				EnqueueDownloadingOperation(&gPendingReadList, &gPendingReadListEnd, recvobj);
+			}
+			else if (queueMessage->opcode == OPS_OK)
+			{
+				recvobj = buf;
+				recvobj->sock = sockobj;
+				recvobj->sock->mess = *queueMessage;
+				EnqueueUploadingOperation(&gPendingWriteList, &gPendingWriteListEnd, recvobj);
+			}
+			else if (queueMessage->opcode == OPT_TLS_HANDSHAKE)
+			{
+				// The last piece of a handshake flight waits for the answer
+				buf->wireLen = 0;
+				if (queueMessage->burst)
+				{
+					buf->sock = sockobj;
+					PostRecv(sockobj, buf);
+				}
+				else
+					FreeBufferObj(buf);
+			}
+			else {
+				buf->sock = sockobj;
+				PostRecv(sockobj, buf);
+			}
+		}
+	}
+
+	// A send slot was freed, let the scheduler fill it
+	if (bSendDone)
+		ProcessPendingOperations();
+	if (sockobj)
+	{
+		if (error != NO_ERROR)
+		{
+			LOG_DEBUG("Socket error %d\n", error);
+			sockobj->bClosing = TRUE;
+		}
+
+		// Check to see if socket is closing. A graceful close waits for the
+		// frames still queued in the scheduler, such as the end of a download.
+		if ((sockobj->OutstandingSend == 0) && (sockobj->OutstandingRecv == 0) && (sockobj->bClosing) &&
+			(sockobj->PendingSend == 0 || error != NO_ERROR))
+		{
+			bCleanupSocket = TRUE;
+		}
+
+		if (bCleanupSocket)
+		{
+			FreeSocketObj(sockobj);
+		}
+	}
+
+	return;
+}
+
+// Function: CompletionThread
+// Description:
+//    This is the completion thread which services our completion port. One of
+//    these threads is created per processor on the system. The thread sits in
+//    an infinite loop calling GetQueuedCompletionStatus and handling socket IO that completed.
+
+DWORD WINAPI CompletionThread(LPVOID lpParam)
+{
+	ULONG_PTR    Key;
+	SOCKET       s;
+	BUFFER_OBJ  *bufobj = NULL;                   // Per I/O object for completed I/O
+	OVERLAPPED  *lpOverlapped = NULL;     // Pointer to overlapped structure for completed I/O
+	HANDLE       CompletionPort;                    // Completion port handle
+	DWORD        BytesTransfered,                   // Number of bytes transferred
+		Flags;                                     // Flags for completed I/O
+	int          rc, error;
+
+	CompletionPort = (HANDLE)lpParam;
+	while (1)
+	{
+		error = NO_ERROR;
+		rc = GetQueuedCompletionStatus(CompletionPort, &BytesTransfered, (PULONG_PTR)&Key, &lpOverlapped, INFINITE);
+		bufobj = CONTAINING_RECORD(lpOverlapped, BUFFER_OBJ, ol);
+		if (rc == FALSE)
+		{
+			// If the call fails, call WSAGetOverlappedResult to translate the
+			//    error code into a Winsock error code.
+			if (bufobj->operation == OP_ACCEPT)
+			{
+				s = ((LISTEN_OBJ *)Key)->s;
+			}
+			else
+			{
+				s = ((SOCKET_OBJ *)Key)->s;
+			}
+			dbgprint("CompletionThread: GetQueuedCompletionStatus failed: %d [0x%x]\n", GetLastError(), lpOverlapped->Internal);
+			rc = WSAGetOverlappedResult(s, &bufobj->ol, &BytesTransfered, FALSE, &Flags);
+			if (rc == FALSE)
+			{
+				error = WSAGetLastError();
+			}
+		}
+		// Handle the IO operation
+		HandleIo(Key, bufobj, CompletionPort, BytesTransfered, error);
+	}
+
+	ExitThread(0);
+	return 0;
+}
+
+// Function: workerReadThread
+// Description:
+//    This is the  thread which services our Download file protocol . One of
+//    these threads is created  on the system. The thread sits in
+//    an infinite loop calling ProcessDownloadingOperations to process file operation needed .
+unsigned __stdcall workerReadThread(void *param)
+{
+	while (TRUE)
+	{
+		ProcessDownloadingOperations();
+	}
+}
+
+// Function: workerWriteThread
+// Description:
+//    This is the  thread which services our Upload file protocol . One of
+//    these threads is created  on the system. The thread sits in
+//    an infinite loop calling ProcessUploadingOperations to process file operation needed .
+unsigned __stdcall workerWriteThread(void *param)
+{
+	while (TRUE)
+	{
+		ProcessUploadingOperations();
+	}
+}
+
@@ -0,0 +1,426 @@
+#pragma once
+
+#ifndef _ACCOUNT_CACHE_H
+#define _ACCOUNT_CACHE_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "dataStructures.h"
+#include "dbUtils.h"
+#include "metrics.h"
+#include "timerWheel.h"
+#include "binaryLog.h"
+#include "stringPool.h"
+
+// Account cache. Accounts are read from the database the first time they
+// are looked up, by name at login or by id when a stored session cookie
+// is presented, instead of all of them at startup. An account stays in
+// memory while anything holds a pin on it: a logged in connection, a live
+// cookie, a transfer, a login being verified or a database change.
+// Unpinned accounts wait on an LRU list and the least recently used are
+// dropped once more than gAccountCacheSize accounts are in memory, so
+// memory follows the active users.
+//
+// Accounts have no lock of their own. They share ACCOUNT_LOCK_STRIPES
+// critical sections by uid; an account lock is only held for short
+// updates and never together with the lock of another account.
+#define ACCOUNT_CACHE_DEFAULT	4096
+#define ACCOUNT_CACHE_MIN		16
+#define ACCOUNT_LOCK_STRIPES	64		// power of two
+
+// Give an account read from the database the session stored with it.
+// Called with gAccountCritSec held, before the account can be found; the
+// cookie index of the processor is kept under the same lock. Defined by
+// the request processor.
+void restoreSession(Account *account);
+
+std::unordered_map<int, Account *> gAccountById;
+std::unordered_map<const char *, Account *, StringHash, StringEqual> gAccountByName;	// keyed by the name the account owns
+Account *gAccountLruHead = NULL, *gAccountLruTail = NULL;
+CRITICAL_SECTION gAccountCritSec;		// protects the indexes, the list and the pins
+CRITICAL_SECTION gAccountLocks[ACCOUNT_LOCK_STRIPES];
+int gAccountCacheSize = ACCOUNT_CACHE_DEFAULT;	// accounts kept in memory, pinned or not
+int gAccountUnpinned = 0;						// accounts on the LRU list
+volatile LONGLONG gAccountHits = 0, gAccountLoads = 0, gAccountMisses = 0, gAccountEvictions = 0;
+
+// Function: initializeAccountCache
+// Description: Initialize the lock and the indexes of the cache
+void initializeAccountCache() {
+	InitializeCriticalSection(&gAccountCritSec);
+	for (int i = 0; i < ACCOUNT_LOCK_STRIPES; i++)
+		InitializeCriticalSection(&gAccountLocks[i]);
+	gAccountById.reserve(gAccountCacheSize);
+	gAccountByName.reserve(gAccountCacheSize);
+}
+
+// Function: accountLock
+// Description: Lock an account, on the stripe its uid falls in
+// -IN: account: the account
+void accountLock(Account *account) {
+	EnterCriticalSection(&gAccountLocks[account->uid & (ACCOUNT_LOCK_STRIPES - 1)]);
+}
+
+// Function: accountUnlock
+// Description: Unlock an account locked by accountLock
+// -IN: account: the account
+void accountUnlock(Account *account) {
+	LeaveCriticalSection(&gAccountLocks[account->uid & (ACCOUNT_LOCK_STRIPES - 1)]);
+}
+
+// Function: accountSetDir
+// Description: Change the directory of an account in its working group
+// Return: 0 if succeed, 1 if out of memory
+// -IN: account: the account
+//      dir: the directory, empty for the root of the group
+int accountSetDir(Account *account, const char *dir) {
+	char *copy = NULL;
+
+	if (dir[0] != 0 && (copy = copyString(dir)) == NULL)
+		return 1;
+
+	accountLock(account);
+	free(account->workingDir);
+	account->workingDir = copy;
+	accountUnlock(account);
+	return 0;
+}
+
+// Function: accountPath
+// Description: Path of a name in the directory of an account, relative to
+//              its working group. The directory may be changed by another
+//              connection of the account, so it is read under the lock.
+// -IN: account: the account
+//      name: the name, empty for the directory itself
+//      size: size of the output buffer
+// -OUT: path: the path
+void accountPath(Account *account, const char *name, char *path, size_t size) {
+	accountLock(account);
+	if (account->workingDir == NULL)
+		snprintf(path, size, "%s", name);
+	else if (name[0] == 0)
+		snprintf(path, size, "%s", account->workingDir);
+	else
+		snprintf(path, size, "%s/%s", account->workingDir, name);
+	accountUnlock(account);
+}
+
+// Function: accountLruUnlink
+// Description: Take an account off the LRU list. Called with
+//              gAccountCritSec held.
+// -IN: account: the account, on the list
+void accountLruUnlink(Account *account) {
+	if (account->lruPrev != NULL)
+		account->lruPrev->lruNext = account->lruNext;
+	else
+		gAccountLruHead = account->lruNext;
+	if (account->lruNext != NULL)
+		account->lruNext->lruPrev = account->lruPrev;
+	else
+		gAccountLruTail = account->lruPrev;
+	account->lruPrev = account->lruNext = NULL;
+	gAccountUnpinned--;
+}
+
+// Function: accountLruPush
+// Description: Put an account at the head of the LRU list. Called with
+//              gAccountCritSec held.
+// -IN: account: the account, not on the list
+void accountLruPush(Account *account) {
+	account->lruPrev = NULL;
+	account->lruNext = gAccountLruHead;
+	if (gAccountLruHead != NULL)
+		gAccountLruHead->lruPrev = account;
+	else
+		gAccountLruTail = account;
+	gAccountLruHead = account;
+	gAccountUnpinned++;
+}
+
+// Function: accountUnindex
+// Description: Take an account out of the indexes of the cache. Its name
+//              may have been given to another account read since, whose
+//              entry is left alone. Called with gAccountCritSec held.
+// -IN: account: the account, in the cache
+void accountUnindex(Account *account) {
+	auto named = gAccountByName.find(account->username);
+
+	if (named != gAccountByName.end() && named->second == account)
+		gAccountByName.erase(named);
+	gAccountById.erase(account->uid);
+	account->cached = false;
+}
+
+// Function: accountFree
+// Description: Release an account dropped from the cache. Called without
+//              gAccountCritSec held, the session timer may be running.
+// -IN: account: the account, no longer in the cache
+void accountFree(Account *account) {
+	timerCancel(&account->sessionTimer);
+	free(account->workingDir);
+	free(account->username);
+	if (account->password != NULL)
+		SecureZeroMemory(account->password, strlen(account->password));
+	free(account->password);
+	delete account;
+}
+
+// Function: accountPin
+// Description: Take one more reference on an account the caller already
+//              holds, so it stays in the cache until accountRelease
+// -IN: account: the account
+void accountPin(Account *account) {
+	EnterCriticalSection(&gAccountCritSec);
+	if (account->pins++ == 0 && account->cached)
+		accountLruUnlink(account);
+	LeaveCriticalSection(&gAccountCritSec);
+}
+
+// Function: accountRelease
+// Description: Drop a reference on an account. The last one puts it on
+//              the LRU list, and the least recently used accounts are
+//              dropped if the cache is over its size.
+// -IN: account: the account
+void accountRelease(Account *account) {
+	Account *evicted = NULL, *victim;
+
+	EnterCriticalSection(&gAccountCritSec);
+	if (--account->pins == 0 && account->cached && account->stale) {
+		// Renamed or deleted in the database, the next lookup reads it again
+		accountUnindex(account);
+		account->lruNext = NULL;
+		evicted = account;
+	}
+	else if (account->pins == 0 && account->cached) {
+		accountLruPush(account);
+
+		// The account just released is kept even if it is the last one
+		while ((int)gAccountById.size() > gAccountCacheSize && gAccountLruTail != account) {
+			victim = gAccountLruTail;
+			accountLruUnlink(victim);
+			gAccountById.erase(victim->uid);
+			gAccountByName.erase(victim->username);
+			victim->cached = false;
+			victim->lruNext = evicted;
+			evicted = victim;
+			gAccountEvictions++;
+		}
+	}
+	LeaveCriticalSection(&gAccountCritSec);
+
+	while ((victim = evicted) != NULL) {
+		evicted = victim->lruNext;
+		accountFree(victim);
+	}
+}
+
+// Function: accountInsert
+// Description: Add an account read from the database to the cache, unless
+//              another thread read it first
+// Return: the account in the cache, pinned
+// -IN: account: the account read, owned by the cache from now on
+Account *accountInsert(Account *account) {
+	Account *cached = NULL;
+
+	EnterCriticalSection(&gAccountCritSec);
+	auto it = gAccountById.find(account->uid);
+	if (it != gAccountById.end()) {
+		cached = it->second;
+		if (cached->pins++ == 0)
+			accountLruUnlink(cached);
+	}
+	else {
+		account->cached = true;
+		account->pins = 1;
+		if (account->cookie[0] != 0) {
+			account->pins++;
+			restoreSession(account);
+		}
+		gAccountById[account->uid] = account;
+		gAccountByName[account->username] = account;
+	}
+	LeaveCriticalSection(&gAccountCritSec);
+
+	if (cached != NULL) {
+		accountFree(account);
+		return cached;
+	}
+	return account;
+}
+
+// Function: accountLoad
+// Description: Read an account and its live session from the database
+// Return: the account, not in the cache yet, NULL if not found
+// -IN: username: name of the account, NULL to look up by id
+//      uid: id of the account
+Account *accountLoad(const char *username, int uid) {
+	Account *account = new Account();
+	int ret;
+
+	InterlockedIncrement64(&gAccountMisses);
+	if ((ret = readAccountDb(username, uid, account)) != 0) {
+		if (ret < 0)
+			LOG_ERROR("Cannot read an account from the database!\n");
+		accountFree(account);
+		return NULL;
+	}
+
+	if (readSessionDb(account) == 0 && time(0) - account->lastActive > TIME_1_DAY)
+		account->cookie[0] = 0;
+
+	InterlockedIncrement64(&gAccountLoads);
+	return account;
+}
+
+// Function: accountAcquire
+// Description: Find an account by name, reading it from the database if it
+//              is not in memory
+// Return: the account, pinned, NULL if there is no such account
+// -IN: username: name of the account
+Account *accountAcquire(const char *username) {
+	Account *account = NULL;
+
+	EnterCriticalSection(&gAccountCritSec);
+	auto it = gAccountByName.find(username);
+	if (it != gAccountByName.end()) {
+		account = it->second;
+		if (account->pins++ == 0)
+			accountLruUnlink(account);
+		gAccountHits++;
+	}
+	LeaveCriticalSection(&gAccountCritSec);
+
+	if (account == NULL && (account = accountLoad(username, 0)) != NULL)
+		account = accountInsert(account);
+	return account;
+}
+
+// Function: accountAcquireById
+// Description: Find an account by id, reading it from the database if it
+//              is not in memory
+// Return: the account, pinned, NULL if there is no such account
+// -IN: uid: id of the account
+Account *accountAcquireById(int uid) {
+	Account *account = NULL;
+
+	EnterCriticalSection(&gAccountCritSec);
+	auto it = gAccountById.find(uid);
+	if (it != gAccountById.end()) {
+		account = it->second;
+		if (account->pins++ == 0)
+			accountLruUnlink(account);
+		gAccountHits++;
+	}
+	LeaveCriticalSection(&gAccountCritSec);
+
+	if (account == NULL && (account = accountLoad(NULL, uid)) != NULL)
+		account = accountInsert(account);
+	return account;
+}
+
+// Function: accountRefresh
+// Description: Apply a change of an account made in the database. An idle
+//              account is dropped and read again on its next lookup. One in
+//              use is updated in place; if it was renamed or deleted it is
+//              also dropped once released, and a deleted one can no longer
+//              log in meanwhile.
+// -IN: uid: id of the account
+void accountRefresh(int uid) {
+	Account *account = NULL, fresh;
+	char *password = NULL;
+	int ret;
+
+	EnterCriticalSection(&gAccountCritSec);
+	auto it = gAccountById.find(uid);
+	if (it != gAccountById.end()) {
+		account = it->second;
+		if (account->pins == 0) {
+			accountLruUnlink(account);
+			accountUnindex(account);
+			gAccountEvictions++;
+		}
+		else
+			account->pins++;
+	}
+	LeaveCriticalSection(&gAccountCritSec);
+
+	if (account == NULL)
+		return;
+	if (!account->cached) {
+		accountFree(account);
+		return;
+	}
+
+	if ((ret = readAccountDb(NULL, uid, &fresh)) < 0) {
+		LOG_ERROR("Cannot read an account from the database!\n");
+	}
+	else {
+		accountLock(account);
+		if (ret == 1) {
+			account->isLocked = true;
+			account->stale = true;
+		}
+		else {
+			if (strcmp(account->username, fresh.username) != 0)
+				account->stale = true;
+			account->isLocked = fresh.isLocked;
+			account->sendWeight = fresh.sendWeight;
+			account->qos.bytesRate = fresh.qos.bytesRate;
+			account->qos.opsRate = fresh.qos.opsRate;
+			if (strcmp(account->password, fresh.password) != 0) {
+				password = account->password;
+				account->password = fresh.password;
+				fresh.password = password;
+			}
+		}
+		accountUnlock(account);
+	}
+
+	free(fresh.username);
+	if (fresh.password != NULL)
+		SecureZeroMemory(fresh.password, strlen(fresh.password));
+	free(fresh.password);
+	accountRelease(account);
+}
+
+// Function: accountCachedIds
+// Description: List the accounts in memory
+// -OUT: uids: ids of the accounts
+void accountCachedIds(std::vector<int> &uids) {
+	EnterCriticalSection(&gAccountCritSec);
+	uids.reserve(gAccountById.size());
+	for (auto it = gAccountById.begin(); it != gAccountById.end(); ++it)
+		uids.push_back(it->first);
+	LeaveCriticalSection(&gAccountCritSec);
+}
+
+// Function: collectAccountMetrics
+// Description: Append the size and traffic of the account cache
+// -IN: out: the scrape
+void collectAccountMetrics(std::string &out) {
+	int cached, unpinned;
+	LONGLONG poolBytes;
+
+	EnterCriticalSection(&gAccountCritSec);
+	cached = (int)gAccountById.size();
+	unpinned = gAccountUnpinned;
+	LeaveCriticalSection(&gAccountCritSec);
+	EnterCriticalSection(&gStringPoolCritSec);
+	poolBytes = gStringPoolBytes;
+	LeaveCriticalSection(&gStringPoolCritSec);
+
+	appendHelp(out, "clouddrive_accounts_cached", "gauge", "Accounts in memory, by whether anything holds them.");
+	appendMetric(out, "clouddrive_accounts_cached", "state=\"pinned\"", cached - unpinned);
+	appendMetric(out, "clouddrive_accounts_cached", "state=\"idle\"", unpinned);
+	appendHelp(out, "clouddrive_account_lookups_total", "counter", "Account lookups, by whether the account was in memory.");
+	appendMetric(out, "clouddrive_account_lookups_total", "result=\"hit\"", (double)gAccountHits);
+	appendMetric(out, "clouddrive_account_lookups_total", "result=\"miss\"", (double)gAccountMisses);
+	appendHelp(out, "clouddrive_account_loads_total", "counter", "Accounts read from the database.");
+	appendMetric(out, "clouddrive_account_loads_total", NULL, (double)gAccountLoads);
+	appendHelp(out, "clouddrive_account_evictions_total", "counter", "Idle accounts dropped from memory.");
+	appendMetric(out, "clouddrive_account_evictions_total", NULL, (double)gAccountEvictions);
+	appendHelp(out, "clouddrive_string_pool_bytes", "gauge", "Memory held by the pool of group names and paths.");
+	appendMetric(out, "clouddrive_string_pool_bytes", NULL, (double)poolBytes);
+}
+
+#endif
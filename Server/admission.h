@@ -0,0 +1,244 @@
+#pragma once
+
+#ifndef _ADMISSION_H
+#define _ADMISSION_H
+
+#include <string>
+#include "dataStructures.h"
+#include "metrics.h"
+#include "sendScheduler.h"
+
+// Admission control. Overlapped sends, downloads and uploads each have a
+// concurrency limit that follows the latency they see: every
+// ADMISSION_WINDOW samples the limit is cut by a quarter if the average
+// went over its target, and raised by one if it did not and the limit was
+// reached. A transfer that does not get a slot, or arrives while the send
+// backlog is deep or the buffers in use are close to the memory budget, is
+// answered OPS_ERR_BUSY with a time to retry after in the offset field.
+// Logins are only refused when the budget is used up, and connections
+// already established are always served.
+#define ADMISSION_WINDOW		64		// Samples per adjustment of a limit
+#define ADMISSION_SEND_TARGET_MS	100		// Overlapped send completion
+#define ADMISSION_QUEUE_TARGET_MS	20		// Wait of a block on the download or upload list
+#define ADMISSION_SEND_FLOOR	8
+#define ADMISSION_TRANSFER_FLOOR	4
+#define ADMISSION_BACKLOG		4		// Frames waiting per send slot before transfers are refused
+#define ADMISSION_MEMORY_SOFT	80		// Percent of the budget past which transfers are refused
+#define ADMISSION_RETRY_MS		250
+#define ADMISSION_RETRY_MAX_MS	10000
+#define DEFAULT_MEMORY_BUDGET_MB	256
+
+typedef struct _ADMISSION_LIMIT {
+	const char         *name;
+	volatile LONG       limit;			// Slots that may be in use
+	LONG                floor, ceiling;
+	volatile LONG       inUse;
+	LONG                peak;			// Most slots in use during the window
+	LONGLONG            targetUs;
+	LONG                samples;		// Latencies of the window so far
+	LONGLONG            latencySum;
+	volatile LONGLONG   latencyUs;		// Average of the last window
+	volatile LONGLONG   rejected;		// Transfers answered busy
+	CRITICAL_SECTION    cs;
+} ADMISSION_LIMIT;
+
+ADMISSION_LIMIT gSendLimit, gDownloadLimit, gUploadLimit;
+volatile LONGLONG gMemoryInUse = 0;		// Bytes of buffer and socket objects handed out
+LONGLONG gMemoryBudget = (LONGLONG)DEFAULT_MEMORY_BUDGET_MB << 20;
+
+// Function: initializeAdmission
+// Description: Initialize a limit. It starts at its ceiling, which is what
+//              the server allowed before the limits adapted.
+// -IN: limit: the limit
+//      name: op label of its metrics
+//      floor: the limit is never cut below this
+//      ceiling: the limit is never raised above this
+//      targetMs: latency the limit aims for
+void initializeAdmission(ADMISSION_LIMIT *limit, const char *name, LONG floor, LONG ceiling, LONG targetMs) {
+	InitializeCriticalSection(&limit->cs);
+	limit->name = name;
+	limit->ceiling = ceiling > 1 ? ceiling : 1;
+	limit->floor = floor < limit->ceiling ? floor : limit->ceiling;
+	limit->limit = limit->ceiling;
+	limit->inUse = 0;
+	limit->peak = 0;
+	limit->targetUs = (LONGLONG)targetMs * 1000;
+	limit->samples = 0;
+	limit->latencySum = 0;
+	limit->latencyUs = 0;
+	limit->rejected = 0;
+}
+
+// Function: admissionAcquire
+// Description: Take a slot of a limit if one is free
+// Return: 1 if a slot was taken, else 0
+// -IN: limit: the limit
+int admissionAcquire(ADMISSION_LIMIT *limit) {
+	LONG inUse;
+
+	do {
+		inUse = limit->inUse;
+		if (inUse >= limit->limit)
+			return 0;
+	} while (InterlockedCompareExchange(&limit->inUse, inUse + 1, inUse) != inUse);
+
+	// Only a hint for the next increase, a lost update does not matter
+	if (inUse + 1 > limit->peak)
+		limit->peak = inUse + 1;
+	return 1;
+}
+
+// Function: admissionRelease
+// Description: Give back a slot taken by admissionAcquire
+// -IN: limit: the limit
+void admissionRelease(ADMISSION_LIMIT *limit) {
+	InterlockedDecrement(&limit->inUse);
+}
+
+// Function: admissionObserveUs
+// Description: Record a latency and adjust the limit at the end of a window
+// -IN: limit: the limit
+//      us: the latency in microseconds
+void admissionObserveUs(ADMISSION_LIMIT *limit, LONGLONG us) {
+	LONGLONG average;
+	LONG next, cut;
+
+	EnterCriticalSection(&limit->cs);
+	limit->latencySum += us;
+	if (++limit->samples < ADMISSION_WINDOW) {
+		LeaveCriticalSection(&limit->cs);
+		return;
+	}
+
+	average = limit->latencySum / limit->samples;
+	next = limit->limit;
+	if (average > limit->targetUs) {
+		// Slots over a limit just cut are still draining and the latency
+		// has not seen the cut yet, so it is not cut again before they are
+		if (limit->inUse <= next) {
+			cut = next / 4;
+			next -= cut > 0 ? cut : 1;
+			if (next < limit->floor)
+				next = limit->floor;
+		}
+	}
+	else if (limit->peak >= next && next < limit->ceiling) {
+		// Only grow a limit that is holding work back
+		next++;
+	}
+	limit->limit = next;
+	limit->latencyUs = average;
+	limit->samples = 0;
+	limit->latencySum = 0;
+	limit->peak = limit->inUse;
+	LeaveCriticalSection(&limit->cs);
+}
+
+// Function: admissionObserve
+// Description: Record the latency of an operation that started at start
+// -IN: limit: the limit
+//      start: the start point, from metricNow
+void admissionObserve(ADMISSION_LIMIT *limit, LONGLONG start) {
+	admissionObserveUs(limit, (metricNow() - start) / gMetricTicksPerUs);
+}
+
+// Function: admissionMemoryPercent
+// Description: Share of the memory budget in use
+// Return: percent of gMemoryBudget
+int admissionMemoryPercent() {
+	return (int)(gMemoryInUse * 100 / gMemoryBudget);
+}
+
+// Function: admissionRetryAfter
+// Description: Time a refused client should wait: the base plus twice the
+//              latency a limit sees, with up to a quarter more of jitter so
+//              refused clients do not come back together
+// Return: milliseconds, at most ADMISSION_RETRY_MAX_MS
+// -IN: limit: the limit that refused, NULL if the memory budget did
+DWORD admissionRetryAfter(ADMISSION_LIMIT *limit) {
+	LONGLONG ms = ADMISSION_RETRY_MS;
+
+	if (limit != NULL)
+		ms += limit->latencyUs * 2 / 1000;
+	else
+		ms *= 4;
+	ms += metricNow() % (ms / 4 + 1);
+	return (DWORD)(ms < ADMISSION_RETRY_MAX_MS ? ms : ADMISSION_RETRY_MAX_MS);
+}
+
+// Function: admissionAdmit
+// Description: Admit a new transfer: the buffers in use must be under the
+//              soft share of the budget, the send backlog not deeper than
+//              ADMISSION_BACKLOG frames per send slot, and a slot of the
+//              limit free. The transfer holds the slot until its
+//              connection is freed.
+// Return: 0 if admitted, else milliseconds the client should wait
+// -IN: limit: gDownloadLimit or gUploadLimit
+DWORD admissionAdmit(ADMISSION_LIMIT *limit) {
+	int control, bulk, shares;
+
+	if (admissionMemoryPercent() >= ADMISSION_MEMORY_SOFT) {
+		InterlockedIncrement64(&limit->rejected);
+		return admissionRetryAfter(NULL);
+	}
+
+	sendBacklog(&control, &bulk, &shares);
+	if (control + bulk > gSendLimit.limit * ADMISSION_BACKLOG || !admissionAcquire(limit)) {
+		InterlockedIncrement64(&limit->rejected);
+		return admissionRetryAfter(limit);
+	}
+	return 0;
+}
+
+// Function: admissionAdmitControl
+// Description: Admit the first message of a control connection, refused
+//              only when the memory budget is used up
+// Return: 0 if admitted, else milliseconds the client should wait
+DWORD admissionAdmitControl() {
+	if (admissionMemoryPercent() < 100)
+		return 0;
+	return admissionRetryAfter(NULL);
+}
+
+// Function: admissionMemoryAdd
+// Description: Count memory handed out or given back
+// -IN: bytes: bytes handed out, negative if given back
+inline void admissionMemoryAdd(LONGLONG bytes) {
+	InterlockedExchangeAdd64(&gMemoryInUse, bytes);
+}
+
+// Function: collectAdmissionMetrics
+// Description: Append the limits, their use and latency, the transfers
+//              refused and the memory in use
+// -IN: out: the scrape
+void collectAdmissionMetrics(std::string &out) {
+	ADMISSION_LIMIT *limits[] = { &gSendLimit, &gDownloadLimit, &gUploadLimit };
+	char labels[32];
+	int i;
+
+	appendHelp(out, "clouddrive_admission_limit", "gauge", "Concurrency limit of sends and transfers, adapted to their latency.");
+	for (i = 0; i < 3; i++) {
+		snprintf(labels, sizeof(labels), "op=\"%s\"", limits[i]->name);
+		appendMetric(out, "clouddrive_admission_limit", labels, limits[i]->limit);
+	}
+	appendHelp(out, "clouddrive_admission_in_use", "gauge", "Overlapped sends and transfers holding a slot.");
+	for (i = 0; i < 3; i++) {
+		snprintf(labels, sizeof(labels), "op=\"%s\"", limits[i]->name);
+		appendMetric(out, "clouddrive_admission_in_use", labels, limits[i]->inUse);
+	}
+	appendHelp(out, "clouddrive_admission_latency_seconds", "gauge", "Average latency of the last window of each limit.");
+	for (i = 0; i < 3; i++) {
+		snprintf(labels, sizeof(labels), "op=\"%s\"", limits[i]->name);
+		appendMetric(out, "clouddrive_admission_latency_seconds", labels, limits[i]->latencyUs / 1e6);
+	}
+	appendHelp(out, "clouddrive_admission_rejected_total", "counter", "Transfers answered busy.");
+	for (i = 1; i < 3; i++) {
+		snprintf(labels, sizeof(labels), "op=\"%s\"", limits[i]->name);
+		appendMetric(out, "clouddrive_admission_rejected_total", labels, (double)limits[i]->rejected);
+	}
+	appendHelp(out, "clouddrive_memory_bytes", "gauge", "Buffer and socket objects in use, and the budget admission keeps them under.");
+	appendMetric(out, "clouddrive_memory_bytes", "state=\"in_use\"", (double)gMemoryInUse);
+	appendMetric(out, "clouddrive_memory_bytes", "state=\"budget\"", (double)gMemoryBudget);
+}
+
+#endif
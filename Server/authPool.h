@@ -0,0 +1,211 @@
+#pragma once
+
+#ifndef _AUTH_POOL_H
+#define _AUTH_POOL_H
+
+#include <string>
+#include <process.h>
+#include "dataStructures.h"
+#include "metrics.h"
+#include "binaryLog.h"
+#include "admission.h"
+#include "passwordHash.h"
+
+// Password verification pool. A hash costs tens of milliseconds of CPU
+// and memory bandwidth, so logins are verified on a few threads of their
+// own, below normal priority, instead of on the completion threads. The
+// number of threads bounds how much of the machine a login storm can take
+// from transfers; logins beyond AUTH_QUEUE_PER_WORKER waiting per thread
+// are answered OPS_ERR_BUSY with the time the queue takes to drain.
+#define AUTH_WORKERS_DEFAULT	2
+#define AUTH_WORKERS_MAX		16
+#define AUTH_QUEUE_PER_WORKER	32
+
+// A login waiting for its password to be verified
+typedef struct _AUTH_REQUEST {
+	struct _BUFFER_OBJ *bufferObj;		// request to answer
+	Account    *account;
+	char        password[CRE_MAXLEN];	// given, cleared once verified
+	char        stored[CRE_MAXLEN];		// hash of the account when the login arrived
+	char        rehash[CRE_MAXLEN];		// new hash to store, empty if none
+	bool        verified;
+	LONGLONG    queued;					// from metricNow
+	struct _AUTH_REQUEST *next;
+} AUTH_REQUEST;
+
+// Called on a pool thread once the password of a login is verified.
+// Defined by the request processor.
+void completeAuth(AUTH_REQUEST *request);
+
+AUTH_REQUEST *gAuthList = NULL, *gAuthListEnd = NULL;
+CRITICAL_SECTION gAuthCritSec;
+HANDLE gAuthSemaphore;
+int gAuthWorkerCount = AUTH_WORKERS_DEFAULT;	// threads to start
+int gAuthRunning = 0;							// threads started, 0 to verify inline
+volatile LONG gAuthQueued = 0;
+volatile LONG gAuthPending = 0;					// queued or being verified, not answered yet
+volatile LONGLONG gAuthAccepted = 0, gAuthWrong = 0, gAuthBusy = 0, gAuthVerifyUs = 0;
+
+// Function: newAuthRequest
+// Description: Create a verification for the pool
+// Return: the request, NULL if out of memory
+// -IN: bufferObj: the login to answer
+//      account: the account logging in
+//      stored: hash stored for the account
+//      password: the password given
+AUTH_REQUEST *newAuthRequest(BUFFER_OBJ *bufferObj, Account *account, const char *stored, const char *password) {
+	AUTH_REQUEST *request = (AUTH_REQUEST *)calloc(1, sizeof(AUTH_REQUEST));
+
+	if (request == NULL)
+		return NULL;
+	request->bufferObj = bufferObj;
+	request->account = account;
+	strcpy_s(request->stored, CRE_MAXLEN, stored);
+	strcpy_s(request->password, CRE_MAXLEN, password);
+	request->queued = metricNow();
+	return request;
+}
+
+// Function: freeAuthRequest
+// Description: Clear and free a verification
+// -IN: request: the request
+void freeAuthRequest(AUTH_REQUEST *request) {
+	SecureZeroMemory(request, sizeof(AUTH_REQUEST));
+	free(request);
+}
+
+// Function: authVerify
+// Description: Verify the password of a login, and hash it again if it is
+//              right but not stored with the current parameters. Runs on
+//              a pool thread, or inline when the pool is not started.
+// -IN/OUT: request: the login, verified and rehash are filled in
+void authVerify(AUTH_REQUEST *request) {
+	LONGLONG start = metricNow();
+	bool rehash;
+
+	request->verified = passwordVerify(request->stored, request->password, &rehash);
+	if (request->verified && rehash && passwordHash(request->password, request->rehash))
+		request->rehash[0] = 0;
+	SecureZeroMemory(request->password, sizeof(request->password));
+
+	InterlockedExchangeAdd64(&gAuthVerifyUs, (metricNow() - start) / gMetricTicksPerUs);
+	InterlockedIncrement64(request->verified ? &gAuthAccepted : &gAuthWrong);
+}
+
+// Function: authRetryAfter
+// Description: Time a login refused by a full queue should wait: what the
+//              queue takes to drain at the average verification time
+// Return: milliseconds, at most ADMISSION_RETRY_MAX_MS
+DWORD authRetryAfter() {
+	LONGLONG done = gAuthAccepted + gAuthWrong, ms;
+
+	ms = done > 0 ? gAuthVerifyUs / done / 1000 : 0;
+	ms = ms * (gAuthQueued / gAuthRunning + 1) + ADMISSION_RETRY_MS;
+	ms += metricNow() % (ms / 4 + 1);
+	return (DWORD)(ms < ADMISSION_RETRY_MAX_MS ? ms : ADMISSION_RETRY_MAX_MS);
+}
+
+// Function: submitAuth
+// Description: Queue a login for the pool unless enough are waiting
+// Return: 0 if queued, else milliseconds the client should wait and the
+//         request is left to the caller
+// -IN: request: the login
+DWORD submitAuth(AUTH_REQUEST *request) {
+	request->next = NULL;
+
+	EnterCriticalSection(&gAuthCritSec);
+	if (gAuthQueued >= gAuthRunning * AUTH_QUEUE_PER_WORKER) {
+		LeaveCriticalSection(&gAuthCritSec);
+		InterlockedIncrement64(&gAuthBusy);
+		return authRetryAfter();
+	}
+	if (gAuthListEnd == NULL)
+		gAuthList = request;
+	else
+		gAuthListEnd->next = request;
+	gAuthListEnd = request;
+	gAuthQueued++;
+	InterlockedIncrement(&gAuthPending);
+	LeaveCriticalSection(&gAuthCritSec);
+
+	ReleaseSemaphore(gAuthSemaphore, 1, NULL);
+	return 0;
+}
+
+// Function: authThread
+// Description: Take logins off the queue, verify them and complete them
+unsigned __stdcall authThread(void *param) {
+	AUTH_REQUEST *request;
+
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+	while (TRUE) {
+		WaitForSingleObject(gAuthSemaphore, INFINITE);
+
+		EnterCriticalSection(&gAuthCritSec);
+		request = gAuthList;
+		gAuthList = request->next;
+		if (gAuthList == NULL)
+			gAuthListEnd = NULL;
+		gAuthQueued--;
+		LeaveCriticalSection(&gAuthCritSec);
+
+		TRACE_SPAN(request->bufferObj->traceId, request->bufferObj->requestOp, "auth_queue", request->queued);
+		request->queued = metricNow();
+		authVerify(request);
+		TRACE_SPAN(request->bufferObj->traceId, request->bufferObj->requestOp, "auth", request->queued);
+
+		completeAuth(request);
+		freeAuthRequest(request);
+		InterlockedDecrement(&gAuthPending);
+	}
+	return 0;
+}
+
+// Function: startAuthPool
+// Description: Create the queue and the verification threads
+// Return: 0 if succeed, else return 1
+int startAuthPool() {
+	int count = gAuthWorkerCount;
+
+	if (initializePasswordHash())
+		return 1;
+	if (count < 1)
+		count = 1;
+	if (count > AUTH_WORKERS_MAX)
+		count = AUTH_WORKERS_MAX;
+
+	InitializeCriticalSection(&gAuthCritSec);
+	gAuthSemaphore = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+	if (gAuthSemaphore == NULL) {
+		LOG_ERROR("CreateSemaphore failed: %d\n", GetLastError());
+		return 1;
+	}
+
+	for (int i = 0; i < count; i++) {
+		if (_beginthreadex(0, 0, authThread, NULL, 0, 0) == 0) {
+			LOG_ERROR("Create auth thread failed with error %d\n", GetLastError());
+			return 1;
+		}
+		gAuthRunning++;
+	}
+	return 0;
+}
+
+// Function: collectAuthMetrics
+// Description: Append the verification pool's queue and results
+// -IN: out: the scrape
+void collectAuthMetrics(std::string &out) {
+	appendHelp(out, "clouddrive_auth_workers", "gauge", "Threads verifying passwords.");
+	appendMetric(out, "clouddrive_auth_workers", NULL, gAuthRunning);
+	appendHelp(out, "clouddrive_auth_queue_depth", "gauge", "Logins waiting for their password to be verified.");
+	appendMetric(out, "clouddrive_auth_queue_depth", NULL, gAuthQueued);
+	appendHelp(out, "clouddrive_auth_verifications_total", "counter", "Passwords verified, by result.");
+	appendMetric(out, "clouddrive_auth_verifications_total", "result=\"ok\"", (double)gAuthAccepted);
+	appendMetric(out, "clouddrive_auth_verifications_total", "result=\"wrong\"", (double)gAuthWrong);
+	appendHelp(out, "clouddrive_auth_verify_seconds_total", "counter", "Time spent verifying and rehashing passwords.");
+	appendMetric(out, "clouddrive_auth_verify_seconds_total", NULL, gAuthVerifyUs / 1e6);
+	appendHelp(out, "clouddrive_auth_busy_total", "counter", "Logins answered busy because the queue was full.");
+	appendMetric(out, "clouddrive_auth_busy_total", NULL, (double)gAuthBusy);
+}
+
+#endif
@@ -0,0 +1,507 @@
+#pragma once
+
+#ifndef _BINARY_LOG_H
+#define _BINARY_LOG_H
+
+#include <string.h>
+#include <string>
+#include <unordered_set>
+#include <unordered_map>
+#include <process.h>
+#include "dataStructures.h"
+
+// Asynchronous binary logger. A thread logging a message only copies the
+// address of the format string and the raw arguments into a ring owned by
+// that thread; nothing is formatted and no lock is taken. A drain thread
+// empties the rings into a binary file, writing each format string once,
+// and echoes warnings and errors to the console. The file is decoded
+// offline with "Server -d <file>".
+//
+// Format strings must be literals. Arguments are kept as 64-bit integers,
+// except for one string argument per message whose first LOG_TEXT_SIZE - 1
+// characters are copied. A full ring drops new records and counts them
+// rather than blocking the thread.
+#define LOG_LEVEL_DEBUG		0
+#define LOG_LEVEL_INFO		1
+#define LOG_LEVEL_WARN		2
+#define LOG_LEVEL_ERROR		3
+
+// Messages below LOG_LEVEL are compiled out
+#ifndef LOG_LEVEL
+#define LOG_LEVEL			LOG_LEVEL_INFO
+#endif
+
+// Per-request trace spans are compiled in unless LOG_TRACE_SPANS is 0 and
+// recorded only when enabled with "-t"
+#ifndef LOG_TRACE_SPANS
+#define LOG_TRACE_SPANS		1
+#endif
+
+#define LOG_RING_SIZE		2048		// records per thread, a power of two
+#define LOG_MAX_ARGS		6
+#define LOG_TEXT_SIZE		56
+#define LOG_DRAIN_INTERVAL	20			// milliseconds between drains
+#define LOG_CONSOLE_LEVEL	LOG_LEVEL_WARN
+#define LOG_FILE_MAGIC		"CDLG"
+#define LOG_FILE_VERSION	1
+#define LOG_DEFAULT_FILE	"server.blog"
+
+#define LOG_KIND_MESSAGE	0
+#define LOG_KIND_SPAN		1
+
+// Entries of the log file after its header
+#define LOG_ENTRY_FORMAT	'F'		// format string: id, length, characters
+#define LOG_ENTRY_RECORD	'R'		// one LOG_RECORD
+
+// One message or trace span. For a span, format is the stage name and
+// args hold the trace id, the opcode and the start and end time.
+typedef struct {
+	LONGLONG    time;				// QueryPerformanceCounter
+	ULONGLONG   format;				// address of the format string
+	DWORD       threadId;
+	BYTE        level;
+	BYTE        kind;
+	BYTE        argCount;
+	BYTE        textArg;			// index of the string argument, 0xFF if none
+	LONGLONG    args[LOG_MAX_ARGS];
+	char        text[LOG_TEXT_SIZE];
+} LOG_RECORD;
+
+typedef struct {
+	char        magic[4];
+	int         version;
+	LONGLONG    frequency;			// performance counter ticks per second
+	LONGLONG    baseCounter;		// performance counter at baseTime
+	FILETIME    baseTime;
+} LOG_FILE_HEADER;
+
+// Written only by its thread (head) and the drain thread (tail)
+typedef struct _LOG_RING {
+	LOG_RECORD  records[LOG_RING_SIZE];
+	volatile LONG head;
+	volatile LONG tail;
+	volatile LONG dropped;
+	LONG        droppedReported;
+	DWORD       threadId;			// owner of the ring
+	struct _LOG_RING *next;
+} LOG_RING;
+
+LOG_RING *gLogRings = NULL;
+CRITICAL_SECTION gLogRingsCritSec;
+__declspec(thread) LOG_RING *tlsLogRing = NULL;
+FILE *gLogFile = NULL;
+char *gLogFileName = LOG_DEFAULT_FILE;
+volatile LONG gTraceEnabled = 0, gTraceNextId = 0;
+std::unordered_set<ULONGLONG> gLogFormatsWritten;	// drain thread only
+
+// Function: logThreadRing
+// Description: Get the ring of the calling thread, creating it on first use
+// Return: the ring, NULL if it cannot be allocated
+LOG_RING* logThreadRing() {
+	LOG_RING *ring = tlsLogRing;
+
+	if (ring == NULL) {
+		ring = (LOG_RING *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(LOG_RING));
+		if (ring == NULL)
+			return NULL;
+		ring->threadId = GetCurrentThreadId();
+		EnterCriticalSection(&gLogRingsCritSec);
+		ring->next = gLogRings;
+		gLogRings = ring;
+		LeaveCriticalSection(&gLogRingsCritSec);
+		tlsLogRing = ring;
+	}
+	return ring;
+}
+
+// Function: logReserve
+// Description: Get the next free record of the calling thread's ring
+// Return: the record, NULL if the ring is full
+LOG_RECORD* logReserve(LOG_RING **ring) {
+	LOG_RECORD *record;
+
+	*ring = logThreadRing();
+	if (*ring == NULL)
+		return NULL;
+	if ((*ring)->head - (*ring)->tail >= LOG_RING_SIZE) {
+		InterlockedIncrement(&(*ring)->dropped);
+		return NULL;
+	}
+
+	record = &(*ring)->records[(*ring)->head & (LOG_RING_SIZE - 1)];
+	QueryPerformanceCounter((LARGE_INTEGER *)&record->time);
+	record->threadId = GetCurrentThreadId();
+	record->argCount = 0;
+	record->textArg = 0xFF;
+	return record;
+}
+
+// Function: logPublish
+// Description: Hand a filled record over to the drain thread
+// -IN: ring: the ring of the calling thread
+void logPublish(LOG_RING *ring) {
+	InterlockedExchange(&ring->head, ring->head + 1);
+}
+
+// Function: logTail
+// Description: End of a string argument that would not fit in a record,
+//              for paths, which differ at their end
+// Return: the last LOG_TEXT_SIZE - 1 characters of text
+// -IN: text: the string
+inline const char *logTail(const char *text) {
+	size_t len = strlen(text);
+
+	return len >= LOG_TEXT_SIZE ? text + len - (LOG_TEXT_SIZE - 1) : text;
+}
+
+inline void logPack(LOG_RECORD *record, const char *text) {
+	strncpy(record->text, text != NULL ? text : "(null)", LOG_TEXT_SIZE - 1);
+	record->text[LOG_TEXT_SIZE - 1] = 0;
+	record->textArg = record->argCount;
+	record->args[record->argCount++] = 0;
+}
+
+inline void logPack(LOG_RECORD *record, char *text) {
+	logPack(record, (const char *)text);
+}
+
+template <typename T> inline void logPack(LOG_RECORD *record, T *value) {
+	record->args[record->argCount++] = (LONGLONG)(ULONG_PTR)value;
+}
+
+template <typename T> inline void logPack(LOG_RECORD *record, T value) {
+	record->args[record->argCount++] = (LONGLONG)value;
+}
+
+inline void logPackAll(LOG_RECORD *record) {
+}
+
+template <typename T, typename... Rest> inline void logPackAll(LOG_RECORD *record, T value, Rest... rest) {
+	if (record->argCount < LOG_MAX_ARGS)
+		logPack(record, value);
+	logPackAll(record, rest...);
+}
+
+// Function: logWrite
+// Description: Log a message. Use the LOG_* macros instead.
+// -IN: level: LOG_LEVEL_*
+//      format: printf-style format, must be a literal
+//      args: the arguments of the format
+template <typename... Args> void logWrite(int level, const char *format, Args... args) {
+	LOG_RING *ring;
+	LOG_RECORD *record = logReserve(&ring);
+
+	if (record == NULL)
+		return;
+	record->format = (ULONGLONG)(ULONG_PTR)format;
+	record->level = (BYTE)level;
+	record->kind = LOG_KIND_MESSAGE;
+	logPackAll(record, args...);
+	logPublish(ring);
+}
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(format, ...)	logWrite(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(format, ...)	((void)0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(format, ...)	logWrite(LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#else
+#define LOG_INFO(format, ...)	((void)0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(format, ...)	logWrite(LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#else
+#define LOG_WARN(format, ...)	((void)0)
+#endif
+#define LOG_ERROR(format, ...)	logWrite(LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+
+// Function: traceStart
+// Description: Give a request a trace id if tracing is enabled
+// Return: the trace id, 0 if the request is not traced
+inline LONG traceStart() {
+	return gTraceEnabled ? InterlockedIncrement(&gTraceNextId) : 0;
+}
+
+// Function: traceSpan
+// Description: Record one stage of a traced request. Use TRACE_SPAN.
+// -IN: traceId: id from traceStart
+//      opcode: opcode of the request
+//      stage: name of the stage, must be a literal
+//      start: start of the stage, from QueryPerformanceCounter
+void traceSpan(LONG traceId, int opcode, const char *stage, LONGLONG start) {
+	LOG_RING *ring;
+	LOG_RECORD *record = logReserve(&ring);
+
+	if (record == NULL)
+		return;
+	record->format = (ULONGLONG)(ULONG_PTR)stage;
+	record->level = LOG_LEVEL_DEBUG;
+	record->kind = LOG_KIND_SPAN;
+	record->args[0] = traceId;
+	record->args[1] = opcode;
+	record->args[2] = start;
+	record->args[3] = record->time;
+	record->argCount = 4;
+	logPublish(ring);
+}
+
+#if LOG_TRACE_SPANS
+#define TRACE_SPAN(traceId, opcode, stage, start) \
+	do { if (traceId) traceSpan(traceId, opcode, stage, start); } while (0)
+#else
+#define TRACE_SPAN(traceId, opcode, stage, start)	((void)0)
+#endif
+
+// Function: logFormatRecord
+// Description: Render a record as text
+// -IN: record: the record
+//      format: its format string, or stage name for a span
+//      frequency: performance counter ticks per second
+// -OUT: out: the text
+//       outLen: size of out
+void logFormatRecord(const LOG_RECORD *record, const char *format, LONGLONG frequency, char *out, int outLen) {
+	static const char *levelNames[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+	char spec[16];
+	int len = 0, arg = 0, specLen;
+	const char *p;
+
+	if (record->kind == LOG_KIND_SPAN) {
+		snprintf(out, outLen, "span %lld op=%lld %s %lld us", record->args[0], record->args[1], format,
+			(record->args[3] - record->args[2]) * 1000000 / frequency);
+		return;
+	}
+
+	len = snprintf(out, outLen, "%-5s [%lu] ", levelNames[record->level & 3], record->threadId);
+	for (p = format; *p != 0 && len < outLen - 1; p++) {
+		if (*p != '%') {
+			out[len++] = *p;
+			continue;
+		}
+		if (p[1] == '%') {
+			out[len++] = '%';
+			p++;
+			continue;
+		}
+
+		// Keep flags and width, drop the length modifiers since every
+		// argument was widened to 64 bits
+		specLen = 0;
+		spec[specLen++] = '%';
+		for (p++; *p != 0 && strchr("-+ #0123456789.", *p) != NULL && specLen < 8; p++)
+			spec[specLen++] = *p;
+		while (*p == 'l' || *p == 'h' || *p == 'z' || *p == 'I')
+			p++;
+		if (*p == 0)
+			break;
+
+		if (arg >= record->argCount) {
+			len += snprintf(out + len, outLen - len, "?");
+		}
+		else if (*p == 's') {
+			spec[specLen++] = 's';
+			spec[specLen] = 0;
+			len += snprintf(out + len, outLen - len, spec, arg == record->textArg ? record->text : "?");
+		}
+		else if (*p == 'p') {
+			len += snprintf(out + len, outLen - len, "0x%llx", record->args[arg]);
+		}
+		else if (*p == 'c') {
+			spec[specLen++] = 'c';
+			spec[specLen] = 0;
+			len += snprintf(out + len, outLen - len, spec, (int)record->args[arg]);
+		}
+		else {
+			spec[specLen++] = 'l';
+			spec[specLen++] = 'l';
+			spec[specLen++] = (*p == 'u' || *p == 'x' || *p == 'X' || *p == 'd' || *p == 'i') ? *p : 'd';
+			spec[specLen] = 0;
+			len += snprintf(out + len, outLen - len, spec, record->args[arg]);
+		}
+		arg++;
+	}
+	if (len >= outLen)
+		len = outLen - 1;
+	out[len] = 0;
+}
+
+// Function: logDrainRecord
+// Description: Write one record to the log file, preceded by its format
+//              string the first time that string is seen
+// -IN: record: the record
+//      frequency: performance counter ticks per second
+void logDrainRecord(const LOG_RECORD *record, LONGLONG frequency) {
+	const char *format = (const char *)(ULONG_PTR)record->format;
+	char text[512];
+
+	if (gLogFile != NULL) {
+		if (gLogFormatsWritten.insert(record->format).second) {
+			unsigned short length = (unsigned short)strlen(format);
+			fputc(LOG_ENTRY_FORMAT, gLogFile);
+			fwrite(&record->format, sizeof(record->format), 1, gLogFile);
+			fwrite(&length, sizeof(length), 1, gLogFile);
+			fwrite(format, 1, length, gLogFile);
+		}
+		fputc(LOG_ENTRY_RECORD, gLogFile);
+		fwrite(record, sizeof(LOG_RECORD), 1, gLogFile);
+	}
+
+	if (record->kind == LOG_KIND_MESSAGE && (record->level >= LOG_CONSOLE_LEVEL || gLogFile == NULL)) {
+		logFormatRecord(record, format, frequency, text, sizeof(text));
+		fprintf(stderr, "%s", text);
+	}
+}
+
+// Function: logDrain
+// Description: Empty every ring into the log file
+// -IN: frequency: performance counter ticks per second
+void logDrain(LONGLONG frequency) {
+	static const char *droppedFormat = "%ld log records dropped by thread %lu\n";
+	LOG_RECORD dropped;
+	LOG_RING *ring;
+	LONG head, tail, count;
+
+	EnterCriticalSection(&gLogRingsCritSec);
+	ring = gLogRings;
+	LeaveCriticalSection(&gLogRingsCritSec);
+
+	// Rings are only ever added at the head, so the list can be walked
+	// without the lock
+	for (; ring != NULL; ring = ring->next) {
+		head = ring->head;
+		for (tail = ring->tail; tail != head; tail++)
+			logDrainRecord(&ring->records[tail & (LOG_RING_SIZE - 1)], frequency);
+		InterlockedExchange(&ring->tail, tail);
+
+		count = ring->dropped - ring->droppedReported;
+		if (count > 0) {
+			memset(&dropped, 0, sizeof(dropped));
+			QueryPerformanceCounter((LARGE_INTEGER *)&dropped.time);
+			dropped.format = (ULONGLONG)(ULONG_PTR)droppedFormat;
+			dropped.level = LOG_LEVEL_WARN;
+			dropped.textArg = 0xFF;
+			dropped.threadId = GetCurrentThreadId();
+			dropped.args[0] = count;
+			dropped.args[1] = ring->threadId;
+			dropped.argCount = 2;
+			logDrainRecord(&dropped, frequency);
+			ring->droppedReported += count;
+		}
+	}
+	if (gLogFile != NULL)
+		fflush(gLogFile);
+}
+
+// Function: logDrainThread
+// Description: Periodically empty the rings
+unsigned __stdcall logDrainThread(void *param) {
+	LARGE_INTEGER frequency;
+
+	QueryPerformanceFrequency(&frequency);
+	while (TRUE) {
+		Sleep(LOG_DRAIN_INTERVAL);
+		logDrain(frequency.QuadPart);
+	}
+	return 0;
+}
+
+// Function: logFlush
+// Description: Give the drain thread a pass at the last records, before
+//              the process exits
+void logFlush() {
+	Sleep(2 * LOG_DRAIN_INTERVAL);
+}
+
+// Function: startLog
+// Description: Open the log file and start the drain thread. Without a
+//              log file, records are still drained and printed.
+// Return: 0 if succeed, else return 1
+int startLog() {
+	LOG_FILE_HEADER header;
+
+	InitializeCriticalSection(&gLogRingsCritSec);
+
+	gLogFile = fopen(gLogFileName, "wb");
+	if (gLogFile == NULL) {
+		fprintf(stderr, "Cannot open log file %s, logging to the console\n", gLogFileName);
+	}
+	else {
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, LOG_FILE_MAGIC, sizeof(header.magic));
+		header.version = LOG_FILE_VERSION;
+		QueryPerformanceFrequency((LARGE_INTEGER *)&header.frequency);
+		QueryPerformanceCounter((LARGE_INTEGER *)&header.baseCounter);
+		GetSystemTimeAsFileTime(&header.baseTime);
+		fwrite(&header, sizeof(header), 1, gLogFile);
+	}
+
+	if (_beginthreadex(0, 0, logDrainThread, NULL, 0, 0) == 0) {
+		printf("Create log thread failed with error %d\n", GetLastError());
+		return 1;
+	}
+	return 0;
+}
+
+// Function: logDecodeFile
+// Description: Print a binary log file as text
+// Return: 0 if succeed, else return 1
+// -IN: path: the log file
+int logDecodeFile(const char *path) {
+	std::unordered_map<ULONGLONG, std::string> formats;
+	LOG_FILE_HEADER header;
+	LOG_RECORD record;
+	ULONGLONG id, base, stamp;
+	FILETIME fileTime;
+	SYSTEMTIME systemTime;
+	unsigned short length;
+	char text[512], buff[65536];
+	FILE *file;
+	int entry;
+
+	file = fopen(path, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "Cannot open %s\n", path);
+		return 1;
+	}
+	if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, LOG_FILE_MAGIC, 4) != 0
+		|| header.version != LOG_FILE_VERSION) {
+		fprintf(stderr, "%s is not a log file\n", path);
+		fclose(file);
+		return 1;
+	}
+	base = ((ULONGLONG)header.baseTime.dwHighDateTime << 32) | header.baseTime.dwLowDateTime;
+
+	while ((entry = fgetc(file)) != EOF) {
+		if (entry == LOG_ENTRY_FORMAT) {
+			if (fread(&id, sizeof(id), 1, file) != 1 || fread(&length, sizeof(length), 1, file) != 1
+				|| fread(buff, 1, length, file) != length)
+				break;
+			formats[id] = std::string(buff, length);
+		}
+		else if (entry == LOG_ENTRY_RECORD) {
+			if (fread(&record, sizeof(record), 1, file) != 1)
+				break;
+			auto format = formats.find(record.format);
+			logFormatRecord(&record, format != formats.end() ? format->second.c_str() : "<unknown format>\n",
+				header.frequency, text, sizeof(text));
+
+			// Wall clock time of the record, in 100 ns units like FILETIME
+			stamp = base + (ULONGLONG)((record.time - header.baseCounter) * 10000000 / header.frequency);
+			fileTime.dwLowDateTime = (DWORD)stamp;
+			fileTime.dwHighDateTime = (DWORD)(stamp >> 32);
+			FileTimeToSystemTime(&fileTime, &systemTime);
+			printf("%04d-%02d-%02d %02d:%02d:%02d.%06llu %s%s", systemTime.wYear, systemTime.wMonth, systemTime.wDay,
+				systemTime.wHour, systemTime.wMinute, systemTime.wSecond, (stamp / 10) % 1000000, text,
+				record.kind == LOG_KIND_SPAN ? "\n" : "");
+		}
+		else {
+			fprintf(stderr, "Corrupted entry in %s\n", path);
+			break;
+		}
+	}
+	fclose(file);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,396 @@
+#pragma once
+
+#ifndef _BLOCK_STORE_H
+#define _BLOCK_STORE_H
+
+#include <vector>
+#include <compressapi.h>
+#include "dataStructures.h"
+#include "md5.h"
+#include "binaryLog.h"
+
+#pragma comment(lib, "Cabinet.lib")
+
+#define STORE_COMPRESS_ALGORITHM	(COMPRESS_ALGORITHM_XPRESS_HUFF | COMPRESS_RAW)
+
+// Function: storedBlockRawLen
+// Description: Get the number of raw bytes held by a block
+// Return: raw length of the block
+// -IN: sf: the opened stored file
+//      blockIdx: index of the block
+int storedBlockRawLen(STORED_FILE* sf, int blockIdx) {
+	long long start = (long long)blockIdx * sf->blockSize;
+	if (sf->rawLen - start < sf->blockSize)
+		return (int)(sf->rawLen - start);
+	return sf->blockSize;
+}
+
+// Function: closeStoredFile
+// Description: Close a stored file and release its block index.
+//              Safe to call on a file that was never opened.
+// -IN: sf: the stored file to close
+void closeStoredFile(STORED_FILE* sf) {
+	if (sf->file != NULL) {
+		fclose(sf->file);
+		sf->file = NULL;
+	}
+	if (sf->index != NULL) {
+		free(sf->index);
+		sf->index = NULL;
+	}
+	if (sf->decompressor != NULL) {
+		CloseDecompressor((DECOMPRESSOR_HANDLE)sf->decompressor);
+		sf->decompressor = NULL;
+	}
+	sf->isBlockFile = false;
+}
+
+// Function: validBlockIndex
+// Description: Check a block header and its index against the stored file,
+//              so that neither an offset nor a length read from the file
+//              reaches past it
+// Return: true if every block lies between the header and the index
+// -IN: header: the header of the file
+//      index: its blockCount entries, NULL to check the header only
+//      fileLen: size of the stored file
+bool validBlockIndex(BLOCK_FILE_HEADER* header, BLOCK_INDEX_ENTRY* index, long long fileLen) {
+	long long blocks, rawLeft;
+
+	if (header->blockSize != STORE_BLOCK_SIZE || header->rawLen < 0)
+		return false;
+	blocks = header->rawLen / STORE_BLOCK_SIZE + (header->rawLen % STORE_BLOCK_SIZE != 0);
+	if (header->blockCount != blocks
+		|| header->indexOffset < (long long)sizeof(BLOCK_FILE_HEADER)
+		|| header->indexOffset > fileLen
+		|| (fileLen - header->indexOffset) / (long long)sizeof(BLOCK_INDEX_ENTRY) < blocks)
+		return false;
+	if (index == NULL)
+		return true;
+
+	rawLeft = header->rawLen;
+	for (int i = 0; i < header->blockCount; i++, rawLeft -= STORE_BLOCK_SIZE) {
+		if (index[i].offset < (long long)sizeof(BLOCK_FILE_HEADER)
+			|| index[i].storedLen <= 0 || index[i].storedLen > STORE_BLOCK_SIZE
+			|| index[i].offset > header->indexOffset - index[i].storedLen)
+			return false;
+		// A block kept raw holds all of its bytes
+		if ((index[i].flags & BLOCK_FLAG_RAW)
+			&& index[i].storedLen != (rawLeft < STORE_BLOCK_SIZE ? rawLeft : STORE_BLOCK_SIZE))
+			return false;
+	}
+	return true;
+}
+
+// Function: openStoredFile
+// Description: Open a file from the storage. Only files of a group that
+//              stores compressed files are read as block files, and only
+//              if they start with a block header; anything a user uploads
+//              elsewhere is served raw whatever its first bytes are. The
+//              header and the block index are checked against the size of
+//              the file before they are used. The digest of a raw file
+//              takes a read of the whole file, ranged downloads skip it.
+// Return: 0 if succeed, else return 1
+// -IN: path: path of the file
+//      blockFormat: whether the group of the file stores compressed files
+//      withDigest: whether to compute the digest of a raw file
+// -OUT: sf: the opened stored file
+int openStoredFile(STORED_FILE* sf, char* path, bool blockFormat, bool withDigest) {
+	BLOCK_FILE_HEADER header;
+	long long fileLen;
+
+	sf->file = fopen(path, "rb");
+	if (sf->file == NULL) {
+		LOG_ERROR("Unable to open file %s\n", logTail(path));
+		return 1;
+	}
+	_fseeki64(sf->file, 0, SEEK_END);
+	fileLen = _ftelli64(sf->file);
+	_fseeki64(sf->file, 0, SEEK_SET);
+
+	if (blockFormat
+		&& fread(&header, sizeof(header), 1, sf->file) == 1
+		&& memcmp(header.magic, STORE_BLOCK_MAGIC, 4) == 0
+		&& header.version == STORE_BLOCK_VERSION) {
+		if (!validBlockIndex(&header, NULL, fileLen)) {
+			LOG_ERROR("Block header of %s is damaged\n", logTail(path));
+			closeStoredFile(sf);
+			return 1;
+		}
+		sf->isBlockFile = true;
+		sf->rawLen = header.rawLen;
+		sf->blockSize = header.blockSize;
+		sf->blockCount = header.blockCount;
+		header.digest[DIGEST_SIZE - 1] = 0;
+		strcpy_s(sf->digest, DIGEST_SIZE, header.digest);
+
+		sf->index = (BLOCK_INDEX_ENTRY*)malloc(sizeof(BLOCK_INDEX_ENTRY) * (sf->blockCount + 1));
+		if (sf->index == NULL) {
+			LOG_ERROR("Memory error!\n");
+			closeStoredFile(sf);
+			return 1;
+		}
+		if (_fseeki64(sf->file, header.indexOffset, SEEK_SET) != 0
+			|| fread(sf->index, sizeof(BLOCK_INDEX_ENTRY), sf->blockCount, sf->file) != (size_t)sf->blockCount) {
+			LOG_ERROR("Block index of %s is truncated\n", logTail(path));
+			closeStoredFile(sf);
+			return 1;
+		}
+		if (!validBlockIndex(&header, sf->index, fileLen)) {
+			LOG_ERROR("Block index of %s is damaged\n", logTail(path));
+			closeStoredFile(sf);
+			return 1;
+		}
+
+		DECOMPRESSOR_HANDLE decompressor;
+		if (!CreateDecompressor(STORE_COMPRESS_ALGORITHM, NULL, &decompressor)) {
+			LOG_ERROR("CreateDecompressor failed: %d\n", GetLastError());
+			closeStoredFile(sf);
+			return 1;
+		}
+		sf->decompressor = decompressor;
+		return 0;
+	}
+
+	// Not a block file, serve it raw
+	sf->isBlockFile = false;
+	sf->rawLen = fileLen;
+	sf->blockSize = STORE_BLOCK_SIZE;
+	sf->blockCount = (int)((sf->rawLen + STORE_BLOCK_SIZE - 1) / STORE_BLOCK_SIZE);
+
+	sf->digest[0] = 0;
+	if (withDigest) {
+		MD5 md5;
+		strcpy_s(sf->digest, DIGEST_SIZE, md5.digestFile(path));
+	}
+	return 0;
+}
+
+// Function: readStoredBlock
+// Description: Read a block as it is stored on disk, without decoding it
+// Return: number of bytes read, -1 if fail
+// -IN: sf: the opened stored file
+//      blockIdx: index of the block to read
+// -OUT: out: buffer of at least STORE_BLOCK_SIZE bytes
+//       isCompressed: set to true if the returned bytes are compressed
+int readStoredBlock(STORED_FILE* sf, int blockIdx, char* out, bool* isCompressed) {
+	if (blockIdx < 0 || blockIdx >= sf->blockCount)
+		return -1;
+
+	if (!sf->isBlockFile) {
+		int len = storedBlockRawLen(sf, blockIdx);
+		_fseeki64(sf->file, (long long)blockIdx * sf->blockSize, SEEK_SET);
+		*isCompressed = false;
+		return (fread(out, 1, len, sf->file) == (size_t)len) ? len : -1;
+	}
+
+	BLOCK_INDEX_ENTRY* entry = &sf->index[blockIdx];
+	if (entry->storedLen > STORE_BLOCK_SIZE)
+		return -1;
+
+	_fseeki64(sf->file, entry->offset, SEEK_SET);
+	if (fread(out, 1, entry->storedLen, sf->file) != (size_t)entry->storedLen)
+		return -1;
+
+	*isCompressed = !(entry->flags & BLOCK_FLAG_RAW);
+	return entry->storedLen;
+}
+
+// Function: readStoredRange
+// Description: Read raw content starting at any offset. Only the blocks
+//              covering the range are read and decoded.
+// Return: number of bytes read, -1 if fail
+// -IN: sf: the opened stored file
+//      offset: raw offset to start reading at
+//      len: number of bytes to read
+// -OUT: out: buffer to store the content
+int readStoredRange(STORED_FILE* sf, long long offset, char* out, int len) {
+	if (offset >= sf->rawLen)
+		return 0;
+	if (sf->rawLen - offset < len)
+		len = (int)(sf->rawLen - offset);
+
+	if (!sf->isBlockFile) {
+		if (_fseeki64(sf->file, offset, SEEK_SET) != 0)
+			return -1;
+		return (fread(out, 1, len, sf->file) == (size_t)len) ? len : -1;
+	}
+
+	char stored[STORE_BLOCK_SIZE];
+	char raw[STORE_BLOCK_SIZE];
+	int done = 0;
+
+	while (done < len) {
+		int blockIdx = (int)((offset + done) / sf->blockSize);
+		int inBlock = (int)((offset + done) % sf->blockSize);
+		int rawLen = storedBlockRawLen(sf, blockIdx);
+		bool isCompressed;
+		SIZE_T decodedLen;
+
+		int storedLen = readStoredBlock(sf, blockIdx, stored, &isCompressed);
+		if (storedLen < 0)
+			return -1;
+
+		if (isCompressed) {
+			if (!Decompress((DECOMPRESSOR_HANDLE)sf->decompressor, stored, storedLen, raw, rawLen, &decodedLen)
+				|| decodedLen != (SIZE_T)rawLen) {
+				LOG_ERROR("Decompress failed on block %d: %d\n", blockIdx, GetLastError());
+				return -1;
+			}
+		}
+		else {
+			memcpy(raw, stored, storedLen);
+		}
+
+		int n = rawLen - inBlock;
+		if (n > len - done)
+			n = len - done;
+		memcpy(out + done, raw + inBlock, n);
+		done += n;
+	}
+	return done;
+}
+
+// Function: compressStoredFile
+// Description: Rewrite a raw file into the block-compressed format.
+//              Blocks that do not shrink are kept raw. The file is only
+//              replaced once the whole of it was written.
+// Return: 0 if succeed, else return 1 and the raw file is left as it was
+// -IN: path: path of the raw file
+//      digest: MD5 digest of the raw content
+int compressStoredFile(char* path, char* digest) {
+	char tmpPath[MAX_PATH];
+	char raw[STORE_BLOCK_SIZE];
+	char packed[STORE_BLOCK_SIZE];
+	BLOCK_FILE_HEADER header;
+	COMPRESSOR_HANDLE compressor;
+	FILE *in, *out;
+	SIZE_T packedLen;
+	size_t len;
+	int ret = 0;
+
+	snprintf(tmpPath, MAX_PATH, "%s.tmp", path);
+
+	in = fopen(path, "rb");
+	if (in == NULL)
+		return 1;
+	out = fopen(tmpPath, "wb");
+	if (out == NULL) {
+		fclose(in);
+		return 1;
+	}
+	if (!CreateCompressor(STORE_COMPRESS_ALGORITHM, NULL, &compressor)) {
+		LOG_ERROR("CreateCompressor failed: %d\n", GetLastError());
+		fclose(in);
+		fclose(out);
+		remove(tmpPath);
+		return 1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, STORE_BLOCK_MAGIC, 4);
+	header.version = STORE_BLOCK_VERSION;
+	header.blockSize = STORE_BLOCK_SIZE;
+	strcpy_s(header.digest, DIGEST_SIZE, digest);
+	if (fwrite(&header, sizeof(header), 1, out) != 1)
+		ret = 1;
+
+	std::vector<BLOCK_INDEX_ENTRY> index;
+	long long pos = sizeof(header);
+
+	while (ret == 0 && (len = fread(raw, 1, STORE_BLOCK_SIZE, in)) > 0) {
+		BLOCK_INDEX_ENTRY entry;
+		entry.offset = pos;
+
+		// Keep the block raw if compressing does not save anything
+		if (Compress(compressor, raw, len, packed, STORE_BLOCK_SIZE, &packedLen) && packedLen < len) {
+			entry.storedLen = (int)packedLen;
+			entry.flags = 0;
+			if (fwrite(packed, 1, packedLen, out) != packedLen)
+				ret = 1;
+		}
+		else {
+			entry.storedLen = (int)len;
+			entry.flags = BLOCK_FLAG_RAW;
+			if (fwrite(raw, 1, len, out) != len)
+				ret = 1;
+		}
+
+		pos += entry.storedLen;
+		header.rawLen += len;
+		index.push_back(entry);
+	}
+	if (ferror(in))
+		ret = 1;
+
+	header.blockCount = (int)index.size();
+	header.indexOffset = pos;
+	if (ret == 0 && !index.empty()
+		&& fwrite(&index[0], sizeof(BLOCK_INDEX_ENTRY), index.size(), out) != index.size())
+		ret = 1;
+
+	// Rewrite the header now that the totals are known
+	if (ret == 0 && (fseek(out, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, out) != 1))
+		ret = 1;
+
+	CloseCompressor(compressor);
+	fclose(in);
+	if (fclose(out) != 0)
+		ret = 1;
+
+	if (ret == 0 && MoveFileExA(tmpPath, path, MOVEFILE_REPLACE_EXISTING) == 0) {
+		LOG_ERROR("Cannot replace %s. Error code %d!\n", logTail(path), GetLastError());
+		ret = 1;
+	}
+	if (ret != 0)
+		remove(tmpPath);
+	return ret;
+}
+
+// Function: expandStoredFile
+// Description: Rewrite a block file back into a raw one, for a file that
+//              leaves a compressed group. A file that is already raw is
+//              left alone.
+// Return: 0 if succeed, else return 1 and the file is left as it was
+// -IN: path: path of the stored file
+int expandStoredFile(char* path) {
+	char tmpPath[MAX_PATH];
+	char raw[STORE_BLOCK_SIZE];
+	STORED_FILE sf;
+	FILE* out;
+	long long offset;
+	int len, ret = 0;
+
+	if (openStoredFile(&sf, path, true, false))
+		return 1;
+	if (!sf.isBlockFile) {
+		closeStoredFile(&sf);
+		return 0;
+	}
+
+	snprintf(tmpPath, MAX_PATH, "%s.tmp", path);
+	out = fopen(tmpPath, "wb");
+	if (out == NULL) {
+		closeStoredFile(&sf);
+		return 1;
+	}
+
+	for (offset = 0; ret == 0 && offset < sf.rawLen; offset += len) {
+		len = readStoredRange(&sf, offset, raw, STORE_BLOCK_SIZE);
+		if (len <= 0 || fwrite(raw, 1, len, out) != (size_t)len)
+			ret = 1;
+	}
+
+	closeStoredFile(&sf);
+	if (fclose(out) != 0)
+		ret = 1;
+
+	if (ret == 0 && MoveFileExA(tmpPath, path, MOVEFILE_REPLACE_EXISTING) == 0) {
+		LOG_ERROR("Cannot replace %s. Error code %d!\n", logTail(path), GetLastError());
+		ret = 1;
+	}
+	if (ret != 0)
+		remove(tmpPath);
+	return ret;
+}
+
+#endif
@@ -0,0 +1,204 @@
+#pragma once
+
+#ifndef _CHANGE_FEED_H
+#define _CHANGE_FEED_H
+
+#include <list>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <process.h>
+#include "dataStructures.h"
+#include "dbUtils.h"
+#include "metrics.h"
+#include "binaryLog.h"
+#include "accountCache.h"
+#include "groupCatalog.h"
+#include "membership.h"
+
+// Change feed. Triggers log every change of an account, a group or a
+// membership in the CHANGELOG table, whoever makes it, so an admin
+// working on the database directly is seen without a restart. A thread
+// checks the data version of its own connection every CHANGE_POLL_MS,
+// which only moves when another connection committed, and reads the log
+// past the last version applied only then. Each change is applied by
+// reading its row again, so changes the server made itself are applied a
+// second time harmlessly. If the log was trimmed past what was applied,
+// everything held in memory is read again.
+#define CHANGE_POLL_MS		50
+
+LONGLONG gChangeVersion = 0;			// last change applied
+volatile LONGLONG gChangesApplied[3] = { 0, 0, 0 };	// by kind
+volatile LONGLONG gChangeResyncs = 0;
+
+// Function: initializeChangeFeed
+// Description: Start the feed after the last change logged. Called before
+//              the groups and memberships are read, so a change made in
+//              between is applied again rather than missed.
+// Return: 0 if succeed, else return 1
+int initializeChangeFeed() {
+	if (readChangeVersionDb(&gChangeVersion)) {
+		fprintf(stderr, "Cannot read the change log version!\n");
+		return 1;
+	}
+	return 0;
+}
+
+// Function: changeGroup
+// Description: Apply a change of a group
+// -IN: gid: id of the group
+void changeGroup(int gid) {
+	Group group;
+	int ret;
+
+	if ((ret = readGroupByIdDb(gid, &group)) < 0) {
+		LOG_ERROR("Cannot read a group from the database!\n");
+	}
+	else if (ret == 1) {
+		groupCatalogRemove(gid);
+	}
+	else {
+		membershipAddGroup(gid);
+		groupCatalogUpdate(&group);
+	}
+}
+
+// Function: changeMember
+// Description: Apply a change of a membership
+// -IN: uid: id of the account
+//      gid: id of the group
+void changeMember(int uid, int gid) {
+	int ret = memberExistsDb(uid, gid);
+
+	if (ret < 0)
+		LOG_ERROR("Cannot read a membership from the database!\n");
+	else if (ret == 1)
+		membershipAdd(uid, gid);
+	else
+		membershipRemove(uid, gid);
+}
+
+// Function: changeResync
+// Description: Read everything held in memory again, for when changes
+//              were trimmed from the log before they were applied
+void changeResync() {
+	std::list<Group> groups;
+	std::unordered_set<int> gids;
+	std::vector<int> uids;
+	std::unordered_map<int, std::vector<int>> accountGroups, groupMembers;
+	GROUP_CATALOG *catalog;
+
+	LOG_WARN("Change log trimmed past version %lld, reading all accounts and groups again\n", gChangeVersion);
+	gChangeResyncs++;
+
+	// The full group read runs on the writer connection
+	EnterCriticalSection(&dbWriteCriticalSection);
+	readGroupDb(groups);
+	LeaveCriticalSection(&dbWriteCriticalSection);
+	for (auto it = groups.begin(); it != groups.end(); ++it) {
+		groupCatalogUpdate(&(*it));
+		gids.insert(it->gid);
+	}
+
+	catalog = groupCatalogEnter();
+	std::vector<Group *> known(catalog->groups);
+	groupCatalogLeave();
+	for (auto it = known.begin(); it != known.end(); ++it) {
+		if (gids.count((*it)->gid) == 0)
+			groupCatalogRemove((*it)->gid);
+	}
+
+	if (readMembershipIndexDb(accountGroups, groupMembers) == 0) {
+		for (auto it = gids.begin(); it != gids.end(); ++it)
+			groupMembers[*it];
+		membershipReplace(accountGroups, groupMembers);
+	}
+
+	accountCachedIds(uids);
+	for (auto it = uids.begin(); it != uids.end(); ++it)
+		accountRefresh(*it);
+}
+
+// Function: applyChanges
+// Description: Apply the changes logged since the last one applied
+void applyChanges() {
+	std::vector<DB_CHANGE> changes;
+
+	do {
+		changes.clear();
+		if (readChangesDb(gChangeVersion, changes)) {
+			LOG_ERROR("Cannot read the change log!\n");
+			return;
+		}
+		if (changes.empty())
+			return;
+
+		// Versions only have holes where the log was trimmed
+		if (changes.front().version != gChangeVersion + 1) {
+			gChangeVersion = changes.back().version;
+			changeResync();
+			continue;
+		}
+
+		for (auto it = changes.begin(); it != changes.end(); ++it) {
+			switch (it->kind) {
+			case CHANGE_ACCOUNT:
+				accountRefresh(it->id);
+				break;
+			case CHANGE_GROUP:
+				changeGroup(it->id);
+				break;
+			case CHANGE_MEMBER:
+				changeMember(it->uid, it->id);
+				break;
+			default:
+				continue;
+			}
+			gChangesApplied[it->kind]++;
+		}
+		gChangeVersion = changes.back().version;
+	} while (changes.size() == DB_CHANGES_BATCH);
+}
+
+// Function: changeFeedThread
+// Description: Poll the database for changes and apply them
+unsigned __stdcall changeFeedThread(void *param) {
+	LONGLONG dataVersion = -1, version;
+
+	while (TRUE) {
+		Sleep(CHANGE_POLL_MS);
+
+		if (readDataVersionDb(&version) || version == dataVersion)
+			continue;
+		dataVersion = version;
+		applyChanges();
+	}
+	return 0;
+}
+
+// Function: startChangeFeed
+// Description: Start the thread applying the change log
+// Return: 0 if succeed, else return 1
+int startChangeFeed() {
+	if (_beginthreadex(0, 0, changeFeedThread, NULL, 0, 0) == 0) {
+		printf("Create change feed thread failed with error %d\n", GetLastError());
+		return 1;
+	}
+	return 0;
+}
+
+// Function: collectChangeFeedMetrics
+// Description: Append the progress of the change feed
+// -IN: out: the scrape
+void collectChangeFeedMetrics(std::string &out) {
+	appendHelp(out, "clouddrive_change_version", "gauge", "Last database change applied in memory.");
+	appendMetric(out, "clouddrive_change_version", NULL, (double)gChangeVersion);
+	appendHelp(out, "clouddrive_changes_applied_total", "counter", "Database changes applied in memory, by kind.");
+	appendMetric(out, "clouddrive_changes_applied_total", "kind=\"account\"", (double)gChangesApplied[CHANGE_ACCOUNT]);
+	appendMetric(out, "clouddrive_changes_applied_total", "kind=\"group\"", (double)gChangesApplied[CHANGE_GROUP]);
+	appendMetric(out, "clouddrive_changes_applied_total", "kind=\"member\"", (double)gChangesApplied[CHANGE_MEMBER]);
+	appendHelp(out, "clouddrive_change_resyncs_total", "counter", "Full reads after the change log was trimmed past the last change applied.");
+	appendMetric(out, "clouddrive_change_resyncs_total", NULL, (double)gChangeResyncs);
+}
+
+#endif
@@ -1,181 +1,370 @@
-#pragma once
-#ifndef _DATA_STRUCTURES_H
-#define _DATA_STRUCTURES_H
-
-#include <windows.h>
-#include <stdio.h>
-#include <conio.h>
-#include <time.h>
-
-#define OPA_REAUTH			100
-#define OPA_REQ_COOKIES		101
-#define OPA_LOGIN			110
-#define OPA_LOGOUT			112
-
-#define OPG_GROUP_USE		200
-#define OPG_GROUP_LIST		201
-#define OPG_GROUP_JOIN		202
-#define OPG_GROUP_LEAVE		203
-#define OPG_GROUP_NEW		204
-#define OPG_GROUP_COUNT		210
-#define OPG_GROUP_NAME		211
-
-#define OPB_LIST			300
-#define OPB_FILE_CD			301
-#define OPB_FILE_COUNT		310
-#define OPB_DIR_COUNT		320
-#define OPB_FILE_NAME		311
-#define OPB_DIR_NAME		321
-#define OPB_FILE_DEL		330
-#define OPB_DIR_DEL			331
-#define OPB_DIR_NEW			340
-
-#define OPT_CONNECT			400
-#define OPT_FILE_DOWN		401
-#define OPT_FILE_UP			402
-#define OPT_FILE_DIGEST		403
-#define OPT_FILE_DATA		404
-
-#define OPS_OK				900
-#define OPS_SUCCESS			901
-#define OPS_CONTINUE		902
-#define OPS_ERR_BADREQUEST	950
-#define OPS_ERR_SERVERFAIL	951
-#define OPS_ERR_FORBIDDEN	953
-#define OPS_ERR_NOTFOUND	954
-#define OPS_ERR_FILE_CORRUPTED 955
-
-#define OPS_ERR_LOCKED		960
-#define OPS_ERR_WRONGPASS	961
-#define OPS_ERR_ANOTHERCLIENT	962
-#define OPS_ERR_NOTLOGGEDIN	963
-#define OPS_ERR_ALREADYINGROUP	970
-#define OPS_ERR_GROUPEXISTS	971
-#define OPS_ERR_ALREADYEXISTS 980
-
-#define GROUPNAME_SIZE 500
-#define FILENAME_SIZE  500
-#define DIGEST_SIZE 33
-#define CRE_MAXLEN	256
-#define COOKIE_LEN		33
-
-#define STORAGE_LOCATION "Server"
-
-#define TIME_1_DAY				86400
-#define TIME_1_HOUR				3600
-#define ATTEMPT_LIMIT			3
-
-typedef struct {
-	int opcode;
-	unsigned int length;
-	long offset;
-	int burst;
-	char payload[2048];
-} MESSAGE, *LPMESSAGE;
-
-typedef struct _MESSAGE_LIST {
-	MESSAGE mess;
-	struct _MESSAGE_LIST* next = NULL;
-} MESSAGE_LIST, *LPMESSAGE_LIST;
-
-typedef struct {
-	int         gid;
-	char        groupName[GROUPNAME_SIZE];
-	char        pathName[GROUPNAME_SIZE];
-	int         ownerId;
-} Group;
-
-typedef struct {
-	char		fileName[FILENAME_SIZE];
-	char		digest[DIGEST_SIZE];
-	FILE*		file = NULL;
-	long        fileLen;
-	long        idx;
-	long        nLeft;
-	char        *fileBuffer;
-	bool		isTransfering = false;
-	short		filePart = 0;
-	Group*      group;
-} FILE_TRANSFER_PROPERTY, *LPFILE_TRANSFER_PROPERTY;
-
-typedef struct {
-	int		uid;
-	char	username[CRE_MAXLEN];
-	char	password[CRE_MAXLEN];
-	char	cookie[COOKIE_LEN];
-	bool	isLocked = 0;
-	time_t	lastActive = 0;
-	char	workingDir[MAX_PATH];
-	Group*	workingGroup = NULL;
-	HANDLE	mutex;
-	LPMESSAGE_LIST queuedMess = NULL;
-} Account;
-
-typedef struct {
-	Account*	account;
-	int			numOfAttempts = 0;
-	time_t		lastAtempt;
-} Attempt;
-
-
-// This is our per socket buffer. It contains information about the socket handle
-// which is returned from each GetQueuedCompletionStatus call.
-typedef struct _SOCKET_OBJ
-{
-	SOCKET    s;               // Socket handle
-	int       af,              // Address family of socket (AF_INET, AF_INET6)
-		bClosing;        // Is the socket closing?
-	FILE_TRANSFER_PROPERTY fileTransfer;
-	MESSAGE mess;
-	volatile LONG      OutstandingRecv, // Number of outstanding overlapped ops on
-		OutstandingSend, PendingSend;
-	CRITICAL_SECTION   SockCritSec;     // Protect access to this structure
-	struct _SOCKET_OBJ  *next;
-} SOCKET_OBJ;
-
-// This is our per I/O buffer. It contains a WSAOVERLAPPED structure as well
-// as other necessary information for handling an IO operation on a socket.
-typedef struct _BUFFER_OBJ
-{
-	WSAOVERLAPPED       ol;
-	SOCKET              sclient;       // Used for AcceptEx client socket
-	HANDLE              PostAccept;
-	char				*buf;          // Buffer for recv/send/AcceptEx
-	int                 buflen;        // Length of the buffer
-	int                 operation;     // Type of operation issued
-#define OP_ACCEPT       0                // AcceptEx
-#define OP_READ         1                   // WSARecv/WSARecvFrom
-#define OP_WRITE        2                   // WSASend/WSASendTo
-
-	SOCKADDR_STORAGE     addr;
-	int                  addrlen;
-	struct _SOCKET_OBJ  *sock;
-	struct _BUFFER_OBJ  *next;
-} BUFFER_OBJ;
-
-typedef struct _LISTEN_OBJ
-{
-	SOCKET          s;
-	int             AddressFamily;
-	BUFFER_OBJ     *PendingAccepts; // Pending AcceptEx buffers
-	volatile long   PendingAcceptCount;
-	int             HiWaterMark, LoWaterMark;
-	HANDLE          AcceptEvent;
-	HANDLE          RepostAccept;
-	volatile long   RepostCount;
-
-	// Pointers to Microsoft specific extensions.
-	LPFN_ACCEPTEX             lpfnAcceptEx;
-	LPFN_GETACCEPTEXSOCKADDRS lpfnGetAcceptExSockaddrs;
-	CRITICAL_SECTION ListenCritSec;
-	struct _LISTEN_OBJ *next;
-} LISTEN_OBJ;
-
-typedef struct  _PER_QUEUE_READ_ITEM
-{
-	struct _SOCKET_OBJ		*socket; // Sua thanh con tro toi SOCKET_OBJ
-									 //LPMESSAGE   message;
-	struct _PER_QUEUE_READ_ITEM *next;
-} PER_QUEUE_READ_ITEM;
-
+#pragma once
+#ifndef _DATA_STRUCTURES_H
+#define _DATA_STRUCTURES_H
+
+#include <windows.h>
+#include <stdio.h>
+#include <conio.h>
+#include <time.h>
+#include "md5.h"
+
+#define OPA_REAUTH			100
+#define OPA_REQ_COOKIES		101
+#define OPA_LOGIN			110
+#define OPA_LOGOUT			112
+
+#define OPG_GROUP_USE		200
+#define OPG_GROUP_LIST		201
+#define OPG_GROUP_JOIN		202
+#define OPG_GROUP_LEAVE		203
+#define OPG_GROUP_NEW		204
+#define OPG_GROUP_COUNT		210
+#define OPG_GROUP_NAME		211
+
+#define OPB_LIST			300
+#define OPB_FILE_CD			301
+#define OPB_FILE_COUNT		310
+#define OPB_DIR_COUNT		320
+#define OPB_FILE_NAME		311
+#define OPB_DIR_NAME		321
+#define OPB_FILE_DEL		330
+#define OPB_DIR_DEL			331
+#define OPB_DIR_NEW			340
+#define OPB_FILE_COPY		350
+#define OPB_FILE_MOVE		351
+
+#define OPT_CONNECT			400
+#define OPT_FILE_DOWN		401
+#define OPT_FILE_UP			402
+#define OPT_FILE_DIGEST		403
+#define OPT_FILE_DATA		404
+#define OPT_FILE_BLOCK		405
+#define OPT_FILE_RANGE		406
+#define OPT_RANGE_DIGEST	407
+#define OPT_RANGE_HEADER	408		// Answer to OPT_FILE_RANGE: file length and the ranges served
+#define OPT_TLS_HANDSHAKE	499		// Internal, marks a buffer carrying TLS handshake bytes
+
+#define OPS_OK				900
+#define OPS_SUCCESS			901
+#define OPS_CONTINUE		902
+#define OPS_ERR_BADREQUEST	950
+#define OPS_ERR_SERVERFAIL	951
+#define OPS_ERR_BUSY		952		// offset holds milliseconds to wait before retrying
+#define OPS_ERR_FORBIDDEN	953
+#define OPS_ERR_NOTFOUND	954
+#define OPS_ERR_FILE_CORRUPTED 955
+#define OPS_ERR_TOOLARGE	956		// file over what a frame offset can address
+
+#define OPS_ERR_LOCKED		960
+#define OPS_ERR_WRONGPASS	961
+#define OPS_ERR_ANOTHERCLIENT	962
+#define OPS_ERR_NOTLOGGEDIN	963
+#define OPS_ERR_ALREADYINGROUP	970
+#define OPS_ERR_GROUPEXISTS	971
+#define OPS_ERR_ALREADYEXISTS 980
+
+#define GROUPNAME_SIZE 500
+#define FILENAME_SIZE  500
+#define DIGEST_SIZE 33
+#define CRE_MAXLEN	256
+#define COOKIE_LEN		33
+
+#define STORAGE_LOCATION "Server"
+
+// Files in compressed groups are stored as independently decodable blocks.
+// One block holds exactly one OPT_FILE_DATA payload so that a stored block
+// can be forwarded to the client without recompressing. Only files of a
+// compressed group are ever read as block files, so the flag has to stay
+// set on a group once files were stored that way.
+#define STORE_BLOCK_SIZE		2048
+#define STORE_BLOCK_MAGIC		"CDBK"
+#define STORE_BLOCK_VERSION		1
+#define BLOCK_FLAG_RAW			0x1
+
+// Value of MESSAGE::burst in an OPT_FILE_DOWN request from a client that
+// can decode OPT_FILE_BLOCK frames itself
+#define TRANSFER_ACCEPT_BLOCKS	0x424C4B31
+
+// Ranges one OPT_FILE_RANGE request may ask for
+#define TRANSFER_MAX_RANGES		16
+
+#define TIME_1_DAY				86400
+#define TIME_1_HOUR				3600
+#define ATTEMPT_LIMIT			3		// wrong passwords an hour before an account is locked
+
+typedef struct {
+	int opcode;
+	unsigned int length;
+	long offset;
+	int burst;
+	char payload[2048];
+} MESSAGE, *LPMESSAGE;
+
+typedef struct _MESSAGE_LIST {
+	MESSAGE mess;
+	struct _MESSAGE_LIST* next = NULL;
+} MESSAGE_LIST, *LPMESSAGE_LIST;
+
+// Token buckets limiting the transfers of an account or a group (qos.h).
+// Tokens are kept in thousandths so a refill of a few milliseconds is not
+// rounded away, and go negative when a block is charged on credit.
+typedef struct {
+	LONGLONG    bytesRate = 0;		// Bytes per second, 0 if unlimited
+	LONGLONG    opsRate = 0;		// Transfer blocks per second, 0 if unlimited
+	LONGLONG    bytesTokens = 0;
+	LONGLONG    opsTokens = 0;
+	ULONGLONG   refilled = 0;		// Tick count of the last refill
+	LONGLONG    bytesUsed = 0;		// Totals charged, for metrics
+	LONGLONG    opsUsed = 0;
+	LONGLONG    throttled = 0;		// Blocks that had to wait
+} QOS_LIMIT;
+
+typedef struct _GROUP {
+	int         gid;
+	const char *groupName = "";		// in the string pool
+	const char *pathName = "";		// in the string pool
+	int         ownerId;
+	bool        compressed = false;
+	int         sendWeight = 0;		// Send share of members without their own, 0 for the default
+	QOS_LIMIT   qos;				// Transfers of all members together
+	struct _GROUP *volatile replacedBy = NULL;	// Newer version, once changed in the database (groupCatalog.h)
+} Group;
+
+// Header at the start of a block-compressed file. The block index
+// (blockCount entries of BLOCK_INDEX_ENTRY) is stored at indexOffset.
+typedef struct {
+	char        magic[4];
+	int         version;
+	long long   rawLen;
+	int         blockSize;
+	int         blockCount;
+	long long   indexOffset;
+	char        digest[DIGEST_SIZE];
+} BLOCK_FILE_HEADER;
+
+typedef struct {
+	long long   offset;         // Position of the block in the stored file
+	int         storedLen;      // Number of bytes the block takes on disk
+	int         flags;          // BLOCK_FLAG_RAW if kept uncompressed
+} BLOCK_INDEX_ENTRY;
+
+// An open stored file, either raw or block-compressed
+typedef struct {
+	FILE*       file = NULL;
+	bool        isBlockFile = false;
+	long long   rawLen;
+	int         blockSize;
+	int         blockCount;
+	BLOCK_INDEX_ENTRY *index = NULL;
+	void*       decompressor = NULL;
+	char        digest[DIGEST_SIZE];
+} STORED_FILE;
+
+// A byte range of a ranged download, length already clamped to the file
+typedef struct {
+	long long   offset;
+	long long   length;
+} TRANSFER_RANGE;
+
+typedef struct {
+	char		fileName[FILENAME_SIZE];
+	char		digest[DIGEST_SIZE];
+	FILE*		file = NULL;
+	long long   fileLen;
+	long long   idx;
+	long long   nLeft;
+	STORED_FILE stored;
+	bool        passThrough = false;
+	TRANSFER_RANGE ranges[TRANSFER_MAX_RANGES];
+	int         rangeCount = 0;		// 0 for a whole-file download
+	int         rangeIdx = 0;		// range being sent
+	MD5         rangeDigest;		// of the range being sent
+	bool		isTransfering = false;
+	short		filePart = 0;
+	Group*      group;
+	struct _ACCOUNT* account;	// Account the transfer is charged to
+} FILE_TRANSFER_PROPERTY, *LPFILE_TRANSFER_PROPERTY;
+
+// A timer on the timer wheel (timerWheel.h). It is embedded in the object
+// it times so that arming and cancelling never allocate.
+typedef struct _TIMER {
+	struct _TIMER  *prev = NULL, *next = NULL;
+	struct _TIMER **slot = NULL;	// List the timer is on, NULL if not armed
+	ULONGLONG       expires = 0;	// Tick the timer fires on
+	void          (*callback)(struct _TIMER *timer) = NULL;
+	void           *context = NULL;
+} TIMER;
+
+// Bandwidth share of an account in the send scheduler (sendScheduler.h).
+// Its connections with download frames waiting take turns within it.
+typedef struct _SEND_SHARE {
+	struct _SEND_FLOW  *head = NULL, *tail = NULL;	// Connections with frames waiting
+	struct _SEND_SHARE *next = NULL;				// Next share in the round
+	int                 weight = 1;					// 1 to SEND_WEIGHT_MAX
+	LONG                deficit = 0;				// Bytes the share may still send this turn
+	bool                active = false;				// On the round
+	bool                inTurn = false;				// Got its quantum for the current turn
+} SEND_SHARE;
+
+// Send queues of one connection in the send scheduler
+typedef struct _SEND_FLOW {
+	struct _BUFFER_OBJ *controlHead = NULL, *controlTail = NULL;	// Responses, sent before any data frame
+	struct _BUFFER_OBJ *bulkHead = NULL, *bulkTail = NULL;			// Download frames
+	struct _SEND_FLOW  *nextControl = NULL;	// Next connection with responses waiting
+	struct _SEND_FLOW  *nextBulk = NULL;	// Next connection of the share with frames waiting
+	SEND_SHARE         *share = NULL;		// Share the frames are counted in, NULL for the default one
+	bool                onControl = false;
+	bool                onBulk = false;
+} SEND_FLOW;
+
+// An account. The fields looked at on every request come first; names
+// are exact-size strings owned by the account, and its lock is one of the
+// stripes of the account cache.
+typedef struct _ACCOUNT {
+	int		uid;
+	LONG	pins = 0;			// References keeping the account in the account cache
+	int		connections = 0;	// Connections logged in as the account
+	bool	isLocked = 0;
+	bool	cached = false;		// Owned by the account cache
+	bool	stale = false;		// Renamed or deleted in the database, dropped once released
+	time_t	lastActive = 0;
+	Group*	workingGroup = NULL;
+	char*	workingDir = NULL;	// Directory in the working group, NULL at its root
+	char	cookie[COOKIE_LEN];
+	struct _ACCOUNT *lruPrev = NULL, *lruNext = NULL;	// Unpinned accounts, most recently used first
+	int		sendWeight = 0;		// Send share, 0 to use the one of the working group
+	SEND_SHARE sendShare;		// Downloads of the account in the send scheduler
+	QOS_LIMIT qos;				// Transfers of the account
+	TIMER	sessionTimer;		// Clears the cookie once the session expires
+	LPMESSAGE_LIST queuedMess = NULL;
+	char*	username = NULL;
+	char*	password = NULL;	// Stored hash, replaced when it is rehashed
+} Account;
+
+
+
+// This is our per socket buffer. It contains information about the socket handle
+// which is returned from each GetQueuedCompletionStatus call.
+typedef struct _SOCKET_OBJ
+{
+	SOCKET    s;               // Socket handle
+	int       af,              // Address family of socket (AF_INET, AF_INET6)
+		bClosing;        // Is the socket closing?
+	FILE_TRANSFER_PROPERTY fileTransfer;
+	MESSAGE mess;
+	volatile LONG      OutstandingRecv, // Number of outstanding overlapped ops on
+		OutstandingSend, PendingSend;
+	CRITICAL_SECTION   SockCritSec;     // Protect access to this structure
+	TIMER              IdleTimer;       // Closes the connection when it goes quiet
+	volatile ULONGLONG LastActivity;    // Tick count of the last completed I/O
+	ULONGLONG          FrameStart;      // Tick count a partly received message began, 0 if none
+	SEND_FLOW          SendFlow;        // Sends waiting for the scheduler
+	struct _ADMISSION_LIMIT *Admission; // Limit the transfer holds a slot of, NULL if none
+	struct _TLS_SESSION *Tls;          // TLS session, NULL if the connection is plaintext
+	int                AwaitFirst;      // The first message is still to come after the handshake
+	ULONGLONG          Source;          // Remote address as a login guard key, 0 if not tracked
+	struct _SOCKET_OBJ  *next;
+} SOCKET_OBJ;
+
+// This is our per I/O buffer. It contains a WSAOVERLAPPED structure as well
+// as other necessary information for handling an IO operation on a socket.
+typedef struct _BUFFER_OBJ
+{
+	WSAOVERLAPPED       ol;
+	SOCKET              sclient;       // Used for AcceptEx client socket
+	HANDLE              PostAccept;
+	char				*buf;          // Buffer for recv/send/AcceptEx
+	int                 buflen;        // Length of the buffer
+	int                 operation;     // Type of operation issued
+#define OP_ACCEPT       0                // AcceptEx
+#define OP_READ         1                   // WSARecv/WSARecvFrom
+#define OP_WRITE        2                   // WSASend/WSASendTo
+
+	SOCKADDR_STORAGE     addr;
+	int                  addrlen;
+	int                  acceptShard;   // Pending accept list this buffer is on
+	int                  received;      // Bytes of the current message received so far
+	LONGLONG             started;       // Arrival of the request being served, 0 if none
+	int                  requestOp;     // Opcode of that request
+	LONG                 traceId;       // Trace id of that request, 0 if not traced
+	LONGLONG             sendPosted;    // When the send was posted, for trace spans and the send limit
+	LONGLONG             queued;        // When put on the download or upload list
+	int                  wireLen;       // TLS: bytes after the message to send as they are, 0 to seal it
+	BOOL                 tlsReplay;     // TLS: receive completed from records already received
+	TIMER                timer;         // Closes accepted connections that send nothing
+	struct _SOCKET_OBJ  *sock;
+	struct _BUFFER_OBJ  *prev;          // Only used on the pending accept lists
+	struct _BUFFER_OBJ  *next;
+} BUFFER_OBJ;
+
+// Pending AcceptEx buffers are spread over several lists so completion
+// threads reposting accepts do not all queue on the same lock
+#define ACCEPT_SHARD_COUNT  16
+
+typedef struct _ACCEPT_SHARD
+{
+	BUFFER_OBJ         *head;
+	CRITICAL_SECTION    cs;
+} ACCEPT_SHARD;
+
+typedef struct _LISTEN_OBJ
+{
+	SOCKET          s;
+	int             AddressFamily;
+	ACCEPT_SHARD    PendingAccepts[ACCEPT_SHARD_COUNT]; // Pending AcceptEx buffers
+	volatile long   PendingAcceptCount;
+	volatile long   NextShard;
+	int             HiWaterMark, LoWaterMark;
+	HANDLE          AcceptEvent;
+
+	// Pointers to Microsoft specific extensions.
+	LPFN_ACCEPTEX             lpfnAcceptEx;
+	LPFN_GETACCEPTEXSOCKADDRS lpfnGetAcceptExSockaddrs;
+	struct _LISTEN_OBJ *next;
+} LISTEN_OBJ;
+
+typedef struct  _PER_QUEUE_READ_ITEM
+{
+	struct _SOCKET_OBJ		*socket; // Sua thanh con tro toi SOCKET_OBJ
+									 //LPMESSAGE   message;
+	struct _PER_QUEUE_READ_ITEM *next;
+} PER_QUEUE_READ_ITEM;
+
+// A metadata change waiting for the database writer thread. The request
+// that caused it is answered once the batch holding it is committed.
+typedef struct _DB_WRITE_REQUEST
+{
+	int         type;
+#define DBW_LOCK_ACCOUNT    0               // lockAccountDb
+#define DBW_ADD_MEMBER      1               // addUserToGroupDb
+#define DBW_DELETE_MEMBER   2               // deleteUserFromGroupDb
+#define DBW_NEW_GROUP       3               // addGroupDb then addUserToGroupDb for the owner
+#define DBW_SET_PASSWORD    4               // setPasswordDb, nobody waits for it
+#define DBW_SET_SESSION     5               // setSessionDb, nobody waits for it
+#define DBW_DELETE_SESSION  6               // deleteSessionDb, nobody waits for it
+
+	Account*    account;
+	Group       group;                      // copy of the group, gid is filled in by DBW_NEW_GROUP
+	char        password[CRE_MAXLEN];       // hash stored by DBW_SET_PASSWORD
+	char        cookie[COOKIE_LEN];         // session stored by DBW_SET_SESSION
+	time_t      lastActive;
+	int         result;                     // 0 if the change is durable, DB_CONSTRAINT if a
+	                                        // group of that name exists, else 1
+	struct _BUFFER_OBJ  *bufferObj;         // request to answer, NULL if none
+	struct _DB_WRITE_REQUEST *next;
+} DB_WRITE_REQUEST;
+
+// A row of the CHANGELOG table, written by triggers whenever an account,
+// a group or a membership changes in the database
+typedef struct
+{
+	LONGLONG    version;
+	int         kind;
+#define CHANGE_ACCOUNT      0               // id is the uid
+#define CHANGE_GROUP        1               // id is the gid
+#define CHANGE_MEMBER       2               // id is the gid, uid the member
+	int         id;
+	int         uid;
+} DB_CHANGE;
+
 #endif
\ No newline at end of file
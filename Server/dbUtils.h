@@ -1,305 +1,819 @@
-#pragma once
-
-#ifndef _DBUTILS_H
-#define _DBUTILS_H
-
-#include "dataStructures.h"
-#include "sqlite3.h"
-
-#define DB_NAME		"data.db"
-
-int accountHasAccessToGroupDb(Account* account, char* groupName);
-int addUserToGroupDb(Account* account, Group* group);
-int deleteUserFromGroupDb(Account* account, Group* group);
-int addGroupDb(Group* group);
-
-
-sqlite3 *db;
-
-
-// Function: openDb
-// Description: Open database and store database info in variable db
-// Return: 0 if succeed, else return 1
-int openDb() {
-	char *err_msg = 0;
-	int ret = sqlite3_open(DB_NAME, &db);
-	if (ret) {
-		fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(db));
-		sqlite3_close(db);
-		return 1;
-	}
-	return 0;
-}
-
-// Function: readAccountDb
-// Description: Read account information from databse
-// Return: 0 if succeed, else return 1
-// -OUT: accList: linked list to store accounts read from database
-int readAccountDb(std::list<Account>& accList) {
-	Account acc;
-	sqlite3_stmt *res;
-	int ret;
-
-	if (db == NULL) {
-		fprintf(stderr, "Databased not opened!\n");
-		return 1;
-	}
-
-	char *sql = "SELECT UID, USERNAME, PASSWORD, LOCKED FROM ACCOUNT;";
-	ret = sqlite3_prepare_v2(db, sql, -1, &res, 0);
-	if (ret != SQLITE_OK) {
-		printf("Failed to execute statement: %s\n", sqlite3_errmsg(db));
-	}
-
-	while (sqlite3_step(res) == SQLITE_ROW) {
-		acc.uid = sqlite3_column_int(res, 0);
-		strcpy_s(acc.username, CRE_MAXLEN, (const char *) sqlite3_column_text(res, 1));
-		strcpy_s(acc.password, CRE_MAXLEN, (const char *) sqlite3_column_text(res, 2));
-		acc.isLocked = (sqlite3_column_int(res, 3) == 1);
-
-		acc.mutex = CreateMutex(NULL, false, NULL);
-
-		accList.push_back(acc);
-	}
-
-	sqlite3_finalize(res);
-	printf("Account data loaded.\n");
-	return 0;
-}
-
-
-// Function: readGroupDb
-// Description: Read group information from databse
-// Return: 0 if succeed, else return 1
-// -OUT: groupList: linked list to store groups read from database
-int readGroupDb(std::list<Group>& groupList) {
-	Group group;
-	sqlite3_stmt *res;
-	int ret;
-
-	if (db == NULL) {
-		fprintf(stderr, "Databased not opened!\n");
-		return 1;
-	}
-
-	char *sql = "SELECT GID, GROUPNAME, PATHNAME, OWNERID FROM [GROUP];";
-	ret = sqlite3_prepare_v2(db, sql, -1, &res, 0);
-	if (ret != SQLITE_OK) {
-		printf("Failed to execute statement: %s\n", sqlite3_errmsg(db));
-	}
-
-	while (sqlite3_step(res) == SQLITE_ROW) {
-		group.gid = sqlite3_column_int(res, 0);
-		strcpy_s(group.groupName, CRE_MAXLEN, (const char *)sqlite3_column_text(res, 1));
-		strcpy_s(group.pathName, MAX_PATH, (const char *)sqlite3_column_text(res, 2));
-		group.ownerId = sqlite3_column_int(res, 3);
-
-		groupList.push_back(group);
-	}
-
-	sqlite3_finalize(res);
-	printf("Group data loaded.\n");
-	return 0;
-}
-
-// Function: accountHasAccessToGroupDb
-// Description: Read from database to see if an account has access to a group
-// Return: 1 if the account has access, return 0 if not
-//         return -1 if fail to read database
-// -IN: account: Account to check
-//      groupName: a char array which has the group name to check
-int accountHasAccessToGroupDb(Account* account, char* groupName) {
-	sqlite3_stmt *res;
-	int ret;
-
-	if (db == NULL) {
-		fprintf(stderr, "Databased not opened!\n");
-		return -1;
-	}
-
-	char *sql = "SELECT gm.GID, gm.UID FROM GROUPMEMBER gm "
-		"JOIN [GROUP] g ON g.GID = gm.GID "
-		"WHERE gm.UID = ? AND g.GROUPNAME = ?;";
-
-	ret = sqlite3_prepare_v2(db, sql, -1, &res, 0);
-	if (ret != SQLITE_OK) {
-		printf("Failed to execute statement: %s\n", sqlite3_errmsg(db));
-	}
-	else {
-		sqlite3_bind_int(res, 1, account->uid);
-		sqlite3_bind_text(res, 2, groupName, -1, NULL);
-	}
-
-	ret = (sqlite3_step(res) == SQLITE_ROW);
-
-	sqlite3_finalize(res);
-	return ret;
-}
-
-// Function: queryGroupForAccount
-// Description: Read from database for a list of the groups that
-//              an user has access to.
-// Return: 0 if succeed, else return 1
-// -IN: account: Account to check
-// -OUT: groupList: a list to store the group information
-int queryGroupForAccount(Account* account, std::list<Group> &groupList) {
-	sqlite3_stmt *res;
-	int ret;
-
-	if (db == NULL) {
-		fprintf(stderr, "Databased not opened!\n");
-		return -1;
-	}
-
-	char *sql = "SELECT g.GID, g.GROUPNAME FROM GROUPMEMBER gm "
-		"JOIN [GROUP] g ON g.GID = gm.GID "
-		"WHERE gm.UID = ?;";
-
-	ret = sqlite3_prepare_v2(db, sql, -1, &res, 0);
-	if (ret != SQLITE_OK) {
-		printf("Failed to execute statement: %s\n", sqlite3_errmsg(db));
-	}
-	else {
-		sqlite3_bind_int(res, 1, account->uid);
-	}
-
-	Group group;
-	while (sqlite3_step(res) == SQLITE_ROW) {
-		group.gid = sqlite3_column_int(res, 0);
-		strcpy_s(group.groupName, GROUPNAME_SIZE, (const char *)sqlite3_column_text(res, 1));
-
-		groupList.push_back(group);
-	}
-
-	sqlite3_finalize(res);
-	return ret;
-}
-
-// Function: addUserToGroupDb
-// Description: Add an user access to a group in database
-// Return: 0 if succeed, else return 1
-// -IN: account: Account to add
-//      group:   Group to add
-int addUserToGroupDb(Account* account, Group* group) {
-	sqlite3_stmt *res;
-	int ret;
-
-	if (db == NULL) {
-		fprintf(stderr, "Databased not opened!\n");
-		return -1;
-	}
-
-	char *sql = "INSERT INTO GROUPMEMBER(GID, UID) VALUES (?, ?);";
-	ret = sqlite3_prepare_v2(db, sql, -1, &res, 0);
-	if (ret != SQLITE_OK) {
-		printf("Failed to execute statement: %s\n", sqlite3_errmsg(db));
-	}
-	else {
-		sqlite3_bind_int(res, 1, group->gid);
-		sqlite3_bind_int(res, 2, account->uid);
-	}
-
-	ret = (sqlite3_step(res) != SQLITE_DONE);
-
-	sqlite3_finalize(res);
-	return ret;
-}
-
-// Function: deleteUserFromGroupDb
-// Description: Remove an user's access to a group in database
-// Return: 0 if succeed, else return 1
-// -IN: account: Account to remove
-//      group:   Group to remove
-int deleteUserFromGroupDb(Account* account, Group* group) {
-	sqlite3_stmt *res;
-	int ret;
-
-	if (db == NULL) {
-		fprintf(stderr, "Databased not opened!\n");
-		return -1;
-	}
-
-	char *sql = "DELETE FROM GROUPMEMBER WHERE uid = ? AND gid = ?;";
-	ret = sqlite3_prepare_v2(db, sql, -1, &res, 0);
-	if (ret != SQLITE_OK) {
-		printf("Failed to execute statement: %s\n", sqlite3_errmsg(db));
-	}
-	else {
-		sqlite3_bind_int(res, 1, account->uid);
-		sqlite3_bind_int(res, 2, group->gid);
-	}
-
-	ret = (sqlite3_step(res) != SQLITE_DONE);
-
-	sqlite3_finalize(res);
-	return ret;
-}
-
-// Function: addGroupDb
-// Description: add a new group to database
-// Return: 0 if succeed, else return 1
-// -IN: group:   Group to add to database
-int addGroupDb(Group* group) {
-	sqlite3_stmt *res;
-	int ret;
-
-	if (db == NULL) {
-		fprintf(stderr, "Databased not opened!\n");
-		return -1;
-	}
-
-	char *sql = "INSERT INTO [GROUP](GROUPNAME, PATHNAME, OWNERID) VALUES (?, ?, ?);";
-	ret = sqlite3_prepare_v2(db, sql, -1, &res, 0);
-	if (ret != SQLITE_OK) {
-		printf("Failed to execute statement: %s\n", sqlite3_errmsg(db));
-	}
-	else {
-		sqlite3_bind_text(res, 1, group->groupName, -1, NULL);
-		sqlite3_bind_text(res, 2, group->pathName, -1, NULL);
-		sqlite3_bind_int(res, 3, group->ownerId);
-	}
-
-	ret = (sqlite3_step(res) != SQLITE_DONE);
-
-	sqlite3_finalize(res);
-	group->gid = (int) sqlite3_last_insert_rowid(db);
-
-	return ret;
-}
-
-// Function: lockAccountDb
-// Description: update an user's status in database
-// Return: 0 if succeed, else return 1
-// -IN: account:   Account to update in database
-int lockAccountDb(Account* account) {
-	sqlite3_stmt *res;
-	int ret;
-
-	if (db == NULL) {
-		fprintf(stderr, "Databased not opened!\n");
-		return -1;
-	}
-
-	char *sql = "UPDATE ACCOUNT SET LOCKED = 1 WHERE UID=?;";
-	ret = sqlite3_prepare_v2(db, sql, -1, &res, 0);
-	if (ret != SQLITE_OK) {
-		printf("Failed to execute statement: %s\n", sqlite3_errmsg(db));
-	}
-	else {
-		sqlite3_bind_int(res, 1, account->uid);
-	}
-
-	ret = (sqlite3_step(res) != SQLITE_DONE);
-
-	sqlite3_finalize(res);
-
-	return ret;
-}
-
-// Function: closeDb
-// Description: close the opened database
-void closeDb() {
-	sqlite3_close(db);
-}
-
+#pragma once
+
+#ifndef _DBUTILS_H
+#define _DBUTILS_H
+
+#include <list>
+#include <vector>
+#include "dataStructures.h"
+#include "sqlite3.h"
+#include "membership.h"
+#include "stringPool.h"
+
+#ifndef DB_NAME
+#define DB_NAME		"data.db"
+#endif
+
+int addUserToGroupDb(Account* account, Group* group);
+int deleteUserFromGroupDb(Account* account, Group* group);
+int addGroupDb(Group* group);
+
+#define DB_MMAP_SIZE		268435456	// 256 MiB of the file mapped for readers
+#define DB_CACHE_SIZE		-8192		// page cache per connection, negative means KiB
+#define DB_BUSY_TIMEOUT		5000		// ms to wait on a lock held by the writer
+#define DB_CHANGES_BATCH	1024		// changes read per query
+#define DB_CONSTRAINT		2			// a write refused by a UNIQUE constraint
+
+// Statements kept prepared on every connection
+enum DB_STATEMENT {
+	STMT_ADD_MEMBER,
+	STMT_DELETE_MEMBER,
+	STMT_ADD_GROUP,
+	STMT_LOCK_ACCOUNT,
+	STMT_SET_PASSWORD,
+	STMT_SET_SESSION,
+	STMT_DELETE_SESSION,
+	STMT_ACCOUNT_BY_NAME,
+	STMT_ACCOUNT_BY_ID,
+	STMT_SESSION_FOR_ACCOUNT,
+	STMT_SESSION_BY_COOKIE,
+	STMT_GROUP_BY_ID,
+	STMT_MEMBER_EXISTS,
+	STMT_CHANGES_SINCE,
+	STMT_CHANGE_VERSION,
+	STMT_DATA_VERSION,
+	STMT_COUNT
+};
+
+static const char *dbStatementSql[STMT_COUNT] = {
+	"INSERT INTO GROUPMEMBER(GID, UID) VALUES (?, ?);",
+
+	"DELETE FROM GROUPMEMBER WHERE uid = ? AND gid = ?;",
+
+	"INSERT INTO [GROUP](GROUPNAME, PATHNAME, OWNERID) VALUES (?, ?, ?);",
+
+	"UPDATE ACCOUNT SET LOCKED = 1 WHERE UID=?;",
+
+	"UPDATE ACCOUNT SET PASSWORD = ? WHERE UID = ?;",
+
+	"INSERT OR REPLACE INTO SESSION(UID, COOKIE, LASTACTIVE) VALUES (?, ?, ?);",
+
+	"DELETE FROM SESSION WHERE UID = ?;",
+
+	"SELECT UID, USERNAME, PASSWORD, LOCKED, SENDWEIGHT, BYTESLIMIT, OPSLIMIT FROM ACCOUNT WHERE USERNAME = ?;",
+
+	"SELECT UID, USERNAME, PASSWORD, LOCKED, SENDWEIGHT, BYTESLIMIT, OPSLIMIT FROM ACCOUNT WHERE UID = ?;",
+
+	"SELECT COOKIE, LASTACTIVE FROM SESSION WHERE UID = ?;",
+
+	"SELECT UID FROM SESSION WHERE COOKIE = ?;",
+
+	"SELECT GID, GROUPNAME, PATHNAME, OWNERID, COMPRESSED, SENDWEIGHT, BYTESLIMIT, OPSLIMIT FROM [GROUP] WHERE GID = ?;",
+
+	"SELECT 1 FROM GROUPMEMBER WHERE UID = ? AND GID = ?;",
+
+	"SELECT VERSION, KIND, ID, UID FROM CHANGELOG WHERE VERSION > ? ORDER BY VERSION LIMIT ?;",
+
+	"SELECT IFNULL(MAX(VERSION), 0) FROM CHANGELOG;",
+
+	"PRAGMA data_version;",
+};
+
+// A connection with its statement cache. Each one is only ever used by
+// one thread at a time, so it is opened without SQLite's own mutex.
+typedef struct _DB_CONN {
+	sqlite3 *handle;
+	sqlite3_stmt *stmts[STMT_COUNT];
+	struct _DB_CONN *next;
+} DB_CONN;
+
+
+sqlite3 *db;						// writer connection, also used for loading at startup
+DB_CONN writerConn;
+CRITICAL_SECTION dbWriteCriticalSection;		// serializes all mutations on writerConn
+
+DB_CONN *dbConnList;					// reader connections, closed by closeDb
+CRITICAL_SECTION dbConnListCriticalSection;
+__declspec(thread) DB_CONN *tlsDbConn;			// reader connection of the calling thread
+
+
+// Function: openDbConnection
+// Description: Open a connection to the database and tune it
+// Return: 0 if succeed, else return 1
+// -IN: readOnly: true for a reader connection
+// -OUT: conn: the opened connection
+int openDbConnection(DB_CONN* conn, bool readOnly) {
+	char sql[128];
+
+	memset(conn, 0, sizeof(DB_CONN));
+	int ret = sqlite3_open_v2(DB_NAME, &conn->handle,
+		SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, NULL);
+	if (ret != SQLITE_OK) {
+		fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(conn->handle));
+		sqlite3_close(conn->handle);
+		conn->handle = NULL;
+		return 1;
+	}
+
+	sqlite3_busy_timeout(conn->handle, DB_BUSY_TIMEOUT);
+	snprintf(sql, sizeof(sql), "PRAGMA mmap_size = %d; PRAGMA cache_size = %d;", DB_MMAP_SIZE, DB_CACHE_SIZE);
+	sqlite3_exec(conn->handle, sql, NULL, NULL, NULL);
+	if (readOnly)
+		sqlite3_exec(conn->handle, "PRAGMA query_only = 1;", NULL, NULL, NULL);
+	return 0;
+}
+
+// Function: closeDbConnection
+// Description: Finalize the cached statements and close a connection
+// -IN: conn: the connection to close
+void closeDbConnection(DB_CONN* conn) {
+	for (int i = 0; i < STMT_COUNT; i++) {
+		if (conn->stmts[i] != NULL) {
+			sqlite3_finalize(conn->stmts[i]);
+			conn->stmts[i] = NULL;
+		}
+	}
+	sqlite3_close(conn->handle);
+	conn->handle = NULL;
+}
+
+// Function: getReadConnection
+// Description: Get the reader connection of the calling thread,
+//              opening it on first use
+// Return: the connection, NULL if fail
+DB_CONN* getReadConnection() {
+	if (tlsDbConn != NULL)
+		return tlsDbConn;
+
+	DB_CONN *conn = (DB_CONN*)malloc(sizeof(DB_CONN));
+	if (conn == NULL) {
+		fprintf(stderr, "Memory error!\n");
+		return NULL;
+	}
+	if (openDbConnection(conn, true)) {
+		free(conn);
+		return NULL;
+	}
+
+	EnterCriticalSection(&dbConnListCriticalSection);
+	conn->next = dbConnList;
+	dbConnList = conn;
+	LeaveCriticalSection(&dbConnListCriticalSection);
+
+	tlsDbConn = conn;
+	return conn;
+}
+
+// Function: getStatement
+// Description: Get a statement from the cache of a connection, preparing
+//              it on first use. Call releaseStatement when done with it.
+// Return: the statement, NULL if fail
+// -IN: conn: the connection
+//      id: the statement to get
+sqlite3_stmt* getStatement(DB_CONN* conn, DB_STATEMENT id) {
+	if (conn == NULL)
+		return NULL;
+
+	if (conn->stmts[id] == NULL) {
+		int ret = sqlite3_prepare_v3(conn->handle, dbStatementSql[id], -1,
+			SQLITE_PREPARE_PERSISTENT, &conn->stmts[id], NULL);
+		if (ret != SQLITE_OK) {
+			printf("Failed to prepare statement: %s\n", sqlite3_errmsg(conn->handle));
+			conn->stmts[id] = NULL;
+			return NULL;
+		}
+	}
+	return conn->stmts[id];
+}
+
+// Function: releaseStatement
+// Description: Reset a cached statement so it ends its read transaction
+//              and can be reused
+// -IN: stmt: the statement
+void releaseStatement(sqlite3_stmt* stmt) {
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+}
+
+// Function: migrateDb
+// Description: Bring a database created by an older server up to the
+//              current schema. Statements that were already applied fail
+//              harmlessly and are ignored.
+void migrateDb() {
+	static const char *migrations[] = {
+		"ALTER TABLE [GROUP] ADD COLUMN COMPRESSED BOOLEAN NOT NULL DEFAULT 0;",
+		"ALTER TABLE ACCOUNT ADD COLUMN SENDWEIGHT INTEGER NOT NULL DEFAULT 0;",
+		"ALTER TABLE [GROUP] ADD COLUMN SENDWEIGHT INTEGER NOT NULL DEFAULT 0;",
+		"ALTER TABLE ACCOUNT ADD COLUMN BYTESLIMIT INTEGER NOT NULL DEFAULT 0;",
+		"ALTER TABLE ACCOUNT ADD COLUMN OPSLIMIT INTEGER NOT NULL DEFAULT 0;",
+		"ALTER TABLE [GROUP] ADD COLUMN BYTESLIMIT INTEGER NOT NULL DEFAULT 0;",
+		"ALTER TABLE [GROUP] ADD COLUMN OPSLIMIT INTEGER NOT NULL DEFAULT 0;",
+		"CREATE TABLE IF NOT EXISTS SESSION (UID INTEGER PRIMARY KEY, COOKIE TEXT NOT NULL, LASTACTIVE INTEGER NOT NULL);",
+		"CREATE INDEX IF NOT EXISTS ACCOUNT_USERNAME ON ACCOUNT(USERNAME);",
+		"CREATE INDEX IF NOT EXISTS SESSION_COOKIE ON SESSION(COOKIE);",
+		// Group names are checked in memory when a group is created, the
+		// index settles two creates of the same name racing to the writer
+		"CREATE UNIQUE INDEX IF NOT EXISTS GROUP_GROUPNAME ON [GROUP](GROUPNAME);",
+
+		// Change feed of the rows the server keeps in memory, filled by
+		// triggers so changes made outside the server are seen as well.
+		// KIND is one of the CHANGE_ values, the last 65536 changes are kept.
+		"CREATE TABLE IF NOT EXISTS CHANGELOG (VERSION INTEGER PRIMARY KEY AUTOINCREMENT, KIND INTEGER NOT NULL, ID INTEGER NOT NULL, UID INTEGER NOT NULL DEFAULT 0);",
+		"CREATE TRIGGER IF NOT EXISTS CHANGELOG_TRIM AFTER INSERT ON CHANGELOG BEGIN "
+			"DELETE FROM CHANGELOG WHERE VERSION <= NEW.VERSION - 65536; END;",
+		"CREATE TRIGGER IF NOT EXISTS ACCOUNT_INSERTED AFTER INSERT ON ACCOUNT BEGIN "
+			"INSERT INTO CHANGELOG(KIND, ID) VALUES (0, NEW.UID); END;",
+		"CREATE TRIGGER IF NOT EXISTS ACCOUNT_UPDATED AFTER UPDATE ON ACCOUNT BEGIN "
+			"INSERT INTO CHANGELOG(KIND, ID) VALUES (0, NEW.UID); END;",
+		"CREATE TRIGGER IF NOT EXISTS ACCOUNT_DELETED AFTER DELETE ON ACCOUNT BEGIN "
+			"INSERT INTO CHANGELOG(KIND, ID) VALUES (0, OLD.UID); END;",
+		"CREATE TRIGGER IF NOT EXISTS GROUP_INSERTED AFTER INSERT ON [GROUP] BEGIN "
+			"INSERT INTO CHANGELOG(KIND, ID) VALUES (1, NEW.GID); END;",
+		"CREATE TRIGGER IF NOT EXISTS GROUP_UPDATED AFTER UPDATE ON [GROUP] BEGIN "
+			"INSERT INTO CHANGELOG(KIND, ID) VALUES (1, NEW.GID); END;",
+		"CREATE TRIGGER IF NOT EXISTS GROUP_DELETED AFTER DELETE ON [GROUP] BEGIN "
+			"INSERT INTO CHANGELOG(KIND, ID) VALUES (1, OLD.GID); END;",
+		"CREATE TRIGGER IF NOT EXISTS MEMBER_INSERTED AFTER INSERT ON GROUPMEMBER BEGIN "
+			"INSERT INTO CHANGELOG(KIND, ID, UID) VALUES (2, NEW.GID, NEW.UID); END;",
+		"CREATE TRIGGER IF NOT EXISTS MEMBER_DELETED AFTER DELETE ON GROUPMEMBER BEGIN "
+			"INSERT INTO CHANGELOG(KIND, ID, UID) VALUES (2, OLD.GID, OLD.UID); END;",
+	};
+
+	for (int i = 0; i < sizeof(migrations) / sizeof(migrations[0]); i++)
+		sqlite3_exec(db, migrations[i], NULL, NULL, NULL);
+}
+
+// Function: readIntegerDb
+// Description: Run a statement returning a single integer on the reader
+//              connection of the calling thread
+// Return: 0 if succeed, else return 1
+// -IN: id: the statement
+// -OUT: value: the integer
+int readIntegerDb(DB_STATEMENT id, LONGLONG* value) {
+	sqlite3_stmt *res;
+	int ret = 1;
+
+	res = getStatement(getReadConnection(), id);
+	if (res == NULL)
+		return 1;
+
+	if (sqlite3_step(res) == SQLITE_ROW) {
+		*value = sqlite3_column_int64(res, 0);
+		ret = 0;
+	}
+
+	releaseStatement(res);
+	return ret;
+}
+
+// Function: openDb
+// Description: Open database and store database info in variable db.
+//              The database is switched to WAL so readers on their own
+//              connections are not blocked by the writer. Commits are
+//              fully synced; the writer thread batches changes so the
+//              sync is paid once per batch.
+// Return: 0 if succeed, else return 1
+int openDb() {
+	InitializeCriticalSection(&dbWriteCriticalSection);
+	InitializeCriticalSection(&dbConnListCriticalSection);
+
+	if (openDbConnection(&writerConn, false))
+		return 1;
+	db = writerConn.handle;
+
+	if (sqlite3_exec(db, "PRAGMA journal_mode = WAL; PRAGMA synchronous = FULL;", NULL, NULL, NULL) != SQLITE_OK)
+		fprintf(stderr, "Cannot switch database to WAL: %s\n", sqlite3_errmsg(db));
+
+	migrateDb();
+	return 0;
+}
+
+// Function: readAccountDb
+// Description: Read one account from the database, by name or by id
+// Return: 0 if found, 1 if there is no such account
+//         return -1 if fail to read database
+// -IN: username: name of the account, NULL to look up by id
+//      uid: id of the account
+// -OUT: account: the account read, its name and password are copies it
+//       owns
+int readAccountDb(const char* username, int uid, Account* account) {
+	sqlite3_stmt *res;
+	int ret;
+
+	res = getStatement(getReadConnection(), username != NULL ? STMT_ACCOUNT_BY_NAME : STMT_ACCOUNT_BY_ID);
+	if (res == NULL)
+		return -1;
+
+	if (username != NULL)
+		sqlite3_bind_text(res, 1, username, -1, SQLITE_STATIC);
+	else
+		sqlite3_bind_int(res, 1, uid);
+
+	ret = sqlite3_step(res);
+	if (ret == SQLITE_ROW) {
+		account->uid = sqlite3_column_int(res, 0);
+		account->username = copyString((const char *) sqlite3_column_text(res, 1));
+		account->password = copyString((const char *) sqlite3_column_text(res, 2));
+		account->isLocked = (sqlite3_column_int(res, 3) == 1);
+		account->sendWeight = sqlite3_column_int(res, 4);
+		account->qos.bytesRate = sqlite3_column_int64(res, 5);
+		account->qos.opsRate = sqlite3_column_int64(res, 6);
+		ret = (account->username == NULL || account->password == NULL) ? -1 : 0;
+	}
+	else if (ret == SQLITE_DONE)
+		ret = 1;
+	else
+		ret = -1;
+
+	releaseStatement(res);
+	return ret;
+}
+
+
+// Function: readGroupDb
+// Description: Read group information from databse
+// Return: 0 if succeed, else return 1
+// -OUT: groupList: linked list to store groups read from database
+int readGroupDb(std::list<Group>& groupList) {
+	Group group;
+	sqlite3_stmt *res;
+	int ret;
+
+	if (db == NULL) {
+		fprintf(stderr, "Databased not opened!\n");
+		return 1;
+	}
+
+	char *sql = "SELECT GID, GROUPNAME, PATHNAME, OWNERID, COMPRESSED, SENDWEIGHT, BYTESLIMIT, OPSLIMIT FROM [GROUP];";
+	ret = sqlite3_prepare_v2(db, sql, -1, &res, 0);
+	if (ret != SQLITE_OK) {
+		printf("Failed to execute statement: %s\n", sqlite3_errmsg(db));
+	}
+
+	while (sqlite3_step(res) == SQLITE_ROW) {
+		group.gid = sqlite3_column_int(res, 0);
+		group.groupName = internString((const char *)sqlite3_column_text(res, 1));
+		group.pathName = internString((const char *)sqlite3_column_text(res, 2));
+		group.ownerId = sqlite3_column_int(res, 3);
+		group.compressed = (sqlite3_column_int(res, 4) == 1);
+		group.sendWeight = sqlite3_column_int(res, 5);
+		group.qos.bytesRate = sqlite3_column_int64(res, 6);
+		group.qos.opsRate = sqlite3_column_int64(res, 7);
+
+		groupList.push_back(group);
+	}
+
+	sqlite3_finalize(res);
+	printf("Group data loaded.\n");
+	return 0;
+}
+
+// Function: readMembershipDb
+// Description: Load group membership from database into the in-memory index
+// Return: 0 if succeed, else return 1
+int readMembershipDb() {
+	sqlite3_stmt *res;
+	int ret;
+
+	if (db == NULL) {
+		fprintf(stderr, "Databased not opened!\n");
+		return 1;
+	}
+
+	char *sql = "SELECT GID, UID FROM GROUPMEMBER;";
+	ret = sqlite3_prepare_v2(db, sql, -1, &res, 0);
+	if (ret != SQLITE_OK) {
+		printf("Failed to execute statement: %s\n", sqlite3_errmsg(db));
+		return 1;
+	}
+
+	while (sqlite3_step(res) == SQLITE_ROW)
+		membershipAdd(sqlite3_column_int(res, 1), sqlite3_column_int(res, 0));
+
+	sqlite3_finalize(res);
+	printf("Membership data loaded.\n");
+	return 0;
+}
+
+// Function: readGroupByIdDb
+// Description: Read one group from the database
+// Return: 0 if found, 1 if there is no such group
+//         return -1 if fail to read database
+// -IN: gid: id of the group
+// -OUT: group: the group read, its names in the string pool
+int readGroupByIdDb(int gid, Group* group) {
+	sqlite3_stmt *res;
+	int ret;
+
+	res = getStatement(getReadConnection(), STMT_GROUP_BY_ID);
+	if (res == NULL)
+		return -1;
+
+	sqlite3_bind_int(res, 1, gid);
+
+	ret = sqlite3_step(res);
+	if (ret == SQLITE_ROW) {
+		group->gid = sqlite3_column_int(res, 0);
+		group->groupName = internString((const char *)sqlite3_column_text(res, 1));
+		group->pathName = internString((const char *)sqlite3_column_text(res, 2));
+		group->ownerId = sqlite3_column_int(res, 3);
+		group->compressed = (sqlite3_column_int(res, 4) == 1);
+		group->sendWeight = sqlite3_column_int(res, 5);
+		group->qos.bytesRate = sqlite3_column_int64(res, 6);
+		group->qos.opsRate = sqlite3_column_int64(res, 7);
+		ret = (group->groupName == NULL || group->pathName == NULL) ? -1 : 0;
+	}
+	else if (ret == SQLITE_DONE)
+		ret = 1;
+	else
+		ret = -1;
+
+	releaseStatement(res);
+	return ret;
+}
+
+// Function: memberExistsDb
+// Description: Read from database whether an account is a member of a group
+// Return: 1 if it is, return 0 if not
+//         return -1 if fail to read database
+// -IN: uid: id of the account
+//      gid: id of the group
+int memberExistsDb(int uid, int gid) {
+	sqlite3_stmt *res;
+	int ret;
+
+	res = getStatement(getReadConnection(), STMT_MEMBER_EXISTS);
+	if (res == NULL)
+		return -1;
+
+	sqlite3_bind_int(res, 1, uid);
+	sqlite3_bind_int(res, 2, gid);
+
+	ret = sqlite3_step(res);
+	if (ret == SQLITE_ROW)
+		ret = 1;
+	else if (ret == SQLITE_DONE)
+		ret = 0;
+	else
+		ret = -1;
+
+	releaseStatement(res);
+	return ret;
+}
+
+// Function: readChangesDb
+// Description: Read the changes logged after a version, oldest first, at
+//              most DB_CHANGES_BATCH of them
+// Return: 0 if succeed, else return 1
+// -IN: since: last version already applied
+// -OUT: changes: the changes read are appended
+int readChangesDb(LONGLONG since, std::vector<DB_CHANGE>& changes) {
+	sqlite3_stmt *res;
+	DB_CHANGE change;
+	int ret;
+
+	res = getStatement(getReadConnection(), STMT_CHANGES_SINCE);
+	if (res == NULL)
+		return 1;
+
+	sqlite3_bind_int64(res, 1, since);
+	sqlite3_bind_int(res, 2, DB_CHANGES_BATCH);
+
+	while ((ret = sqlite3_step(res)) == SQLITE_ROW) {
+		change.version = sqlite3_column_int64(res, 0);
+		change.kind = sqlite3_column_int(res, 1);
+		change.id = sqlite3_column_int(res, 2);
+		change.uid = sqlite3_column_int(res, 3);
+		changes.push_back(change);
+	}
+
+	releaseStatement(res);
+	return ret == SQLITE_DONE ? 0 : 1;
+}
+
+// Function: readChangeVersionDb
+// Description: Read the version of the last change logged
+// Return: 0 if succeed, else return 1
+// -OUT: version: the version, 0 if nothing was logged yet
+int readChangeVersionDb(LONGLONG* version) {
+	return readIntegerDb(STMT_CHANGE_VERSION, version);
+}
+
+// Function: readDataVersionDb
+// Description: Read the data version of the reader connection of the
+//              calling thread. It changes whenever another connection
+//              commits, so the change log is only queried when it did.
+// Return: 0 if succeed, else return 1
+// -OUT: version: the data version
+int readDataVersionDb(LONGLONG* version) {
+	return readIntegerDb(STMT_DATA_VERSION, version);
+}
+
+// Function: readMembershipIndexDb
+// Description: Read the whole GROUPMEMBER table into a new index, on the
+//              reader connection of the calling thread
+// Return: 0 if succeed, else return 1
+// -OUT: accountGroups: uid -> sorted gids
+//       groupMembers: gid -> sorted uids
+int readMembershipIndexDb(std::unordered_map<int, std::vector<int>>& accountGroups,
+	std::unordered_map<int, std::vector<int>>& groupMembers) {
+	DB_CONN *conn = getReadConnection();
+	sqlite3_stmt *res;
+	int ret, uid, gid;
+
+	if (conn == NULL)
+		return 1;
+
+	char *sql = "SELECT GID, UID FROM GROUPMEMBER;";
+	ret = sqlite3_prepare_v2(conn->handle, sql, -1, &res, 0);
+	if (ret != SQLITE_OK) {
+		printf("Failed to execute statement: %s\n", sqlite3_errmsg(conn->handle));
+		return 1;
+	}
+
+	while ((ret = sqlite3_step(res)) == SQLITE_ROW) {
+		gid = sqlite3_column_int(res, 0);
+		uid = sqlite3_column_int(res, 1);
+		sortedInsert(accountGroups[uid], gid);
+		sortedInsert(groupMembers[gid], uid);
+	}
+
+	sqlite3_finalize(res);
+	return ret == SQLITE_DONE ? 0 : 1;
+}
+
+// Function: readSessionDb
+// Description: Read the stored session of an account
+// Return: 0 if found, 1 if the account has none
+//         return -1 if fail to read database
+// -IN/OUT: account: the account, cookie and lastActive are filled in
+int readSessionDb(Account* account) {
+	sqlite3_stmt *res;
+	int ret;
+
+	res = getStatement(getReadConnection(), STMT_SESSION_FOR_ACCOUNT);
+	if (res == NULL)
+		return -1;
+
+	sqlite3_bind_int(res, 1, account->uid);
+
+	ret = sqlite3_step(res);
+	if (ret == SQLITE_ROW) {
+		ret = 1;
+		if (sqlite3_column_bytes(res, 0) == COOKIE_LEN - 1) {
+			memcpy(account->cookie, sqlite3_column_text(res, 0), COOKIE_LEN);
+			account->lastActive = (time_t)sqlite3_column_int64(res, 1);
+			ret = 0;
+		}
+	}
+	else if (ret == SQLITE_DONE)
+		ret = 1;
+	else
+		ret = -1;
+
+	releaseStatement(res);
+	return ret;
+}
+
+// Function: findSessionDb
+// Description: Find the account a stored session cookie belongs to
+// Return: 0 if found, 1 if the cookie is not stored
+//         return -1 if fail to read database
+// -IN: cookie: the cookie
+// -OUT: uid: id of the account
+int findSessionDb(const char* cookie, int* uid) {
+	sqlite3_stmt *res;
+	int ret;
+
+	res = getStatement(getReadConnection(), STMT_SESSION_BY_COOKIE);
+	if (res == NULL)
+		return -1;
+
+	sqlite3_bind_text(res, 1, cookie, -1, SQLITE_STATIC);
+
+	ret = sqlite3_step(res);
+	if (ret == SQLITE_ROW) {
+		*uid = sqlite3_column_int(res, 0);
+		ret = 0;
+	}
+	else if (ret == SQLITE_DONE)
+		ret = 1;
+	else
+		ret = -1;
+
+	releaseStatement(res);
+	return ret;
+}
+
+// Function: expireSessionsDb
+// Description: Drop the sessions that expired while the server was down
+// Return: 0 if succeed, else return 1
+// -IN: oldest: sessions last active before this are expired
+int expireSessionsDb(time_t oldest) {
+	char sql[96];
+	int ret;
+
+	if (db == NULL) {
+		fprintf(stderr, "Databased not opened!\n");
+		return 1;
+	}
+
+	snprintf(sql, sizeof(sql), "DELETE FROM SESSION WHERE LASTACTIVE < %lld;", (long long)oldest);
+	EnterCriticalSection(&dbWriteCriticalSection);
+	ret = sqlite3_exec(db, sql, NULL, NULL, NULL);
+	LeaveCriticalSection(&dbWriteCriticalSection);
+	if (ret != SQLITE_OK) {
+		printf("Failed to execute statement: %s\n", sqlite3_errmsg(db));
+		return 1;
+	}
+	return 0;
+}
+
+// Function: execWriteStatement
+// Description: Run a cached mutation on the writer connection. The caller
+//              must hold dbWriteCriticalSection and have bound the values.
+// Return: 0 if succeed, DB_CONSTRAINT if a row with the same key exists,
+//         else return 1
+// -IN: res: the bound statement
+int execWriteStatement(sqlite3_stmt* res) {
+	int ret = 0;
+
+	switch (sqlite3_step(res)) {
+	case SQLITE_DONE:
+		break;
+	case SQLITE_CONSTRAINT:
+		ret = DB_CONSTRAINT;
+		break;
+	default:
+		printf("Failed to execute statement: %s\n", sqlite3_errmsg(db));
+		ret = 1;
+	}
+	releaseStatement(res);
+	return ret;
+}
+
+// Function: addUserToGroupDb
+// Description: Add an user access to a group in database
+// Return: 0 if succeed, else return 1
+// -IN: account: Account to add
+//      group:   Group to add
+int addUserToGroupDb(Account* account, Group* group) {
+	sqlite3_stmt *res;
+	int ret = 1;
+
+	EnterCriticalSection(&dbWriteCriticalSection);
+	res = getStatement(&writerConn, STMT_ADD_MEMBER);
+	if (res != NULL) {
+		sqlite3_bind_int(res, 1, group->gid);
+		sqlite3_bind_int(res, 2, account->uid);
+		ret = execWriteStatement(res);
+	}
+	LeaveCriticalSection(&dbWriteCriticalSection);
+
+	return ret;
+}
+
+// Function: deleteUserFromGroupDb
+// Description: Remove an user's access to a group in database
+// Return: 0 if succeed, else return 1
+// -IN: account: Account to remove
+//      group:   Group to remove
+int deleteUserFromGroupDb(Account* account, Group* group) {
+	sqlite3_stmt *res;
+	int ret = 1;
+
+	EnterCriticalSection(&dbWriteCriticalSection);
+	res = getStatement(&writerConn, STMT_DELETE_MEMBER);
+	if (res != NULL) {
+		sqlite3_bind_int(res, 1, account->uid);
+		sqlite3_bind_int(res, 2, group->gid);
+		ret = execWriteStatement(res);
+	}
+	LeaveCriticalSection(&dbWriteCriticalSection);
+
+	return ret;
+}
+
+// Function: addGroupDb
+// Description: add a new group to database
+// Return: 0 if succeed, DB_CONSTRAINT if a group has the same name,
+//         else return 1
+// -IN: group:   Group to add to database
+int addGroupDb(Group* group) {
+	sqlite3_stmt *res;
+	int ret = 1;
+
+	EnterCriticalSection(&dbWriteCriticalSection);
+	res = getStatement(&writerConn, STMT_ADD_GROUP);
+	if (res != NULL) {
+		sqlite3_bind_text(res, 1, group->groupName, -1, SQLITE_STATIC);
+		sqlite3_bind_text(res, 2, group->pathName, -1, SQLITE_STATIC);
+		sqlite3_bind_int(res, 3, group->ownerId);
+		ret = execWriteStatement(res);
+		if (ret == 0)
+			group->gid = (int)sqlite3_last_insert_rowid(db);
+	}
+	LeaveCriticalSection(&dbWriteCriticalSection);
+
+	return ret;
+}
+
+// Function: lockAccountDb
+// Description: update an user's status in database
+// Return: 0 if succeed, else return 1
+// -IN: account:   Account to update in database
+int lockAccountDb(Account* account) {
+	sqlite3_stmt *res;
+	int ret = 1;
+
+	EnterCriticalSection(&dbWriteCriticalSection);
+	res = getStatement(&writerConn, STMT_LOCK_ACCOUNT);
+	if (res != NULL) {
+		sqlite3_bind_int(res, 1, account->uid);
+		ret = execWriteStatement(res);
+	}
+	LeaveCriticalSection(&dbWriteCriticalSection);
+
+	return ret;
+}
+
+// Function: setPasswordDb
+// Description: Store the password hash of an account
+// Return: 0 if succeed, else return 1
+// -IN: account:   Account to update in database
+//      password:  the hash
+int setPasswordDb(Account* account, const char* password) {
+	sqlite3_stmt *res;
+	int ret = 1;
+
+	EnterCriticalSection(&dbWriteCriticalSection);
+	res = getStatement(&writerConn, STMT_SET_PASSWORD);
+	if (res != NULL) {
+		sqlite3_bind_text(res, 1, password, -1, SQLITE_STATIC);
+		sqlite3_bind_int(res, 2, account->uid);
+		ret = execWriteStatement(res);
+	}
+	LeaveCriticalSection(&dbWriteCriticalSection);
+
+	return ret;
+}
+
+// Function: setSessionDb
+// Description: Store the session of an account, replacing its last one
+// Return: 0 if succeed, else return 1
+// -IN: account:   Account the session belongs to
+//      cookie:    the cookie
+//      lastActive: last activity of the session
+int setSessionDb(Account* account, const char* cookie, time_t lastActive) {
+	sqlite3_stmt *res;
+	int ret = 1;
+
+	EnterCriticalSection(&dbWriteCriticalSection);
+	res = getStatement(&writerConn, STMT_SET_SESSION);
+	if (res != NULL) {
+		sqlite3_bind_int(res, 1, account->uid);
+		sqlite3_bind_text(res, 2, cookie, -1, SQLITE_STATIC);
+		sqlite3_bind_int64(res, 3, (sqlite3_int64)lastActive);
+		ret = execWriteStatement(res);
+	}
+	LeaveCriticalSection(&dbWriteCriticalSection);
+
+	return ret;
+}
+
+// Function: deleteSessionDb
+// Description: Remove the session of an account
+// Return: 0 if succeed, else return 1
+// -IN: account:   Account the session belongs to
+int deleteSessionDb(Account* account) {
+	sqlite3_stmt *res;
+	int ret = 1;
+
+	EnterCriticalSection(&dbWriteCriticalSection);
+	res = getStatement(&writerConn, STMT_DELETE_SESSION);
+	if (res != NULL) {
+		sqlite3_bind_int(res, 1, account->uid);
+		ret = execWriteStatement(res);
+	}
+	LeaveCriticalSection(&dbWriteCriticalSection);
+
+	return ret;
+}
+
+// Function: closeDb
+// Description: close the opened database and every reader connection
+void closeDb() {
+	EnterCriticalSection(&dbConnListCriticalSection);
+	while (dbConnList != NULL) {
+		DB_CONN *conn = dbConnList;
+		dbConnList = conn->next;
+		closeDbConnection(conn);
+		free(conn);
+	}
+	LeaveCriticalSection(&dbConnListCriticalSection);
+
+	closeDbConnection(&writerConn);
+	db = NULL;
+}
+
 #endif
\ No newline at end of file
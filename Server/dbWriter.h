@@ -0,0 +1,177 @@
+#pragma once
+
+#ifndef _DB_WRITER_H
+#define _DB_WRITER_H
+
+#include <process.h>
+#include "dataStructures.h"
+#include "dbUtils.h"
+
+#define DB_WRITE_BATCH_MAX		256		// most changes committed in one transaction
+
+// Called on the writer thread for every request once its batch is
+// committed or rolled back. Defined by the request processor.
+void completeDbWrite(DB_WRITE_REQUEST* request);
+
+DB_WRITE_REQUEST *gDbWriteList = NULL, *gDbWriteListEnd = NULL;
+CRITICAL_SECTION gDbWriteListCritSec;
+HANDLE gDbWriteEvent;
+volatile LONG gDbWritesPending = 0;		// submitted and not completed yet
+
+// Function: submitDbWrite
+// Description: Queue a metadata change for the writer thread
+// -IN: request: the change, owned by the writer from now on
+void submitDbWrite(DB_WRITE_REQUEST* request) {
+	request->next = NULL;
+	request->result = 1;
+	InterlockedIncrement(&gDbWritesPending);
+
+	EnterCriticalSection(&gDbWriteListCritSec);
+	if (gDbWriteListEnd == NULL) {
+		gDbWriteList = gDbWriteListEnd = request;
+	}
+	else {
+		gDbWriteListEnd->next = request;
+		gDbWriteListEnd = request;
+	}
+	LeaveCriticalSection(&gDbWriteListCritSec);
+
+	SetEvent(gDbWriteEvent);
+}
+
+// Function: takeDbWriteBatch
+// Description: Detach up to DB_WRITE_BATCH_MAX queued changes
+// Return: the first change of the batch, NULL if the queue is empty
+DB_WRITE_REQUEST* takeDbWriteBatch() {
+	DB_WRITE_REQUEST *batch, *last;
+	int count = 1;
+
+	EnterCriticalSection(&gDbWriteListCritSec);
+	batch = last = gDbWriteList;
+	if (batch != NULL) {
+		while (last->next != NULL && count < DB_WRITE_BATCH_MAX) {
+			last = last->next;
+			count++;
+		}
+		gDbWriteList = last->next;
+		if (gDbWriteList == NULL)
+			gDbWriteListEnd = NULL;
+		last->next = NULL;
+	}
+	LeaveCriticalSection(&gDbWriteListCritSec);
+
+	// More left behind, make sure the writer comes back for them
+	if (gDbWriteList != NULL)
+		SetEvent(gDbWriteEvent);
+	return batch;
+}
+
+// Function: runDbWrite
+// Description: Apply one change on the writer connection
+// Return: 0 if succeed, DB_CONSTRAINT if the name of a new group is
+//         taken, else return 1
+// -IN/OUT: request: the change
+int runDbWrite(DB_WRITE_REQUEST* request) {
+	int ret;
+
+	switch (request->type) {
+	case DBW_LOCK_ACCOUNT:
+		return lockAccountDb(request->account);
+	case DBW_ADD_MEMBER:
+		return addUserToGroupDb(request->account, &request->group);
+	case DBW_DELETE_MEMBER:
+		return deleteUserFromGroupDb(request->account, &request->group);
+	case DBW_NEW_GROUP:
+		ret = addGroupDb(&request->group);
+		if (ret != 0)
+			return ret;
+		return addUserToGroupDb(request->account, &request->group);
+	case DBW_SET_PASSWORD:
+		return setPasswordDb(request->account, request->password);
+	case DBW_SET_SESSION:
+		return setSessionDb(request->account, request->cookie, request->lastActive);
+	case DBW_DELETE_SESSION:
+		return deleteSessionDb(request->account);
+	}
+	return 1;
+}
+
+// Function: commitDbWriteBatch
+// Description: Apply a batch of changes in one transaction. Each change
+//              runs under its own savepoint, so a change that fails is
+//              rolled back alone and the rest of the batch still commits.
+// -IN/OUT: batch: the changes, their result is filled in
+void commitDbWriteBatch(DB_WRITE_REQUEST* batch) {
+	DB_WRITE_REQUEST *request;
+
+	EnterCriticalSection(&dbWriteCriticalSection);
+
+	if (sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) != SQLITE_OK) {
+		printf("Cannot begin write transaction: %s\n", sqlite3_errmsg(db));
+		LeaveCriticalSection(&dbWriteCriticalSection);
+		return;
+	}
+
+	for (request = batch; request != NULL; request = request->next) {
+		sqlite3_exec(db, "SAVEPOINT change;", NULL, NULL, NULL);
+		request->result = runDbWrite(request);
+		if (request->result != 0)
+			sqlite3_exec(db, "ROLLBACK TO change;", NULL, NULL, NULL);
+		sqlite3_exec(db, "RELEASE change;", NULL, NULL, NULL);
+	}
+
+	if (sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+		printf("Cannot commit write transaction: %s\n", sqlite3_errmsg(db));
+		sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+		for (request = batch; request != NULL; request = request->next)
+			request->result = 1;
+	}
+
+	LeaveCriticalSection(&dbWriteCriticalSection);
+}
+
+// Function: dbWriterThread
+// Description: Wait for metadata changes, commit them in batches and
+//              complete their requests once the batch is durable.
+//              Changes that arrive while a commit is syncing are picked
+//              up together by the next one.
+unsigned __stdcall dbWriterThread(void *param) {
+	DB_WRITE_REQUEST *batch, *next;
+
+	while (TRUE) {
+		WaitForSingleObject(gDbWriteEvent, INFINITE);
+
+		while ((batch = takeDbWriteBatch()) != NULL) {
+			commitDbWriteBatch(batch);
+
+			for (; batch != NULL; batch = next) {
+				next = batch->next;
+				completeDbWrite(batch);
+				free(batch);
+				InterlockedDecrement(&gDbWritesPending);
+			}
+		}
+	}
+	return 0;
+}
+
+// Function: startDbWriter
+// Description: Create the queue and the writer thread
+// Return: 0 if succeed, else return 1
+int startDbWriter() {
+	InitializeCriticalSection(&gDbWriteListCritSec);
+
+	gDbWriteEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (gDbWriteEvent == NULL) {
+		fprintf(stderr, "CreateEvent failed: %d\n", GetLastError());
+		return 1;
+	}
+
+	if (_beginthreadex(0, 0, dbWriterThread, NULL, 0, 0) == 0) {
+		printf("Create database writer thread failed with error %d\n", GetLastError());
+		return 1;
+	}
+	return 0;
+}
+
+#endif
@@ -0,0 +1,412 @@
+#pragma once
+
+#ifndef _DIR_INDEX_H
+#define _DIR_INDEX_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <process.h>
+#include "dataStructures.h"
+
+#define DIR_INDEX_MAX_DIRS		4096		// cached directories before the cache is dropped
+#define DIR_WATCH_BUFFER_SIZE	65536		// bytes of change records read at once
+
+// One entry of a directory, as FindFirstFileA reports it
+typedef struct {
+	std::string name;
+	bool        isDir;
+	long long   size;
+	FILETIME    lastWrite;
+} DIR_ENTRY;
+
+// Cached content of one directory. A listing is inserted incomplete while
+// threads enumerate the directory; changes that arrive meanwhile are
+// counted so an enumeration that started before one of them is redone
+// instead of published.
+typedef struct {
+	std::vector<DIR_ENTRY> entries;		// sorted by name, case-insensitive
+	bool        complete = false;
+	unsigned int changes = 0;			// changes seen while incomplete
+} DIR_LISTING;
+
+// Directories of the storage, keyed by their lowercase path relative to
+// STORAGE_LOCATION with '/' separators. Filled lazily on first use, kept
+// up to date by dirIndexRefresh, which the server calls after each of its
+// own changes and the watcher thread calls for changes made by anyone else.
+std::unordered_map<std::string, DIR_LISTING> dirIndex;
+SRWLOCK dirIndexLock = SRWLOCK_INIT;
+volatile LONG dirIndexWatching = 0;		// cache is only used while changes are watched
+
+// Function: dirIndexKey
+// Description: Turn a storage path into a directory index key
+// Return: the key
+// -IN: path: path starting with STORAGE_LOCATION, or relative to it
+std::string dirIndexKey(const char* path) {
+	std::string key(path);
+	size_t rootLen = strlen(STORAGE_LOCATION);
+
+	for (size_t i = 0; i < key.size(); i++) {
+		if (key[i] == '\\')
+			key[i] = '/';
+		else
+			key[i] = (char)tolower((unsigned char)key[i]);
+	}
+	while (!key.empty() && key.back() == '/')
+		key.pop_back();
+
+	if (_strnicmp(key.c_str(), STORAGE_LOCATION, rootLen) == 0
+		&& (key.size() == rootLen || key[rootLen] == '/'))
+		key.erase(0, key.size() == rootLen ? rootLen : rootLen + 1);
+	return key;
+}
+
+// Function: dirEntryLess
+// Description: Order entries the way the file system compares names
+bool dirEntryLess(const DIR_ENTRY& entry, const char* name) {
+	return _stricmp(entry.name.c_str(), name) < 0;
+}
+
+// Function: dirIndexFind
+// Description: Find an entry in a listing
+// Return: the entry, NULL if not found
+// -IN: listing: the listing to search
+//      name: name of the entry
+DIR_ENTRY* dirIndexFind(DIR_LISTING& listing, const char* name) {
+	auto it = std::lower_bound(listing.entries.begin(), listing.entries.end(), name, dirEntryLess);
+	if (it != listing.entries.end() && _stricmp(it->name.c_str(), name) == 0)
+		return &(*it);
+	return NULL;
+}
+
+// Function: dirIndexEnumerate
+// Description: Read the content of a directory from the file system
+// Return: 0 if succeed, else return 1
+// -IN: key: index key of the directory
+// -OUT: entries: the entries, sorted
+int dirIndexEnumerate(const std::string& key, std::vector<DIR_ENTRY>& entries) {
+	WIN32_FIND_DATAA findData;
+	HANDLE hFind;
+	char path[MAX_PATH];
+	DIR_ENTRY entry;
+
+	if (key.empty())
+		snprintf(path, MAX_PATH, "%s/*", STORAGE_LOCATION);
+	else
+		snprintf(path, MAX_PATH, "%s/%s/*", STORAGE_LOCATION, key.c_str());
+
+	entries.clear();
+	hFind = FindFirstFileA(path, &findData);
+	if (hFind == INVALID_HANDLE_VALUE) {
+		if (GetLastError() == ERROR_NO_MORE_FILES)
+			return 0;
+		return 1;
+	}
+
+	do {
+		entry.name = findData.cFileName;
+		entry.isDir = (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+		entry.size = ((long long)findData.nFileSizeHigh << 32) | findData.nFileSizeLow;
+		entry.lastWrite = findData.ftLastWriteTime;
+		entries.push_back(entry);
+	} while (FindNextFileA(hFind, &findData) != 0);
+
+	if (GetLastError() != ERROR_NO_MORE_FILES) {
+		printf("FindNextFile failed (%d)\n", GetLastError());
+		FindClose(hFind);
+		return 1;
+	}
+	FindClose(hFind);
+
+	std::sort(entries.begin(), entries.end(), [](const DIR_ENTRY& a, const DIR_ENTRY& b) {
+		return _stricmp(a.name.c_str(), b.name.c_str()) < 0;
+	});
+	return 0;
+}
+
+// Function: dirIndexLoad
+// Description: Enumerate a directory into the index unless it is there
+//              already. Several threads may read the same directory; a
+//              read is only published if no change arrived since it began.
+// Return: 0 if succeed, else return 1
+// -IN: key: index key of the directory
+int dirIndexLoad(const std::string& key) {
+	std::vector<DIR_ENTRY> entries;
+	unsigned int seen;
+
+	AcquireSRWLockExclusive(&dirIndexLock);
+	auto it = dirIndex.find(key);
+	if (it != dirIndex.end() && it->second.complete) {
+		ReleaseSRWLockExclusive(&dirIndexLock);
+		return 0;
+	}
+	if (it == dirIndex.end() && dirIndex.size() >= DIR_INDEX_MAX_DIRS)
+		dirIndex.clear();
+	seen = dirIndex[key].changes;
+	ReleaseSRWLockExclusive(&dirIndexLock);
+
+	while (1) {
+		if (dirIndexEnumerate(key, entries)) {
+			AcquireSRWLockExclusive(&dirIndexLock);
+			it = dirIndex.find(key);
+			if (it != dirIndex.end() && !it->second.complete)
+				dirIndex.erase(it);
+			ReleaseSRWLockExclusive(&dirIndexLock);
+			return 1;
+		}
+
+		AcquireSRWLockExclusive(&dirIndexLock);
+		it = dirIndex.find(key);
+		if (it == dirIndex.end() || it->second.complete) {
+			// Dropped or published by someone else meanwhile
+			ReleaseSRWLockExclusive(&dirIndexLock);
+			return 0;
+		}
+		if (it->second.changes == seen) {
+			it->second.entries.swap(entries);
+			it->second.complete = true;
+			ReleaseSRWLockExclusive(&dirIndexLock);
+			return 0;
+		}
+		seen = it->second.changes;
+		ReleaseSRWLockExclusive(&dirIndexLock);
+	}
+}
+
+// Function: dirIndexList
+// Description: Get the content of a directory
+// Return: 0 if succeed, else return 1
+// -IN: dirPath: path of the directory
+// -OUT: entries: the entries, sorted by name
+int dirIndexList(const char* dirPath, std::vector<DIR_ENTRY>& entries) {
+	std::string key = dirIndexKey(dirPath);
+
+	if (!dirIndexWatching)
+		return dirIndexEnumerate(key, entries);
+
+	while (1) {
+		AcquireSRWLockShared(&dirIndexLock);
+		auto it = dirIndex.find(key);
+		if (it != dirIndex.end() && it->second.complete) {
+			entries = it->second.entries;
+			ReleaseSRWLockShared(&dirIndexLock);
+			return 0;
+		}
+		ReleaseSRWLockShared(&dirIndexLock);
+
+		if (dirIndexLoad(key))
+			return 1;
+	}
+}
+
+// Function: dirIndexStat
+// Description: Look up a file or directory
+// Return: 1 if it exists, 0 if not
+// -IN: path: path of the file or directory
+// -OUT: entry: the entry if found, may be NULL
+int dirIndexStat(const char* path, DIR_ENTRY* entry) {
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	std::string key = dirIndexKey(path);
+	size_t slash = key.rfind('/');
+	std::string parent = (slash == std::string::npos) ? "" : key.substr(0, slash);
+	const char* name = strrchr(path, '/');
+	name = (name == NULL) ? path : name + 1;
+
+	while (dirIndexWatching) {
+		AcquireSRWLockShared(&dirIndexLock);
+		auto it = dirIndex.find(parent);
+		if (it != dirIndex.end() && it->second.complete) {
+			DIR_ENTRY* found = dirIndexFind(it->second, name);
+			if (found != NULL && entry != NULL)
+				*entry = *found;
+			ReleaseSRWLockShared(&dirIndexLock);
+			return found != NULL;
+		}
+		ReleaseSRWLockShared(&dirIndexLock);
+
+		// The parent cannot be listed, most likely it does not exist
+		if (dirIndexLoad(parent))
+			break;
+	}
+
+	// Not cached, ask the file system
+	if (GetFileAttributesExA(path, GetFileExInfoStandard, &data) == 0)
+		return 0;
+	if (entry != NULL) {
+		entry->name = name;
+		entry->isDir = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+		entry->size = ((long long)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+		entry->lastWrite = data.ftLastWriteTime;
+	}
+	return 1;
+}
+
+// Function: dirIndexDropTree
+// Description: Forget a directory and everything cached below it.
+//              The caller must hold dirIndexLock exclusively.
+// -IN: key: index key of the directory
+void dirIndexDropTree(const std::string& key) {
+	std::string prefix = key + "/";
+
+	for (auto it = dirIndex.begin(); it != dirIndex.end(); ) {
+		if (it->first == key || it->first.compare(0, prefix.size(), prefix) == 0)
+			it = dirIndex.erase(it);
+		else
+			++it;
+	}
+}
+
+// Function: dirIndexRefresh
+// Description: Bring the entry for a path in line with the file system
+//              after it was created, changed, renamed or removed
+// -IN: path: path of the file or directory
+void dirIndexRefresh(const char* path) {
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	std::string key = dirIndexKey(path);
+	size_t slash = key.rfind('/');
+	std::string parent = (slash == std::string::npos) ? "" : key.substr(0, slash);
+	const char* name = strrchr(path, '/');
+	name = (name == NULL) ? path : name + 1;
+
+	bool exists = GetFileAttributesExA(path, GetFileExInfoStandard, &data) != 0;
+	bool isDir = exists && (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+	bool wasDir = false;
+
+	AcquireSRWLockExclusive(&dirIndexLock);
+
+	auto it = dirIndex.find(parent);
+	if (it != dirIndex.end()) {
+		if (!it->second.complete) {
+			it->second.changes++;
+		}
+		else {
+			std::vector<DIR_ENTRY>& entries = it->second.entries;
+			auto pos = std::lower_bound(entries.begin(), entries.end(), name, dirEntryLess);
+			bool found = pos != entries.end() && _stricmp(pos->name.c_str(), name) == 0;
+			wasDir = found && pos->isDir;
+
+			if (exists) {
+				DIR_ENTRY entry;
+				entry.name = name;
+				entry.isDir = isDir;
+				entry.size = ((long long)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+				entry.lastWrite = data.ftLastWriteTime;
+				if (found)
+					*pos = entry;
+				else
+					entries.insert(pos, entry);
+			}
+			else if (found) {
+				entries.erase(pos);
+			}
+		}
+	}
+
+	// A directory that is gone takes its cached subtree with it
+	if (!exists || (wasDir && !isDir))
+		dirIndexDropTree(key);
+
+	ReleaseSRWLockExclusive(&dirIndexLock);
+}
+
+// Function: dirIndexClear
+// Description: Forget every cached directory
+void dirIndexClear() {
+	AcquireSRWLockExclusive(&dirIndexLock);
+	for (auto it = dirIndex.begin(); it != dirIndex.end(); ) {
+		// Listings being read are only marked, their readers clean up
+		if (!it->second.complete) {
+			it->second.changes++;
+			++it;
+		}
+		else
+			it = dirIndex.erase(it);
+	}
+	ReleaseSRWLockExclusive(&dirIndexLock);
+}
+
+// Function: dirWatchThread
+// Description: Watch the storage for changes made outside the server
+//              and refresh the index entries they touch
+unsigned __stdcall dirWatchThread(void *param) {
+	HANDLE hDir = (HANDLE)param;
+	DWORD *buffer = (DWORD*)malloc(DIR_WATCH_BUFFER_SIZE);
+	DWORD bytes;
+	char name[MAX_PATH], path[MAX_PATH];
+
+	if (buffer == NULL) {
+		fprintf(stderr, "Memory error!\n");
+		return 1;
+	}
+
+	while (TRUE) {
+		if (ReadDirectoryChangesW(hDir, buffer, DIR_WATCH_BUFFER_SIZE, TRUE,
+			FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
+			FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE,
+			&bytes, NULL, NULL) == 0) {
+			if (GetLastError() == ERROR_NOTIFY_ENUM_DIR) {
+				dirIndexClear();
+				continue;
+			}
+			printf("ReadDirectoryChangesW failed (%d), directory index disabled\n", GetLastError());
+			break;
+		}
+
+		// The change records overflowed, everything may be out of date
+		if (bytes == 0) {
+			dirIndexClear();
+			continue;
+		}
+
+		FILE_NOTIFY_INFORMATION *info = (FILE_NOTIFY_INFORMATION*)buffer;
+		while (1) {
+			int len = WideCharToMultiByte(CP_ACP, 0, info->FileName, info->FileNameLength / sizeof(WCHAR),
+				name, MAX_PATH - 1, NULL, NULL);
+			name[len] = 0;
+			for (int i = 0; i < len; i++) {
+				if (name[i] == '\\')
+					name[i] = '/';
+			}
+			snprintf(path, MAX_PATH, "%s/%s", STORAGE_LOCATION, name);
+			dirIndexRefresh(path);
+
+			if (info->NextEntryOffset == 0)
+				break;
+			info = (FILE_NOTIFY_INFORMATION*)((char*)info + info->NextEntryOffset);
+		}
+	}
+
+	// Without notifications the cache cannot be trusted anymore
+	InterlockedExchange(&dirIndexWatching, 0);
+	AcquireSRWLockExclusive(&dirIndexLock);
+	dirIndex.clear();
+	ReleaseSRWLockExclusive(&dirIndexLock);
+	free(buffer);
+	CloseHandle(hDir);
+	return 1;
+}
+
+// Function: startDirIndex
+// Description: Start watching the storage for changes
+// Return: 0 if succeed, else return 1
+int startDirIndex() {
+	HANDLE hDir = CreateFileA(STORAGE_LOCATION, FILE_LIST_DIRECTORY,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+	if (hDir == INVALID_HANDLE_VALUE) {
+		fprintf(stderr, "Cannot watch %s. Error code %d!\n", STORAGE_LOCATION, GetLastError());
+		return 1;
+	}
+
+	InterlockedExchange(&dirIndexWatching, 1);
+	if (_beginthreadex(0, 0, dirWatchThread, hDir, 0, 0) == 0) {
+		printf("Create directory watch thread failed with error %d\n", GetLastError());
+		InterlockedExchange(&dirIndexWatching, 0);
+		CloseHandle(hDir);
+		return 1;
+	}
+	return 0;
+}
+
+#endif
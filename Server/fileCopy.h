@@ -0,0 +1,292 @@
+#pragma once
+
+#ifndef _FILE_COPY_H
+#define _FILE_COPY_H
+
+#include <string>
+#include <process.h>
+#include <winioctl.h>
+#include "dataStructures.h"
+#include "metrics.h"
+#include "binaryLog.h"
+#include "blockStore.h"
+
+// Server-side copy and move. A move is a rename. A copy first asks the
+// volume to clone the extents of the file into the new one
+// (FSCTL_DUPLICATE_EXTENTS_TO_FILE, block cloning on ReFS), so both share
+// the same clusters until one of them is written and a file of any size is
+// copied in the time of a few metadata updates. Where the volume cannot
+// clone, and for moves across volumes, the bytes are copied on a thread of
+// its own so that a large file does not hold a completion thread; those
+// requests are answered once the copy is done. A file going to a group
+// that stores files in the other format is always copied there and
+// rewritten in the format of its new group before the source goes away.
+#define COPY_CLONE_CHUNK	(1LL << 30)		// bytes cloned per call, under the 4GB limit
+#define COPY_QUEUE_MAX		16				// byte copies waiting, more are answered busy
+
+// A copy or move waiting for the copy thread
+typedef struct _COPY_REQUEST {
+	struct _BUFFER_OBJ *bufferObj;		// request to answer
+	char        source[MAX_PATH];
+	char        target[MAX_PATH];
+	bool        move;
+	bool        recode;					// groups store files in different formats
+	bool        compress;				// format of the target group, if recode
+	DWORD       error;					// NO_ERROR once done
+	LONGLONG    queued;					// from metricNow
+	struct _COPY_REQUEST *next;
+} COPY_REQUEST;
+
+// Called on the copy thread once a copy is done. Defined by the request
+// processor.
+void completeCopy(COPY_REQUEST *request);
+
+COPY_REQUEST *gCopyList = NULL, *gCopyListEnd = NULL;
+CRITICAL_SECTION gCopyCritSec;
+HANDLE gCopySemaphore;
+volatile LONG gCopyQueued = 0;
+volatile LONG gCopyPending = 0;			// queued or being copied, not answered yet
+volatile LONGLONG gCopiesCloned = 0, gCopiesStreamed = 0, gMovesRenamed = 0, gCopiesFailed = 0;
+volatile LONGLONG gCopyClonedBytes = 0, gCopyStreamUs = 0;
+
+// Function: cloneFile
+// Description: Create a file sharing the clusters of another, on volumes
+//              that support block cloning
+// Return: 0 if succeed, else return 1 and no target is left behind
+// -IN: source: path of the file to copy
+//      target: path of the new file, which must not exist
+int cloneFile(const char *source, const char *target) {
+	FSCTL_GET_INTEGRITY_INFORMATION_BUFFER integrity;
+	FSCTL_SET_INTEGRITY_INFORMATION_BUFFER setIntegrity;
+	DUPLICATE_EXTENTS_DATA extents;
+	FILE_END_OF_FILE_INFO eof;
+	FILE_DISPOSITION_INFO disposition;
+	LARGE_INTEGER size;
+	LONGLONG offset, chunk, cluster;
+	HANDLE src, dst;
+	DWORD bytes;
+	int ret = 1;
+
+	src = CreateFileA(source, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	if (src == INVALID_HANDLE_VALUE)
+		return 1;
+
+	// Only volumes that can clone answer with their cluster size
+	if (!GetFileSizeEx(src, &size)
+		|| !DeviceIoControl(src, FSCTL_GET_INTEGRITY_INFORMATION, NULL, 0, &integrity, sizeof(integrity), &bytes, NULL)) {
+		CloseHandle(src);
+		return 1;
+	}
+	cluster = integrity.ClusterSizeInBytes;
+
+	dst = CreateFileA(target, GENERIC_READ | GENERIC_WRITE | DELETE, 0, NULL, CREATE_NEW, 0, NULL);
+	if (dst == INVALID_HANDLE_VALUE) {
+		CloseHandle(src);
+		return 1;
+	}
+
+	// Both files need the same integrity setting, and the target its full
+	// length before extents are cloned into it
+	setIntegrity.ChecksumAlgorithm = integrity.ChecksumAlgorithm;
+	setIntegrity.Reserved = 0;
+	setIntegrity.Flags = integrity.Flags;
+	eof.EndOfFile = size;
+	if (DeviceIoControl(dst, FSCTL_SET_INTEGRITY_INFORMATION, &setIntegrity, sizeof(setIntegrity), NULL, 0, &bytes, NULL)
+		&& SetFileInformationByHandle(dst, FileEndOfFileInfo, &eof, sizeof(eof))) {
+		ret = 0;
+		extents.FileHandle = src;
+		for (offset = 0; offset < size.QuadPart && ret == 0; offset += chunk) {
+			chunk = (size.QuadPart - offset < COPY_CLONE_CHUNK) ? size.QuadPart - offset : COPY_CLONE_CHUNK;
+			extents.SourceFileOffset.QuadPart = offset;
+			extents.TargetFileOffset.QuadPart = offset;
+			// The tail is rounded up to a whole cluster
+			extents.ByteCount.QuadPart = (chunk + cluster - 1) / cluster * cluster;
+			if (!DeviceIoControl(dst, FSCTL_DUPLICATE_EXTENTS_TO_FILE, &extents, sizeof(extents), NULL, 0, &bytes, NULL))
+				ret = 1;
+		}
+	}
+
+	if (ret != 0) {
+		disposition.DeleteFile = TRUE;
+		SetFileInformationByHandle(dst, FileDispositionInfo, &disposition, sizeof(disposition));
+	}
+	CloseHandle(dst);
+	CloseHandle(src);
+
+	if (ret == 0) {
+		InterlockedIncrement64(&gCopiesCloned);
+		InterlockedExchangeAdd64(&gCopyClonedBytes, size.QuadPart);
+	}
+	return ret;
+}
+
+// Function: renameFile
+// Description: Move a file within its volume
+// Return: 0 if succeed, else the Win32 error, ERROR_NOT_SAME_DEVICE if
+//         the move has to copy the bytes
+// -IN: source: path of the file
+//      target: its new path, which must not exist
+DWORD renameFile(const char *source, const char *target) {
+	if (!MoveFileExA(source, target, 0))
+		return GetLastError();
+	InterlockedIncrement64(&gMovesRenamed);
+	return NO_ERROR;
+}
+
+// Function: newCopyRequest
+// Description: Create a copy or move for the copy thread
+// Return: the request, NULL if out of memory
+// -IN: bufferObj: the request to answer
+//      source: path of the file
+//      target: path to copy or move it to
+//      move: whether the source goes away
+//      recode: whether the target group stores files in the other format
+//      compress: whether the target group stores compressed files
+COPY_REQUEST *newCopyRequest(struct _BUFFER_OBJ *bufferObj, const char *source, const char *target, bool move,
+	bool recode, bool compress) {
+	COPY_REQUEST *request = (COPY_REQUEST *)calloc(1, sizeof(COPY_REQUEST));
+
+	if (request == NULL)
+		return NULL;
+	request->bufferObj = bufferObj;
+	strcpy_s(request->source, MAX_PATH, source);
+	strcpy_s(request->target, MAX_PATH, target);
+	request->move = move;
+	request->recode = recode;
+	request->compress = compress;
+	request->queued = metricNow();
+	return request;
+}
+
+// Function: submitCopy
+// Description: Queue a copy for the copy thread unless enough are waiting
+// Return: 0 if queued, else return 1 and the request is left to the caller
+// -IN: request: the copy
+int submitCopy(COPY_REQUEST *request) {
+	request->next = NULL;
+
+	EnterCriticalSection(&gCopyCritSec);
+	if (gCopyQueued >= COPY_QUEUE_MAX) {
+		LeaveCriticalSection(&gCopyCritSec);
+		return 1;
+	}
+	if (gCopyListEnd == NULL)
+		gCopyList = request;
+	else
+		gCopyListEnd->next = request;
+	gCopyListEnd = request;
+	gCopyQueued++;
+	InterlockedIncrement(&gCopyPending);
+	LeaveCriticalSection(&gCopyCritSec);
+
+	ReleaseSemaphore(gCopySemaphore, 1, NULL);
+	return 0;
+}
+
+// Function: recodeFile
+// Description: Copy a file into a group that stores files in the other
+//              format, then remove the source of a move
+// Return: NO_ERROR if succeed, else the Win32 error and no target is left
+// -IN: request: the copy
+DWORD recodeFile(COPY_REQUEST *request) {
+	DWORD error;
+	MD5 md5;
+	int ret;
+
+	if (!CopyFileExA(request->source, request->target, NULL, NULL, NULL, COPY_FILE_FAIL_IF_EXISTS))
+		return GetLastError();
+
+	if (request->compress)
+		ret = compressStoredFile(request->target, md5.digestFile(request->target));
+	else
+		ret = expandStoredFile(request->target);
+	if (ret != 0) {
+		DeleteFileA(request->target);
+		return ERROR_WRITE_FAULT;
+	}
+
+	if (request->move && !DeleteFileA(request->source)) {
+		error = GetLastError();
+		DeleteFileA(request->target);
+		return error;
+	}
+	return NO_ERROR;
+}
+
+// Function: copyThread
+// Description: Take copies off the queue, copy the bytes and complete them
+unsigned __stdcall copyThread(void *param) {
+	COPY_REQUEST *request;
+	LONGLONG start;
+	BOOL done;
+
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+	while (TRUE) {
+		WaitForSingleObject(gCopySemaphore, INFINITE);
+
+		EnterCriticalSection(&gCopyCritSec);
+		request = gCopyList;
+		gCopyList = request->next;
+		if (gCopyList == NULL)
+			gCopyListEnd = NULL;
+		gCopyQueued--;
+		LeaveCriticalSection(&gCopyCritSec);
+
+		start = metricNow();
+		if (request->recode) {
+			request->error = recodeFile(request);
+			done = request->error == NO_ERROR;
+		}
+		else {
+			if (request->move)
+				done = MoveFileExA(request->source, request->target, MOVEFILE_COPY_ALLOWED);
+			else
+				done = CopyFileExA(request->source, request->target, NULL, NULL, NULL, COPY_FILE_FAIL_IF_EXISTS);
+			request->error = done ? NO_ERROR : GetLastError();
+		}
+		InterlockedExchangeAdd64(&gCopyStreamUs, (metricNow() - start) / gMetricTicksPerUs);
+		InterlockedIncrement64(done ? &gCopiesStreamed : &gCopiesFailed);
+
+		completeCopy(request);
+		free(request);
+		InterlockedDecrement(&gCopyPending);
+	}
+	return 0;
+}
+
+// Function: startCopyPool
+// Description: Create the queue and the copy thread
+// Return: 0 if succeed, else return 1
+int startCopyPool() {
+	InitializeCriticalSection(&gCopyCritSec);
+	gCopySemaphore = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+	if (gCopySemaphore == NULL) {
+		LOG_ERROR("CreateSemaphore failed: %d\n", GetLastError());
+		return 1;
+	}
+
+	if (_beginthreadex(0, 0, copyThread, NULL, 0, 0) == 0) {
+		LOG_ERROR("Create copy thread failed with error %d\n", GetLastError());
+		return 1;
+	}
+	return 0;
+}
+
+// Function: collectCopyMetrics
+// Description: Append the copies and moves done on the server
+// -IN: out: the scrape
+void collectCopyMetrics(std::string &out) {
+	appendHelp(out, "clouddrive_copies_total", "counter", "Server-side copies and moves, by how they were done.");
+	appendMetric(out, "clouddrive_copies_total", "method=\"clone\"", (double)gCopiesCloned);
+	appendMetric(out, "clouddrive_copies_total", "method=\"rename\"", (double)gMovesRenamed);
+	appendMetric(out, "clouddrive_copies_total", "method=\"stream\"", (double)gCopiesStreamed);
+	appendMetric(out, "clouddrive_copies_total", "method=\"failed\"", (double)gCopiesFailed);
+	appendHelp(out, "clouddrive_copy_cloned_bytes_total", "counter", "Bytes copied by cloning extents instead of reading them.");
+	appendMetric(out, "clouddrive_copy_cloned_bytes_total", NULL, (double)gCopyClonedBytes);
+	appendHelp(out, "clouddrive_copy_stream_seconds_total", "counter", "Time spent copying bytes on the copy thread.");
+	appendMetric(out, "clouddrive_copy_stream_seconds_total", NULL, gCopyStreamUs / 1e6);
+	appendHelp(out, "clouddrive_copy_queue_depth", "gauge", "Copies waiting for the copy thread.");
+	appendMetric(out, "clouddrive_copy_queue_depth", NULL, gCopyQueued);
+}
+
+#endif
@@ -0,0 +1,270 @@
+#pragma once
+
+#ifndef _GROUP_CATALOG_H
+#define _GROUP_CATALOG_H
+
+#include <list>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include "dataStructures.h"
+#include "metrics.h"
+#include "stringPool.h"
+
+// Group catalog. Groups are looked up on every group operation from all
+// completion threads and only added when a group is created, so lookups
+// take no lock. The indexes live in a GROUP_CATALOG that is never changed
+// once published: a writer copies the current one, adds to the copy and
+// swaps the pointer. The old copy is freed once every reader that may
+// still see it is done, which readers announce on a counter of their own
+// cache line. Groups themselves are allocated once and never changed or
+// freed, so a Group* (Account::workingGroup, a transfer) stays valid
+// across versions. A group changed in the database gets a new Group in
+// the next version of the catalog, and the one it replaces points to it;
+// holders read a group through groupLatest.
+#define CATALOG_READER_SLOTS	64
+
+typedef struct {
+	std::unordered_map<const char *, Group *, StringHash, StringEqual> byName;	// keyed by the pooled name
+	std::unordered_map<int, Group *> byId;
+	std::vector<Group *> groups;		// in the order they were added
+} GROUP_CATALOG;
+
+typedef struct __declspec(align(METRIC_LINE)) {
+	volatile LONG active;			// readers of the slot inside the catalog
+} CATALOG_READER;
+
+GROUP_CATALOG *volatile gGroupCatalog = NULL;
+CATALOG_READER gCatalogReaders[CATALOG_READER_SLOTS];
+volatile LONG gCatalogNextReader = 0;
+__declspec(thread) int tlsCatalogReader = -1;
+CRITICAL_SECTION gCatalogWriteCritSec;	// one writer at a time
+volatile LONGLONG gCatalogVersions = 0, gCatalogWaits = 0;
+
+// Function: initializeGroupCatalog
+// Description: Publish an empty catalog
+void initializeGroupCatalog() {
+	InitializeCriticalSection(&gCatalogWriteCritSec);
+	gGroupCatalog = new GROUP_CATALOG();
+}
+
+// Function: groupCatalogEnter
+// Description: Start reading the catalog. The catalog returned stays valid
+//              until groupCatalogLeave; keep the section short, writers
+//              wait for it. Sections do not nest.
+// Return: the current catalog
+GROUP_CATALOG *groupCatalogEnter() {
+	if (tlsCatalogReader < 0)
+		tlsCatalogReader = (InterlockedIncrement(&gCatalogNextReader) - 1) % CATALOG_READER_SLOTS;
+
+	// The increment is a full barrier: either the writer sees this reader
+	// or this reader sees the catalog the writer published
+	InterlockedIncrement(&gCatalogReaders[tlsCatalogReader].active);
+	return gGroupCatalog;
+}
+
+// Function: groupCatalogLeave
+// Description: End a read started by groupCatalogEnter
+void groupCatalogLeave() {
+	InterlockedDecrement(&gCatalogReaders[tlsCatalogReader].active);
+}
+
+// Function: groupCatalogSync
+// Description: Wait until every reader that may have seen the catalog
+//              before the last publish is done with it. Called by the
+//              writer, outside any read section.
+void groupCatalogSync() {
+	for (int i = 0; i < CATALOG_READER_SLOTS; i++) {
+		if (gCatalogReaders[i].active == 0)
+			continue;
+		gCatalogWaits++;
+		while (gCatalogReaders[i].active != 0)
+			SwitchToThread();
+	}
+}
+
+// Function: groupCatalogPublish
+// Description: Make a new version of the catalog the current one and free
+//              the version it replaces. Called with gCatalogWriteCritSec
+//              held.
+// -IN: catalog: the new version, not changed after this
+void groupCatalogPublish(GROUP_CATALOG *catalog) {
+	GROUP_CATALOG *old = (GROUP_CATALOG *)InterlockedExchangePointer((PVOID volatile *)&gGroupCatalog, catalog);
+
+	gCatalogVersions++;
+	groupCatalogSync();
+	delete old;
+}
+
+// Function: groupCatalogInsert
+// Description: Add a copy of a group to a catalog being built
+// Return: the copy
+// -IN: catalog: the new version, not published yet
+//      group: the group
+Group *groupCatalogInsert(GROUP_CATALOG *catalog, const Group *group) {
+	Group *copy = new Group(*group);
+
+	copy->replacedBy = NULL;
+	catalog->byName[copy->groupName] = copy;
+	catalog->byId[copy->gid] = copy;
+	catalog->groups.push_back(copy);
+	return copy;
+}
+
+// Function: groupCatalogAdd
+// Description: Add groups to the catalog in one new version
+// Return: the copy of the last group in the catalog, NULL if none was
+//         given
+// -IN: groups: the groups, their names already in the string pool
+Group *groupCatalogAdd(const std::list<Group> &groups) {
+	GROUP_CATALOG *catalog;
+	Group *added = NULL;
+
+	EnterCriticalSection(&gCatalogWriteCritSec);
+	catalog = new GROUP_CATALOG(*gGroupCatalog);
+	for (auto it = groups.begin(); it != groups.end(); ++it)
+		added = groupCatalogInsert(catalog, &(*it));
+	groupCatalogPublish(catalog);
+	LeaveCriticalSection(&gCatalogWriteCritSec);
+	return added;
+}
+
+// Function: groupLatest
+// Description: Follow a group to its latest version
+// Return: the latest version, NULL if group is NULL
+// -IN: group: any version of the group
+Group *groupLatest(Group *group) {
+	Group *next;
+
+	while (group != NULL && (next = group->replacedBy) != NULL)
+		group = next;
+	return group;
+}
+
+// Function: groupCatalogUnname
+// Description: Drop the name of a group from a catalog being built, unless
+//              another group took the name already
+// -IN: catalog: the new version, not published yet
+//      group: the group
+void groupCatalogUnname(GROUP_CATALOG *catalog, Group *group) {
+	auto it = catalog->byName.find(group->groupName);
+	if (it != catalog->byName.end() && it->second == group)
+		catalog->byName.erase(it);
+}
+
+// Function: groupCatalogUpdate
+// Description: Bring the catalog in line with a group read from the
+//              database. A new group is added. A group that changed is
+//              replaced by a new version, which takes over its transfer
+//              buckets; the old one is retired like a removed group and
+//              points to the new one, so the Group* held by accounts and
+//              transfers sees the change through groupLatest.
+// Return: the group in the catalog
+// -IN: group: the group, its names already in the string pool
+Group *groupCatalogUpdate(const Group *group) {
+	GROUP_CATALOG *catalog;
+	Group *current, *old;
+
+	EnterCriticalSection(&gCatalogWriteCritSec);
+	auto it = gGroupCatalog->byId.find(group->gid);
+	if (it == gGroupCatalog->byId.end()) {
+		catalog = new GROUP_CATALOG(*gGroupCatalog);
+		current = groupCatalogInsert(catalog, group);
+		groupCatalogPublish(catalog);
+	}
+	else if (it->second->groupName == group->groupName && it->second->pathName == group->pathName
+		&& it->second->ownerId == group->ownerId && it->second->compressed == group->compressed
+		&& it->second->sendWeight == group->sendWeight && it->second->qos.bytesRate == group->qos.bytesRate
+		&& it->second->qos.opsRate == group->qos.opsRate) {
+		current = it->second;
+	}
+	else {
+		old = it->second;
+		current = new Group(*group);
+		current->replacedBy = NULL;
+
+		// Blocks charged to the old version from here on are not carried over
+		current->qos = old->qos;
+		current->qos.bytesRate = group->qos.bytesRate;
+		current->qos.opsRate = group->qos.opsRate;
+
+		catalog = new GROUP_CATALOG(*gGroupCatalog);
+		groupCatalogUnname(catalog, old);
+		catalog->byName[current->groupName] = current;
+		catalog->byId[current->gid] = current;
+		*std::find(catalog->groups.begin(), catalog->groups.end(), old) = current;
+		groupCatalogPublish(catalog);
+		old->replacedBy = current;
+	}
+	LeaveCriticalSection(&gCatalogWriteCritSec);
+	return current;
+}
+
+// Function: groupCatalogRemove
+// Description: Take a group deleted from the database out of the catalog.
+//              The Group itself is kept, accounts may still point to it.
+// -IN: gid: id of the group
+void groupCatalogRemove(int gid) {
+	GROUP_CATALOG *catalog;
+	Group *group;
+
+	EnterCriticalSection(&gCatalogWriteCritSec);
+	auto it = gGroupCatalog->byId.find(gid);
+	if (it != gGroupCatalog->byId.end()) {
+		group = it->second;
+		catalog = new GROUP_CATALOG(*gGroupCatalog);
+		catalog->byId.erase(gid);
+		groupCatalogUnname(catalog, group);
+		catalog->groups.erase(std::find(catalog->groups.begin(), catalog->groups.end(), group));
+		groupCatalogPublish(catalog);
+	}
+	LeaveCriticalSection(&gCatalogWriteCritSec);
+}
+
+// Function: groupCatalogFindByName
+// Description: Find a group by its name
+// Return: the group, NULL if not found
+// -IN: groupName: name of the group
+Group *groupCatalogFindByName(const char *groupName) {
+	GROUP_CATALOG *catalog = groupCatalogEnter();
+	Group *group = NULL;
+
+	auto it = catalog->byName.find(groupName);
+	if (it != catalog->byName.end())
+		group = it->second;
+	groupCatalogLeave();
+	return group;
+}
+
+// Function: groupCatalogFindById
+// Description: Find a group by its id
+// Return: the group, NULL if not found
+// -IN: gid: id of the group
+Group *groupCatalogFindById(int gid) {
+	GROUP_CATALOG *catalog = groupCatalogEnter();
+	Group *group = NULL;
+
+	auto it = catalog->byId.find(gid);
+	if (it != catalog->byId.end())
+		group = it->second;
+	groupCatalogLeave();
+	return group;
+}
+
+// Function: collectCatalogMetrics
+// Description: Append the size and versions of the catalog
+// -IN: out: the scrape
+void collectCatalogMetrics(std::string &out) {
+	GROUP_CATALOG *catalog = groupCatalogEnter();
+	size_t groups = catalog->groups.size();
+	groupCatalogLeave();
+
+	appendHelp(out, "clouddrive_groups", "gauge", "Groups in the catalog.");
+	appendMetric(out, "clouddrive_groups", NULL, (double)groups);
+	appendHelp(out, "clouddrive_group_catalog_versions_total", "counter", "Versions of the group catalog published.");
+	appendMetric(out, "clouddrive_group_catalog_versions_total", NULL, (double)gCatalogVersions);
+	appendHelp(out, "clouddrive_group_catalog_waits_total", "counter", "Reader slots a catalog writer had to wait for.");
+	appendMetric(out, "clouddrive_group_catalog_waits_total", NULL, (double)gCatalogWaits);
+}
+
+#endif
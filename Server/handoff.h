@@ -0,0 +1,261 @@
+#pragma once
+
+#ifndef _HANDOFF_H
+#define _HANDOFF_H
+
+#include <string>
+#include <process.h>
+#include <winsock2.h>
+#include "dataStructures.h"
+#include "metrics.h"
+#include "binaryLog.h"
+#include "admission.h"
+#include "dbWriter.h"
+#include "authPool.h"
+#include "fileCopy.h"
+#include "sendScheduler.h"
+
+// Restart handoff. A server started with -r takes over from the one
+// running on the same port instead of binding: it connects to the pipe
+// the running server listens on, sends its process id and gets back its
+// listening sockets duplicated with WSADuplicateSocket, so the port never
+// stops accepting. Once the new server has posted its accepts it says so,
+// and the old one closes its own handles of the sockets, which cancels its
+// pending accepts, and drains: connections it already has are served until
+// no transfer holds a slot, every login, copy and database change taken in
+// was answered and every response went out, or the drain deadline passes,
+// then it exits. Sessions are in the SESSION table,
+// so clients log back in to the new server with their cookie.
+#define HANDOFF_PIPE_FORMAT		"\\\\.\\pipe\\clouddrive-%s"	// by port
+#define HANDOFF_MAGIC			0x46444E48		// "HNDF"
+#define HANDOFF_MAX_SOCKETS		8
+#define HANDOFF_CONNECT_MS		5000		// wait for the pipe of the running server
+#define HANDOFF_POLL_MS			250			// drain checks
+#define DEFAULT_DRAIN_TIMEOUT	300			// seconds
+
+typedef struct {
+	DWORD       magic;
+	DWORD       pid;			// process to duplicate the sockets for
+} HANDOFF_REQUEST;
+
+typedef struct {
+	DWORD       magic;
+	int         count;
+	struct {
+		int               family;
+		WSAPROTOCOL_INFOW info;
+	} sockets[HANDOFF_MAX_SOCKETS];
+} HANDOFF_REPLY;
+
+int gTakeOver = 0;						// take the sockets of the running server
+int gDrainTimeout = DEFAULT_DRAIN_TIMEOUT;
+volatile LONG gDraining = 0;			// sockets handed off, no more accepts
+HANDLE gHandoffPipe = INVALID_HANDLE_VALUE;
+LISTEN_OBJ *gHandoffSockets = NULL;
+
+// Function: handoffPipeName
+// Description: Name of the handoff pipe of the server on a port
+// -IN: port: the port
+//      size: size of the output buffer
+// -OUT: name: the pipe name
+void handoffPipeName(const char *port, char *name, size_t size) {
+	snprintf(name, size, HANDOFF_PIPE_FORMAT, port);
+}
+
+// Function: handoffReceive
+// Description: Get the listening sockets of the server running on a port
+// Return: 0 if succeed, else return 1
+// -IN: port: the port
+// -OUT: reply: the sockets, to create with WSASocketW
+int handoffReceive(const char *port, HANDOFF_REPLY *reply) {
+	char name[MAX_PATH];
+	HANDOFF_REQUEST request;
+	DWORD mode = PIPE_READMODE_MESSAGE, bytes;
+
+	handoffPipeName(port, name, sizeof(name));
+	if (!WaitNamedPipeA(name, HANDOFF_CONNECT_MS)) {
+		LOG_ERROR("No server to take over on port %s: %d\n", port, GetLastError());
+		return 1;
+	}
+	gHandoffPipe = CreateFileA(name, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+	if (gHandoffPipe == INVALID_HANDLE_VALUE || !SetNamedPipeHandleState(gHandoffPipe, &mode, NULL, NULL)) {
+		LOG_ERROR("Cannot open handoff pipe %s: %d\n", logTail(name), GetLastError());
+		return 1;
+	}
+
+	request.magic = HANDOFF_MAGIC;
+	request.pid = GetCurrentProcessId();
+	if (!WriteFile(gHandoffPipe, &request, sizeof(request), &bytes, NULL)
+		|| !ReadFile(gHandoffPipe, reply, sizeof(*reply), &bytes, NULL)
+		|| bytes != sizeof(*reply) || reply->magic != HANDOFF_MAGIC
+		|| reply->count <= 0 || reply->count > HANDOFF_MAX_SOCKETS) {
+		LOG_ERROR("Handoff from the running server failed: %d\n", GetLastError());
+		return 1;
+	}
+	return 0;
+}
+
+// Function: handoffAccepting
+// Description: Tell the old server the sockets taken over are accepting,
+//              and wait for it to close its end of the pipe so that this
+//              server can create the pipe for the next restart
+// Return: 0 if succeed, else return 1
+int handoffAccepting() {
+	DWORD magic = HANDOFF_MAGIC, bytes;
+
+	if (!WriteFile(gHandoffPipe, &magic, sizeof(magic), &bytes, NULL)) {
+		LOG_ERROR("Handoff confirmation failed: %d\n", GetLastError());
+		return 1;
+	}
+
+	// Only fails once the old server closed the pipe
+	while (ReadFile(gHandoffPipe, &magic, sizeof(magic), &bytes, NULL))
+		;
+	CloseHandle(gHandoffPipe);
+	gHandoffPipe = INVALID_HANDLE_VALUE;
+	return 0;
+}
+
+// Function: handoffIdle
+// Description: Whether the drain is done: no transfer holds a slot, no
+//              login, copy or database change waits for its answer and no
+//              response waits to be sent
+// Return: 1 if done, else 0
+int handoffIdle() {
+	return gDownloadLimit.inUse == 0 && gUploadLimit.inUse == 0 && gDbWritesPending == 0
+		&& gAuthPending == 0 && gCopyPending == 0
+		&& gSendControlQueued == 0 && gSendLimit.inUse == 0;
+}
+
+// Function: handoffDrain
+// Description: Stop accepting on the sockets handed off, serve the
+//              connections left until they are idle or the deadline
+//              passes, and exit
+void handoffDrain() {
+	LISTEN_OBJ *listenobj;
+	LONGLONG start = metricNow();
+	ULONGLONG deadline = GetTickCount64() + (ULONGLONG)gDrainTimeout * 1000;
+
+	InterlockedExchange(&gDraining, 1);
+	for (listenobj = gHandoffSockets; listenobj != NULL; listenobj = listenobj->next)
+		closesocket(listenobj->s);
+	LOG_INFO("Sockets handed off, draining for up to %d seconds\n", gDrainTimeout);
+
+	while (!handoffIdle() && GetTickCount64() < deadline)
+		Sleep(HANDOFF_POLL_MS);
+
+	// Changes already accepted are written whatever the deadline, the new
+	// server reads sessions and memberships from the database
+	while (gDbWritesPending != 0)
+		Sleep(HANDOFF_POLL_MS);
+
+	if (handoffIdle())
+		LOG_INFO("Drained in %lld ms, exiting\n", (metricNow() - start) / gMetricTicksPerUs / 1000);
+	else {
+		LOG_WARN("Drain deadline passed with %ld downloads and %ld uploads left\n",
+			gDownloadLimit.inUse, gUploadLimit.inUse);
+		LOG_WARN("Exiting with %ld logins, %ld copies and %d responses unanswered\n",
+			gAuthPending, gCopyPending, gSendControlQueued);
+	}
+
+	logFlush();
+	ExitProcess(0);
+}
+
+// Function: handoffSend
+// Description: Answer a server taking over: duplicate the listening
+//              sockets for it and wait until it accepts on them
+// Return: 0 if the sockets were taken over, else return 1
+int handoffSend() {
+	HANDOFF_REQUEST request;
+	HANDOFF_REPLY reply;
+	LISTEN_OBJ *listenobj;
+	DWORD magic, bytes;
+
+	if (!ReadFile(gHandoffPipe, &request, sizeof(request), &bytes, NULL)
+		|| bytes != sizeof(request) || request.magic != HANDOFF_MAGIC)
+		return 1;
+
+	memset(&reply, 0, sizeof(reply));
+	reply.magic = HANDOFF_MAGIC;
+	for (listenobj = gHandoffSockets; listenobj != NULL && reply.count < HANDOFF_MAX_SOCKETS; listenobj = listenobj->next) {
+		if (WSADuplicateSocketW(listenobj->s, request.pid, &reply.sockets[reply.count].info) == SOCKET_ERROR) {
+			LOG_ERROR("WSADuplicateSocket failed: %d\n", WSAGetLastError());
+			return 1;
+		}
+		reply.sockets[reply.count++].family = listenobj->AddressFamily;
+	}
+	if (!WriteFile(gHandoffPipe, &reply, sizeof(reply), &bytes, NULL))
+		return 1;
+
+	// The new server confirms once its accepts are posted. If it dies
+	// before that this server goes on accepting.
+	if (!ReadFile(gHandoffPipe, &magic, sizeof(magic), &bytes, NULL)
+		|| bytes != sizeof(magic) || magic != HANDOFF_MAGIC)
+		return 1;
+	return 0;
+}
+
+// Function: handoffThread
+// Description: Wait for a server to take over, one at a time
+unsigned __stdcall handoffThread(void *param) {
+	while (TRUE) {
+		if (!ConnectNamedPipe(gHandoffPipe, NULL) && GetLastError() != ERROR_PIPE_CONNECTED) {
+			LOG_ERROR("ConnectNamedPipe failed: %d\n", GetLastError());
+			return 1;
+		}
+
+		LOG_INFO("A new server is taking over\n");
+		if (handoffSend() == 0) {
+			// Closing the pipe lets the new server create its own
+			CloseHandle(gHandoffPipe);
+			gHandoffPipe = INVALID_HANDLE_VALUE;
+			handoffDrain();
+		}
+		LOG_WARN("Takeover abandoned, still accepting\n");
+		DisconnectNamedPipe(gHandoffPipe);
+	}
+	return 0;
+}
+
+// Function: startHandoff
+// Description: Create the handoff pipe of the port and the thread that
+//              answers it
+// Return: 0 if succeed, else return 1
+// -IN: port: the port
+//      sockets: the listening sockets to hand off
+int startHandoff(const char *port, LISTEN_OBJ *sockets) {
+	char name[MAX_PATH];
+
+	gHandoffSockets = sockets;
+	handoffPipeName(port, name, sizeof(name));
+
+	// Only one server owns the pipe of a port, and only local processes
+	// of the same user may open it
+	gHandoffPipe = CreateNamedPipeA(name,
+		PIPE_ACCESS_DUPLEX | FILE_FLAG_FIRST_PIPE_INSTANCE,
+		PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+		1, sizeof(HANDOFF_REPLY), sizeof(HANDOFF_REPLY), 0, NULL);
+	if (gHandoffPipe == INVALID_HANDLE_VALUE) {
+		LOG_ERROR("Cannot create handoff pipe %s: %d\n", logTail(name), GetLastError());
+		return 1;
+	}
+
+	if (_beginthreadex(0, 0, handoffThread, NULL, 0, 0) == 0) {
+		LOG_ERROR("Create handoff thread failed with error %d\n", GetLastError());
+		return 1;
+	}
+	return 0;
+}
+
+// Function: collectHandoffMetrics
+// Description: Append the drain state of the server
+// -IN: out: the scrape
+void collectHandoffMetrics(std::string &out) {
+	appendHelp(out, "clouddrive_draining", "gauge", "1 once the listening sockets are handed to a new server.");
+	appendMetric(out, "clouddrive_draining", NULL, (double)gDraining);
+	appendHelp(out, "clouddrive_db_writes_pending", "gauge", "Database changes queued or being committed.");
+	appendMetric(out, "clouddrive_db_writes_pending", NULL, (double)gDbWritesPending);
+}
+
+#endif
@@ -0,0 +1,384 @@
+#pragma once
+
+#ifndef _LOGIN_GUARD_H
+#define _LOGIN_GUARD_H
+
+#include <string>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include "dataStructures.h"
+#include "metrics.h"
+#include "binaryLog.h"
+
+// Login guard. Failed logins are counted per source address and per
+// account in two fixed-size tables, so a flood over many usernames or
+// addresses costs a hash and a few compares per login and cannot grow
+// memory. Each table is set-associative: a key hashes to one set of
+// GUARD_WAYS entries under its own lock, and a new key takes the place of
+// the entry of the set used least recently. Entries whose window still
+// holds failures, or whose source is refused, are never replaced, so
+// failing over other keys of the same set cannot wipe a count; while all
+// entries of a set are held that way, new keys of the set are refused.
+//
+// A source gets a token bucket of connections, checked when it is
+// accepted, and one of logins, checked before the account is looked up.
+// Its failed logins are counted over a sliding window; once they go over
+// LOGIN_SOURCE_FAIL_LIMIT the source is refused for LOGIN_SOURCE_BLOCK
+// seconds, at accept and at login, before any work on an account. The
+// failed logins of an account are counted the same way over an hour; over
+// ATTEMPT_LIMIT the account is locked as before. Windows are two fixed
+// buckets, the previous one weighted by how much of it is still inside
+// the window.
+//
+// Sources are IPv4 addresses or IPv6 /64 prefixes. Key 0 is not tracked,
+// which is what connections the server did not accept itself have.
+#define GUARD_SET_BITS				11
+#define GUARD_SETS					(1 << GUARD_SET_BITS)
+#define GUARD_WAYS					4
+#define LOGIN_SOURCE_RATE			5		// logins per second of a source
+#define LOGIN_SOURCE_BURST			20
+#define LOGIN_CONNECT_RATE			20		// connections per second of a source
+#define LOGIN_CONNECT_BURST			50
+#define LOGIN_SOURCE_FAIL_LIMIT		20		// failed logins of a source per window
+#define LOGIN_SOURCE_WINDOW			60		// seconds
+#define LOGIN_SOURCE_BLOCK			900		// seconds a source over its limit is refused
+#define GUARD_FULL_RETRY			1000	// milliseconds a key refused for a full set waits
+
+typedef struct {
+	ULONGLONG   key;				// 0 if free
+	ULONGLONG   seen;				// tick count of the last use
+	ULONGLONG   windowStart;		// tick count the current window began
+	int         windowCount;		// failures in the current window
+	int         previousCount;		// failures in the window before
+	ULONGLONG   blockedUntil;		// tick count the source is refused until
+	LONGLONG    tokens;				// thousandths of a login
+	LONGLONG    connectTokens;		// thousandths of a connection
+	ULONGLONG   refilled;			// tick count the buckets were last filled
+} GUARD_ENTRY;
+
+typedef struct {
+	SRWLOCK     lock;
+	GUARD_ENTRY ways[GUARD_WAYS];
+} GUARD_SET;
+
+GUARD_SET gGuardSources[GUARD_SETS];
+GUARD_SET gGuardAccounts[GUARD_SETS];
+volatile LONGLONG gGuardRefusedAccepts = 0, gGuardRefusedLogins = 0, gGuardBlocks = 0,
+gGuardLockouts = 0, gGuardEvictions = 0, gGuardFull = 0;
+
+// Function: initializeLoginGuard
+// Description: Initialize the locks of the tables
+void initializeLoginGuard() {
+	for (int i = 0; i < GUARD_SETS; i++) {
+		InitializeSRWLock(&gGuardSources[i].lock);
+		InitializeSRWLock(&gGuardAccounts[i].lock);
+	}
+}
+
+// Function: loginSourceKey
+// Description: Key of the source of a connection
+// Return: the key, 0 if the address family is not known
+// -IN: addr: the remote address
+ULONGLONG loginSourceKey(const SOCKADDR *addr) {
+	const BYTE *bytes;
+	ULONGLONG key = 0;
+
+	if (addr == NULL)
+		return 0;
+	if (addr->sa_family == AF_INET)
+		return (4ULL << 56) | ntohl(((const SOCKADDR_IN *)addr)->sin_addr.s_addr);
+	if (addr->sa_family != AF_INET6)
+		return 0;
+
+	// An IPv4 client of a dual-stack socket, ::ffff:a.b.c.d, is the IPv4 source
+	bytes = ((const SOCKADDR_IN6 *)addr)->sin6_addr.s6_addr;
+	for (int i = 0; i < 10; i++)
+		key |= bytes[i];
+	if (key == 0 && bytes[10] == 0xFF && bytes[11] == 0xFF)
+		return (4ULL << 56) | ((ULONGLONG)bytes[12] << 24) | (bytes[13] << 16) | (bytes[14] << 8) | bytes[15];
+	key = 0;
+	for (int i = 0; i < 8; i++)
+		key = (key << 8) | bytes[i];
+	return key != 0 ? key : 6ULL << 56;
+}
+
+// Function: guardSet
+// Description: Set of a table a key falls in
+// Return: the set
+// -IN: table: the table
+//      key: the key
+GUARD_SET *guardSet(GUARD_SET *table, ULONGLONG key) {
+	return &table[(key * 0x9E3779B97F4A7C15ULL) >> (64 - GUARD_SET_BITS)];
+}
+
+// Function: guardFailures
+// Description: Failures of an entry over the sliding window ending now
+// Return: the estimated count
+// -IN: entry: the entry
+//      now: tick count
+//      windowMs: length of the window
+int guardFailures(GUARD_ENTRY *entry, ULONGLONG now, ULONGLONG windowMs) {
+	ULONGLONG elapsed = now - entry->windowStart;
+
+	if (elapsed >= windowMs) {
+		entry->previousCount = elapsed < 2 * windowMs ? entry->windowCount : 0;
+		entry->windowCount = 0;
+		entry->windowStart = now - elapsed % windowMs;
+		elapsed %= windowMs;
+	}
+	return entry->windowCount + (int)(entry->previousCount * (windowMs - elapsed) / windowMs);
+}
+
+// Function: guardFind
+// Description: Find the entry of a key in its set, taking the least
+//              recently used entry of the set for it if it has none.
+//              Entries still counting failures or a block are not taken.
+//              Called with the lock of the set held exclusively.
+// Return: the entry, NULL if not found and create is false or every
+//         entry of the set is still counting failures
+// -IN: set: the set of the key
+//      key: the key
+//      now: tick count
+//      windowMs: length of the failure window of the table
+//      create: whether to make an entry for a new key
+GUARD_ENTRY *guardFind(GUARD_SET *set, ULONGLONG key, ULONGLONG now, ULONGLONG windowMs, bool create) {
+	GUARD_ENTRY *entry, *oldest = NULL;
+
+	for (int i = 0; i < GUARD_WAYS; i++) {
+		entry = &set->ways[i];
+		if (entry->key == key) {
+			entry->seen = now;
+			return entry;
+		}
+		if (entry->key != 0 && (entry->blockedUntil > now || guardFailures(entry, now, windowMs) > 0))
+			continue;
+		if (oldest == NULL || entry->key == 0 || (oldest->key != 0 && entry->seen < oldest->seen))
+			oldest = entry;
+	}
+	if (!create)
+		return NULL;
+	if (oldest == NULL) {
+		InterlockedIncrement64(&gGuardFull);
+		return NULL;
+	}
+
+	if (oldest->key != 0)
+		InterlockedIncrement64(&gGuardEvictions);
+	memset(oldest, 0, sizeof(GUARD_ENTRY));
+	oldest->key = key;
+	oldest->seen = oldest->windowStart = oldest->refilled = now;
+	oldest->tokens = LOGIN_SOURCE_BURST * 1000;
+	oldest->connectTokens = LOGIN_CONNECT_BURST * 1000;
+	return oldest;
+}
+
+// Function: guardRefill
+// Description: Fill the token buckets of a source for the time since they
+//              were last filled
+// -IN: entry: the entry of the source
+//      now: tick count
+void guardRefill(GUARD_ENTRY *entry, ULONGLONG now) {
+	LONGLONG elapsed = (LONGLONG)(now - entry->refilled);
+
+	entry->tokens += elapsed * LOGIN_SOURCE_RATE;
+	if (entry->tokens > LOGIN_SOURCE_BURST * 1000)
+		entry->tokens = LOGIN_SOURCE_BURST * 1000;
+	entry->connectTokens += elapsed * LOGIN_CONNECT_RATE;
+	if (entry->connectTokens > LOGIN_CONNECT_BURST * 1000)
+		entry->connectTokens = LOGIN_CONNECT_BURST * 1000;
+	entry->refilled = now;
+}
+
+// Function: guardTake
+// Description: Take one from a token bucket
+// Return: 0 if taken, else milliseconds until one is available
+// -IN: tokens: the bucket, in thousandths
+//      rate: tokens per second
+DWORD guardTake(LONGLONG *tokens, int rate) {
+	if (*tokens >= 1000) {
+		*tokens -= 1000;
+		return 0;
+	}
+	return (DWORD)((1000 - *tokens + rate - 1) / rate);
+}
+
+// Function: loginGuardAccept
+// Description: Check a new connection against its source
+// Return: 0 if it may go on, 1 to close it
+// -IN: source: key of the source
+int loginGuardAccept(ULONGLONG source) {
+	GUARD_SET *set = guardSet(gGuardSources, source);
+	GUARD_ENTRY *entry;
+	ULONGLONG now = GetTickCount64();
+	int refused;
+
+	if (source == 0)
+		return 0;
+
+	AcquireSRWLockExclusive(&set->lock);
+	entry = guardFind(set, source, now, LOGIN_SOURCE_WINDOW * 1000, true);
+	if (entry == NULL) {
+		refused = 1;
+	}
+	else {
+		guardRefill(entry, now);
+		refused = entry->blockedUntil > now || guardTake(&entry->connectTokens, LOGIN_CONNECT_RATE) != 0;
+	}
+	ReleaseSRWLockExclusive(&set->lock);
+
+	if (refused)
+		InterlockedIncrement64(&gGuardRefusedAccepts);
+	return refused;
+}
+
+// Function: loginGuardBegin
+// Description: Check a login against its source, before the account is
+//              looked up
+// Return: 0 if it may go on, else milliseconds to wait before retrying
+// -IN: source: key of the source
+DWORD loginGuardBegin(ULONGLONG source) {
+	GUARD_SET *set = guardSet(gGuardSources, source);
+	GUARD_ENTRY *entry;
+	ULONGLONG now = GetTickCount64();
+	DWORD waitMs;
+
+	if (source == 0)
+		return 0;
+
+	AcquireSRWLockExclusive(&set->lock);
+	entry = guardFind(set, source, now, LOGIN_SOURCE_WINDOW * 1000, true);
+	if (entry == NULL) {
+		waitMs = GUARD_FULL_RETRY;
+	}
+	else {
+		guardRefill(entry, now);
+		if (entry->blockedUntil > now)
+			waitMs = (DWORD)(entry->blockedUntil - now);
+		else
+			waitMs = guardTake(&entry->tokens, LOGIN_SOURCE_RATE);
+	}
+	ReleaseSRWLockExclusive(&set->lock);
+
+	if (waitMs != 0)
+		InterlockedIncrement64(&gGuardRefusedLogins);
+	return waitMs;
+}
+
+// Function: loginGuardFailed
+// Description: Count a failed login of a source, wrong password or
+//              unknown account, and refuse the source for a while once it
+//              goes over its limit
+// -IN: source: key of the source
+void loginGuardFailed(ULONGLONG source) {
+	GUARD_SET *set = guardSet(gGuardSources, source);
+	GUARD_ENTRY *entry;
+	ULONGLONG now = GetTickCount64();
+	bool blocked = false;
+
+	if (source == 0)
+		return;
+
+	AcquireSRWLockExclusive(&set->lock);
+	entry = guardFind(set, source, now, LOGIN_SOURCE_WINDOW * 1000, true);
+	if (entry == NULL) {
+		// Its next login is refused until the set has room
+		ReleaseSRWLockExclusive(&set->lock);
+		return;
+	}
+	guardFailures(entry, now, LOGIN_SOURCE_WINDOW * 1000);	// move the window up to now first
+	entry->windowCount++;
+	if (entry->blockedUntil <= now && guardFailures(entry, now, LOGIN_SOURCE_WINDOW * 1000) > LOGIN_SOURCE_FAIL_LIMIT) {
+		entry->blockedUntil = now + LOGIN_SOURCE_BLOCK * 1000;
+		blocked = true;
+	}
+	ReleaseSRWLockExclusive(&set->lock);
+
+	if (blocked) {
+		InterlockedIncrement64(&gGuardBlocks);
+		LOG_WARN("Source %llx refused for %d seconds after too many failed logins\n", source, LOGIN_SOURCE_BLOCK);
+	}
+}
+
+// Function: loginAccountBegin
+// Description: Check that the failed logins of an account can be counted
+//              before its password is verified
+// Return: 0 if it may go on, else milliseconds to wait before retrying
+// -IN: uid: id of the account
+DWORD loginAccountBegin(int uid) {
+	GUARD_SET *set = guardSet(gGuardAccounts, uid);
+	DWORD waitMs = 0;
+
+	AcquireSRWLockExclusive(&set->lock);
+	if (guardFind(set, uid, GetTickCount64(), TIME_1_HOUR * 1000ULL, true) == NULL)
+		waitMs = GUARD_FULL_RETRY;
+	ReleaseSRWLockExclusive(&set->lock);
+
+	if (waitMs != 0)
+		InterlockedIncrement64(&gGuardRefusedLogins);
+	return waitMs;
+}
+
+// Function: loginAccountFailed
+// Description: Count a wrong password given for an account
+// Return: 1 if the account went over ATTEMPT_LIMIT and is to be locked,
+//         else 0
+// -IN: uid: id of the account
+int loginAccountFailed(int uid) {
+	GUARD_SET *set = guardSet(gGuardAccounts, uid);
+	GUARD_ENTRY *entry;
+	ULONGLONG now = GetTickCount64();
+	int locked = 0;
+
+	AcquireSRWLockExclusive(&set->lock);
+	entry = guardFind(set, uid, now, TIME_1_HOUR * 1000ULL, true);
+	if (entry == NULL) {
+		// The set filled up since loginAccountBegin. A failure that cannot
+		// be counted locks the account rather than being forgotten.
+		ReleaseSRWLockExclusive(&set->lock);
+		InterlockedIncrement64(&gGuardLockouts);
+		return 1;
+	}
+	guardFailures(entry, now, TIME_1_HOUR * 1000ULL);	// move the window up to now first
+	entry->windowCount++;
+	if (guardFailures(entry, now, TIME_1_HOUR * 1000ULL) > ATTEMPT_LIMIT) {
+		entry->key = 0;		// the lock is stored, nothing left to count
+		locked = 1;
+	}
+	ReleaseSRWLockExclusive(&set->lock);
+
+	if (locked)
+		InterlockedIncrement64(&gGuardLockouts);
+	return locked;
+}
+
+// Function: loginAccountSucceeded
+// Description: Forget the failed logins of an account that logged in
+// -IN: uid: id of the account
+void loginAccountSucceeded(int uid) {
+	GUARD_SET *set = guardSet(gGuardAccounts, uid);
+	GUARD_ENTRY *entry;
+
+	AcquireSRWLockExclusive(&set->lock);
+	if ((entry = guardFind(set, uid, GetTickCount64(), TIME_1_HOUR * 1000ULL, false)) != NULL)
+		entry->key = 0;
+	ReleaseSRWLockExclusive(&set->lock);
+}
+
+// Function: collectLoginGuardMetrics
+// Description: Append the refusals and blocks of the guard
+// -IN: out: the scrape
+void collectLoginGuardMetrics(std::string &out) {
+	appendHelp(out, "clouddrive_login_refused_total", "counter", "Connections and logins refused by the source they came from.");
+	appendMetric(out, "clouddrive_login_refused_total", "stage=\"accept\"", (double)gGuardRefusedAccepts);
+	appendMetric(out, "clouddrive_login_refused_total", "stage=\"login\"", (double)gGuardRefusedLogins);
+	appendHelp(out, "clouddrive_login_source_blocks_total", "counter", "Sources refused for too many failed logins.");
+	appendMetric(out, "clouddrive_login_source_blocks_total", NULL, (double)gGuardBlocks);
+	appendHelp(out, "clouddrive_login_lockouts_total", "counter", "Accounts locked for too many wrong passwords.");
+	appendMetric(out, "clouddrive_login_lockouts_total", NULL, (double)gGuardLockouts);
+	appendHelp(out, "clouddrive_login_guard_evictions_total", "counter", "Entries of the login guard replaced by a newer key.");
+	appendMetric(out, "clouddrive_login_guard_evictions_total", NULL, (double)gGuardEvictions);
+	appendHelp(out, "clouddrive_login_guard_full_total", "counter", "New keys refused because every entry of their set was still counting failures.");
+	appendMetric(out, "clouddrive_login_guard_full_total", NULL, (double)gGuardFull);
+}
+
+#endif
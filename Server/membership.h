@@ -0,0 +1,131 @@
+#pragma once
+
+#ifndef _MEMBERSHIP_H
+#define _MEMBERSHIP_H
+
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <windows.h>
+
+// In-memory copy of the GROUPMEMBER table, indexed both ways. Each set is
+// a sorted vector of ids so a check is a binary search. The index is
+// loaded once at startup and kept up to date by the functions in dbUtils.h
+// that change membership, right after the database accepted the change,
+// and by the change feed for changes made outside the server.
+std::unordered_map<int, std::vector<int>> accountGroupIndex;	// uid -> gids
+std::unordered_map<int, std::vector<int>> groupMemberIndex;	// gid -> uids
+SRWLOCK membershipLock = SRWLOCK_INIT;
+
+// Function: sortedInsert
+// Description: Insert an id into a sorted vector if it is not there yet
+// -IN: id: the id to insert
+// -OUT: ids: the sorted vector
+void sortedInsert(std::vector<int>& ids, int id) {
+	auto it = std::lower_bound(ids.begin(), ids.end(), id);
+	if (it == ids.end() || *it != id)
+		ids.insert(it, id);
+}
+
+// Function: sortedErase
+// Description: Remove an id from a sorted vector
+// -IN: id: the id to remove
+// -OUT: ids: the sorted vector
+void sortedErase(std::vector<int>& ids, int id) {
+	auto it = std::lower_bound(ids.begin(), ids.end(), id);
+	if (it != ids.end() && *it == id)
+		ids.erase(it);
+}
+
+// Function: membershipAdd
+// Description: Record that an account is a member of a group
+// -IN: uid: id of the account
+//      gid: id of the group
+void membershipAdd(int uid, int gid) {
+	AcquireSRWLockExclusive(&membershipLock);
+	sortedInsert(accountGroupIndex[uid], gid);
+	sortedInsert(groupMemberIndex[gid], uid);
+	ReleaseSRWLockExclusive(&membershipLock);
+}
+
+// Function: membershipRemove
+// Description: Record that an account left a group
+// -IN: uid: id of the account
+//      gid: id of the group
+void membershipRemove(int uid, int gid) {
+	AcquireSRWLockExclusive(&membershipLock);
+	auto groups = accountGroupIndex.find(uid);
+	if (groups != accountGroupIndex.end())
+		sortedErase(groups->second, gid);
+	auto members = groupMemberIndex.find(gid);
+	if (members != groupMemberIndex.end())
+		sortedErase(members->second, uid);
+	ReleaseSRWLockExclusive(&membershipLock);
+}
+
+// Function: membershipAddGroup
+// Description: Create an empty member set for a new group
+// -IN: gid: id of the group
+void membershipAddGroup(int gid) {
+	AcquireSRWLockExclusive(&membershipLock);
+	groupMemberIndex[gid];
+	ReleaseSRWLockExclusive(&membershipLock);
+}
+
+// Function: membershipReplace
+// Description: Swap in an index rebuilt from the database
+// -IN/OUT: accountGroups: uid -> sorted gids, gets the old index
+//          groupMembers: gid -> sorted uids, gets the old index
+void membershipReplace(std::unordered_map<int, std::vector<int>>& accountGroups,
+	std::unordered_map<int, std::vector<int>>& groupMembers) {
+	AcquireSRWLockExclusive(&membershipLock);
+	accountGroupIndex.swap(accountGroups);
+	groupMemberIndex.swap(groupMembers);
+	ReleaseSRWLockExclusive(&membershipLock);
+}
+
+// Function: membershipHas
+// Description: Check if an account is a member of a group
+// Return: true if the account is a member, else false
+// -IN: uid: id of the account
+//      gid: id of the group
+bool membershipHas(int uid, int gid) {
+	bool ret = false;
+
+	AcquireSRWLockShared(&membershipLock);
+	auto groups = accountGroupIndex.find(uid);
+	if (groups != accountGroupIndex.end())
+		ret = std::binary_search(groups->second.begin(), groups->second.end(), gid);
+	ReleaseSRWLockShared(&membershipLock);
+	return ret;
+}
+
+// Function: membershipGroupsOf
+// Description: Get the groups an account is a member of
+// -IN: uid: id of the account
+// -OUT: gids: sorted ids of the groups
+void membershipGroupsOf(int uid, std::vector<int>& gids) {
+	AcquireSRWLockShared(&membershipLock);
+	auto groups = accountGroupIndex.find(uid);
+	if (groups != accountGroupIndex.end())
+		gids = groups->second;
+	else
+		gids.clear();
+	ReleaseSRWLockShared(&membershipLock);
+}
+
+// Function: membershipMembersOf
+// Description: Get the members of a group
+// -IN: gid: id of the group
+// -OUT: uids: sorted ids of the accounts
+void membershipMembersOf(int gid, std::vector<int>& uids) {
+	AcquireSRWLockShared(&membershipLock);
+	auto members = groupMemberIndex.find(gid);
+	if (members != groupMemberIndex.end())
+		uids = members->second;
+	else
+		uids.clear();
+	ReleaseSRWLockShared(&membershipLock);
+}
+
+#endif
@@ -0,0 +1,412 @@
+#pragma once
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <string>
+#include <intrin.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <process.h>
+#include "dataStructures.h"
+
+// Counters and histograms are split in METRIC_SHARDS cache lines. Each
+// thread updates the shard it was given on first use, so updates from the
+// completion and worker threads do not contend; a scrape adds the shards.
+#define METRIC_SHARDS			16
+#define METRIC_LINE				64
+
+// Latencies are kept in microseconds in log-linear buckets: each power of
+// two is split in HIST_SUB_COUNT buckets, which bounds the error of any
+// reported value to 1/HIST_SUB_COUNT. Values from 1 us up to 2^32 us
+// (about 71 minutes) are kept, longer ones land in the last bucket.
+#define HIST_SUB_BITS			3
+#define HIST_SUB_COUNT			(1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS			32
+#define HIST_BUCKETS			((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+#define HIST_FIRST_EXPORT_BIT	4		// smallest exported bucket bound, 16 us
+
+#define METRICS_REQUEST_SIZE	4096
+#define METRICS_TIMEOUT_MS		2000	// a scrape has this long to send its request, and again to read the answer
+
+typedef struct __declspec(align(METRIC_LINE)) {
+	volatile LONGLONG value;
+} METRIC_CELL;
+
+typedef struct {
+	METRIC_CELL cells[METRIC_SHARDS];
+} METRIC_COUNTER;
+
+typedef struct __declspec(align(METRIC_LINE)) {
+	volatile LONG counts[HIST_BUCKETS];
+	volatile LONGLONG sum;
+} HIST_SHARD;
+
+typedef struct {
+	HIST_SHARD shards[METRIC_SHARDS];
+} METRIC_HISTOGRAM;
+
+#define METRIC_OP(op)	{ op, #op }
+
+// Request opcodes with their own latency histogram
+const struct {
+	int         opcode;
+	const char *name;
+} gMetricOps[] = {
+	METRIC_OP(OPA_REAUTH), METRIC_OP(OPA_REQ_COOKIES), METRIC_OP(OPA_LOGIN), METRIC_OP(OPA_LOGOUT),
+	METRIC_OP(OPG_GROUP_USE), METRIC_OP(OPG_GROUP_LIST), METRIC_OP(OPG_GROUP_JOIN),
+	METRIC_OP(OPG_GROUP_LEAVE), METRIC_OP(OPG_GROUP_NEW),
+	METRIC_OP(OPB_LIST), METRIC_OP(OPB_FILE_CD), METRIC_OP(OPB_FILE_DEL), METRIC_OP(OPB_DIR_DEL),
+	METRIC_OP(OPB_DIR_NEW), METRIC_OP(OPB_FILE_COPY), METRIC_OP(OPB_FILE_MOVE),
+	METRIC_OP(OPT_FILE_DOWN), METRIC_OP(OPT_FILE_UP), METRIC_OP(OPT_FILE_DIGEST), METRIC_OP(OPT_FILE_DATA),
+	METRIC_OP(OPT_FILE_RANGE),
+	METRIC_OP(OPS_OK), METRIC_OP(OPS_CONTINUE),
+};
+#define METRIC_OP_COUNT		(sizeof(gMetricOps) / sizeof(gMetricOps[0]))
+
+METRIC_COUNTER gMetricBytesReceived, gMetricBytesSent;
+METRIC_COUNTER gMetricConnectionsAccepted, gMetricConnectionsClosed;
+METRIC_COUNTER gMetricUnknownOps;
+METRIC_HISTOGRAM gMetricRequestLatency[METRIC_OP_COUNT];
+METRIC_HISTOGRAM gMetricDiskRead, gMetricDiskWrite;
+
+LONGLONG gMetricTicksPerUs = 1;
+volatile LONG gMetricNextShard = 0;
+__declspec(thread) int tlsMetricShard = -1;
+
+// Gauges owned by the server (queue depths, outstanding operations), added
+// to the output of each scrape. Defined by the server.
+void CollectServerGauges(std::string &out);
+
+// Function: metricShard
+// Description: Get the shard of the calling thread
+// Return: index of the shard
+inline int metricShard() {
+	if (tlsMetricShard < 0)
+		tlsMetricShard = (InterlockedIncrement(&gMetricNextShard) - 1) % METRIC_SHARDS;
+	return tlsMetricShard;
+}
+
+// Function: metricAdd
+// Description: Add to a counter
+// -IN: counter: the counter
+//      value: the amount to add
+inline void metricAdd(METRIC_COUNTER *counter, LONGLONG value) {
+	InterlockedExchangeAdd64(&counter->cells[metricShard()].value, value);
+}
+
+// Function: metricRead
+// Description: Read a counter
+// Return: the sum of all shards
+LONGLONG metricRead(METRIC_COUNTER *counter) {
+	LONGLONG total = 0;
+	for (int i = 0; i < METRIC_SHARDS; i++)
+		total += counter->cells[i].value;
+	return total;
+}
+
+// Function: metricNow
+// Description: Read the high resolution clock
+// Return: the clock in performance counter ticks
+inline LONGLONG metricNow() {
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+}
+
+// Function: histBucket
+// Description: Get the bucket of a value
+// Return: index of the bucket
+// -IN: us: the value in microseconds
+inline int histBucket(ULONGLONG us) {
+	unsigned long msb;
+	int shift;
+
+	if (us < HIST_SUB_COUNT)
+		return (int)us;
+	if (us >= ((ULONGLONG)1 << HIST_MAX_BITS))
+		return HIST_BUCKETS - 1;
+
+	_BitScanReverse64(&msb, us);
+	shift = (int)msb - HIST_SUB_BITS;
+	return (shift + 1) * HIST_SUB_COUNT + (int)((us >> shift) & (HIST_SUB_COUNT - 1));
+}
+
+// Function: histUpperBound
+// Description: Get the smallest value above a bucket
+// Return: the bound in microseconds
+// -IN: bucket: index of the bucket
+ULONGLONG histUpperBound(int bucket) {
+	int shift;
+
+	if (bucket < HIST_SUB_COUNT)
+		return bucket + 1;
+	shift = bucket / HIST_SUB_COUNT - 1;
+	return ((ULONGLONG)(HIST_SUB_COUNT + bucket % HIST_SUB_COUNT) + 1) << shift;
+}
+
+// Function: metricObserve
+// Description: Record the time elapsed since a start point in a histogram
+// -IN: hist: the histogram
+//      start: the start point, from metricNow
+void metricObserve(METRIC_HISTOGRAM *hist, LONGLONG start) {
+	ULONGLONG us = (ULONGLONG)(metricNow() - start) / gMetricTicksPerUs;
+	HIST_SHARD *shard = &hist->shards[metricShard()];
+
+	InterlockedIncrement(&shard->counts[histBucket(us)]);
+	InterlockedExchangeAdd64(&shard->sum, (LONGLONG)us);
+}
+
+// Function: metricObserveRequest
+// Description: Record the latency of a request by its opcode
+// -IN: opcode: opcode of the request
+//      start: arrival of the request, from metricNow
+void metricObserveRequest(int opcode, LONGLONG start) {
+	for (int i = 0; i < METRIC_OP_COUNT; i++) {
+		if (gMetricOps[i].opcode == opcode) {
+			metricObserve(&gMetricRequestLatency[i], start);
+			return;
+		}
+	}
+	metricAdd(&gMetricUnknownOps, 1);
+}
+
+// Function: appendMetric
+// Description: Append one line of the text exposition format
+// -IN: name: the metric name
+//      labels: the labels without braces, NULL for none
+//      value: the sample
+// -OUT: out: the output
+void appendMetric(std::string &out, const char *name, const char *labels, double value) {
+	char line[256];
+
+	if (labels != NULL)
+		snprintf(line, sizeof(line), "%s{%s} %.9g\n", name, labels, value);
+	else
+		snprintf(line, sizeof(line), "%s %.9g\n", name, value);
+	out += line;
+}
+
+// Function: appendHelp
+// Description: Append the HELP and TYPE lines of a metric
+// -IN: name: the metric name
+//      type: counter, gauge or histogram
+//      help: the description
+// -OUT: out: the output
+void appendHelp(std::string &out, const char *name, const char *type, const char *help) {
+	out += "# HELP ";
+	out += name;
+	out += " ";
+	out += help;
+	out += "\n# TYPE ";
+	out += name;
+	out += " ";
+	out += type;
+	out += "\n";
+}
+
+// Function: appendHistogram
+// Description: Append a histogram. Buckets are exported at powers of two,
+//              which are exact bucket boundaries. The p50/p99/p999 values
+//              computed from the fine buckets go to the matching
+//              "_quantile" gauge.
+// -IN: hist: the histogram
+//      name: the metric name
+//      label: label identifying the histogram, NULL for none
+// -OUT: out: the output
+//       quantiles: the output of the quantile gauge
+void appendHistogram(std::string &out, std::string &quantiles, METRIC_HISTOGRAM *hist, const char *name, const char *label) {
+	static const double quantileList[] = { 0.5, 0.99, 0.999 };
+	LONGLONG counts[HIST_BUCKETS] = { 0 }, sum = 0, total = 0, cumulative = 0;
+	char metric[128], labels[128];
+	int bucket, bit, q;
+
+	for (int shard = 0; shard < METRIC_SHARDS; shard++) {
+		for (bucket = 0; bucket < HIST_BUCKETS; bucket++)
+			counts[bucket] += hist->shards[shard].counts[bucket];
+		sum += hist->shards[shard].sum;
+	}
+	for (bucket = 0; bucket < HIST_BUCKETS; bucket++)
+		total += counts[bucket];
+
+	snprintf(metric, sizeof(metric), "%s_bucket", name);
+	bucket = 0;
+	for (bit = HIST_FIRST_EXPORT_BIT; bit <= HIST_MAX_BITS; bit++) {
+		while (bucket < HIST_BUCKETS && histUpperBound(bucket) <= ((ULONGLONG)1 << bit))
+			cumulative += counts[bucket++];
+		snprintf(labels, sizeof(labels), "%s%sle=\"%.9g\"", label ? label : "", label ? "," : "",
+			(double)((ULONGLONG)1 << bit) / 1e6);
+		appendMetric(out, metric, labels, (double)cumulative);
+	}
+	snprintf(labels, sizeof(labels), "%s%sle=\"+Inf\"", label ? label : "", label ? "," : "");
+	appendMetric(out, metric, labels, (double)total);
+
+	snprintf(metric, sizeof(metric), "%s_sum", name);
+	appendMetric(out, metric, label, (double)sum / 1e6);
+	snprintf(metric, sizeof(metric), "%s_count", name);
+	appendMetric(out, metric, label, (double)total);
+
+	if (total == 0)
+		return;
+	snprintf(metric, sizeof(metric), "%s_quantile", name);
+	for (q = 0; q < sizeof(quantileList) / sizeof(quantileList[0]); q++) {
+		LONGLONG rank = (LONGLONG)(quantileList[q] * total + 0.5);
+		if (rank < 1)
+			rank = 1;
+		cumulative = 0;
+		for (bucket = 0; bucket < HIST_BUCKETS - 1; bucket++) {
+			cumulative += counts[bucket];
+			if (cumulative >= rank)
+				break;
+		}
+		snprintf(labels, sizeof(labels), "%s%squantile=\"%g\"", label ? label : "", label ? "," : "", quantileList[q]);
+		appendMetric(quantiles, metric, labels, (double)histUpperBound(bucket) / 1e6);
+	}
+}
+
+// Function: collectMetrics
+// Description: Render all metrics in the Prometheus text format
+// -OUT: out: the output
+void collectMetrics(std::string &out) {
+	std::string quantiles;
+	char label[64];
+	LONGLONG accepted = metricRead(&gMetricConnectionsAccepted), closed = metricRead(&gMetricConnectionsClosed);
+
+	appendHelp(out, "clouddrive_bytes_received_total", "counter", "Bytes received from clients.");
+	appendMetric(out, "clouddrive_bytes_received_total", NULL, (double)metricRead(&gMetricBytesReceived));
+	appendHelp(out, "clouddrive_bytes_sent_total", "counter", "Bytes sent to clients.");
+	appendMetric(out, "clouddrive_bytes_sent_total", NULL, (double)metricRead(&gMetricBytesSent));
+	appendHelp(out, "clouddrive_connections_accepted_total", "counter", "Connections accepted.");
+	appendMetric(out, "clouddrive_connections_accepted_total", NULL, (double)accepted);
+	appendHelp(out, "clouddrive_connections_open", "gauge", "Connections currently open.");
+	appendMetric(out, "clouddrive_connections_open", NULL, (double)(accepted - closed));
+	appendHelp(out, "clouddrive_unknown_requests_total", "counter", "Requests with an opcode that has no histogram.");
+	appendMetric(out, "clouddrive_unknown_requests_total", NULL, (double)metricRead(&gMetricUnknownOps));
+
+	CollectServerGauges(out);
+
+	appendHelp(out, "clouddrive_request_duration_seconds", "histogram",
+		"Time from the arrival of a request to its response being posted, by opcode.");
+	for (int i = 0; i < METRIC_OP_COUNT; i++) {
+		snprintf(label, sizeof(label), "op=\"%s\"", gMetricOps[i].name);
+		appendHistogram(out, quantiles, &gMetricRequestLatency[i], "clouddrive_request_duration_seconds", label);
+	}
+	appendHelp(out, "clouddrive_disk_read_duration_seconds", "histogram", "Time to read one block of a stored file.");
+	appendHistogram(out, quantiles, &gMetricDiskRead, "clouddrive_disk_read_duration_seconds", NULL);
+	appendHelp(out, "clouddrive_disk_write_duration_seconds", "histogram", "Time to write one block of an upload.");
+	appendHistogram(out, quantiles, &gMetricDiskWrite, "clouddrive_disk_write_duration_seconds", NULL);
+
+	out += "# HELP clouddrive_duration_quantile_seconds Latency quantiles of the histograms above.\n"
+		"# TYPE clouddrive_duration_quantile_seconds gauge\n";
+	out += quantiles;
+}
+
+// Function: metricsServerThread
+// Description: Answer scrapes on the admin socket, one connection at a
+//              time. A client that is slow to send its request or to read
+//              the answer is dropped after METRICS_TIMEOUT_MS so that it
+//              cannot hold the listener.
+// -IN: param: the listening socket
+unsigned __stdcall metricsServerThread(void *param) {
+	SOCKET listenSock = (SOCKET)param, client;
+	char request[METRICS_REQUEST_SIZE], header[256];
+	std::string body;
+	DWORD timeout = METRICS_TIMEOUT_MS;
+	ULONGLONG deadline;
+	int ret, received, sent;
+
+	while (TRUE) {
+		client = accept(listenSock, NULL, NULL);
+		if (client == INVALID_SOCKET) {
+			printf("Metrics accept failed with error %d\n", WSAGetLastError());
+			continue;
+		}
+
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
+		setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout, sizeof(timeout));
+
+		// Read the request line and headers
+		received = 0;
+		request[0] = 0;
+		deadline = GetTickCount64() + METRICS_TIMEOUT_MS;
+		ret = 0;
+		while (received < METRICS_REQUEST_SIZE - 1 && GetTickCount64() < deadline) {
+			ret = recv(client, request + received, METRICS_REQUEST_SIZE - 1 - received, 0);
+			if (ret <= 0)
+				break;
+			received += ret;
+			request[received] = 0;
+			if (strstr(request, "\r\n\r\n") != NULL)
+				break;
+		}
+
+		// Too slow, drop it without an answer
+		if (strstr(request, "\r\n\r\n") == NULL && (ret < 0 || GetTickCount64() >= deadline)) {
+			closesocket(client);
+			continue;
+		}
+
+		body.clear();
+		if (strncmp(request, "GET /metrics", 12) == 0) {
+			collectMetrics(body);
+			snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+				"Content-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\n\r\n", (int)body.size());
+		}
+		else
+			snprintf(header, sizeof(header), "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+
+		send(client, header, (int)strlen(header), 0);
+		for (sent = 0; sent < (int)body.size(); sent += ret) {
+			ret = send(client, body.c_str() + sent, (int)body.size() - sent, 0);
+			if (ret <= 0)
+				break;
+		}
+		closesocket(client);
+	}
+	return 0;
+}
+
+// Function: startMetricsServer
+// Description: Listen for scrapes on the loopback interface
+// Return: 0 if succeed, else return 1
+// -IN: port: the admin port
+int startMetricsServer(const char *port) {
+	SOCKADDR_IN addr;
+	SOCKET listenSock;
+
+	listenSock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (listenSock == INVALID_SOCKET) {
+		printf("Metrics socket failed with error %d\n", WSAGetLastError());
+		return 1;
+	}
+
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((u_short)atoi(port));
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+	if (bind(listenSock, (SOCKADDR *)&addr, sizeof(addr)) == SOCKET_ERROR || listen(listenSock, SOMAXCONN) == SOCKET_ERROR) {
+		printf("Metrics port %s unavailable: %d\n", port, WSAGetLastError());
+		closesocket(listenSock);
+		return 1;
+	}
+
+	if (_beginthreadex(0, 0, metricsServerThread, (void *)listenSock, 0, 0) == 0) {
+		printf("Create metrics thread failed with error %d\n", GetLastError());
+		closesocket(listenSock);
+		return 1;
+	}
+	printf("Metrics on http://127.0.0.1:%s/metrics\n", port);
+	return 0;
+}
+
+// Function: initializeMetrics
+// Description: Calibrate the clock used for latencies
+void initializeMetrics() {
+	LARGE_INTEGER frequency;
+
+	QueryPerformanceFrequency(&frequency);
+	gMetricTicksPerUs = frequency.QuadPart / 1000000;
+	if (gMetricTicksPerUs == 0)
+		gMetricTicksPerUs = 1;
+}
+
+#endif
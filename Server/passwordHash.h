@@ -0,0 +1,290 @@
+#pragma once
+
+#ifndef _PASSWORD_HASH_H
+#define _PASSWORD_HASH_H
+
+#include <windows.h>
+#include <bcrypt.h>
+#include "dataStructures.h"
+
+#pragma comment(lib, "Bcrypt.lib")
+
+// Passwords are stored as scrypt hashes:
+//     $scrypt$ln=14,r=8,p=1$<salt in hex>$<key in hex>
+// PBKDF2-HMAC-SHA256 comes from CNG, the memory-hard mix is done here.
+// A hash takes 128 * r * 2^ln bytes of scratch (16 MB with the defaults),
+// kept per thread so a verification never allocates. Passwords stored
+// before hashing, or with other parameters, still verify and are rehashed
+// with the current parameters on the next login.
+#define SCRYPT_PREFIX			"$scrypt$"
+#define SCRYPT_LOG_N			14
+#define SCRYPT_R				8
+#define SCRYPT_P				1
+#define SCRYPT_SALT_LEN			16
+#define SCRYPT_KEY_LEN			32
+#define SCRYPT_MAX_SCRATCH		((SIZE_T)64 << 20)	// largest stored parameters accepted
+
+#define SALSA_ROTL(a, b)		(((a) << (b)) | ((a) >> (32 - (b))))
+
+BCRYPT_ALG_HANDLE gHmacSha256 = NULL;
+__declspec(thread) UINT32 *tlsScryptScratch = NULL;
+__declspec(thread) SIZE_T tlsScryptScratchSize = 0;
+
+// Function: initializePasswordHash
+// Description: Open the HMAC-SHA256 provider PBKDF2 runs on
+// Return: 0 if succeed, else return 1
+int initializePasswordHash() {
+	NTSTATUS status = BCryptOpenAlgorithmProvider(&gHmacSha256, BCRYPT_SHA256_ALGORITHM, NULL, BCRYPT_ALG_HANDLE_HMAC_FLAG);
+
+	if (!BCRYPT_SUCCESS(status)) {
+		fprintf(stderr, "BCryptOpenAlgorithmProvider failed: 0x%x\n", status);
+		return 1;
+	}
+	return 0;
+}
+
+// Function: passwordHashRelease
+// Description: Free the scratch of the calling thread, for threads that
+//              end after verifying passwords
+void passwordHashRelease() {
+	if (tlsScryptScratch != NULL)
+		VirtualFree(tlsScryptScratch, 0, MEM_RELEASE);
+	tlsScryptScratch = NULL;
+	tlsScryptScratchSize = 0;
+}
+
+// Function: salsa208
+// Description: Apply the Salsa20/8 core to a 64 byte block in place
+// -IN/OUT: b: the block
+void salsa208(UINT32 *b) {
+	UINT32 x[16];
+	int i;
+
+	memcpy(x, b, sizeof(x));
+	for (i = 0; i < 8; i += 2) {
+		x[4] ^= SALSA_ROTL(x[0] + x[12], 7);	x[8] ^= SALSA_ROTL(x[4] + x[0], 9);
+		x[12] ^= SALSA_ROTL(x[8] + x[4], 13);	x[0] ^= SALSA_ROTL(x[12] + x[8], 18);
+		x[9] ^= SALSA_ROTL(x[5] + x[1], 7);		x[13] ^= SALSA_ROTL(x[9] + x[5], 9);
+		x[1] ^= SALSA_ROTL(x[13] + x[9], 13);	x[5] ^= SALSA_ROTL(x[1] + x[13], 18);
+		x[14] ^= SALSA_ROTL(x[10] + x[6], 7);	x[2] ^= SALSA_ROTL(x[14] + x[10], 9);
+		x[6] ^= SALSA_ROTL(x[2] + x[14], 13);	x[10] ^= SALSA_ROTL(x[6] + x[2], 18);
+		x[3] ^= SALSA_ROTL(x[15] + x[11], 7);	x[7] ^= SALSA_ROTL(x[3] + x[15], 9);
+		x[11] ^= SALSA_ROTL(x[7] + x[3], 13);	x[15] ^= SALSA_ROTL(x[11] + x[7], 18);
+
+		x[1] ^= SALSA_ROTL(x[0] + x[3], 7);		x[2] ^= SALSA_ROTL(x[1] + x[0], 9);
+		x[3] ^= SALSA_ROTL(x[2] + x[1], 13);	x[0] ^= SALSA_ROTL(x[3] + x[2], 18);
+		x[6] ^= SALSA_ROTL(x[5] + x[4], 7);		x[7] ^= SALSA_ROTL(x[6] + x[5], 9);
+		x[4] ^= SALSA_ROTL(x[7] + x[6], 13);	x[5] ^= SALSA_ROTL(x[4] + x[7], 18);
+		x[11] ^= SALSA_ROTL(x[10] + x[9], 7);	x[8] ^= SALSA_ROTL(x[11] + x[10], 9);
+		x[9] ^= SALSA_ROTL(x[8] + x[11], 13);	x[10] ^= SALSA_ROTL(x[9] + x[8], 18);
+		x[12] ^= SALSA_ROTL(x[15] + x[14], 7);	x[13] ^= SALSA_ROTL(x[12] + x[15], 9);
+		x[14] ^= SALSA_ROTL(x[13] + x[12], 13);	x[15] ^= SALSA_ROTL(x[14] + x[13], 18);
+	}
+	for (i = 0; i < 16; i++)
+		b[i] += x[i];
+}
+
+// Function: scryptBlockMix
+// Description: Mix the 2 * r blocks of 64 bytes of b through Salsa20/8,
+//              even outputs first, then odd ones
+// -IN: b: the blocks
+//      r: the block size parameter
+// -OUT: y: the mixed blocks
+void scryptBlockMix(const UINT32 *b, UINT32 *y, int r) {
+	UINT32 x[16];
+	int i, k;
+
+	memcpy(x, b + (2 * r - 1) * 16, sizeof(x));
+	for (i = 0; i < 2 * r; i++) {
+		for (k = 0; k < 16; k++)
+			x[k] ^= b[i * 16 + k];
+		salsa208(x);
+		memcpy(y + ((i & 1) * r + i / 2) * 16, x, sizeof(x));
+	}
+}
+
+// Function: scryptRoMix
+// Description: The memory-hard step: fill the scratch with n successive
+//              mixes of b, then mix b with entries picked by its own value
+// -IN/OUT: b: 128 * r bytes
+// -IN: n: number of entries, a power of two
+//      r: the block size parameter
+//      v: scratch of n * 128 * r bytes followed by 256 * r more
+void scryptRoMix(UINT32 *b, ULONG n, int r, UINT32 *v) {
+	SIZE_T words = 32 * r, i, k;
+	UINT32 *x = v + n * words, *y = x + words;
+	ULONG j;
+
+	memcpy(x, b, words * 4);
+	for (i = 0; i < n; i++) {
+		memcpy(v + i * words, x, words * 4);
+		scryptBlockMix(x, y, r);
+		memcpy(x, y, words * 4);
+	}
+	for (i = 0; i < n; i++) {
+		j = x[(2 * r - 1) * 16] & (n - 1);
+		for (k = 0; k < words; k++)
+			x[k] ^= v[j * words + k];
+		scryptBlockMix(x, y, r);
+		memcpy(x, y, words * 4);
+	}
+	memcpy(b, x, words * 4);
+}
+
+// Function: scryptDerive
+// Description: Derive a key from a password with scrypt
+// Return: 0 if succeed, else return 1
+// -IN: password, passwordLen: the password
+//      salt, saltLen: the salt
+//      logN: log2 of the cost parameter
+//      r, p: the block size and parallelism parameters
+//      keyLen: bytes of key wanted
+// -OUT: key: the derived key
+int scryptDerive(const char *password, ULONG passwordLen, const BYTE *salt, ULONG saltLen,
+	int logN, int r, int p, BYTE *key, ULONG keyLen) {
+	ULONG n = 1UL << logN, blockLen = 128 * r;
+	SIZE_T scratch = (SIZE_T)blockLen * (n + 2);
+	BYTE *b;
+	int i;
+
+	if (logN < 1 || logN > 24 || r < 1 || p < 1 || (ULONGLONG)r * p >= (1 << 20) || scratch > SCRYPT_MAX_SCRATCH)
+		return 1;
+
+	if (scratch > tlsScryptScratchSize) {
+		if (tlsScryptScratch != NULL)
+			VirtualFree(tlsScryptScratch, 0, MEM_RELEASE);
+		tlsScryptScratch = (UINT32 *)VirtualAlloc(NULL, scratch, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		tlsScryptScratchSize = tlsScryptScratch != NULL ? scratch : 0;
+		if (tlsScryptScratch == NULL)
+			return 1;
+	}
+
+	b = (BYTE *)malloc((SIZE_T)blockLen * p);
+	if (b == NULL)
+		return 1;
+
+	if (!BCRYPT_SUCCESS(BCryptDeriveKeyPBKDF2(gHmacSha256, (PUCHAR)password, passwordLen, (PUCHAR)salt, saltLen,
+		1, b, blockLen * p, 0))) {
+		free(b);
+		return 1;
+	}
+	for (i = 0; i < p; i++)
+		scryptRoMix((UINT32 *)(b + (SIZE_T)i * blockLen), n, r, tlsScryptScratch);
+	if (!BCRYPT_SUCCESS(BCryptDeriveKeyPBKDF2(gHmacSha256, (PUCHAR)password, passwordLen, b, blockLen * p,
+		1, key, keyLen, 0))) {
+		SecureZeroMemory(b, (SIZE_T)blockLen * p);
+		free(b);
+		return 1;
+	}
+	SecureZeroMemory(b, (SIZE_T)blockLen * p);
+	free(b);
+	return 0;
+}
+
+// Function: hexEncode
+// Description: Write bytes as lowercase hex
+// -IN: data, len: the bytes
+// -OUT: out: 2 * len characters and a terminator
+void hexEncode(const BYTE *data, int len, char *out) {
+	static const char digits[] = "0123456789abcdef";
+
+	for (int i = 0; i < len; i++) {
+		out[2 * i] = digits[data[i] >> 4];
+		out[2 * i + 1] = digits[data[i] & 15];
+	}
+	out[2 * len] = 0;
+}
+
+// Function: hexDecode
+// Description: Read hex up to a '$' or the end of the string
+// Return: number of bytes read, -1 if the hex is invalid or too long
+// -IN: in: the hex
+//      maxLen: room in data
+// -OUT: data: the bytes
+int hexDecode(const char *in, BYTE *data, int maxLen) {
+	int len = 0, hi, lo;
+
+	while (*in != 0 && *in != '$') {
+		if (len == maxLen || !isxdigit((unsigned char)in[0]) || !isxdigit((unsigned char)in[1]))
+			return -1;
+		hi = isdigit((unsigned char)in[0]) ? in[0] - '0' : tolower(in[0]) - 'a' + 10;
+		lo = isdigit((unsigned char)in[1]) ? in[1] - '0' : tolower(in[1]) - 'a' + 10;
+		data[len++] = (BYTE)(hi << 4 | lo);
+		in += 2;
+	}
+	return len;
+}
+
+// Function: passwordHash
+// Description: Hash a password with a new salt and the current parameters
+// Return: 0 if succeed, else return 1
+// -IN: password: the password
+// -OUT: out: the hash to store, CRE_MAXLEN characters
+int passwordHash(const char *password, char *out) {
+	BYTE salt[SCRYPT_SALT_LEN], key[SCRYPT_KEY_LEN];
+	char saltHex[SCRYPT_SALT_LEN * 2 + 1], keyHex[SCRYPT_KEY_LEN * 2 + 1];
+
+	if (!BCRYPT_SUCCESS(BCryptGenRandom(NULL, salt, sizeof(salt), BCRYPT_USE_SYSTEM_PREFERRED_RNG)))
+		return 1;
+	if (scryptDerive(password, (ULONG)strlen(password), salt, sizeof(salt), SCRYPT_LOG_N, SCRYPT_R, SCRYPT_P, key, sizeof(key)))
+		return 1;
+
+	hexEncode(salt, sizeof(salt), saltHex);
+	hexEncode(key, sizeof(key), keyHex);
+	snprintf(out, CRE_MAXLEN, SCRYPT_PREFIX "ln=%d,r=%d,p=%d$%s$%s", SCRYPT_LOG_N, SCRYPT_R, SCRYPT_P, saltHex, keyHex);
+	return 0;
+}
+
+// Function: passwordEqual
+// Description: Compare two byte strings in a time that does not depend on
+//              where they differ
+// Return: true if they are equal
+bool passwordEqual(const BYTE *a, int aLen, const BYTE *b, int bLen) {
+	BYTE diff = (BYTE)(aLen != bLen);
+	int len = aLen < bLen ? aLen : bLen;
+
+	for (int i = 0; i < len; i++)
+		diff |= a[i] ^ b[i];
+	return diff == 0;
+}
+
+// Function: passwordVerify
+// Description: Check a password against what is stored for an account
+// Return: true if the password matches
+// -IN: stored: the stored hash, or a password stored before hashing
+//      password: the password given
+// -OUT: rehash: set if the password matches but is not stored with the
+//               current parameters
+bool passwordVerify(const char *stored, const char *password, bool *rehash) {
+	BYTE salt[CRE_MAXLEN / 2], key[CRE_MAXLEN / 2], derived[CRE_MAXLEN / 2];
+	int logN, r, p, saltLen, keyLen, used = 0;
+	const char *field;
+
+	*rehash = false;
+	if (strncmp(stored, SCRYPT_PREFIX, sizeof(SCRYPT_PREFIX) - 1) != 0) {
+		if (!passwordEqual((const BYTE *)stored, (int)strlen(stored), (const BYTE *)password, (int)strlen(password)))
+			return false;
+		*rehash = true;
+		return true;
+	}
+
+	field = stored + sizeof(SCRYPT_PREFIX) - 1;
+	if (sscanf(field, "ln=%d,r=%d,p=%d$%n", &logN, &r, &p, &used) != 3 || used == 0)
+		return false;
+	field += used;
+	if ((saltLen = hexDecode(field, salt, sizeof(salt))) <= 0 || (field = strchr(field, '$')) == NULL)
+		return false;
+	if ((keyLen = hexDecode(field + 1, key, sizeof(key))) <= 0)
+		return false;
+
+	if (scryptDerive(password, (ULONG)strlen(password), salt, saltLen, logN, r, p, derived, keyLen))
+		return false;
+	if (!passwordEqual(key, keyLen, derived, keyLen))
+		return false;
+
+	*rehash = logN != SCRYPT_LOG_N || r != SCRYPT_R || p != SCRYPT_P ||
+		saltLen != SCRYPT_SALT_LEN || keyLen != SCRYPT_KEY_LEN;
+	return true;
+}
+
+#endif
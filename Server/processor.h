@@ -1,885 +1,1359 @@
-#pragma once
-
-#ifndef _PROCESSOR_H
-#define _PROCESSOR_H
-
-#include <list>
-#include <unordered_map>
-#include <winsock2.h>
-#include "dbUtils.h"
-
-std::list<Attempt> attemptList;
-std::list<Account> accountList;
-std::list<Group> groupList;
-
-std::unordered_map<SOCKET, Account*> socketAccountMap;
-
-CRITICAL_SECTION attemptCritSec;
-
-// Function: initializeData
-// Description: Call functions to open database, read accounts and groups
-//              information from database and initialize critical section
-// Return: 0 if succeed, else return 1
-int initializeData() {
-	if (openDb()) return 1;
-	if (readAccountDb(accountList)) return 1;
-	if (readGroupDb(groupList)) return 1;
-
-	InitializeCriticalSection(&attemptCritSec);
-	return 0;
-}
-
-// Function: isValidName
-// Description: Validate the provided string to see if it is a valid folder/file name
-// Return: 1 if the string is valid, else return 0
-// -IN:  s: a char array that needs checking
-bool isValidName(char* s) {
-	char prohibitedChars[] = { '<', '>', ':', '\"', '/', '\\', '|', '?', '*' };
-	bool allSpaces = true;
-	for (int i = 0; s[i] != 0; i++) {
-		for (char c : prohibitedChars) {
-			if (s[i] == c) return false;
-		}
-		if (s[i] != ' ') allSpaces = false;
-	}
-	if (allSpaces) return false;
-	return true;
-}
-
-// Function: packMessage
-// Description: Pack the message based on provided parameters
-// -IN:  message: the message to be packed
-//       opcode: int opcode value
-//       length: int length value
-//       offset: int offset value
-//       burst: int burst value
-//       payload: char array
-void packMessage(LPMESSAGE message, int opcode, int length, int offset, int burst, char* payload) {
-	message->opcode = opcode;
-	message->length = length;
-	message->offset = offset;
-	message->burst = burst;
-	strcpy(message->payload, payload);
-}
-
-/*
-Generate a new unique cookie.
-[OUT] cookie:		a char array to store newly created cookie
-*/
-void generateCookies(char* cookie) {
-	static char* characters = "1234567890ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefjhijklmnopqrstuvwxyz";
-	srand((unsigned int)time(NULL));
-
-	bool duplicate = false;
-	// Generate new cookie until it's unique
-	do {
-		// Randomly choose a character
-		for (int i = 0; i < COOKIE_LEN - 1; i++) {
-			cookie[i] = characters[rand() % 62];
-		}
-		cookie[COOKIE_LEN - 1] = 0;
-
-		// Check if duplicate
-		for (auto it = accountList.begin(); it != accountList.end(); it++) {
-			if (strcmp(it->cookie, cookie) == 0) {
-				duplicate = true;
-				break;
-			}
-		}
-	} while (duplicate);
-}
-
-/*
-Process login and produce response
-[IN/OUT] bufferObj:		buffer object to read from and write to
-*/
-int processOpLogIn(BUFFER_OBJ* bufferObj) {
-	LPMESSAGE message = &(bufferObj->sock->mess);
-	Account* account = NULL;
-	time_t now = time(0);
-
-	// Parse username and password
-	char* username = NULL;
-	char* password = NULL;
-
-	username = message->payload;
-	for (unsigned int i = 0; i < message->length; i++) {
-		if (message->payload[i] == ' ') {
-			message->payload[i] = 0;
-			password = message->payload + i + 1;
-		}
-	}
-
-	if (password == NULL) {
-		packMessage(message, OPS_ERR_BADREQUEST, 0, 0, 0, "");
-		return 1;
-	}
-
-	// Find account in account list
-	for (auto it = accountList.begin(); it != accountList.end(); it++) {
-		if (strcmp(it->username, message->payload) == 0) {
-			account = &(*it);
-			break;
-		}
-	}
-
-	// If cannot find account, inform not found error
-	if (account == NULL) {
-		packMessage(message, OPS_ERR_NOTFOUND, 0, 0, 0, "");
-		return 1;
-	}
-
-	WaitForSingleObject(account->mutex, INFINITE);
-
-	// Check if account is currently active on another device
-	for (auto accountIt = socketAccountMap.begin(); accountIt != socketAccountMap.end(); accountIt++) {
-		if (accountIt->second->uid == account->uid) {
-			packMessage(message, OPS_ERR_ANOTHERCLIENT, 0, 0, 0, "");
-			ReleaseMutex(account->mutex);
-			return 1;
-		}
-	}
-
-	// Check if account is locked
-	if (account->isLocked) {
-		packMessage(message, OPS_ERR_LOCKED, 0, 0, 0, "");
-		ReleaseMutex(account->mutex);
-		return 1;
-	}
-
-	// Check if has attempt before
-	Attempt* attempt = NULL;
-	auto it = attemptList.begin();
-	for ( ; it != attemptList.end(); it++) {
-		if (it->account == account) {
-			attempt = &((Attempt)*it);
-			break;
-		}
-	}
-
-	// Check password
-	if (strcmp(account->password, password) != 0) {
-		printf("Wrong password!\n");
-
-		EnterCriticalSection(&attemptCritSec);
-		
-		if (attempt != NULL) {
-			// If last attempt is more than 1 hour before then reset number of attempts
-			if (now - attempt->lastAtempt > TIME_1_HOUR)
-				attempt->numOfAttempts = 1;
-			else
-				attempt->numOfAttempts++;
-			attempt->lastAtempt = now;
-
-			// If number of attempts exceeds limit then block account and update database 
-			if (attempt->numOfAttempts > ATTEMPT_LIMIT) {
-				account->isLocked = true;
-				lockAccountDb(account);
-				printf("Account locked. Database updated.\n");
-
-				packMessage(message, OPS_ERR_LOCKED, 0, 0, 0, "");
-				LeaveCriticalSection(&attemptCritSec);
-				ReleaseMutex(account->mutex);
-				return 1;
-			}
-		}
-		// if there is no previous attempt, add attempt
-		else {
-			Attempt newAttempt;
-			newAttempt.lastAtempt = now;
-			newAttempt.numOfAttempts = 1;
-			newAttempt.account = account;
-			attemptList.push_back(newAttempt);
-		}
-		packMessage(message, OPS_ERR_WRONGPASS, 0, 0, 0, "");
-		LeaveCriticalSection(&attemptCritSec);
-		ReleaseMutex(account->mutex);
-		return 1;
-	}
-
-	// Passed all checks. Update active time and session account info
-	account->lastActive = now;
-	socketAccountMap[bufferObj->sock->s] = account;
-
-	if (attempt != NULL)
-		attemptList.erase(it);
-
-	printf("Login successful.\n");
-	packMessage(message, OPS_OK, 0, 0, 0, "");
-
-	LeaveCriticalSection(&attemptCritSec);
-	ReleaseMutex(account->mutex);
-
-	return 1;
-}
-
-/*
-Process log out and construct response
-[OUT] buff:		a char array to store the constructed response message
-[IN] cookie:		a char array containing the SID to be processed
-*/
-int processOpLogOut(BUFFER_OBJ* bufferObj) {
-	LPMESSAGE message = &(bufferObj->sock->mess);
-	Account* account = NULL;
-	time_t now = time(0);
-
-	// Find account. If cannot find account, deny log out
-	auto accountSearch = socketAccountMap.find(bufferObj->sock->s);
-	if (accountSearch == socketAccountMap.end()) {
-		packMessage(message, OPS_ERR_NOTLOGGEDIN, 0, 0, 0, "");
-		return 1;
-	}
-
-	account = accountSearch->second;
-
-	// All checks out! Allow log out
-	printf("Log out OK.\n");
-	account->lastActive = now;
-	account->workingGroup = NULL;
-	account->cookie[0] = 0;
-	socketAccountMap.erase(accountSearch);
-
-	packMessage(message, OPS_OK, 0, 0, 0, "");
-	printf("Log out successful.\n");
-	return 1;
-}
-
-/*
-Process reauthentication request and construct response
-[IN] sock:		the socket that's sending the request
-[OUT] buff:		a char array to store the constructed response message
-[IN] cookie:		a char array containing the SID to be processed
-*/
-int processOpReauth(BUFFER_OBJ* bufferObj) {
-	LPMESSAGE message = &(bufferObj->sock->mess);
-	time_t now = time(0);
-	Account* account = NULL;
-
-	// Check if cookie's length is correct
-	if (message->length != COOKIE_LEN) {
-		packMessage(message, OPS_ERR_BADREQUEST, 0, 0, 0, "");
-		return 1;
-	}
-
-	// Find account with cookie
-	for (auto it = accountList.begin(); it != accountList.end(); it++)
-		if (strcmp(message->payload, it->cookie) == 0) {
-			account = (Account*)&(*it);
-			break;
-		}
-
-	// If account does not exists
-	if (account == NULL) {
-		printf("Cookie not found.\n");
-		packMessage(message, OPS_ERR_NOTFOUND, 0, 0, 0, "");
-		return 1;
-	}
-
-	// Check if lastActive is more than 1 day ago
-	if (now - account->lastActive > TIME_1_DAY) {
-		printf("Login session timeout. Deny reauth.\n");
-		packMessage(message, OPS_ERR_NOTLOGGEDIN, 0, 0, 0, "");
-		return 1;
-	}
-
-	// Check if account is disabled
-	if (account->isLocked) {
-		printf("Account is locked. Reauth failed.\n");
-		account->cookie[0] = 0;
-		packMessage(message, OPS_ERR_LOCKED, 0, 0, 0, "");
-		return 1;
-	}
-
-	// Check if account is logged in on another device
-	for (auto accountIt = socketAccountMap.begin(); accountIt != socketAccountMap.end(); accountIt++) {
-		if (accountIt->second->uid == account->uid) {
-			packMessage(message, OPS_ERR_ANOTHERCLIENT, 0, 0, 0, "");
-			ReleaseMutex(account->mutex);
-			return 1;
-		}
-	}
-
-	// All checks out!
-	printf("Allow reauth.\n");
-	socketAccountMap[bufferObj->sock->s] = account;
-	account->lastActive = time(0);
-	packMessage(message, OPS_OK, 0, 0, 0, "");
-	return 1;
-}
-
-/*
-Process cookie request and construct response
-[IN] sock:		the socket that's sending the request
-[OUT] buff:		a char array to store the constructed response message
-[OUT] responseLen: a short to store the length of the response payload
-*/
-int processOpRequestCookie(BUFFER_OBJ* bufferObj) {
-	LPMESSAGE message = &(bufferObj->sock->mess);
-
-	// Find account
-	auto accountSearch = socketAccountMap.find(bufferObj->sock->s);
-	if (accountSearch == socketAccountMap.end()) {
-		packMessage(message, OPS_ERR_FORBIDDEN, 0, 0, 0, "");
-		return 1;
-	}
-
-	Account* account = accountSearch->second;
-	char cookie[COOKIE_LEN];
-	generateCookies(cookie);
-
-	// Create cookie and add to account
-	account->lastActive = time(0);
-	strcpy_s(account->cookie, COOKIE_LEN, cookie);
-
-	// Construct response
-	packMessage(message, OPS_OK, 0, 0, 0, cookie);
-	printf("Generated new Cookie for socket %d: %s.\n", bufferObj->sock->s, cookie);
-	return 1;
-}
-
-/*
-Remove socket information from any Session previously associated with it
-[IN] sock:	the socket which has been disconnected
-*/
-void disconnect(SOCKET sock) {
-	socketAccountMap.erase(sock);
-}
-
-int processOpGroup(BUFFER_OBJ* bufferObj) {
-
-	LPMESSAGE message = &(bufferObj->sock->mess);
-	Group* group = NULL;
-	int ret;
-
-	// Check if this socket is associated with an account
-	auto accountSearch = socketAccountMap.find(bufferObj->sock->s);
-	if (accountSearch == socketAccountMap.end()) {
-		packMessage(message, OPS_ERR_FORBIDDEN, 0, 0, 0, "");
-		return 1;
-	}
-	Account* account = accountSearch->second;
-	std::list<Group> tempGroupList;
-	auto it = tempGroupList.begin();
-
-	switch (message->opcode) {
-	case OPG_GROUP_LIST:
-
-		if (queryGroupForAccount(account, tempGroupList)) {
-			packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
-			return 1;
-		}
-
-		char count[10];
-		MESSAGE newMessage;
-		LPMESSAGE_LIST listPtr;
-
-		// Send group count
-		_itoa(tempGroupList.size(), count, 10);
-		packMessage(message, OPG_GROUP_COUNT, 0, 0, 0, count);
-
-		// Add directory count to wait queue
-		if (!tempGroupList.empty()) {
-			packMessage(&newMessage, OPG_GROUP_NAME, strlen(tempGroupList.front().groupName), 0, 0, tempGroupList.front().groupName);
-			account->queuedMess = (LPMESSAGE_LIST)malloc(sizeof(MESSAGE_LIST));
-			listPtr = account->queuedMess;
-			listPtr->mess = newMessage;
-
-			it = tempGroupList.begin();
-			it++;
-			// Add file name to wait queue
-			for ( ; it != tempGroupList.end(); it++) {
-				packMessage(&newMessage, OPG_GROUP_NAME, strlen((*it).groupName), 0, 0, (*it).groupName);
-				listPtr->next = (LPMESSAGE_LIST)malloc(sizeof(MESSAGE_LIST));
-				listPtr = listPtr->next;
-				listPtr->mess = newMessage;
-			}
-		}
-		return 1;
-
-	case OPG_GROUP_USE:
-		// Check if account has access to requested group
-		ret = accountHasAccessToGroupDb(account, message->payload);
-		if (ret == -1) {
-			packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
-			return 1;
-		}
-		
-		if (ret == 1) {
-			// Find group in group list and attach to account
-			for (auto it = groupList.begin(); it != groupList.end(); ++it) {
-				if (strcmp(it->groupName, message->payload) == 0) {
-					account->workingGroup = &(*it);
-					account->workingDir[0] = 0;
-					break;
-				}
-			}
-			if (account->workingGroup == NULL) {
-				packMessage(message, OPS_ERR_NOTFOUND, 0, 0, 0, "");
-				return 1;
-			}
-			packMessage(message, OPS_OK, 0, 0, 0, "");
-			return 1;
-		}
-
-		// Account doesn't have access to requested group
-		packMessage(message, OPS_ERR_FORBIDDEN, 0, 0, 0, "");
-		return 1;
-
-	case OPG_GROUP_JOIN:
-		// Check if the account already has access to this group
-		ret = accountHasAccessToGroupDb(account, message->payload);
-		if (ret == -1) {
-			packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
-			return 1;
-		}
-		
-		if (ret == 1) {
-			packMessage(message, OPS_ERR_ALREADYINGROUP, 0, 0, 0, "");
-			return 1;
-		}
-
-		// If not, check if the group exists
-		for (auto it = groupList.begin(); it != groupList.end(); ++it) {
-			if (strcmp(it->groupName, message->payload) == 0) {
-				group = &(*it);
-				break;
-			}
-		}
-
-		if (group == NULL) {
-			packMessage(message, OPS_ERR_NOTFOUND, 0, 0, 0, "");
-			return 1;
-		}
-
-		// Add to database
-		if (addUserToGroupDb(account, group)) {
-			packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
-			return 1;
-		}
-
-		packMessage(message, OPS_OK, 0, 0, 0, "");
-		return 1;
-
-	case OPG_GROUP_LEAVE:
-		// Check if the account has access to this group
-		ret = accountHasAccessToGroupDb(account, message->payload);
-		if (ret == -1) {
-			packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
-			return 1;
-		}
-		
-		if (ret == 0) {
-			packMessage(message, OPS_ERR_FORBIDDEN, 0, 0, 0, "");
-			return 1;
-		}
-
-		// Find the group in 
-		for (auto it = groupList.begin(); it != groupList.end(); ++it) {
-			if (strcmp(it->groupName, message->payload) == 0) {
-				group = &(*it);
-				break;
-			}
-		}
-
-		if (group == NULL) {
-			packMessage(message, OPS_ERR_NOTFOUND, 0, 0, 0, "");
-			return 1;
-		}
-
-		// Delete permission from database
-		if (deleteUserFromGroupDb(account, group)) {
-			packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
-			return 1;
-		}
-
-		packMessage(message, OPS_OK, 0, 0, 0, "");
-		return 1;
-
-	case OPG_GROUP_NEW:
-
-		// Verify group name:
-
-		if (!isValidName(message->payload)) {
-			packMessage(message, OPS_ERR_BADREQUEST, 0, 0, 0, "");
-			return 1;
-		}
-
-		// Check if a group with the same name already exists
-		for (auto it = groupList.begin(); it != groupList.end(); ++it) {
-			if (strcmp(it->groupName, message->payload) == 0) {
-				group = &(*it);
-				break;
-			}
-		}
-
-		if (group != NULL) {
-			packMessage(message, OPS_ERR_GROUPEXISTS, 0, 0, 0, "");
-			return 1;
-		}
-
-		// Initialize new group
-		Group newGroup;
-		newGroup.ownerId = account->uid;
-		strcpy_s(newGroup.groupName, GROUPNAME_SIZE, message->payload);
-
-		char path[MAX_PATH];
-		strcpy_s(newGroup.pathName, MAX_PATH, newGroup.groupName);
-
-		while (1) {
-			snprintf(path, MAX_PATH, "%s/%s", STORAGE_LOCATION, newGroup.pathName);
-			if (CreateDirectoryA(path, NULL) == 0) {
-				if (GetLastError() == ERROR_ALREADY_EXISTS) {
-					printf("Cannot create directory with path %s as it already exists", path);
-					strcat_s(newGroup.pathName, GROUPNAME_SIZE, "_");
-					continue;
-				}
-				else {
-					packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
-					return 1;
-				}
-			}
-			break;
-		}
-
-		// Add group to database
-		if (addGroupDb(&newGroup)) {
-			if (RemoveDirectoryA(path) == 0) {
-				printf("Cannot remove directory at path %s. Error code %d!", path, GetLastError());
-			}
-			packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
-			return 1;
-		}
-
-		// Add user to group
-		if (addUserToGroupDb(account, &newGroup)) {
-			if (RemoveDirectoryA(path) == 0) {
-				printf("Cannot remove directory with path %s. Error code %d!", path, GetLastError());
-			}
-			packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
-			return 1;
-		}
-
-		groupList.push_back(newGroup);
-		packMessage(message, OPS_OK, 0, 0, 0, "");
-		return 1;
-	}
-	return 0;
-}
-
-int processOpContinue(BUFFER_OBJ* bufferObj) {
-
-	// Find account
-	auto accountSearch = socketAccountMap.find(bufferObj->sock->s);
-	if (accountSearch == socketAccountMap.end()) {
-		packMessage(&(bufferObj->sock->mess), OPS_ERR_FORBIDDEN, 0, 0, 0, "");
-		return 1;
-	}
-
-	Account* account = accountSearch->second;
-
-	// Dequeue message and send 
-	if (account->queuedMess != NULL) {
-		bufferObj->sock->mess = account->queuedMess->mess;
-		LPMESSAGE_LIST ptr = account->queuedMess->next;
-		free(account->queuedMess);
-		account->queuedMess = ptr;
-		return 1;
-	}
-	else {
-		packMessage(&(bufferObj->sock->mess), OPS_ERR_BADREQUEST, 0, 0, 0, "");
-		return 1;
-	}
-	return 0;
-}
-
-int processOpBrowsing(BUFFER_OBJ* bufferObj) {
-
-	LPMESSAGE message = &(bufferObj->sock->mess);
-
-	// Find account
-	auto accountSearch = socketAccountMap.find(bufferObj->sock->s);
-	if (accountSearch == socketAccountMap.end()) {
-		packMessage(message, OPS_ERR_FORBIDDEN, 0, 0, 0, "");
-		return 1;
-	}
-
-	Account* account = accountSearch->second;
-
-	// If account is not using any group, forbid browsing
-	if (account->workingGroup == NULL) {
-		packMessage(message, OPS_ERR_FORBIDDEN, 0, 0, 0, "");
-		return 1;
-	}
-
-	WIN32_FIND_DATAA FindFileData;
-	HANDLE hFind;
-	std::list<MESSAGE> fileList;
-	std::list<MESSAGE> folderList;
-	char fullPath[MAX_PATH];
-	char path[MAX_PATH];
-
-	switch (message->opcode) {
-	case OPB_LIST:
-		MESSAGE newMessage;
-
-		// Construct path
-		snprintf(path, MAX_PATH, "%s/%s", STORAGE_LOCATION, account->workingGroup->pathName);
-		if (strlen(account->workingDir) > 0) {
-			snprintf(path, MAX_PATH, "%s/%s", path, account->workingDir);
-		}
-		strcat_s(path, MAX_PATH, "/*");
-
-		// Find files
-		hFind = FindFirstFileA(path, &FindFileData);
-		if (hFind == INVALID_HANDLE_VALUE) {
-			if (GetLastError() != ERROR_NO_MORE_FILES) {
-				printf("FindFirstFile failed (%d)\n", GetLastError());
-				packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
-				return 1;
-			}
-		}
-		else {
-			while (1) {
-				if (FindFileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-					packMessage(&newMessage, OPB_DIR_NAME, strlen(FindFileData.cFileName), 0, 0, FindFileData.cFileName);
-					folderList.push_back(newMessage);
-				}
-				else {
-					packMessage(&newMessage, OPB_FILE_NAME, strlen(FindFileData.cFileName), 0, 0, FindFileData.cFileName);
-					fileList.push_back(newMessage);
-				}
-
-				if (FindNextFileA(hFind, &FindFileData) == 0) {
-					if (GetLastError() == ERROR_NO_MORE_FILES) {
-						break;
-					}
-					else {
-						printf("FindNextFile failed (%d)\n", GetLastError());
-						packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
-						return 1;
-					}
-				}
-			}
-
-			FindClose(hFind);
-		}
-
-		// Construct messages and enqueue pending sends
-		char count[10];
-		LPMESSAGE_LIST listPtr;
-
-		// Send file count
-		_itoa(fileList.size(), count, 10);
-		packMessage(message, OPB_FILE_COUNT, 0, 0, 0, count);
-
-		// Add directory count to wait queue
-		_itoa(folderList.size(), count, 10);
-		packMessage(&newMessage, OPB_DIR_COUNT, 0, 0, 0, count);
-		account->queuedMess = (LPMESSAGE_LIST)malloc(sizeof(MESSAGE_LIST));
-		listPtr = account->queuedMess;
-		listPtr->mess = newMessage;
-
-		// Add file name to wait queue
-		for (auto it = fileList.begin(); it != fileList.end(); it++) {
-			listPtr->next = (LPMESSAGE_LIST)malloc(sizeof(MESSAGE_LIST));
-			listPtr = listPtr->next;
-			listPtr->mess = *it;
-		}
-
-		// Add directory name to wait queue
-		for (auto it = folderList.begin(); it != folderList.end(); it++) {
-			listPtr->next = (LPMESSAGE_LIST)malloc(sizeof(MESSAGE_LIST));
-			listPtr = listPtr->next;
-			listPtr->mess = *it;
-		}
-
-		return 1;
-
-	case OPB_FILE_CD:
-
-		// Check if the requested path is valid
-		if (!isValidName(message->payload)) {
-			packMessage(message, OPS_ERR_BADREQUEST, 0, 0, 0, "");
-			return 1;
-		}
-
-		// Check if this is a special navigation
-		if (strcmp(message->payload, "..") == 0) {
-			if (strlen(account->workingDir) == 0) {
-				packMessage(message, OPS_ERR_FORBIDDEN, 0, 0, 0, "");
-				return 1;
-			}
-			else {
-				char* lastSlash = strrchr(account->workingDir, MAX_PATH);
-				if (lastSlash) {
-					*lastSlash = 0;
-				}
-				else {
-					account->workingDir[0] = 0;
-				}
-				packMessage(message, OPS_OK, 0, 0, 0, "");
-				return 1;
-			}
-		}
-
-		if (strcmp(message->payload, ".") == 0) {
-			packMessage(message, OPS_OK, 0, 0, 0, "");
-			return 1;
-		}
-
-		// Check if path exists
-		if (strlen(account->workingDir) == 0){
-			snprintf(path, MAX_PATH, "%s", message->payload);
-		}
-		else {
-			snprintf(path, MAX_PATH, "%s/%s", account->workingDir, message->payload);
-		}
-		snprintf(fullPath, MAX_PATH, "%s/%s/%s", STORAGE_LOCATION, account->workingGroup->pathName, path);
-
-		hFind = FindFirstFileA(fullPath, (LPWIN32_FIND_DATAA)&FindFileData);
-		if (hFind == INVALID_HANDLE_VALUE) {
-			if (GetLastError() == ERROR_NO_MORE_FILES) {
-				packMessage(message, OPS_ERR_NOTFOUND, 0, 0, 0, "");
-				return 1;
-			}
-			printf("FindFirstFile failed (%d)\n", GetLastError());
-			packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
-			return 1;
-		}
-		else {
-			strcpy(account->workingDir, path);
-			packMessage(message, OPS_OK, 0, 0, 0, "");
-			FindClose(hFind);
-			return 1;
-		}
-
-	case OPB_FILE_DEL:
-		// Check if account is the group owner
-		if (account->uid != account->workingGroup->ownerId) {
-			packMessage(message, OPS_ERR_FORBIDDEN, 0, 0, 0, "");
-			return 1;
-		}
-
-		// Delete file
-		if (strlen(account->workingDir) == 0) {
-			snprintf(path, MAX_PATH, "%s", message->payload);
-		}
-		else {
-			snprintf(path, MAX_PATH, "%s/%s", account->workingDir, message->payload);
-		}
-		snprintf(fullPath, MAX_PATH, "%s/%s/%s", STORAGE_LOCATION, account->workingGroup->pathName, path);
-
-		if (DeleteFileA(fullPath) == 0) {
-			if (GetLastError() == ERROR_FILE_NOT_FOUND) {
-				printf("Cannot remove file %s. File not found!", fullPath);
-				packMessage(message, OPS_ERR_NOTFOUND, 0, 0, 0, "");
-				return 1;
-			}
-			printf("Cannot remove file %s. Error code %d!", fullPath, GetLastError());
-			packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
-			return 1;
-		}
-		packMessage(message, OPS_OK, 0, 0, 0, "");
-		return 1;
-
-	case OPB_DIR_DEL:
-
-		// Check if account is group owner
-		if (account->uid != account->workingGroup->ownerId) {
-			packMessage(message, OPS_ERR_FORBIDDEN, 0, 0, 0, "");
-			return 1;
-		}
-
-		if (strlen(account->workingDir) == 0) {
-			snprintf(path, MAX_PATH, "%s", message->payload);
-		}
-		else {
-			snprintf(path, MAX_PATH, "%s/%s", account->workingDir, message->payload);
-		}
-		snprintf(fullPath, MAX_PATH, "%s/%s/%s", STORAGE_LOCATION, account->workingGroup->pathName, path);
-
-		// Delete directory
-		if (RemoveDirectoryA(fullPath) == 0) {
-			printf("Cannot remove directory with path %s. Error code %d!", fullPath, GetLastError());
-			packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
-			return 1;
-		}
-		packMessage(message, OPS_OK, 0, 0, 0, "");
-		return 1;
-
-	case OPB_DIR_NEW:
-		// Construct full path
-		if (strlen(account->workingDir) == 0) {
-			snprintf(path, MAX_PATH, "%s", message->payload);
-		}
-		else {
-			snprintf(path, MAX_PATH, "%s/%s", account->workingDir, message->payload);
-		}
-		snprintf(fullPath, MAX_PATH, "%s/%s/%s", STORAGE_LOCATION, account->workingGroup->pathName, path);
-
-		if (CreateDirectoryA(fullPath, NULL) == 0) {
-			if (GetLastError() == ERROR_ALREADY_EXISTS) {
-				printf("Cannot create directory with path %s as it already exists", fullPath);
-				packMessage(message, OPS_ERR_ALREADYEXISTS, 0, 0, 0, "");
-			}
-			else {
-				packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
-				return 1;
-			}
-		}
-
-		packMessage(message, OPS_OK, 0, 0, 0, "");
-		return 1;
-	}
-	return 0;
-}
-
-
-/*
-Extract information from request and call corresponding process function
-Function returns 1 if a response is ready to be sent, else returns 0
-[IN] sock:		the socket that's sending the request
-[IN/OUT] buff:	a char array which contains the request, and stores response
-after the request has been processed
-[OUT] len:		the length of the payload of the output
-*/
-int parseAndProcess(BUFFER_OBJ* bufferObj) {
-	LPMESSAGE message = &(bufferObj->sock->mess);
-
-	// Process request
-	switch (message->opcode) {
-		// Authentication operations
-	case OPA_REAUTH:
-		return processOpReauth(bufferObj);
-	case OPA_REQ_COOKIES:
-		return processOpRequestCookie(bufferObj);
-	case OPA_LOGIN:
-		return processOpLogIn(bufferObj);
-	case OPA_LOGOUT:
-		return processOpLogOut(bufferObj);
-
-	case OPG_GROUP_LIST:
-	case OPG_GROUP_USE:
-	case OPG_GROUP_JOIN:
-	case OPG_GROUP_LEAVE:
-	case OPG_GROUP_NEW:
-		return processOpGroup(bufferObj);
-
-	case OPB_LIST:
-	case OPB_FILE_CD:
-	case OPB_FILE_DEL:
-	case OPB_DIR_DEL:
-	case OPB_DIR_NEW:
-		return processOpBrowsing(bufferObj);
-
-	case OPS_CONTINUE:
-		return processOpContinue(bufferObj);
-
-	default:
-		printf("Bad request!\n");
-		packMessage(&(bufferObj->sock->mess), OPS_ERR_BADREQUEST, 0, 0, 0, "");
-		return 1;
-	}
-}
-
+#pragma once
+
+#ifndef _PROCESSOR_H
+#define _PROCESSOR_H
+
+#include <list>
+#include <unordered_map>
+#include <winsock2.h>
+#include "dbUtils.h"
+#include "dbWriter.h"
+#include "dirIndex.h"
+#include "timerWheel.h"
+#include "binaryLog.h"
+#include "authPool.h"
+#include "accountCache.h"
+#include "groupCatalog.h"
+#include "loginGuard.h"
+#include "changeFeed.h"
+#include "fileCopy.h"
+
+
+std::unordered_map<SOCKET, Account*> socketAccountMap;		// each entry holds a pin, under gSocketAccountLock
+SRWLOCK gSocketAccountLock = SRWLOCK_INIT;
+std::unordered_map<const char*, Account*, StringHash, StringEqual> cookieAccountMap;	// accounts by the cookie they hold, under gAccountCritSec
+
+bool sessionStoreOpen = false;		// sessions are stored once the expired ones are dropped
+
+void clearSession(Account* account);
+Account* findSession(const char* cookie);
+int openSessions();
+
+// Function: socketAccount
+// Description: Find the account logged in on a socket. Logins finish on
+//              the auth pool while completion threads look sockets up, so
+//              the map is only touched under gSocketAccountLock.
+// Return: the account, NULL if none
+// -IN:  s: the socket
+Account* socketAccount(SOCKET s) {
+	Account* account = NULL;
+
+	AcquireSRWLockShared(&gSocketAccountLock);
+	auto accountSearch = socketAccountMap.find(s);
+	if (accountSearch != socketAccountMap.end())
+		account = accountSearch->second;
+	ReleaseSRWLockShared(&gSocketAccountLock);
+	return account;
+}
+
+// Function: bindSocketAccount
+// Description: Log an account in on a socket. The entry takes over a pin
+//              of the account held by the caller.
+// -IN:  s: the socket
+//       account: the account
+void bindSocketAccount(SOCKET s, Account* account) {
+	AcquireSRWLockExclusive(&gSocketAccountLock);
+	socketAccountMap[s] = account;
+	ReleaseSRWLockExclusive(&gSocketAccountLock);
+}
+
+// Function: unbindSocketAccount
+// Description: Log out whatever account is logged in on a socket
+// Return: the account, whose pin now belongs to the caller, NULL if none
+// -IN:  s: the socket
+Account* unbindSocketAccount(SOCKET s) {
+	Account* account = NULL;
+
+	AcquireSRWLockExclusive(&gSocketAccountLock);
+	auto accountSearch = socketAccountMap.find(s);
+	if (accountSearch != socketAccountMap.end()) {
+		account = accountSearch->second;
+		socketAccountMap.erase(accountSearch);
+	}
+	ReleaseSRWLockExclusive(&gSocketAccountLock);
+	return account;
+}
+
+// Send the response held by a request whose processing was deferred.
+// Defined by the server.
+void CompleteDeferredResponse(BUFFER_OBJ* bufferObj);
+
+// Function: sessionTimeout
+// Description: Timer callback expiring the cookie of an account a day after
+//              it was last active. The timer is armed again if the account
+//              was active since it was set.
+// -IN: timer: the session timer of the account
+void sessionTimeout(TIMER* timer) {
+	Account* account = (Account*)timer->context;
+	time_t idle;
+
+	accountLock(account);
+	idle = time(0) - account->lastActive;
+	if (idle > TIME_1_DAY) {
+		clearSession(account);
+		LOG_INFO("Session of %s expired.\n", account->username);
+	}
+	else if (account->cookie[0] != 0)
+		timerArm(timer, (DWORD)(TIME_1_DAY - idle + 1) * 1000, sessionTimeout, account);
+	accountUnlock(account);
+}
+
+// Function: initializeData
+// Description: Call functions to open database, read groups information
+//              from database and initialize critical section. Accounts are
+//              read when they are first looked up.
+// Return: 0 if succeed, else return 1
+int initializeData() {
+	std::list<Group> groups;
+
+	initializeStringPool();
+	if (openDb()) return 1;
+	initializeAccountCache();
+	initializeGroupCatalog();
+	if (initializeChangeFeed()) return 1;
+	if (readGroupDb(groups)) return 1;
+	groupCatalogAdd(groups);
+	if (readMembershipDb()) return 1;
+	if (startTimerWheel()) return 1;
+	if (startDbWriter()) return 1;
+	if (startChangeFeed()) return 1;
+	if (startAuthPool()) return 1;
+	if (startCopyPool()) return 1;
+	if (startDirIndex()) printf("Directory index runs without change notifications.\n");
+
+	initializeLoginGuard();
+	if (openSessions()) return 1;
+	return 0;
+}
+
+// Function: isValidName
+// Description: Validate the provided string to see if it is a valid folder/file name
+// Return: 1 if the string is valid, else return 0
+// -IN:  s: a char array that needs checking
+bool isValidName(char* s) {
+	char prohibitedChars[] = { '<', '>', ':', '\"', '/', '\\', '|', '?', '*' };
+	bool allSpaces = true;
+	for (int i = 0; s[i] != 0; i++) {
+		for (char c : prohibitedChars) {
+			if (s[i] == c) return false;
+		}
+		if (s[i] != ' ') allSpaces = false;
+	}
+	if (allSpaces) return false;
+	return true;
+}
+
+// Function: isValidPath
+// Description: Validate a path relative to a directory: valid folder/file
+//              names separated by single slashes, none of them "." or ".."
+// Return: 1 if the path is valid, else return 0
+// -IN:  s: a char array that needs checking
+bool isValidPath(char* s) {
+	char name[MAX_PATH];
+	char* start = s;
+	char* slash;
+	size_t len;
+
+	while (true) {
+		slash = strchr(start, '/');
+		len = (slash != NULL) ? (size_t)(slash - start) : strlen(start);
+		if (len == 0 || len >= MAX_PATH)
+			return false;
+		memcpy(name, start, len);
+		name[len] = 0;
+		if (!isValidName(name) || strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+			return false;
+		if (slash == NULL)
+			return true;
+		start = slash + 1;
+	}
+}
+
+// Function: isGroupOwner
+// Description: Check if an account owns a group, which it needs to remove
+//              anything from the group
+// Return: 1 if the account owns the group, else return 0
+// -IN:  account: the account
+//       group: the group
+bool isGroupOwner(Account* account, Group* group) {
+	return account->uid == groupLatest(group)->ownerId;
+}
+
+// Function: findGroupByName
+// Description: Find a group in the group catalog by its name
+// Return: pointer to the group, NULL if not found
+// -IN:  groupName: name of the group
+Group* findGroupByName(const char* groupName) {
+	return groupCatalogFindByName(groupName);
+}
+
+// Function: findGroupById
+// Description: Find a group in the group catalog by its id
+// Return: pointer to the group, NULL if not found
+// -IN:  gid: id of the group
+Group* findGroupById(int gid) {
+	return groupCatalogFindById(gid);
+}
+
+// Function: packMessage
+// Description: Pack the message based on provided parameters
+// -IN:  message: the message to be packed
+//       opcode: int opcode value
+//       length: int length value
+//       offset: int offset value
+//       burst: int burst value
+//       payload: char array
+void packMessage(LPMESSAGE message, int opcode, int length, int offset, int burst, char* payload) {
+	message->opcode = opcode;
+	message->length = length;
+	message->offset = offset;
+	message->burst = burst;
+	strcpy(message->payload, payload);
+}
+
+/*
+Generate a new unique cookie.
+[OUT] cookie:		a char array to store newly created cookie
+*/
+void generateCookies(char* cookie) {
+	static char* characters = "1234567890ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefjhijklmnopqrstuvwxyz";
+	BYTE random[COOKIE_LEN - 1];
+
+	// Generate new cookie until it's unique. Cookies outlive restarts, so
+	// they come from the system generator rather than rand().
+	while (TRUE) {
+		if (!BCRYPT_SUCCESS(BCryptGenRandom(NULL, random, sizeof(random), BCRYPT_USE_SYSTEM_PREFERRED_RNG))) {
+			LOG_ERROR("Cannot generate a cookie!\n");
+			exit(1);
+		}
+		for (int i = 0; i < COOKIE_LEN - 1; i++)
+			cookie[i] = characters[random[i] % 62];
+		cookie[COOKIE_LEN - 1] = 0;
+
+		Account* duplicate = findSession(cookie);
+		if (duplicate == NULL)
+			break;
+		accountRelease(duplicate);
+	}
+}
+
+// Function: newDbWrite
+// Description: Create a metadata change for the writer thread
+// Return: the change to pass to submitDbWrite
+// -IN:  type: one of the DBW_ values
+//       account: account the change is about
+//       group: group the change is about, may be NULL
+//       bufferObj: request to answer once the change is stored
+DB_WRITE_REQUEST* newDbWrite(int type, Account* account, Group* group, BUFFER_OBJ* bufferObj) {
+	DB_WRITE_REQUEST* request = (DB_WRITE_REQUEST*)calloc(1, sizeof(DB_WRITE_REQUEST));
+	if (request == NULL) {
+		LOG_ERROR("Memory error!\n");
+		exit(1);
+	}
+	request->type = type;
+	request->account = account;
+	accountPin(account);
+	if (group != NULL)
+		request->group = *group;
+	request->bufferObj = bufferObj;
+	return request;
+}
+
+// Function: storeSession
+// Description: Queue the session of an account for the database, so that
+//              it survives a restart. Called with the account locked.
+// -IN:  account: the account
+void storeSession(Account* account) {
+	DB_WRITE_REQUEST* request;
+
+	if (!sessionStoreOpen || account->cookie[0] == 0)
+		return;
+	request = newDbWrite(DBW_SET_SESSION, account, NULL, NULL);
+	strcpy_s(request->cookie, COOKIE_LEN, account->cookie);
+	request->lastActive = account->lastActive;
+	submitDbWrite(request);
+}
+
+// Function: setSession
+// Description: Give an account a new cookie in place of its last one.
+//              Called with the account locked.
+// -IN:  account: the account
+//       cookie: the new cookie
+void setSession(Account* account, const char* cookie) {
+	EnterCriticalSection(&gAccountCritSec);
+	if (account->cookie[0] != 0)
+		cookieAccountMap.erase(account->cookie);
+	else
+		account->pins++;	// the cookie keeps the account, the caller already does
+	strcpy_s(account->cookie, COOKIE_LEN, cookie);
+	cookieAccountMap[account->cookie] = account;
+	LeaveCriticalSection(&gAccountCritSec);
+
+	storeSession(account);
+}
+
+// Function: restoreSession
+// Description: Index the cookie of an account read from the database and
+//              arm its session timer. Called by the account cache with
+//              gAccountCritSec held.
+// -IN:  account: the account
+void restoreSession(Account* account) {
+	time_t idle = time(0) - account->lastActive;
+
+	cookieAccountMap[account->cookie] = account;
+	timerArm(&account->sessionTimer, (DWORD)(TIME_1_DAY - (idle > 0 ? idle : 0) + 1) * 1000, sessionTimeout, account);
+}
+
+// Function: clearSession
+// Description: End the session of an account, if it has one. Called with
+//              the account locked. The pin of the cookie is dropped, so
+//              the caller holds one of its own or runs on the session
+//              timer, which the cache waits for.
+// -IN:  account: the account
+void clearSession(Account* account) {
+	if (account->cookie[0] == 0)
+		return;
+
+	EnterCriticalSection(&gAccountCritSec);
+	cookieAccountMap.erase(account->cookie);
+	account->cookie[0] = 0;
+	LeaveCriticalSection(&gAccountCritSec);
+
+	if (sessionStoreOpen)
+		submitDbWrite(newDbWrite(DBW_DELETE_SESSION, account, NULL, NULL));
+	accountRelease(account);
+}
+
+// Function: findSession
+// Description: Find the account a cookie was given to. A cookie stored
+//              before a restart reads its account from the database; the
+//              stored session only counts if the account has none newer.
+// Return: pointer to the account, pinned, NULL if not found
+// -IN:  cookie: the cookie
+Account* findSession(const char* cookie) {
+	Account* account = NULL;
+	int uid;
+
+	EnterCriticalSection(&gAccountCritSec);
+	auto it = cookieAccountMap.find(cookie);
+	if (it != cookieAccountMap.end()) {
+		account = it->second;
+		account->pins++;
+	}
+	LeaveCriticalSection(&gAccountCritSec);
+
+	if (account != NULL || !sessionStoreOpen || findSessionDb(cookie, &uid) != 0)
+		return account;
+
+	if ((account = accountAcquireById(uid)) != NULL && strcmp(account->cookie, cookie) != 0) {
+		accountRelease(account);
+		account = NULL;
+	}
+	return account;
+}
+
+// Function: openSessions
+// Description: Drop the sessions that expired while the server was down
+//              and start storing new ones. The others are read back with
+//              their accounts, when their cookie or account is first used.
+// Return: 0 if succeed, else return 1
+int openSessions() {
+	if (expireSessionsDb(time(0) - TIME_1_DAY))
+		return 1;
+	sessionStoreOpen = true;
+	return 0;
+}
+
+// Function: completeDbWrite
+// Description: Apply a stored metadata change to the in-memory state and
+//              answer the request that caused it. Runs on the writer thread.
+// -IN:  request: the change, with its result filled in
+void completeDbWrite(DB_WRITE_REQUEST* request) {
+	LPMESSAGE message;
+	Account* account = request->account;
+	char path[MAX_PATH];
+
+	// A rehashed password is only kept for the next login
+	if (request->type == DBW_SET_PASSWORD) {
+		char* password;
+		if (request->result == 0 && (password = copyString(request->password)) != NULL) {
+			accountLock(account);
+			std::swap(account->password, password);
+			accountUnlock(account);
+			SecureZeroMemory(password, strlen(password));
+			free(password);
+		}
+		else
+			LOG_WARN("Cannot store the password hash of an account.\n");
+		accountRelease(account);
+		return;
+	}
+
+	// A session that was not stored only costs its client a login after
+	// a restart
+	if (request->type == DBW_SET_SESSION || request->type == DBW_DELETE_SESSION) {
+		if (request->result != 0)
+			LOG_WARN("Cannot store the session of an account.\n");
+		accountRelease(account);
+		return;
+	}
+
+	message = &(request->bufferObj->sock->mess);
+	switch (request->type) {
+	case DBW_LOCK_ACCOUNT:
+		// The account is locked in memory either way
+		if (request->result == 0)
+			LOG_INFO("Account locked. Database updated.\n");
+		packMessage(message, OPS_ERR_LOCKED, 0, 0, 0, "");
+		break;
+
+	case DBW_ADD_MEMBER:
+		if (request->result == 0) {
+			membershipAdd(account->uid, request->group.gid);
+			packMessage(message, OPS_OK, 0, 0, 0, "");
+		}
+		else
+			packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
+		break;
+
+	case DBW_DELETE_MEMBER:
+		if (request->result == 0) {
+			membershipRemove(account->uid, request->group.gid);
+			packMessage(message, OPS_OK, 0, 0, 0, "");
+		}
+		else
+			packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
+		break;
+
+	case DBW_NEW_GROUP:
+		if (request->result == 0) {
+			// The change feed may have added it already
+			groupCatalogUpdate(&request->group);
+			membershipAddGroup(request->group.gid);
+			membershipAdd(account->uid, request->group.gid);
+			packMessage(message, OPS_OK, 0, 0, 0, "");
+		}
+		else {
+			snprintf(path, MAX_PATH, "%s/%s", STORAGE_LOCATION, request->group.pathName);
+			if (RemoveDirectoryA(path) == 0) {
+				LOG_WARN("Cannot remove directory with path %s. Error code %d!\n", path, GetLastError());
+			}
+			dirIndexRefresh(path);
+			// Another create of the same name got to the writer first
+			packMessage(message, request->result == DB_CONSTRAINT ? OPS_ERR_GROUPEXISTS : OPS_ERR_SERVERFAIL, 0, 0, 0, "");
+		}
+		break;
+	}
+
+	accountRelease(account);
+	CompleteDeferredResponse(request->bufferObj);
+}
+
+// Function: loginRefused
+// Description: Check whether an account may log in whatever the password.
+//              Called with the account locked.
+// Return: the opcode to answer, 0 if the account may log in
+// -IN:  account: the account
+int loginRefused(Account* account) {
+	// Check if account is currently active on another device
+	if (account->connections > 0)
+		return OPS_ERR_ANOTHERCLIENT;
+
+	// Check if account is locked
+	if (account->isLocked)
+		return OPS_ERR_LOCKED;
+	return 0;
+}
+
+// Function: finishLogin
+// Description: Log an account in once its password is verified, or count
+//              the failed attempt. The account is checked again, another
+//              login may have got in while the password was verified.
+// Return: 1 if the response is ready, 0 if it is sent once the account
+//         lock is stored
+// -IN:  request: the verified login
+int finishLogin(AUTH_REQUEST* request) {
+	BUFFER_OBJ* bufferObj = request->bufferObj;
+	LPMESSAGE message = &(bufferObj->sock->mess);
+	Account* account = request->account;
+	DB_WRITE_REQUEST* write;
+	time_t now = time(0);
+	int refused;
+
+	accountLock(account);
+	if ((refused = loginRefused(account)) != 0) {
+		packMessage(message, refused, 0, 0, 0, "");
+		accountUnlock(account);
+		return 1;
+	}
+
+	// Check password
+	if (!request->verified) {
+		LOG_INFO("Wrong password!\n");
+		loginGuardFailed(bufferObj->sock->Source);
+
+		// If the failures of the last hour exceed the limit then block
+		// account and update database. The client is answered once the
+		// lock is stored.
+		if (loginAccountFailed(account->uid)) {
+			account->isLocked = true;
+			submitDbWrite(newDbWrite(DBW_LOCK_ACCOUNT, account, NULL, bufferObj));
+			accountUnlock(account);
+			return 0;
+		}
+		packMessage(message, OPS_ERR_WRONGPASS, 0, 0, 0, "");
+		accountUnlock(account);
+		return 1;
+	}
+
+	// Passed all checks. Update active time and session account info
+	account->lastActive = now;
+	account->connections++;
+	accountPin(account);
+	bindSocketAccount(bufferObj->sock->s, account);
+	loginAccountSucceeded(account->uid);
+
+	// A password stored in clear or with older parameters is stored again
+	if (request->rehash[0] != 0) {
+		write = newDbWrite(DBW_SET_PASSWORD, account, NULL, NULL);
+		strcpy_s(write->password, CRE_MAXLEN, request->rehash);
+		submitDbWrite(write);
+	}
+
+	LOG_INFO("Login successful.\n");
+	packMessage(message, OPS_OK, 0, 0, 0, "");
+	accountUnlock(account);
+
+	return 1;
+}
+
+// Function: completeAuth
+// Description: Answer a login verified by the auth pool. Runs on a pool
+//              thread.
+// -IN:  request: the verified login
+void completeAuth(AUTH_REQUEST* request) {
+	BUFFER_OBJ* bufferObj = request->bufferObj;
+
+	if (finishLogin(request))
+		CompleteDeferredResponse(bufferObj);
+	accountRelease(request->account);
+}
+
+/*
+Process login and produce response. The password is verified by the auth
+pool, which answers through completeAuth; when the pool is not running it
+is verified here. Sources over their login rate or refused for failing too
+often are answered busy before the account is looked up.
+[IN/OUT] bufferObj:		buffer object to read from and write to
+*/
+int processOpLogIn(BUFFER_OBJ* bufferObj) {
+	LPMESSAGE message = &(bufferObj->sock->mess);
+	Account* account = NULL;
+	AUTH_REQUEST* request;
+	DWORD retryMs;
+	int refused, respond;
+
+	if ((retryMs = loginGuardBegin(bufferObj->sock->Source)) != 0) {
+		packMessage(message, OPS_ERR_BUSY, 0, (long)retryMs, 0, "");
+		return 1;
+	}
+
+	// Parse username and password
+	char* username = NULL;
+	char* password = NULL;
+
+	username = message->payload;
+	for (unsigned int i = 0; i < message->length; i++) {
+		if (message->payload[i] == ' ') {
+			message->payload[i] = 0;
+			password = message->payload + i + 1;
+		}
+	}
+
+	if (password == NULL) {
+		packMessage(message, OPS_ERR_BADREQUEST, 0, 0, 0, "");
+		return 1;
+	}
+
+	// Find account, reading it from the database if it is not in memory.
+	// The login holds it until it is answered.
+	account = accountAcquire(username);
+
+	// If cannot find account, inform not found error. Guessing names
+	// counts against the source like guessing passwords.
+	if (account == NULL) {
+		loginGuardFailed(bufferObj->sock->Source);
+		packMessage(message, OPS_ERR_NOTFOUND, 0, 0, 0, "");
+		return 1;
+	}
+
+	// Refuse what no password can change before paying for a hash
+	accountLock(account);
+	if ((refused = loginRefused(account)) != 0) {
+		packMessage(message, refused, 0, 0, 0, "");
+		accountUnlock(account);
+		accountRelease(account);
+		return 1;
+	}
+
+	// A password is only tried if a wrong one can be counted
+	if ((retryMs = loginAccountBegin(account->uid)) != 0) {
+		packMessage(message, OPS_ERR_BUSY, 0, (long)retryMs, 0, "");
+		accountUnlock(account);
+		accountRelease(account);
+		return 1;
+	}
+	request = newAuthRequest(bufferObj, account, account->password, password);
+	accountUnlock(account);
+	SecureZeroMemory(password, strlen(password));
+
+	if (request == NULL) {
+		packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
+		accountRelease(account);
+		return 1;
+	}
+
+	if (gAuthRunning == 0) {
+		authVerify(request);
+		respond = finishLogin(request);
+		freeAuthRequest(request);
+		accountRelease(account);
+		return respond;
+	}
+
+	if ((retryMs = submitAuth(request)) != 0) {
+		freeAuthRequest(request);
+		accountRelease(account);
+		packMessage(message, OPS_ERR_BUSY, 0, (long)retryMs, 0, "");
+		return 1;
+	}
+	return 0;
+}
+
+/*
+Process log out and construct response
+[OUT] buff:		a char array to store the constructed response message
+[IN] cookie:		a char array containing the SID to be processed
+*/
+int processOpLogOut(BUFFER_OBJ* bufferObj) {
+	LPMESSAGE message = &(bufferObj->sock->mess);
+	Account* account = NULL;
+	time_t now = time(0);
+
+	// Find account. If cannot find account, deny log out
+	account = unbindSocketAccount(bufferObj->sock->s);
+	if (account == NULL) {
+		packMessage(message, OPS_ERR_NOTLOGGEDIN, 0, 0, 0, "");
+		return 1;
+	}
+
+	// All checks out! Allow log out
+	accountLock(account);
+	account->lastActive = now;
+	account->workingGroup = NULL;
+	account->connections--;
+	clearSession(account);
+	accountUnlock(account);
+	accountRelease(account);
+
+	packMessage(message, OPS_OK, 0, 0, 0, "");
+	LOG_INFO("Log out successful.\n");
+	return 1;
+}
+
+/*
+Process reauthentication request and construct response
+[IN] sock:		the socket that's sending the request
+[OUT] buff:		a char array to store the constructed response message
+[IN] cookie:		a char array containing the SID to be processed
+*/
+int processOpReauth(BUFFER_OBJ* bufferObj) {
+	LPMESSAGE message = &(bufferObj->sock->mess);
+	time_t now = time(0);
+	Account* account = NULL;
+
+	// Check if cookie's length is correct
+	if (message->length != COOKIE_LEN) {
+		packMessage(message, OPS_ERR_BADREQUEST, 0, 0, 0, "");
+		return 1;
+	}
+
+	// Find account with cookie
+	message->payload[COOKIE_LEN - 1] = 0;
+	account = findSession(message->payload);
+
+	// If account does not exists
+	if (account == NULL) {
+		LOG_INFO("Cookie not found.\n");
+		packMessage(message, OPS_ERR_NOTFOUND, 0, 0, 0, "");
+		return 1;
+	}
+
+	// Check if lastActive is more than 1 day ago
+	if (now - account->lastActive > TIME_1_DAY) {
+		LOG_INFO("Login session timeout. Deny reauth.\n");
+		packMessage(message, OPS_ERR_NOTLOGGEDIN, 0, 0, 0, "");
+		accountRelease(account);
+		return 1;
+	}
+
+	// Check if account is disabled
+	if (account->isLocked) {
+		LOG_INFO("Account is locked. Reauth failed.\n");
+		accountLock(account);
+		clearSession(account);
+		accountUnlock(account);
+		accountRelease(account);
+		packMessage(message, OPS_ERR_LOCKED, 0, 0, 0, "");
+		return 1;
+	}
+
+	// Check if account is logged in on another device
+	accountLock(account);
+	if (account->connections > 0) {
+		accountUnlock(account);
+		packMessage(message, OPS_ERR_ANOTHERCLIENT, 0, 0, 0, "");
+		accountRelease(account);
+		return 1;
+	}
+
+	// All checks out! The connection keeps the pin of the lookup
+	LOG_INFO("Allow reauth.\n");
+	account->connections++;
+	bindSocketAccount(bufferObj->sock->s, account);
+	account->lastActive = time(0);
+	storeSession(account);
+	accountUnlock(account);
+	packMessage(message, OPS_OK, 0, 0, 0, "");
+	return 1;
+}
+
+/*
+Process cookie request and construct response
+[IN] sock:		the socket that's sending the request
+[OUT] buff:		a char array to store the constructed response message
+[OUT] responseLen: a short to store the length of the response payload
+*/
+int processOpRequestCookie(BUFFER_OBJ* bufferObj) {
+	LPMESSAGE message = &(bufferObj->sock->mess);
+
+	// Find account
+	Account* account = socketAccount(bufferObj->sock->s);
+	if (account == NULL) {
+		packMessage(message, OPS_ERR_FORBIDDEN, 0, 0, 0, "");
+		return 1;
+	}
+
+	char cookie[COOKIE_LEN];
+	generateCookies(cookie);
+
+	// Create cookie and add to account
+	accountLock(account);
+	account->lastActive = time(0);
+	setSession(account, cookie);
+	timerArm(&account->sessionTimer, TIME_1_DAY * 1000, sessionTimeout, account);
+	accountUnlock(account);
+
+	// Construct response
+	packMessage(message, OPS_OK, 0, 0, 0, cookie);
+	LOG_INFO("Generated new cookie for socket %d.\n", bufferObj->sock->s);
+	return 1;
+}
+
+/*
+Remove socket information from any Session previously associated with it.
+Replies still queued for the socket are dropped, the cookie stays valid
+until its session timer fires.
+[IN] sock:	the socket which has been disconnected
+*/
+void disconnect(SOCKET sock) {
+	Account* account = unbindSocketAccount(sock);
+	if (account == NULL)
+		return;
+
+	accountLock(account);
+	account->connections--;
+	while (account->queuedMess != NULL) {
+		LPMESSAGE_LIST next = account->queuedMess->next;
+		free(account->queuedMess);
+		account->queuedMess = next;
+	}
+	accountUnlock(account);
+	accountRelease(account);
+}
+
+int processOpGroup(BUFFER_OBJ* bufferObj) {
+
+	LPMESSAGE message = &(bufferObj->sock->mess);
+	Group* group = NULL;
+
+	// Check if this socket is associated with an account
+	Account* account = socketAccount(bufferObj->sock->s);
+	if (account == NULL) {
+		packMessage(message, OPS_ERR_FORBIDDEN, 0, 0, 0, "");
+		return 1;
+	}
+	std::list<Group> tempGroupList;
+	std::vector<int> gids;
+	auto it = tempGroupList.begin();
+
+	switch (message->opcode) {
+	case OPG_GROUP_LIST:
+
+		membershipGroupsOf(account->uid, gids);
+		for (int gid : gids) {
+			group = findGroupById(gid);
+			if (group != NULL)
+				tempGroupList.push_back(*group);
+		}
+
+		char count[10];
+		MESSAGE newMessage;
+		LPMESSAGE_LIST listPtr;
+
+		// Send group count
+		_itoa(tempGroupList.size(), count, 10);
+		packMessage(message, OPG_GROUP_COUNT, 0, 0, 0, count);
+
+		// Add directory count to wait queue
+		if (!tempGroupList.empty()) {
+			packMessage(&newMessage, OPG_GROUP_NAME, strlen(tempGroupList.front().groupName), 0, 0, tempGroupList.front().groupName);
+			account->queuedMess = (LPMESSAGE_LIST)malloc(sizeof(MESSAGE_LIST));
+			listPtr = account->queuedMess;
+			listPtr->mess = newMessage;
+
+			it = tempGroupList.begin();
+			it++;
+			// Add file name to wait queue
+			for ( ; it != tempGroupList.end(); it++) {
+				packMessage(&newMessage, OPG_GROUP_NAME, strlen((*it).groupName), 0, 0, (*it).groupName);
+				listPtr->next = (LPMESSAGE_LIST)malloc(sizeof(MESSAGE_LIST));
+				listPtr = listPtr->next;
+				listPtr->mess = newMessage;
+			}
+		}
+		return 1;
+
+	case OPG_GROUP_USE:
+		// Check if account has access to requested group
+		group = findGroupByName(message->payload);
+		if (group != NULL && membershipHas(account->uid, group->gid)) {
+			// Attach group to account
+			account->workingGroup = group;
+			accountSetDir(account, "");
+			packMessage(message, OPS_OK, 0, 0, 0, "");
+			return 1;
+		}
+
+		// Account doesn't have access to requested group
+		packMessage(message, OPS_ERR_FORBIDDEN, 0, 0, 0, "");
+		return 1;
+
+	case OPG_GROUP_JOIN:
+		// Check if the group exists
+		group = findGroupByName(message->payload);
+		if (group == NULL) {
+			packMessage(message, OPS_ERR_NOTFOUND, 0, 0, 0, "");
+			return 1;
+		}
+
+		// Check if the account already has access to this group
+		if (membershipHas(account->uid, group->gid)) {
+			packMessage(message, OPS_ERR_ALREADYINGROUP, 0, 0, 0, "");
+			return 1;
+		}
+
+		// Add to database, answered by completeDbWrite
+		submitDbWrite(newDbWrite(DBW_ADD_MEMBER, account, group, bufferObj));
+		return 0;
+
+	case OPG_GROUP_LEAVE:
+		// Check if the account has access to this group
+		group = findGroupByName(message->payload);
+		if (group == NULL || !membershipHas(account->uid, group->gid)) {
+			packMessage(message, OPS_ERR_FORBIDDEN, 0, 0, 0, "");
+			return 1;
+		}
+
+		// Delete permission from database, answered by completeDbWrite
+		submitDbWrite(newDbWrite(DBW_DELETE_MEMBER, account, group, bufferObj));
+		return 0;
+
+	case OPG_GROUP_NEW:
+
+		// Verify group name:
+
+		if (!isValidName(message->payload)) {
+			packMessage(message, OPS_ERR_BADREQUEST, 0, 0, 0, "");
+			return 1;
+		}
+
+		// Check if a group with the same name already exists
+		if (findGroupByName(message->payload) != NULL) {
+			packMessage(message, OPS_ERR_GROUPEXISTS, 0, 0, 0, "");
+			return 1;
+		}
+
+		// Initialize new group
+		Group newGroup;
+		char pathName[GROUPNAME_SIZE];
+		newGroup.ownerId = account->uid;
+
+		char path[MAX_PATH];
+		strcpy_s(pathName, GROUPNAME_SIZE, message->payload);
+
+		while (1) {
+			snprintf(path, MAX_PATH, "%s/%s", STORAGE_LOCATION, pathName);
+			if (CreateDirectoryA(path, NULL) == 0) {
+				if (GetLastError() == ERROR_ALREADY_EXISTS) {
+					LOG_WARN("Cannot create directory with path %s as it already exists\n", path);
+					strcat_s(pathName, GROUPNAME_SIZE, "_");
+					continue;
+				}
+				else {
+					packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
+					return 1;
+				}
+			}
+			break;
+		}
+		dirIndexRefresh(path);
+
+		// The names go to the pool, they live as long as the group
+		newGroup.groupName = internString(message->payload);
+		newGroup.pathName = internString(pathName);
+		if (newGroup.groupName == NULL || newGroup.pathName == NULL) {
+			RemoveDirectoryA(path);
+			dirIndexRefresh(path);
+			packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
+			return 1;
+		}
+
+		// Add group to database and make the account its first member,
+		// answered by completeDbWrite
+		submitDbWrite(newDbWrite(DBW_NEW_GROUP, account, &newGroup, bufferObj));
+		return 0;
+	}
+	return 0;
+}
+
+int processOpContinue(BUFFER_OBJ* bufferObj) {
+
+	// Find account
+	Account* account = socketAccount(bufferObj->sock->s);
+	if (account == NULL) {
+		packMessage(&(bufferObj->sock->mess), OPS_ERR_FORBIDDEN, 0, 0, 0, "");
+		return 1;
+	}
+
+	// Dequeue message and send 
+	if (account->queuedMess != NULL) {
+		bufferObj->sock->mess = account->queuedMess->mess;
+		LPMESSAGE_LIST ptr = account->queuedMess->next;
+		free(account->queuedMess);
+		account->queuedMess = ptr;
+		return 1;
+	}
+	else {
+		packMessage(&(bufferObj->sock->mess), OPS_ERR_BADREQUEST, 0, 0, 0, "");
+		return 1;
+	}
+	return 0;
+}
+
+// Function: copyStatus
+// Description: Status answering a copy or move
+// Return: the status opcode
+// -IN:  error: Win32 error of the copy or move, NO_ERROR if done
+int copyStatus(DWORD error) {
+	switch (error) {
+	case NO_ERROR:
+		return OPS_OK;
+	case ERROR_FILE_NOT_FOUND:
+	case ERROR_PATH_NOT_FOUND:
+		return OPS_ERR_NOTFOUND;
+	case ERROR_FILE_EXISTS:
+	case ERROR_ALREADY_EXISTS:
+		return OPS_ERR_ALREADYEXISTS;
+	case ERROR_SHARING_VIOLATION:
+		// The file is being downloaded or uploaded
+		return OPS_ERR_BUSY;
+	default:
+		return OPS_ERR_SERVERFAIL;
+	}
+}
+
+// Function: logCopyFailure
+// Description: Log a copy or move that failed. A log record keeps one
+//              string, so each path goes in a record of its own.
+// -IN:  move: whether it was a move
+//       source: path of the file
+//       target: path it was copied or moved to
+//       error: Win32 error of the copy or move
+void logCopyFailure(bool move, const char* source, const char* target, DWORD error) {
+	if (move)
+		LOG_WARN("Cannot move %s, error code %d!\n", logTail(source), error);
+	else
+		LOG_WARN("Cannot copy %s, error code %d!\n", logTail(source), error);
+	LOG_WARN("  to %s\n", logTail(target));
+}
+
+// Function: completeCopy
+// Description: Answer a copy or move done by the copy thread. Runs on the
+//              copy thread.
+// -IN:  request: the copy
+void completeCopy(COPY_REQUEST* request) {
+	int status = copyStatus(request->error);
+
+	if (request->error != NO_ERROR)
+		logCopyFailure(request->move, request->source, request->target, request->error);
+	dirIndexRefresh(request->target);
+	if (request->move)
+		dirIndexRefresh(request->source);
+	packMessage(&(request->bufferObj->sock->mess), status, 0, status == OPS_ERR_BUSY ? ADMISSION_RETRY_MS : 0, 0, "");
+	CompleteDeferredResponse(request->bufferObj);
+}
+
+int processOpBrowsing(BUFFER_OBJ* bufferObj) {
+
+	LPMESSAGE message = &(bufferObj->sock->mess);
+
+	// Find account
+	Account* account = socketAccount(bufferObj->sock->s);
+	if (account == NULL) {
+		packMessage(message, OPS_ERR_FORBIDDEN, 0, 0, 0, "");
+		return 1;
+	}
+
+	// If account is not using any group, forbid browsing
+	if (account->workingGroup == NULL) {
+		packMessage(message, OPS_ERR_FORBIDDEN, 0, 0, 0, "");
+		return 1;
+	}
+	Group* working = groupLatest(account->workingGroup);
+
+	std::vector<DIR_ENTRY> entries;
+	DIR_ENTRY entry;
+	int ret;
+	std::list<MESSAGE> fileList;
+	std::list<MESSAGE> folderList;
+	char fullPath[MAX_PATH];
+	char path[MAX_PATH];
+	char targetPath[MAX_PATH];
+	char* target;
+	char* groupName;
+	size_t at;
+	Group* group;
+	COPY_REQUEST* request;
+	DWORD error;
+	bool recode;
+
+	switch (message->opcode) {
+	case OPB_LIST:
+		MESSAGE newMessage;
+
+		// Construct path
+		accountPath(account, "", fullPath, MAX_PATH);
+		if (fullPath[0] != 0)
+			snprintf(path, MAX_PATH, "%s/%s/%s", STORAGE_LOCATION, working->pathName, fullPath);
+		else
+			snprintf(path, MAX_PATH, "%s/%s", STORAGE_LOCATION, working->pathName);
+
+		// List files from the directory index
+		if (dirIndexList(path, entries)) {
+			LOG_WARN("Cannot list directory %s (%d)\n", path, GetLastError());
+			packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
+			return 1;
+		}
+
+		for (auto it = entries.begin(); it != entries.end(); it++) {
+			if (it->isDir) {
+				packMessage(&newMessage, OPB_DIR_NAME, it->name.size(), 0, 0, (char*)it->name.c_str());
+				folderList.push_back(newMessage);
+			}
+			else {
+				packMessage(&newMessage, OPB_FILE_NAME, it->name.size(), 0, 0, (char*)it->name.c_str());
+				fileList.push_back(newMessage);
+			}
+		}
+
+		// Construct messages and enqueue pending sends
+		char count[10];
+		LPMESSAGE_LIST listPtr;
+
+		// Send file count
+		_itoa(fileList.size(), count, 10);
+		packMessage(message, OPB_FILE_COUNT, 0, 0, 0, count);
+
+		// Add directory count to wait queue
+		_itoa(folderList.size(), count, 10);
+		packMessage(&newMessage, OPB_DIR_COUNT, 0, 0, 0, count);
+		account->queuedMess = (LPMESSAGE_LIST)malloc(sizeof(MESSAGE_LIST));
+		listPtr = account->queuedMess;
+		listPtr->mess = newMessage;
+
+		// Add file name to wait queue
+		for (auto it = fileList.begin(); it != fileList.end(); it++) {
+			listPtr->next = (LPMESSAGE_LIST)malloc(sizeof(MESSAGE_LIST));
+			listPtr = listPtr->next;
+			listPtr->mess = *it;
+		}
+
+		// Add directory name to wait queue
+		for (auto it = folderList.begin(); it != folderList.end(); it++) {
+			listPtr->next = (LPMESSAGE_LIST)malloc(sizeof(MESSAGE_LIST));
+			listPtr = listPtr->next;
+			listPtr->mess = *it;
+		}
+
+		return 1;
+
+	case OPB_FILE_CD:
+
+		// Check if the requested path is valid
+		if (!isValidName(message->payload)) {
+			packMessage(message, OPS_ERR_BADREQUEST, 0, 0, 0, "");
+			return 1;
+		}
+
+		// Check if this is a special navigation
+		if (strcmp(message->payload, "..") == 0) {
+			accountPath(account, "", path, MAX_PATH);
+			if (path[0] == 0) {
+				packMessage(message, OPS_ERR_FORBIDDEN, 0, 0, 0, "");
+				return 1;
+			}
+			else {
+				char* lastSlash = strrchr(path, '/');
+				if (lastSlash) {
+					*lastSlash = 0;
+				}
+				else {
+					path[0] = 0;
+				}
+				accountSetDir(account, path);
+				packMessage(message, OPS_OK, 0, 0, 0, "");
+				return 1;
+			}
+		}
+
+		if (strcmp(message->payload, ".") == 0) {
+			packMessage(message, OPS_OK, 0, 0, 0, "");
+			return 1;
+		}
+
+		// Check if path exists
+		accountPath(account, message->payload, path, MAX_PATH);
+		snprintf(fullPath, MAX_PATH, "%s/%s/%s", STORAGE_LOCATION, working->pathName, path);
+
+		ret = dirIndexStat(fullPath, &entry);
+		if (ret == 0 || !entry.isDir) {
+			packMessage(message, OPS_ERR_NOTFOUND, 0, 0, 0, "");
+			return 1;
+		}
+		if (accountSetDir(account, path)) {
+			packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
+			return 1;
+		}
+		packMessage(message, OPS_OK, 0, 0, 0, "");
+		return 1;
+
+	case OPB_FILE_DEL:
+		// Check if account is the group owner
+		if (!isGroupOwner(account, working)) {
+			packMessage(message, OPS_ERR_FORBIDDEN, 0, 0, 0, "");
+			return 1;
+		}
+
+		// Delete file
+		accountPath(account, message->payload, path, MAX_PATH);
+		snprintf(fullPath, MAX_PATH, "%s/%s/%s", STORAGE_LOCATION, working->pathName, path);
+
+		if (DeleteFileA(fullPath) == 0) {
+			if (GetLastError() == ERROR_FILE_NOT_FOUND) {
+				LOG_INFO("Cannot remove file %s. File not found!\n", fullPath);
+				packMessage(message, OPS_ERR_NOTFOUND, 0, 0, 0, "");
+				return 1;
+			}
+			LOG_WARN("Cannot remove file %s. Error code %d!\n", fullPath, GetLastError());
+			packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
+			return 1;
+		}
+		dirIndexRefresh(fullPath);
+		packMessage(message, OPS_OK, 0, 0, 0, "");
+		return 1;
+
+	case OPB_DIR_DEL:
+
+		// Check if account is group owner
+		if (!isGroupOwner(account, working)) {
+			packMessage(message, OPS_ERR_FORBIDDEN, 0, 0, 0, "");
+			return 1;
+		}
+
+		accountPath(account, message->payload, path, MAX_PATH);
+		snprintf(fullPath, MAX_PATH, "%s/%s/%s", STORAGE_LOCATION, working->pathName, path);
+
+		// Delete directory
+		if (RemoveDirectoryA(fullPath) == 0) {
+			LOG_WARN("Cannot remove directory with path %s. Error code %d!\n", fullPath, GetLastError());
+			packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
+			return 1;
+		}
+		dirIndexRefresh(fullPath);
+		packMessage(message, OPS_OK, 0, 0, 0, "");
+		return 1;
+
+	case OPB_DIR_NEW:
+		// Construct full path
+		accountPath(account, message->payload, path, MAX_PATH);
+		snprintf(fullPath, MAX_PATH, "%s/%s/%s", STORAGE_LOCATION, working->pathName, path);
+
+		if (CreateDirectoryA(fullPath, NULL) == 0) {
+			if (GetLastError() == ERROR_ALREADY_EXISTS) {
+				LOG_INFO("Cannot create directory with path %s as it already exists\n", fullPath);
+				packMessage(message, OPS_ERR_ALREADYEXISTS, 0, 0, 0, "");
+				return 1;
+			}
+			else {
+				packMessage(message, OPS_ERR_SERVERFAIL, 0, 0, 0, "");
+				return 1;
+			}
+		}
+
+		dirIndexRefresh(fullPath);
+		packMessage(message, OPS_OK, 0, 0, 0, "");
+		return 1;
+
+	case OPB_FILE_COPY:
+	case OPB_FILE_MOVE:
+		// Payload is the file, relative to the directory of the account, then
+		// its new path from the root of the group to put it in and the name
+		// of that group, empty for the working group, each ending with a zero
+		message->payload[sizeof(message->payload) - 1] = 0;
+		at = strlen(message->payload) + 1;
+		if (at >= message->length || at >= sizeof(message->payload)) {
+			packMessage(message, OPS_ERR_BADREQUEST, 0, 0, 0, "");
+			return 1;
+		}
+		target = message->payload + at;
+		at += strlen(target) + 1;
+		groupName = (at < message->length && at < sizeof(message->payload)) ? message->payload + at : (char*)"";
+		if (!isValidPath(message->payload) || !isValidPath(target)) {
+			packMessage(message, OPS_ERR_BADREQUEST, 0, 0, 0, "");
+			return 1;
+		}
+
+		// The file may go to another group the account is a member of
+		group = working;
+		if (groupName[0] != 0) {
+			group = findGroupByName(groupName);
+			if (group == NULL || !membershipHas(account->uid, group->gid)) {
+				packMessage(message, OPS_ERR_FORBIDDEN, 0, 0, 0, "");
+				return 1;
+			}
+		}
+
+		// A move removes the file from the working group, like a delete
+		if (message->opcode == OPB_FILE_MOVE && !isGroupOwner(account, working)) {
+			packMessage(message, OPS_ERR_FORBIDDEN, 0, 0, 0, "");
+			return 1;
+		}
+
+		accountPath(account, message->payload, path, MAX_PATH);
+		snprintf(fullPath, MAX_PATH, "%s/%s/%s", STORAGE_LOCATION, working->pathName, path);
+		snprintf(targetPath, MAX_PATH, "%s/%s/%s", STORAGE_LOCATION, group->pathName, target);
+
+		if (dirIndexStat(fullPath, &entry) == 0 || entry.isDir) {
+			packMessage(message, OPS_ERR_NOTFOUND, 0, 0, 0, "");
+			return 1;
+		}
+		if (dirIndexStat(targetPath, NULL)) {
+			packMessage(message, OPS_ERR_ALREADYEXISTS, 0, 0, 0, "");
+			return 1;
+		}
+
+		// Renames and clones only touch metadata and are answered right away,
+		// unless the file has to be rewritten in the format of the target group
+		recode = group->compressed != working->compressed;
+		if (!recode && message->opcode == OPB_FILE_MOVE) {
+			error = renameFile(fullPath, targetPath);
+			if (error != ERROR_NOT_SAME_DEVICE) {
+				if (error != NO_ERROR)
+					logCopyFailure(true, fullPath, targetPath, error);
+				dirIndexRefresh(fullPath);
+				dirIndexRefresh(targetPath);
+				packMessage(message, copyStatus(error), 0, error == ERROR_SHARING_VIOLATION ? ADMISSION_RETRY_MS : 0, 0, "");
+				return 1;
+			}
+		}
+		else if (!recode && cloneFile(fullPath, targetPath) == 0) {
+			dirIndexRefresh(targetPath);
+			packMessage(message, OPS_OK, 0, 0, 0, "");
+			return 1;
+		}
+
+		// The bytes have to be copied, answered by completeCopy
+		request = newCopyRequest(bufferObj, fullPath, targetPath, message->opcode == OPB_FILE_MOVE, recode, group->compressed);
+		if (request == NULL || submitCopy(request)) {
+			free(request);
+			packMessage(message, OPS_ERR_BUSY, 0, ADMISSION_RETRY_MS, 0, "");
+			return 1;
+		}
+		return 0;
+	}
+	return 0;
+}
+
+
+/*
+Extract information from request and call corresponding process function
+Function returns 1 if a response is ready to be sent, else returns 0. A
+request that returned 0 is answered later through CompleteDeferredResponse.
+[IN] sock:		the socket that's sending the request
+[IN/OUT] buff:	a char array which contains the request, and stores response
+after the request has been processed
+[OUT] len:		the length of the payload of the output
+*/
+int parseAndProcess(BUFFER_OBJ* bufferObj) {
+	LPMESSAGE message = &(bufferObj->sock->mess);
+
+	// Process request
+	switch (message->opcode) {
+		// Authentication operations
+	case OPA_REAUTH:
+		return processOpReauth(bufferObj);
+	case OPA_REQ_COOKIES:
+		return processOpRequestCookie(bufferObj);
+	case OPA_LOGIN:
+		return processOpLogIn(bufferObj);
+	case OPA_LOGOUT:
+		return processOpLogOut(bufferObj);
+
+	case OPG_GROUP_LIST:
+	case OPG_GROUP_USE:
+	case OPG_GROUP_JOIN:
+	case OPG_GROUP_LEAVE:
+	case OPG_GROUP_NEW:
+		return processOpGroup(bufferObj);
+
+	case OPB_LIST:
+	case OPB_FILE_CD:
+	case OPB_FILE_DEL:
+	case OPB_DIR_DEL:
+	case OPB_DIR_NEW:
+	case OPB_FILE_COPY:
+	case OPB_FILE_MOVE:
+		return processOpBrowsing(bufferObj);
+
+	case OPS_CONTINUE:
+		return processOpContinue(bufferObj);
+
+	default:
+		LOG_INFO("Bad request!\n");
+		packMessage(&(bufferObj->sock->mess), OPS_ERR_BADREQUEST, 0, 0, 0, "");
+		return 1;
+	}
+}
+
 #endif
\ No newline at end of file
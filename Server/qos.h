@@ -0,0 +1,193 @@
+#pragma once
+
+#ifndef _QOS_H
+#define _QOS_H
+
+#include <stddef.h>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include "dataStructures.h"
+#include "metrics.h"
+#include "timerWheel.h"
+#include "groupCatalog.h"
+
+// Transfer limits. Every block of a download or upload is charged to the
+// account doing it and to the group it is in, in bytes and in blocks
+// (one disk read or write each). A bucket may go into debt for one block,
+// so a block larger than the burst still passes; the next one waits until
+// the debt is paid off. Waiting blocks are parked on their buffer's timer
+// and put back on their worker's list when it fires.
+#define QOS_BURST_MS		250		// Tokens a bucket holds, in milliseconds of its rate
+
+CRITICAL_SECTION gQosCritSec;
+
+// Function: initializeQos
+// Description: Initialize the lock of the buckets
+void initializeQos() {
+	InitializeCriticalSection(&gQosCritSec);
+}
+
+// Function: qosRefill
+// Description: Add the tokens earned since the last refill. Called with
+//              gQosCritSec held.
+// -IN: limit: the buckets
+//      now: tick count in milliseconds
+void qosRefill(QOS_LIMIT *limit, ULONGLONG now) {
+	LONGLONG elapsed = (LONGLONG)(now - limit->refilled);
+
+	// A longer pause fills the buckets anyway, and would overflow at high rates
+	if (elapsed > QOS_BURST_MS || elapsed < 0)
+		elapsed = QOS_BURST_MS;
+	limit->refilled = now;
+	if (limit->bytesRate > 0) {
+		limit->bytesTokens += limit->bytesRate * elapsed;
+		if (limit->bytesTokens > limit->bytesRate * QOS_BURST_MS)
+			limit->bytesTokens = limit->bytesRate * QOS_BURST_MS;
+	}
+	if (limit->opsRate > 0) {
+		limit->opsTokens += limit->opsRate * elapsed;
+		if (limit->opsTokens > limit->opsRate * QOS_BURST_MS)
+			limit->opsTokens = limit->opsRate * QOS_BURST_MS;
+	}
+}
+
+// Function: qosDebt
+// Description: Time until the buckets are out of debt. Called with
+//              gQosCritSec held, after qosRefill.
+// Return: milliseconds, 0 if a block may pass now
+// -IN: limit: the buckets
+LONGLONG qosDebt(QOS_LIMIT *limit) {
+	LONGLONG wait = 0, ops;
+
+	if (limit->bytesRate > 0 && limit->bytesTokens < 0)
+		wait = (-limit->bytesTokens + limit->bytesRate - 1) / limit->bytesRate;
+	if (limit->opsRate > 0 && limit->opsTokens < 0) {
+		ops = (-limit->opsTokens + limit->opsRate - 1) / limit->opsRate;
+		if (ops > wait)
+			wait = ops;
+	}
+	return wait;
+}
+
+// Function: qosCharge
+// Description: Charge a block to the limits of an account and of a group
+//              if neither is in debt
+// Return: 0 if the block was charged, else milliseconds to wait before
+//         trying again
+// -IN: account: the account, NULL if none
+//      group: the group, NULL if none
+//      bytes: size of the block
+//      now: tick count in milliseconds
+LONGLONG qosCharge(Account *account, Group *group, LONGLONG bytes, ULONGLONG now) {
+	QOS_LIMIT *limits[2];
+	LONGLONG wait = 0, debt;
+	int count = 0, i;
+
+	if (account != NULL && (account->qos.bytesRate > 0 || account->qos.opsRate > 0))
+		limits[count++] = &account->qos;
+	group = groupLatest(group);
+	if (group != NULL && (group->qos.bytesRate > 0 || group->qos.opsRate > 0))
+		limits[count++] = &group->qos;
+	if (count == 0)
+		return 0;
+
+	EnterCriticalSection(&gQosCritSec);
+	for (i = 0; i < count; i++) {
+		qosRefill(limits[i], now);
+		if ((debt = qosDebt(limits[i])) > wait)
+			wait = debt;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (wait > 0) {
+			limits[i]->throttled++;
+			continue;
+		}
+		limits[i]->bytesTokens -= bytes * 1000;
+		limits[i]->opsTokens -= 1000;
+		limits[i]->bytesUsed += bytes;
+		limits[i]->opsUsed++;
+	}
+	LeaveCriticalSection(&gQosCritSec);
+	return wait;
+}
+
+// Function: qosAdmit
+// Description: Charge a transfer block, or park its buffer until the
+//              limits allow it
+// Return: 0 if the block may go now, 1 if the buffer was parked
+// -IN: obj: the buffer of the block
+//      bytes: size of the block
+//      resume: puts the buffer back on its worker's list, gets the buffer
+//              in timer->context
+int qosAdmit(BUFFER_OBJ *obj, LONGLONG bytes, void(*resume)(TIMER *timer)) {
+	LPFILE_TRANSFER_PROPERTY transfer = &obj->sock->fileTransfer;
+	LONGLONG wait;
+
+	wait = qosCharge(transfer->account, transfer->group, bytes, GetTickCount64());
+	if (wait == 0)
+		return 0;
+
+	timerArm(&obj->timer, (DWORD)wait, resume, obj);
+	return 1;
+}
+
+// Function: appendQosMetric
+// Description: Append one metric of the accounts and groups that have
+//              limits set, so each metric stays in one block of the scrape
+// -IN: out: the scrape
+//      name: the metric
+//      unit: "bytes" or "ops", NULL if the metric has no unit
+//      field: offset of the value in QOS_LIMIT
+//      accounts: the accounts in memory
+//      groups: the groups, of a catalog being read
+void appendQosMetric(std::string &out, const char *name, const char *unit, size_t field, std::unordered_map<int, Account *> &accounts, std::vector<Group *> &groups) {
+	char labels[96], unitLabel[32] = "";
+	QOS_LIMIT *limit;
+
+	if (unit != NULL)
+		snprintf(unitLabel, sizeof(unitLabel), ",unit=\"%s\"", unit);
+
+	auto account = accounts.begin();
+	auto group = groups.begin();
+	while (account != accounts.end() || group != groups.end()) {
+		if (account != accounts.end()) {
+			limit = &account->second->qos;
+			snprintf(labels, sizeof(labels), "scope=\"account\",id=\"%d\"%s", account->second->uid, unitLabel);
+			account++;
+		}
+		else {
+			limit = &(*group)->qos;
+			snprintf(labels, sizeof(labels), "scope=\"group\",id=\"%d\"%s", (*group)->gid, unitLabel);
+			group++;
+		}
+		if (limit->bytesRate == 0 && limit->opsRate == 0)
+			continue;
+
+		appendMetric(out, name, labels, (double)*(LONGLONG *)((char *)limit + field));
+	}
+}
+
+// Function: collectQosMetrics
+// Description: Append the limits and usage of the accounts and groups that
+//              have limits set. A limit of 0 is unlimited; rate() of the
+//              usage against the limit shows how close a tenant runs.
+//              Accounts are the ones in memory, called with their cache
+//              locked; the usage of an account restarts when it is read
+//              again.
+// -IN: out: the scrape
+//      accounts: the accounts in memory
+//      groups: the groups, of a catalog being read
+void collectQosMetrics(std::string &out, std::unordered_map<int, Account *> &accounts, std::vector<Group *> &groups) {
+	appendHelp(out, "clouddrive_qos_limit_per_second", "gauge", "Transfer limit of an account or group, 0 if unlimited.");
+	appendQosMetric(out, "clouddrive_qos_limit_per_second", "bytes", offsetof(QOS_LIMIT, bytesRate), accounts, groups);
+	appendQosMetric(out, "clouddrive_qos_limit_per_second", "ops", offsetof(QOS_LIMIT, opsRate), accounts, groups);
+	appendHelp(out, "clouddrive_qos_used_total", "counter", "Transfer bytes and blocks charged to an account or group.");
+	appendQosMetric(out, "clouddrive_qos_used_total", "bytes", offsetof(QOS_LIMIT, bytesUsed), accounts, groups);
+	appendQosMetric(out, "clouddrive_qos_used_total", "ops", offsetof(QOS_LIMIT, opsUsed), accounts, groups);
+	appendHelp(out, "clouddrive_qos_throttled_total", "counter", "Transfer blocks delayed by a limit.");
+	appendQosMetric(out, "clouddrive_qos_throttled_total", NULL, offsetof(QOS_LIMIT, throttled), accounts, groups);
+}
+
+#endif
@@ -0,0 +1,342 @@
+#pragma once
+
+#ifndef _SEND_SCHEDULER_H
+#define _SEND_SCHEDULER_H
+
+#include "dataStructures.h"
+#include "groupCatalog.h"
+
+// Send scheduler. Every connection has its own send queues: responses go
+// to a control lane that is always served first, download frames to a
+// bulk lane shared out by deficit round robin. The bulk lane is fair
+// between accounts, not connections: each account with frames waiting
+// gets a quantum per turn in proportion to its weight, and its
+// connections take turns within it. Quanta are scaled so the heaviest
+// account waiting gets one frame per turn; a download only has one frame
+// queued at a time, so lighter accounts have to skip turns for the
+// weights to show.
+#define SEND_FRAME_COST		((LONG)sizeof(MESSAGE))	// Bytes PostSend puts on the wire per frame
+#define SEND_WEIGHT_DEFAULT	1
+#define SEND_WEIGHT_MAX		16
+
+SEND_FLOW *gSendControlHead = NULL, *gSendControlTail = NULL;	// Connections with responses waiting
+SEND_SHARE *gSendRoundHead = NULL, *gSendRoundTail = NULL;		// Shares with frames waiting
+SEND_SHARE gSendDefaultShare;		// Frames of connections no download was started on
+int gSendWeightCount[SEND_WEIGHT_MAX + 1];	// Shares on the round by weight
+int gSendControlQueued = 0, gSendBulkQueued = 0;
+CRITICAL_SECTION gSendCritSec;
+
+// Function: initializeSendScheduler
+// Description: Initialize the lock of the scheduler
+void initializeSendScheduler() {
+	InitializeCriticalSection(&gSendCritSec);
+}
+
+// Function: sendWeight
+// Description: Weight of the downloads of an account: its own, else the
+//              one of its working group, else the default
+// Return: the weight, between 1 and SEND_WEIGHT_MAX
+// -IN: account: the account
+int sendWeight(Account *account) {
+	int weight = account->sendWeight;
+
+	if (weight <= 0 && account->workingGroup != NULL)
+		weight = groupLatest(account->workingGroup)->sendWeight;
+	if (weight <= 0)
+		return SEND_WEIGHT_DEFAULT;
+	return weight > SEND_WEIGHT_MAX ? SEND_WEIGHT_MAX : weight;
+}
+
+// Function: attachSendFlow
+// Description: Count the download frames of a connection in the share of
+//              an account. Called when a download starts, before its first
+//              frame is queued.
+// -IN: sock: the connection
+//      account: the account downloading
+void attachSendFlow(SOCKET_OBJ *sock, Account *account) {
+	SEND_FLOW *flow = &sock->SendFlow;
+	SEND_SHARE *share = &account->sendShare;
+	int weight = sendWeight(account);
+
+	EnterCriticalSection(&gSendCritSec);
+	if (share->weight != weight) {
+		if (share->active) {
+			gSendWeightCount[share->weight]--;
+			gSendWeightCount[weight]++;
+		}
+		share->weight = weight;
+	}
+	// Frames already waiting stay in the share they were counted in
+	if (!flow->onBulk)
+		flow->share = share;
+	LeaveCriticalSection(&gSendCritSec);
+}
+
+// Function: sendShareJoin
+// Description: Put a share at the end of the round. Called with
+//              gSendCritSec held.
+// -IN: share: the share, not on the round
+void sendShareJoin(SEND_SHARE *share) {
+	share->next = NULL;
+	share->deficit = 0;
+	share->inTurn = false;
+	share->active = true;
+	if (gSendRoundTail != NULL)
+		gSendRoundTail->next = share;
+	else
+		gSendRoundHead = share;
+	gSendRoundTail = share;
+	gSendWeightCount[share->weight]++;
+}
+
+// Function: sendShareLeave
+// Description: Take a share off the round. Called with gSendCritSec held;
+//              the share is at the head unless its last connection closed.
+// -IN: share: the share, on the round
+void sendShareLeave(SEND_SHARE *share) {
+	SEND_SHARE *prev = NULL, *it;
+
+	for (it = gSendRoundHead; it != share; it = it->next)
+		prev = it;
+	if (prev != NULL)
+		prev->next = share->next;
+	else
+		gSendRoundHead = share->next;
+	if (gSendRoundTail == share)
+		gSendRoundTail = prev;
+	share->next = NULL;
+	share->active = false;
+	gSendWeightCount[share->weight]--;
+}
+
+// Function: sendQuantum
+// Description: Bytes a share may send per turn, scaled to the heaviest
+//              share on the round. Called with gSendCritSec held.
+// Return: the quantum
+// -IN: share: the share, on the round
+LONG sendQuantum(SEND_SHARE *share) {
+	int top = SEND_WEIGHT_MAX;
+
+	while (top > share->weight && gSendWeightCount[top] == 0)
+		top--;
+	return SEND_FRAME_COST * share->weight / top;
+}
+
+// Function: enqueueSend
+// Description: Queue a frame for sending. Data frames of a download go to
+//              the bulk lane of the connection, anything else to its
+//              control lane unless data frames are already waiting, so
+//              the frames of a connection never pass each other.
+// -IN: obj: the buffer holding the frame, obj->sock set
+void enqueueSend(BUFFER_OBJ *obj) {
+	SEND_FLOW *flow = &obj->sock->SendFlow;
+	SEND_SHARE *share;
+	int opcode = ((MESSAGE *)obj->buf)->opcode;
+
+	obj->next = NULL;
+	InterlockedIncrement(&obj->sock->PendingSend);
+	EnterCriticalSection(&gSendCritSec);
+	if (opcode != OPT_FILE_DATA && opcode != OPT_FILE_BLOCK && flow->bulkHead == NULL) {
+		if (flow->controlTail != NULL)
+			flow->controlTail->next = obj;
+		else
+			flow->controlHead = obj;
+		flow->controlTail = obj;
+		gSendControlQueued++;
+
+		if (!flow->onControl) {
+			flow->onControl = true;
+			flow->nextControl = NULL;
+			if (gSendControlTail != NULL)
+				gSendControlTail->nextControl = flow;
+			else
+				gSendControlHead = flow;
+			gSendControlTail = flow;
+		}
+		LeaveCriticalSection(&gSendCritSec);
+		return;
+	}
+
+	if (flow->bulkTail != NULL)
+		flow->bulkTail->next = obj;
+	else
+		flow->bulkHead = obj;
+	flow->bulkTail = obj;
+	gSendBulkQueued++;
+
+	if (!flow->onBulk) {
+		share = flow->share != NULL ? flow->share : &gSendDefaultShare;
+		flow->onBulk = true;
+		flow->nextBulk = NULL;
+		if (share->tail != NULL)
+			share->tail->nextBulk = flow;
+		else
+			share->head = flow;
+		share->tail = flow;
+		if (!share->active)
+			sendShareJoin(share);
+	}
+	LeaveCriticalSection(&gSendCritSec);
+}
+
+// Function: dequeueSend
+// Description: Take the next frame to send: the oldest response if any is
+//              waiting, else a frame of the share whose turn it is
+// Return: the buffer holding the frame, NULL if nothing is waiting
+BUFFER_OBJ *dequeueSend() {
+	BUFFER_OBJ *obj = NULL;
+	SEND_FLOW *flow;
+	SEND_SHARE *share;
+
+	EnterCriticalSection(&gSendCritSec);
+	if ((flow = gSendControlHead) != NULL) {
+		obj = flow->controlHead;
+		flow->controlHead = obj->next;
+		if (flow->controlHead == NULL)
+			flow->controlTail = NULL;
+		gSendControlQueued--;
+
+		// Connections with several responses waiting take turns
+		gSendControlHead = flow->nextControl;
+		if (gSendControlHead == NULL)
+			gSendControlTail = NULL;
+		flow->nextControl = NULL;
+		flow->onControl = false;
+		if (flow->controlHead != NULL) {
+			flow->onControl = true;
+			if (gSendControlTail != NULL)
+				gSendControlTail->nextControl = flow;
+			else
+				gSendControlHead = flow;
+			gSendControlTail = flow;
+		}
+	}
+
+	while (obj == NULL && (share = gSendRoundHead) != NULL) {
+		if (!share->inTurn) {
+			share->deficit += sendQuantum(share);
+			share->inTurn = true;
+		}
+
+		if (share->deficit < SEND_FRAME_COST) {
+			// Turn over, the share waits for the next one
+			share->inTurn = false;
+			if (share->next != NULL) {
+				gSendRoundHead = share->next;
+				share->next = NULL;
+				gSendRoundTail->next = share;
+				gSendRoundTail = share;
+			}
+			continue;
+		}
+
+		flow = share->head;
+		obj = flow->bulkHead;
+		flow->bulkHead = obj->next;
+		if (flow->bulkHead == NULL)
+			flow->bulkTail = NULL;
+		share->deficit -= SEND_FRAME_COST;
+		gSendBulkQueued--;
+
+		// The next connection of the share sends the next frame
+		share->head = flow->nextBulk;
+		if (share->head == NULL)
+			share->tail = NULL;
+		flow->nextBulk = NULL;
+		flow->onBulk = false;
+		if (flow->bulkHead != NULL) {
+			flow->onBulk = true;
+			if (share->tail != NULL)
+				share->tail->nextBulk = flow;
+			else
+				share->head = flow;
+			share->tail = flow;
+		}
+
+		if (share->head == NULL)
+			sendShareLeave(share);
+	}
+	LeaveCriticalSection(&gSendCritSec);
+
+	if (obj != NULL) {
+		obj->next = NULL;
+		InterlockedDecrement(&obj->sock->PendingSend);
+	}
+	return obj;
+}
+
+// Function: dropSends
+// Description: Take every frame still queued for a connection out of the
+//              scheduler, so the connection can be freed
+// Return: the frames, chained through next, NULL if none
+// -IN: sock: the connection
+BUFFER_OBJ *dropSends(SOCKET_OBJ *sock) {
+	SEND_FLOW *flow = &sock->SendFlow, *prev, *it;
+	SEND_SHARE *share;
+	BUFFER_OBJ *dropped = NULL, *obj;
+	int count = 0;
+
+	EnterCriticalSection(&gSendCritSec);
+	if (flow->onControl) {
+		for (prev = NULL, it = gSendControlHead; it != flow; it = it->nextControl)
+			prev = it;
+		if (prev != NULL)
+			prev->nextControl = flow->nextControl;
+		else
+			gSendControlHead = flow->nextControl;
+		if (gSendControlTail == flow)
+			gSendControlTail = prev;
+		flow->onControl = false;
+	}
+
+	if (flow->onBulk) {
+		share = flow->share != NULL ? flow->share : &gSendDefaultShare;
+		for (prev = NULL, it = share->head; it != flow; it = it->nextBulk)
+			prev = it;
+		if (prev != NULL)
+			prev->nextBulk = flow->nextBulk;
+		else
+			share->head = flow->nextBulk;
+		if (share->tail == flow)
+			share->tail = prev;
+		flow->onBulk = false;
+		if (share->head == NULL)
+			sendShareLeave(share);
+	}
+
+	for (obj = flow->controlHead; obj != NULL; obj = obj->next, count++)
+		gSendControlQueued--;
+	for (obj = flow->bulkHead; obj != NULL; obj = obj->next, count++)
+		gSendBulkQueued--;
+	if (flow->controlTail != NULL) {
+		flow->controlTail->next = flow->bulkHead;
+		dropped = flow->controlHead;
+	}
+	else
+		dropped = flow->bulkHead;
+	flow->controlHead = flow->controlTail = NULL;
+	flow->bulkHead = flow->bulkTail = NULL;
+	flow->nextControl = flow->nextBulk = NULL;
+	flow->share = NULL;
+	LeaveCriticalSection(&gSendCritSec);
+
+	InterlockedExchangeAdd(&sock->PendingSend, -count);
+	return dropped;
+}
+
+// Function: sendBacklog
+// Description: Count the frames waiting in the scheduler
+// -OUT: control: responses waiting
+//       bulk: download frames waiting
+//       shares: accounts with download frames waiting
+void sendBacklog(int *control, int *bulk, int *shares) {
+	EnterCriticalSection(&gSendCritSec);
+	*control = gSendControlQueued;
+	*bulk = gSendBulkQueued;
+	*shares = 0;
+	for (int i = 1; i <= SEND_WEIGHT_MAX; i++)
+		*shares += gSendWeightCount[i];
+	LeaveCriticalSection(&gSendCritSec);
+}
+
+#endif
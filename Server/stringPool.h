@@ -0,0 +1,96 @@
+#pragma once
+
+#ifndef _STRING_POOL_H
+#define _STRING_POOL_H
+
+#include <string.h>
+#include <stdlib.h>
+#include <unordered_set>
+#include "dataStructures.h"
+
+// String pool. Names that live as long as the server, group names and
+// paths, are copied once into large blocks and shared by every record
+// that holds them, so a Group is a few pointers and copying one is cheap.
+// A name already in the pool is not copied again. Strings of records that
+// come and go, like the names of cached accounts, are exact-size copies
+// owned by their record instead.
+#define STRING_POOL_BLOCK	65536
+
+// Hash and compare C strings by content, for maps keyed by a name held in
+// a record rather than by a std::string copy of it
+struct StringHash {
+	size_t operator()(const char *s) const {
+		size_t hash = 2166136261u;
+		for (; *s != 0; s++)
+			hash = (hash ^ (unsigned char)*s) * 16777619u;
+		return hash;
+	}
+};
+
+struct StringEqual {
+	bool operator()(const char *a, const char *b) const {
+		return strcmp(a, b) == 0;
+	}
+};
+
+std::unordered_set<const char *, StringHash, StringEqual> gStringPool;
+char *gStringBlock = NULL;			// block being filled
+size_t gStringBlockLeft = 0;		// bytes left in it
+LONGLONG gStringPoolBytes = 0;		// bytes taken by the blocks
+CRITICAL_SECTION gStringPoolCritSec;
+
+// Function: initializeStringPool
+// Description: Initialize the lock of the pool
+void initializeStringPool() {
+	InitializeCriticalSection(&gStringPoolCritSec);
+}
+
+// Function: internString
+// Description: Get the copy of a string kept in the pool, adding it if it
+//              is not there yet. The copy is never freed or changed.
+// Return: the pooled string, NULL if out of memory
+// -IN: s: the string
+const char *internString(const char *s) {
+	const char *pooled = NULL;
+	size_t len = strlen(s) + 1;
+	char *copy;
+
+	EnterCriticalSection(&gStringPoolCritSec);
+	auto it = gStringPool.find(s);
+	if (it != gStringPool.end()) {
+		pooled = *it;
+	}
+	else {
+		if (len > gStringBlockLeft) {
+			size_t size = len > STRING_POOL_BLOCK ? len : STRING_POOL_BLOCK;
+			gStringBlock = (char *)malloc(size);
+			gStringBlockLeft = gStringBlock != NULL ? size : 0;
+			gStringPoolBytes += gStringBlockLeft;
+		}
+		if (gStringBlock != NULL) {
+			copy = gStringBlock;
+			memcpy(copy, s, len);
+			gStringBlock += len;
+			gStringBlockLeft -= len;
+			gStringPool.insert(copy);
+			pooled = copy;
+		}
+	}
+	LeaveCriticalSection(&gStringPoolCritSec);
+	return pooled;
+}
+
+// Function: copyString
+// Description: Copy a string into memory of its own size
+// Return: the copy, to free with free(), NULL if out of memory
+// -IN: s: the string
+char *copyString(const char *s) {
+	size_t len = strlen(s) + 1;
+	char *copy = (char *)malloc(len);
+
+	if (copy != NULL)
+		memcpy(copy, s, len);
+	return copy;
+}
+
+#endif
@@ -0,0 +1,219 @@
+#pragma once
+
+#ifndef _TIMER_WHEEL_H
+#define _TIMER_WHEEL_H
+
+#include <process.h>
+#include "dataStructures.h"
+
+// Hierarchical timer wheel. The root wheel has one slot per tick for the
+// next TIMER_ROOT_SIZE ticks, each level above it covers TIMER_LEVEL_SIZE
+// times the span of the one below. Timers far in the future sit in a
+// coarse slot and are moved down a level each time the level below wraps,
+// so arming and cancelling are a list insert/unlink whatever the timeout.
+#define TIMER_TICK_MS		100
+#define TIMER_ROOT_BITS		8
+#define TIMER_LEVEL_BITS	6
+#define TIMER_LEVELS		3		// levels above the root
+#define TIMER_ROOT_SIZE		(1 << TIMER_ROOT_BITS)
+#define TIMER_LEVEL_SIZE	(1 << TIMER_LEVEL_BITS)
+#define TIMER_ROOT_MASK		(TIMER_ROOT_SIZE - 1)
+#define TIMER_LEVEL_MASK	(TIMER_LEVEL_SIZE - 1)
+#define TIMER_MAX_TICKS		((ULONGLONG)1 << (TIMER_ROOT_BITS + TIMER_LEVELS * TIMER_LEVEL_BITS))
+
+TIMER *gTimerRoot[TIMER_ROOT_SIZE];
+TIMER *gTimerLevels[TIMER_LEVELS][TIMER_LEVEL_SIZE];
+TIMER *gTimerExpired = NULL;		// Due timers whose callback has not run yet
+TIMER *volatile gTimerRunning = NULL;	// Timer whose callback is running
+ULONGLONG gTimerNow;				// Next tick to be processed
+DWORD gTimerThreadId;
+CRITICAL_SECTION gTimerCritSec;
+
+// Function: timerLink
+// Description: Put a timer at the head of a slot list
+// -IN: slot: the list
+//      timer: the timer, not on any list
+void timerLink(TIMER **slot, TIMER *timer) {
+	timer->slot = slot;
+	timer->prev = NULL;
+	timer->next = *slot;
+	if (*slot != NULL)
+		(*slot)->prev = timer;
+	*slot = timer;
+}
+
+// Function: timerUnlink
+// Description: Take a timer off the slot list it is on
+// -IN: timer: the timer
+void timerUnlink(TIMER *timer) {
+	if (timer->prev != NULL)
+		timer->prev->next = timer->next;
+	else
+		*timer->slot = timer->next;
+	if (timer->next != NULL)
+		timer->next->prev = timer->prev;
+	timer->prev = timer->next = NULL;
+	timer->slot = NULL;
+}
+
+// Function: timerPlace
+// Description: Put a timer in the slot matching its expiry. Timers already
+//              due go in the slot of the next tick, timers beyond the
+//              range of the wheel are clamped to its last slot.
+// -IN: timer: the timer, not on any list
+void timerPlace(TIMER *timer) {
+	ULONGLONG delta;
+	int level;
+
+	if (timer->expires < gTimerNow) {
+		timerLink(&gTimerRoot[gTimerNow & TIMER_ROOT_MASK], timer);
+		return;
+	}
+
+	delta = timer->expires - gTimerNow;
+	if (delta < TIMER_ROOT_SIZE) {
+		timerLink(&gTimerRoot[timer->expires & TIMER_ROOT_MASK], timer);
+		return;
+	}
+
+	if (delta >= TIMER_MAX_TICKS)
+		timer->expires = gTimerNow + TIMER_MAX_TICKS - 1;
+
+	for (level = 0; level < TIMER_LEVELS - 1; level++) {
+		if (delta < ((ULONGLONG)1 << (TIMER_ROOT_BITS + (level + 1) * TIMER_LEVEL_BITS)))
+			break;
+	}
+	timerLink(&gTimerLevels[level][(timer->expires >> (TIMER_ROOT_BITS + level * TIMER_LEVEL_BITS)) & TIMER_LEVEL_MASK], timer);
+}
+
+// Function: timerArm
+// Description: Arm a timer, or move it if it is already armed. The callback
+//              runs on the timer thread and must not block for long.
+// -IN: timer: the timer, embedded in the object it times
+//      timeoutMs: milliseconds from now
+//      callback: function to call when the timer fires
+//      context: passed to the callback in timer->context
+void timerArm(TIMER *timer, DWORD timeoutMs, void(*callback)(TIMER *timer), void *context) {
+	ULONGLONG ticks = (timeoutMs + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+
+	EnterCriticalSection(&gTimerCritSec);
+	if (timer->slot != NULL)
+		timerUnlink(timer);
+	timer->callback = callback;
+	timer->context = context;
+	timer->expires = gTimerNow + (ticks > 0 ? ticks : 1);
+	timerPlace(timer);
+	LeaveCriticalSection(&gTimerCritSec);
+}
+
+// Function: timerCancel
+// Description: Disarm a timer. When this returns the callback is not
+//              running on another thread and will not run, so the object
+//              holding the timer can be released.
+// -IN: timer: the timer
+void timerCancel(TIMER *timer) {
+	EnterCriticalSection(&gTimerCritSec);
+	while (TRUE) {
+		if (timer->slot != NULL)
+			timerUnlink(timer);
+		if (gTimerRunning != timer || GetCurrentThreadId() == gTimerThreadId)
+			break;
+
+		// The callback is running and may re-arm the timer, wait it out
+		LeaveCriticalSection(&gTimerCritSec);
+		SwitchToThread();
+		EnterCriticalSection(&gTimerCritSec);
+	}
+	LeaveCriticalSection(&gTimerCritSec);
+}
+
+// Function: timerCascade
+// Description: Move the timers of a slot of an upper level down the wheel
+// -IN: level: index of the level
+//      index: index of the slot in the level
+void timerCascade(int level, int index) {
+	TIMER *timer = gTimerLevels[level][index], *next;
+
+	gTimerLevels[level][index] = NULL;
+	for (; timer != NULL; timer = next) {
+		next = timer->next;
+		timer->prev = timer->next = NULL;
+		timer->slot = NULL;
+		timerPlace(timer);
+	}
+}
+
+// Function: timerTick
+// Description: Advance the wheel by one tick and run the timers that are
+//              due. Called with gTimerCritSec held, which is released
+//              around each callback.
+void timerTick() {
+	int index = (int)(gTimerNow & TIMER_ROOT_MASK), level, slot;
+	TIMER *timer;
+	void(*callback)(TIMER *timer);
+
+	// The root wheel wrapped, refill it from the levels above
+	if (index == 0) {
+		for (level = 0; level < TIMER_LEVELS; level++) {
+			slot = (int)((gTimerNow >> (TIMER_ROOT_BITS + level * TIMER_LEVEL_BITS)) & TIMER_LEVEL_MASK);
+			timerCascade(level, slot);
+			if (slot != 0)
+				break;
+		}
+	}
+	gTimerNow++;
+
+	while ((timer = gTimerRoot[index]) != NULL) {
+		timerUnlink(timer);
+		timerLink(&gTimerExpired, timer);
+	}
+
+	// Take the due timers one by one so that a timer cancelled by a
+	// callback that ran before it does not fire
+	while ((timer = gTimerExpired) != NULL) {
+		timerUnlink(timer);
+		callback = timer->callback;
+		gTimerRunning = timer;
+		LeaveCriticalSection(&gTimerCritSec);
+
+		callback(timer);
+
+		EnterCriticalSection(&gTimerCritSec);
+		gTimerRunning = NULL;
+	}
+}
+
+// Function: timerThread
+// Description: Drive the wheel from the system tick count. Ticks missed
+//              while the thread was not scheduled are caught up at once.
+unsigned __stdcall timerThread(void *param) {
+	ULONGLONG target;
+
+	gTimerThreadId = GetCurrentThreadId();
+	while (TRUE) {
+		Sleep(TIMER_TICK_MS);
+
+		target = GetTickCount64() / TIMER_TICK_MS;
+		EnterCriticalSection(&gTimerCritSec);
+		while (gTimerNow <= target)
+			timerTick();
+		LeaveCriticalSection(&gTimerCritSec);
+	}
+	return 0;
+}
+
+// Function: startTimerWheel
+// Description: Initialize the wheel and start the timer thread
+// Return: 0 if succeed, else return 1
+int startTimerWheel() {
+	InitializeCriticalSection(&gTimerCritSec);
+	gTimerNow = GetTickCount64() / TIMER_TICK_MS;
+
+	if (_beginthreadex(0, 0, timerThread, NULL, 0, 0) == 0) {
+		printf("Create timer thread failed with error %d\n", GetLastError());
+		return 1;
+	}
+	return 0;
+}
+
+#endif
@@ -0,0 +1,388 @@
+#pragma once
+
+#ifndef _TLS_H
+#define _TLS_H
+
+#define SECURITY_WIN32
+#include <string>
+#include <windows.h>
+#include <wincrypt.h>
+#include <security.h>
+#include <schannel.h>
+#include "dataStructures.h"
+#include "metrics.h"
+#include "binaryLog.h"
+#include "admission.h"
+
+#pragma comment(lib, "Secur32.lib")
+#pragma comment(lib, "Crypt32.lib")
+
+// TLS transport. The handshake and the record layer are done by SChannel
+// on buffers the server owns, so the overlapped I/O does not change: the
+// ciphertext of a connection is received into its session and decrypted
+// in place, and a frame is sealed into the spare part of its send buffer
+// right before it is posted, under the lock of its socket so the records
+// go out in the order they were numbered. The plaintext frame stays at
+// the start of the buffer for the completion to look at.
+#define TLS_RECORD_SIZE			16384			// Largest plaintext of a record
+#define TLS_RECORD_OVERHEAD		2048			// Most a record may add to its plaintext
+#define TLS_IN_SIZE				(5 + TLS_RECORD_SIZE + TLS_RECORD_OVERHEAD)
+#define TLS_SEAL_OVERHEAD		256				// Header and trailer room left after a sealed frame
+#define TLS_MIN_BUFFER_SIZE		((int)sizeof(MESSAGE) * 2 + TLS_SEAL_OVERHEAD)
+
+// Results of tlsReceive
+#define TLS_DATA				0				// The plaintext asked for was copied
+#define TLS_MORE				1				// More ciphertext is needed
+#define TLS_TOKEN				2				// Handshake bytes are waiting in token
+#define TLS_CLOSED				3				// The peer sent close_notify
+#define TLS_FAILED				4
+
+typedef struct _TLS_SESSION {
+	CtxtHandle                context;
+	bool                      hasContext;		// The first handshake call created context
+	bool                      established;
+	SecPkgContext_StreamSizes sizes;
+	char                      in[TLS_IN_SIZE];	// Received, decrypted in place
+	int                       inLen;
+	int                       plainOff, plainLen;	// Plaintext of the last record not handed out yet
+	int                       cipherOff;		// Start of the ciphertext after that record
+	void                     *token;			// Handshake bytes to send, allocated by SChannel
+	int                       tokenLen;
+} TLS_SESSION;
+
+CredHandle gTlsCred;
+int gTlsEnabled = 0;
+volatile LONGLONG gTlsHandshakes = 0, gTlsHandshakeFailures = 0;
+
+// Function: tlsAcquire
+// Description: Acquire the server credentials of a certificate. Only
+//              TLS 1.2 with strong ciphers is offered.
+// Return: 0 if succeed, else return 1
+// -IN: cert: the certificate, with a private key
+int tlsAcquire(PCCERT_CONTEXT cert) {
+	SCHANNEL_CRED cred;
+	TimeStamp expiry;
+	SECURITY_STATUS status;
+
+	memset(&cred, 0, sizeof(cred));
+	cred.dwVersion = SCHANNEL_CRED_VERSION;
+	cred.cCreds = 1;
+	cred.paCred = &cert;
+	cred.grbitEnabledProtocols = SP_PROT_TLS1_2_SERVER;
+	cred.dwFlags = SCH_USE_STRONG_CRYPTO;
+
+	status = AcquireCredentialsHandleA(NULL, UNISP_NAME_A, SECPKG_CRED_INBOUND, NULL, &cred, NULL, NULL, &gTlsCred, &expiry);
+	if (status != SEC_E_OK) {
+		printf("AcquireCredentialsHandle failed with error 0x%x\n", (unsigned int)status);
+		return 1;
+	}
+	gTlsEnabled = 1;
+	return 0;
+}
+
+// Function: initializeTls
+// Description: Find the certificate of the server in the personal store of
+//              the machine, else of the user, and acquire its credentials
+// Return: 0 if succeed, else return 1
+// -IN: subject: text the subject of the certificate contains
+int initializeTls(const char *subject) {
+	DWORD locations[] = { CERT_SYSTEM_STORE_LOCAL_MACHINE, CERT_SYSTEM_STORE_CURRENT_USER };
+	PCCERT_CONTEXT cert = NULL;
+	HCERTSTORE store;
+	int rc;
+
+	for (int i = 0; i < 2 && cert == NULL; i++) {
+		store = CertOpenStore(CERT_STORE_PROV_SYSTEM_A, 0, 0, locations[i] | CERT_STORE_READONLY_FLAG, "MY");
+		if (store == NULL)
+			continue;
+		cert = CertFindCertificateInStore(store, X509_ASN_ENCODING | PKCS_7_ASN_ENCODING, 0, CERT_FIND_SUBJECT_STR_A, subject, NULL);
+		CertCloseStore(store, 0);
+	}
+	if (cert == NULL) {
+		printf("No certificate of %s in the MY store\n", subject);
+		return 1;
+	}
+
+	rc = tlsAcquire(cert);
+	CertFreeCertificateContext(cert);
+	return rc;
+}
+
+// Function: tlsCreate
+// Description: Allocate the session of a new connection
+// Return: the session, NULL if out of memory
+TLS_SESSION *tlsCreate() {
+	TLS_SESSION *tls = (TLS_SESSION *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(TLS_SESSION));
+
+	if (tls != NULL)
+		admissionMemoryAdd(sizeof(TLS_SESSION));
+	return tls;
+}
+
+// Function: tlsTokenDone
+// Description: Release the handshake bytes once they are copied out
+// -IN: tls: the session
+void tlsTokenDone(TLS_SESSION *tls) {
+	if (tls->token != NULL)
+		FreeContextBuffer(tls->token);
+	tls->token = NULL;
+	tls->tokenLen = 0;
+}
+
+// Function: tlsFree
+// Description: Release a session
+// -IN: tls: the session
+void tlsFree(TLS_SESSION *tls) {
+	tlsTokenDone(tls);
+	if (tls->hasContext)
+		DeleteSecurityContext(&tls->context);
+	HeapFree(GetProcessHeap(), 0, tls);
+	admissionMemoryAdd(-(LONGLONG)sizeof(TLS_SESSION));
+}
+
+// Function: tlsRecvSpace
+// Description: Room left for ciphertext after what was received
+// Return: bytes, 0 if a record does not fit
+// -IN: tls: the session
+inline int tlsRecvSpace(TLS_SESSION *tls) {
+	return TLS_IN_SIZE - tls->inLen;
+}
+
+// Function: tlsBuffered
+// Description: Check whether a receive can be served without reading the
+//              socket: plaintext is left, or a whole record was received
+// Return: 1 if so, else 0
+// -IN: tls: the session
+int tlsBuffered(TLS_SESSION *tls) {
+	unsigned char *record = (unsigned char *)tls->in + tls->cipherOff;
+	int available = tls->inLen - tls->cipherOff;
+
+	if (tls->plainLen > 0)
+		return 1;
+	if (!tls->established || available < 5)
+		return 0;
+	return available >= 5 + ((record[3] << 8) | record[4]);
+}
+
+// Function: tlsHandshake
+// Description: Feed the handshake bytes received to SChannel. Bytes past
+//              the end of a handshake flight, which may already be
+//              records, are kept for the next call.
+// Return: TLS_TOKEN if bytes must be sent, TLS_MORE if more must be
+//         received, TLS_DATA once established with nothing to send,
+//         TLS_FAILED if the handshake failed
+// -IN: tls: the session
+int tlsHandshake(TLS_SESSION *tls) {
+	SecBuffer inBuffers[2], outBuffer;
+	SecBufferDesc inDesc, outDesc;
+	SECURITY_STATUS status;
+	ULONG attributes;
+	TimeStamp expiry;
+
+	while (TRUE) {
+		inBuffers[0].BufferType = SECBUFFER_TOKEN;
+		inBuffers[0].pvBuffer = tls->in;
+		inBuffers[0].cbBuffer = tls->inLen;
+		inBuffers[1].BufferType = SECBUFFER_EMPTY;
+		inBuffers[1].pvBuffer = NULL;
+		inBuffers[1].cbBuffer = 0;
+		inDesc.ulVersion = SECBUFFER_VERSION;
+		inDesc.cBuffers = 2;
+		inDesc.pBuffers = inBuffers;
+		outBuffer.BufferType = SECBUFFER_TOKEN;
+		outBuffer.pvBuffer = NULL;
+		outBuffer.cbBuffer = 0;
+		outDesc.ulVersion = SECBUFFER_VERSION;
+		outDesc.cBuffers = 1;
+		outDesc.pBuffers = &outBuffer;
+
+		status = AcceptSecurityContext(&gTlsCred, tls->hasContext ? &tls->context : NULL, &inDesc,
+			ASC_REQ_SEQUENCE_DETECT | ASC_REQ_REPLAY_DETECT | ASC_REQ_CONFIDENTIALITY |
+			ASC_REQ_EXTENDED_ERROR | ASC_REQ_ALLOCATE_MEMORY | ASC_REQ_STREAM,
+			SECURITY_NATIVE_DREP, tls->hasContext ? NULL : &tls->context, &outDesc, &attributes, &expiry);
+
+		if (status == SEC_E_INCOMPLETE_MESSAGE) {
+			if (outBuffer.pvBuffer != NULL)
+				FreeContextBuffer(outBuffer.pvBuffer);
+			return tlsRecvSpace(tls) > 0 ? TLS_MORE : TLS_FAILED;
+		}
+		if (status != SEC_E_OK && status != SEC_I_CONTINUE_NEEDED) {
+			if (outBuffer.pvBuffer != NULL)
+				FreeContextBuffer(outBuffer.pvBuffer);
+			InterlockedIncrement64(&gTlsHandshakeFailures);
+			LOG_DEBUG("AcceptSecurityContext failed with error 0x%x\n", (unsigned int)status);
+			return TLS_FAILED;
+		}
+		tls->hasContext = true;
+
+		// Keep what SChannel did not consume
+		if (inBuffers[1].BufferType == SECBUFFER_EXTRA && inBuffers[1].cbBuffer > 0) {
+			memmove(tls->in, tls->in + tls->inLen - inBuffers[1].cbBuffer, inBuffers[1].cbBuffer);
+			tls->inLen = inBuffers[1].cbBuffer;
+		}
+		else
+			tls->inLen = 0;
+
+		if (outBuffer.pvBuffer != NULL && outBuffer.cbBuffer > 0) {
+			tls->token = outBuffer.pvBuffer;
+			tls->tokenLen = outBuffer.cbBuffer;
+		}
+		else if (outBuffer.pvBuffer != NULL)
+			FreeContextBuffer(outBuffer.pvBuffer);
+
+		if (status == SEC_E_OK) {
+			status = QueryContextAttributesA(&tls->context, SECPKG_ATTR_STREAM_SIZES, &tls->sizes);
+			if (status != SEC_E_OK || tls->sizes.cbHeader + tls->sizes.cbTrailer > TLS_SEAL_OVERHEAD) {
+				tlsTokenDone(tls);
+				InterlockedIncrement64(&gTlsHandshakeFailures);
+				return TLS_FAILED;
+			}
+			tls->established = true;
+			InterlockedIncrement64(&gTlsHandshakes);
+		}
+
+		if (tls->token != NULL)
+			return TLS_TOKEN;
+		if (tls->established)
+			return TLS_DATA;
+		if (tls->inLen == 0)
+			return TLS_MORE;
+	}
+}
+
+// Function: tlsReceive
+// Description: Hand out plaintext from the ciphertext received, running the
+//              handshake first if it is not done. The caller adds what it
+//              received to inLen before the call.
+// Return: TLS_DATA if need bytes were copied, TLS_MORE if more ciphertext
+//         is needed, TLS_TOKEN if handshake bytes must be sent first,
+//         TLS_CLOSED or TLS_FAILED if the session is over
+// -IN: tls: the session
+//      need: bytes wanted
+// -OUT: out: the plaintext
+//       copied: bytes copied to out
+int tlsReceive(TLS_SESSION *tls, char *out, int need, int *copied) {
+	SecBuffer buffers[4];
+	SecBufferDesc desc;
+	SECURITY_STATUS status;
+	int state, chunk, i;
+
+	*copied = 0;
+	if (!tls->established && (state = tlsHandshake(tls)) != TLS_DATA)
+		return state;
+
+	while (*copied < need) {
+		if (tls->plainLen > 0) {
+			chunk = need - *copied < tls->plainLen ? need - *copied : tls->plainLen;
+			memcpy(out + *copied, tls->in + tls->plainOff, chunk);
+			tls->plainOff += chunk;
+			tls->plainLen -= chunk;
+			*copied += chunk;
+			if (tls->plainLen == 0 && tls->cipherOff > 0) {
+				// The record is used up, the next one moves to the front
+				memmove(tls->in, tls->in + tls->cipherOff, tls->inLen - tls->cipherOff);
+				tls->inLen -= tls->cipherOff;
+				tls->cipherOff = 0;
+			}
+			continue;
+		}
+		if (tls->inLen == 0)
+			break;
+
+		buffers[0].BufferType = SECBUFFER_DATA;
+		buffers[0].pvBuffer = tls->in;
+		buffers[0].cbBuffer = tls->inLen;
+		for (i = 1; i < 4; i++) {
+			buffers[i].BufferType = SECBUFFER_EMPTY;
+			buffers[i].pvBuffer = NULL;
+			buffers[i].cbBuffer = 0;
+		}
+		desc.ulVersion = SECBUFFER_VERSION;
+		desc.cBuffers = 4;
+		desc.pBuffers = buffers;
+
+		status = DecryptMessage(&tls->context, &desc, 0, NULL);
+		if (status == SEC_E_INCOMPLETE_MESSAGE) {
+			if (tlsRecvSpace(tls) == 0)
+				return TLS_FAILED;
+			break;
+		}
+		if (status == SEC_I_CONTEXT_EXPIRED)
+			return TLS_CLOSED;
+		if (status != SEC_E_OK) {
+			// Renegotiation is not offered, it fails the session too
+			LOG_DEBUG("DecryptMessage failed with error 0x%x\n", (unsigned int)status);
+			return TLS_FAILED;
+		}
+
+		tls->cipherOff = tls->inLen;
+		for (i = 1; i < 4; i++) {
+			if (buffers[i].BufferType == SECBUFFER_DATA) {
+				tls->plainOff = (int)((char *)buffers[i].pvBuffer - tls->in);
+				tls->plainLen = buffers[i].cbBuffer;
+			}
+			else if (buffers[i].BufferType == SECBUFFER_EXTRA)
+				tls->cipherOff = tls->inLen - buffers[i].cbBuffer;
+		}
+		if (tls->plainLen == 0) {
+			memmove(tls->in, tls->in + tls->cipherOff, tls->inLen - tls->cipherOff);
+			tls->inLen -= tls->cipherOff;
+			tls->cipherOff = 0;
+		}
+	}
+	return *copied == need ? TLS_DATA : TLS_MORE;
+}
+
+// Function: tlsSeal
+// Description: Seal plaintext into one record
+// Return: bytes of the record, -1 if it could not be sealed
+// -IN: tls: the session, established
+//      data: the plaintext
+//      len: its length, at most a record
+//      wireSize: room at wire
+// -OUT: wire: the record
+int tlsSeal(TLS_SESSION *tls, const char *data, int len, char *wire, int wireSize) {
+	SecBuffer buffers[4];
+	SecBufferDesc desc;
+	SECURITY_STATUS status;
+	SecPkgContext_StreamSizes *sizes = &tls->sizes;
+
+	if (!tls->established || len > (int)sizes->cbMaximumMessage ||
+		(int)(sizes->cbHeader + sizes->cbTrailer) + len > wireSize)
+		return -1;
+
+	memcpy(wire + sizes->cbHeader, data, len);
+	buffers[0].BufferType = SECBUFFER_STREAM_HEADER;
+	buffers[0].pvBuffer = wire;
+	buffers[0].cbBuffer = sizes->cbHeader;
+	buffers[1].BufferType = SECBUFFER_DATA;
+	buffers[1].pvBuffer = wire + sizes->cbHeader;
+	buffers[1].cbBuffer = len;
+	buffers[2].BufferType = SECBUFFER_STREAM_TRAILER;
+	buffers[2].pvBuffer = wire + sizes->cbHeader + len;
+	buffers[2].cbBuffer = sizes->cbTrailer;
+	buffers[3].BufferType = SECBUFFER_EMPTY;
+	buffers[3].pvBuffer = NULL;
+	buffers[3].cbBuffer = 0;
+	desc.ulVersion = SECBUFFER_VERSION;
+	desc.cBuffers = 4;
+	desc.pBuffers = buffers;
+
+	status = EncryptMessage(&tls->context, 0, &desc, 0);
+	if (status != SEC_E_OK) {
+		LOG_DEBUG("EncryptMessage failed with error 0x%x\n", (unsigned int)status);
+		return -1;
+	}
+	return (int)(buffers[0].cbBuffer + buffers[1].cbBuffer + buffers[2].cbBuffer);
+}
+
+// Function: collectTlsMetrics
+// Description: Append the handshakes done and failed
+// -IN: out: the scrape
+void collectTlsMetrics(std::string &out) {
+	appendHelp(out, "clouddrive_tls_handshakes_total", "counter", "TLS handshakes by result.");
+	appendMetric(out, "clouddrive_tls_handshakes_total", "result=\"ok\"", (double)gTlsHandshakes);
+	appendMetric(out, "clouddrive_tls_handshakes_total", "result=\"failed\"", (double)gTlsHandshakeFailures);
+}
+
+#endif